@@ -0,0 +1,18 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+
+#include "../src/cpu.h"
+
+
+double bench_seconds();
+
+void main_bench_cpu();
+void main_bench_ppu();
+void main_bench_apu();
+void main_bench_video();
+void main_bench_env();
+
+
+#endif
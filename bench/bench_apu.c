@@ -0,0 +1,145 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "./bench.h"
+#include "../src/emulator.h"
+#include "../src/resampler.h"
+
+// ==================================================================================
+//                                  Workload
+// ==================================================================================
+
+#define CYCLES_PER_VIDEO_FRAME 17556
+
+// A tune: both squares retriggered on new notes every few frames, wave and
+// noise running continuously
+static void start_tune(apu_t *apu)
+{
+    for (int i = 0; i < 16; i++)
+    {
+        apu_write_register(apu, WAVE_RAM + i, (uint8_t)(i * 0x11 + 0x37), 0);
+    }
+    apu_write_register(apu, NR11_REGISTER, 0x80, 0);
+    apu_write_register(apu, NR12_REGISTER, 0xF3, 0);
+    apu_write_register(apu, NR21_REGISTER, 0x40, 0);
+    apu_write_register(apu, NR22_REGISTER, 0xA2, 0);
+    apu_write_register(apu, NR30_REGISTER, 0x80, 0);
+    apu_write_register(apu, NR32_REGISTER, 0x20, 0);
+    apu_write_register(apu, NR33_REGISTER, 0x40, 0);
+    apu_write_register(apu, NR34_REGISTER, 0x86, 0);
+    apu_write_register(apu, NR42_REGISTER, 0x81, 0);
+    apu_write_register(apu, NR43_REGISTER, 0x45, 0);
+    apu_write_register(apu, NR44_REGISTER, 0x80, 0);
+}
+
+static void play_note(apu_t *apu, int frame, uint64_t cycle)
+{
+    uint16_t frequency = 1400 + (frame * 37) % 500;
+    apu_write_register(apu, NR13_REGISTER, frequency & 0xFF, cycle);
+    apu_write_register(apu, NR14_REGISTER, 0x80 | (frequency >> 8), cycle);
+    apu_write_register(apu, NR23_REGISTER, (frequency / 2) & 0xFF, cycle + 100);
+    apu_write_register(apu, NR24_REGISTER, 0x80 | (frequency / 2) >> 8, cycle + 100);
+    apu_write_register(apu, NR44_REGISTER, 0x80, cycle + 200);
+}
+
+// ==================================================================================
+//                                  Benchmarks
+// ==================================================================================
+
+/**
+ * APU alone: a tune with notes every 8 frames, pulled once per video frame.
+ */
+void bench_apu_synthesis()
+{
+    const int frames = 20000;
+    int16_t samples[2048 * 2];
+    for (int synthesis = 1; synthesis >= 0; synthesis--)
+    {
+        apu_t *apu = new_apu();
+        if (apu == NULL)
+        {
+            printf("Could not allocate the benchmark APU\n");
+            exit(1);
+        }
+        apu->synthesis = synthesis;
+        start_tune(apu);
+        uint64_t produced = 0;
+        double start = bench_seconds();
+        for (int frame = 0; frame < frames; frame++)
+        {
+            uint64_t cycle = (uint64_t)frame * CYCLES_PER_VIDEO_FRAME;
+            if (frame % 8 == 0)
+            {
+                play_note(apu, frame, cycle);
+            }
+            produced += apu_read_samples(apu, cycle + CYCLES_PER_VIDEO_FRAME, samples, 2048);
+        }
+        double elapsed = bench_seconds() - start;
+        double emulated = frames * (double)CYCLES_PER_VIDEO_FRAME * 4 / APU_CLOCK_RATE;
+        printf("APU, synthesis %-3s %8.0f x real time, %6.1f Msamples/s\n", synthesis ? "on" : "off",
+               emulated / elapsed, produced / elapsed / 1e6);
+        free_apu(apu);
+    }
+}
+
+/**
+ * Resampler alone on one thread: APU output converted from 48 kHz to
+ * 44.1 kHz with each filter kernel the host supports.
+ */
+void bench_resampler()
+{
+    const size_t frames = 48000;
+    const int seconds = 20;
+    int16_t *input = malloc(frames * 2 * sizeof(int16_t));
+    int16_t *output = malloc(frames * 2 * sizeof(int16_t));
+    apu_t *apu = new_apu();
+    if (input == NULL || output == NULL || apu == NULL)
+    {
+        printf("Could not allocate the benchmark resampler\n");
+        exit(1);
+    }
+    start_tune(apu);
+    for (size_t done = 0; done < frames;)
+    {
+        uint64_t cycle = (uint64_t)(done / 800) * CYCLES_PER_VIDEO_FRAME;
+        play_note(apu, done / 800, cycle);
+        done += apu_read_samples(apu, cycle + CYCLES_PER_VIDEO_FRAME, input + done * 2, frames - done);
+    }
+
+    for (int kernel = RESAMPLER_KERNEL_SCALAR; kernel <= (int)resampler_best_kernel(); kernel++)
+    {
+        resampler_t *resampler = new_resampler(48000, 44100);
+        if (resampler == NULL)
+        {
+            printf("Could not allocate the benchmark resampler\n");
+            exit(1);
+        }
+        resampler->kernel = kernel;
+        uint64_t produced = 0;
+        double start = bench_seconds();
+        for (int second = 0; second < seconds; second++)
+        {
+            for (size_t written = 0; written < frames;)
+            {
+                size_t count = frames - written < 1024 ? frames - written : 1024;
+                written += resampler_write(resampler, input + written * 2, count);
+                produced += resampler_read(resampler, output, frames);
+            }
+        }
+        double elapsed = bench_seconds() - start;
+        printf("Resampler 48 -> 44.1 kHz, %-6s %6.1f Mframes/s per core, %6.0f x real time\n",
+               resampler_kernel_name(kernel), produced / elapsed / 1e6, seconds / elapsed);
+        free_resampler(resampler);
+    }
+    free_apu(apu);
+    free(input);
+    free(output);
+}
+
+void main_bench_apu()
+{
+    printf("Running APU benchmarks...\n");
+    bench_apu_synthesis();
+    bench_resampler();
+}
@@ -0,0 +1,324 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./bench.h"
+#include "../src/emulator.h"
+#include "../src/lockstep.h"
+#include "../src/coverage.h"
+#include "../test/test_programs.h"
+
+// ==================================================================================
+//                                  Workload
+// ==================================================================================
+
+// Outer loop mixing the three fused idioms with ordinary code:
+// a 256-byte copy loop, a LDH/CP/JR poll and a DEC/JR countdown.
+static const uint8_t bench_program[] = {
+    0x21, 0x00, 0xC0,                   // 0100: LD HL,0xC000
+    0x11, 0x00, 0xD0,                   // 0103: LD DE,0xD000
+    0x06, 0x00,                         // 0106: LD B,0 (256 iterations)
+    0x2A, 0x12, 0x13, 0x05, 0x20, 0xFA, // 0108: LD A,(HL+); LD (DE),A; INC DE; DEC B; JR NZ
+    0x0E, 0x20,                         // 010E: LD C,0x20
+    0xF0, 0x81, 0xFE, 0x01, 0x20, 0x00, // 0110: LDH A,(0x81); CP 1; JR NZ,+0
+    0x79,                               // 0116: LD A,C
+    0xC6, 0x03,                         // 0117: ADD A,3
+    0x0D, 0x20, 0xF4,                   // 0119: DEC C; JR NZ,0x0110
+    0xC3, 0x00, 0x01                    // 011C: JP 0x0100
+};
+
+static cpu_t *new_bench_cpu()
+{
+    cpu_t *cpu = new_cpu();
+    if (cpu == NULL)
+    {
+        printf("Could not allocate the benchmark cpu\n");
+        exit(1);
+    }
+    for (int i = 0; i < 0x10000; i++)
+    {
+        cpu->memorybus[i] = 0x00;
+    }
+    for (size_t i = 0; i < sizeof(bench_program); i++)
+    {
+        cpu->memorybus[0x0100 + i] = bench_program[i];
+    }
+    cpu->PC = 0x0100;
+    cpu->SP = 0xFFFE;
+    return cpu;
+}
+
+static double run_cycles(cpu_t *cpu, uint64_t cycles)
+{
+    double start = bench_seconds();
+    uint64_t done = 0;
+    while (done < cycles)
+    {
+        done += execute_next_instruction(cpu);
+    }
+    return bench_seconds() - start;
+}
+
+// ==================================================================================
+//                                  Benchmarks
+// ==================================================================================
+
+// Profiles the ROM named by GAMEBOY_ROM, a 32 KiB one without a mapper, over
+// 600 frames from 0x0100. Without it the profile is of bench_program, which
+// is built from the fused idioms and so only shows the counters work: the
+// idioms themselves were picked by hand, not from a profile.
+void bench_opcode_pairs()
+{
+    const char *rom_path = getenv("GAMEBOY_ROM");
+    if (rom_path == NULL)
+    {
+        printf("Most frequent opcode pairs of bench_program (set GAMEBOY_ROM to profile a ROM):\n");
+        cpu_t *cpu = new_bench_cpu();
+        if (start_opcode_profile(cpu) != 0)
+        {
+            printf("Could not allocate the opcode pair counters\n");
+            exit(1);
+        }
+        run_cycles(cpu, 1000000);
+        print_top_opcode_pairs(cpu, 8);
+        free_cpu(cpu);
+        return;
+    }
+
+    emulator_t *emulator = new_emulator();
+    FILE *rom = fopen(rom_path, "rb");
+    if (emulator == NULL || rom == NULL)
+    {
+        printf("Could not load %s\n", rom_path);
+        exit(1);
+    }
+    size_t size = fread(emulator->cpu->memorybus, 1, 0x8000, rom);
+    fclose(rom);
+    rehash_ram(emulator->cpu);
+    emulator->cpu->PC = 0x0100;
+    emulator->cpu->SP = 0xFFFE;
+    if (start_opcode_profile(emulator->cpu) != 0)
+    {
+        printf("Could not allocate the opcode pair counters\n");
+        exit(1);
+    }
+    for (int frame = 0; frame < 600; frame++)
+    {
+        tick_emulator(emulator);
+    }
+    printf("Most frequent opcode pairs of %s (%zu bytes, 600 frames):\n", rom_path, size);
+    print_top_opcode_pairs(emulator->cpu, 16);
+    free_emulator(emulator);
+}
+
+void bench_fusion()
+{
+    const uint64_t cycles = 200000000;
+
+    cpu_t *cpu = new_bench_cpu();
+    cpu->fusion = FUSE_NONE;
+    double plain = run_cycles(cpu, cycles);
+    free_cpu(cpu);
+
+    cpu = new_bench_cpu();
+    cpu->fusion = FUSE_ALL;
+    double fused = run_cycles(cpu, cycles);
+    free_cpu(cpu);
+
+    printf("Fusion off: %8.1f M-cycles/s\n", cycles / plain / 1e6);
+    printf("Fusion on:  %8.1f M-cycles/s (x%.2f)\n", cycles / fused / 1e6, plain / fused);
+}
+
+// The agent program spends most of each frame polling LY for VBlank and its end
+static double run_vblank_frames(bool idle_skip, int frames)
+{
+    emulator_t *emulator = new_emulator();
+    if (emulator == NULL)
+    {
+        printf("Could not allocate the benchmark emulator\n");
+        exit(1);
+    }
+    load_agent_program(emulator->cpu, 0);
+    emulator->cpu->idle_skip = idle_skip;
+
+    double start = bench_seconds();
+    for (int i = 0; i < frames; i++)
+    {
+        tick_emulator(emulator);
+    }
+    double elapsed = bench_seconds() - start;
+    free_emulator(emulator);
+    return elapsed;
+}
+
+void bench_idle_skip()
+{
+    const int frames = 6000;
+    double plain = run_vblank_frames(false, frames);
+    double skipped = run_vblank_frames(true, frames);
+    printf("Idle skip off: %10.0f frames/s\n", frames / plain);
+    printf("Idle skip on:  %10.0f frames/s (x%.1f)\n", frames / skipped, plain / skipped);
+}
+
+// Per lane: loop (data & 0xF) + 1 times, branch on the data's top bit,
+// update the data, repeat. Lanes given the same data never diverge.
+static const uint8_t lane_program[] = {
+    0x21, 0x00, 0xC0,       // 0100: LD HL,0xC000
+    0x7E, 0x47,             // 0103: LD A,(HL); LD B,A
+    0x0E, 0x0F, 0xA1, 0x57, // 0105: LD C,0x0F; AND C; LD D,A
+    0x14,                   // 0109: INC D
+    0x15, 0x20, 0xFD,       // 010A: DEC D; JR NZ,0x010A
+    0x78, 0xFE, 0x80,       // 010D: LD A,B; CP 0x80
+    0x38, 0x03,             // 0110: JR C,0x0115
+    0x1C, 0x18, 0x01,       // 0112: INC E; JR 0x0116
+    0x1D,                   // 0115: DEC E
+    0x78, 0xD6, 0x25, 0x77, // 0116: LD A,B; SUB 0x25; LD (HL),A
+    0xC3, 0x00, 0x01        // 011A: JP 0x0100
+};
+
+static void load_lane_program(cpu_t *cpu, uint8_t seed)
+{
+    memcpy(&cpu->memorybus[0x0100], lane_program, sizeof(lane_program));
+    cpu->memorybus[0xC000] = seed;
+    cpu->PC = 0x0100;
+    cpu->SP = 0xFFFE;
+    cpu->fusion = FUSE_NONE;
+    cpu->idle_skip = false;
+}
+
+/**
+ * Emulated M-cycles per second of K lanes in lockstep against K CPUs run one
+ * after the other, with every lane on the same data and with data that
+ * splits their loops and branches.
+ */
+void bench_lockstep()
+{
+    const uint64_t cycles = 2000000;
+    const uint32_t lane_counts[] = {8, 16};
+    for (int k = 0; k < 2; k++)
+    {
+        uint32_t lanes = lane_counts[k];
+        for (int divergent = 0; divergent < 2; divergent++)
+        {
+            double start = bench_seconds();
+            for (uint32_t lane = 0; lane < lanes; lane++)
+            {
+                cpu_t *cpu = new_bench_cpu();
+                load_lane_program(cpu, divergent ? lane * 0x3B + 7 : 0x5A);
+                while (cpu->cycles < cycles)
+                {
+                    execute_next_instruction(cpu);
+                }
+                free_cpu(cpu);
+            }
+            double scalar = bench_seconds() - start;
+
+            lockstep_t *lockstep = new_lockstep(lanes);
+            if (lockstep == NULL)
+            {
+                printf("Could not allocate the benchmark lanes\n");
+                exit(1);
+            }
+            for (uint32_t lane = 0; lane < lanes; lane++)
+            {
+                load_lane_program(lockstep->cpus[lane], divergent ? lane * 0x3B + 7 : 0x5A);
+            }
+            lockstep_load_registers(lockstep);
+            start = bench_seconds();
+            lockstep_run(lockstep, cycles);
+            double vector = bench_seconds() - start;
+
+            printf("K=%2u %-9s scalar %6.1f, lockstep %6.1f M-cycles/s (x%.2f), %3.0f%% lanes busy, %3.0f%% vector\n",
+                   lanes, divergent ? "divergent" : "converged", lanes * cycles / scalar / 1e6,
+                   lanes * cycles / vector / 1e6, scalar / vector, 100 * lockstep_utilization(lockstep),
+                   100 * lockstep_vector_fraction(lockstep));
+            free_lockstep(lockstep);
+        }
+    }
+}
+
+// Worst case for the RAM hash: a read-modify-write of WRAM every other instruction
+static const uint8_t ram_write_program[] = {
+    0x21, 0x00, 0xC0,                   // 0100: LD HL,0xC000
+    0x06, 0x00,                         // 0103: LD B,0 (256 iterations)
+    0x34, 0x23,                         // 0105: INC (HL); INC HL
+    0x05, 0x20, 0xFB,                   // 0107: DEC B; JR NZ,0x0105
+    0xC3, 0x00, 0x01                    // 010A: JP 0x0100
+};
+
+void bench_ram_hash()
+{
+    const uint64_t cycles = 100000000;
+    double elapsed[2];
+    for (int hashing = 0; hashing < 2; hashing++)
+    {
+        cpu_t *cpu = new_bench_cpu();
+        memcpy(&cpu->memorybus[0x0100], ram_write_program, sizeof(ram_write_program));
+        cpu->ram_hashing = hashing;
+        rehash_ram(cpu);
+        elapsed[hashing] = run_cycles(cpu, cycles);
+        free_cpu(cpu);
+    }
+    printf("RAM hash off: %8.1f M-cycles/s\n", cycles / elapsed[0] / 1e6);
+    printf("RAM hash on:  %8.1f M-cycles/s (x%.2f)\n", cycles / elapsed[1] / 1e6, elapsed[0] / elapsed[1]);
+
+    const int passes = 1000;
+    cpu_t *cpu = new_bench_cpu();
+    uint64_t hash = 0;
+    double start = bench_seconds();
+    for (int i = 0; i < passes; i++)
+    {
+        cpu->memorybus[0xC000 + i] = (uint8_t)i;
+        hash ^= compute_ram_hash(cpu);
+    }
+    double full = (bench_seconds() - start) / passes;
+    printf("Full RAM hash recompute: %6.1f us per frame (%016llx)\n", full * 1e6, (unsigned long long)hash);
+    free_cpu(cpu);
+}
+
+void bench_coverage()
+{
+    const uint64_t cycles = 100000000;
+    coverage_t *coverage = new_coverage(2);
+    coverage_t *total = new_coverage(2);
+    if (coverage == NULL || total == NULL)
+    {
+        printf("Could not allocate the coverage maps\n");
+        exit(1);
+    }
+    double elapsed[2];
+    for (int tracking = 0; tracking < 2; tracking++)
+    {
+        cpu_t *cpu = new_bench_cpu();
+        cpu->coverage = tracking ? coverage : NULL;
+        elapsed[tracking] = run_cycles(cpu, cycles);
+        free_cpu(cpu);
+    }
+    printf("Coverage off: %8.1f M-cycles/s\n", cycles / elapsed[0] / 1e6);
+    printf("Coverage on:  %8.1f M-cycles/s (x%.2f)\n", cycles / elapsed[1] / 1e6, elapsed[0] / elapsed[1]);
+
+    const int merges = 10000;
+    uint64_t fresh = 0;
+    double start = bench_seconds();
+    for (int i = 0; i < merges; i++)
+    {
+        coverage->edges[(i * 2654435761u) & (COVERAGE_EDGES - 1)]++;
+        fresh += coverage_merge(total, coverage, NULL);
+    }
+    double merge = (bench_seconds() - start) / merges;
+    printf("Coverage merge: %5.2f us per map (%llu edges)\n", merge * 1e6, (unsigned long long)fresh);
+    free_coverage(coverage);
+    free_coverage(total);
+}
+
+void main_bench_cpu()
+{
+    printf("Running CPU benchmarks...\n");
+    bench_opcode_pairs();
+    bench_fusion();
+    bench_idle_skip();
+    bench_ram_hash();
+    bench_coverage();
+    bench_lockstep();
+}
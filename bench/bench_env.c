@@ -0,0 +1,277 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ftw.h>
+
+#include "./bench.h"
+#include "../src/env.h"
+#include "../src/vec_env.h"
+#include "../src/state_archive.h"
+#include "../src/fuzzer.h"
+#include "../test/test_programs.h"
+
+// ==================================================================================
+//                                  Workload
+// ==================================================================================
+
+// Game-like frame from the tests: wait for VBlank, read the joypad, scroll
+static void load_bench_program(env_t *env)
+{
+    load_agent_program(env->emulator->cpu, 0);
+    env_set_ram_addresses(env, agent_ram_addresses, AGENT_RAM_ADDRESS_COUNT);
+    env_save_snapshot(env);
+}
+
+static env_t *new_bench_env(uint32_t obs_scale)
+{
+    env_t *env = new_env(obs_scale);
+    if (env == NULL)
+    {
+        printf("Could not allocate the benchmark environment\n");
+        exit(1);
+    }
+    load_bench_program(env);
+    return env;
+}
+
+static int remove_entry(const char *path, const struct stat *status, int flag, struct FTW *ftw)
+{
+    (void)status;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+// ==================================================================================
+//                                  Benchmarks
+// ==================================================================================
+
+/**
+ * Steps per second on one thread, with an episode reset every 1000 steps.
+ */
+void bench_env_step()
+{
+    const int steps = 4000;
+    const uint32_t frameskips[] = {1, 4};
+    const uint32_t scales[] = {1, 2, 4};
+    uint8_t obs[SCREEN_WIDTH * SCREEN_HEIGHT];
+    uint8_t ram[4];
+    for (size_t f = 0; f < sizeof(frameskips) / sizeof(frameskips[0]); f++)
+    {
+        for (size_t s = 0; s < sizeof(scales) / sizeof(scales[0]); s++)
+        {
+            env_t *env = new_bench_env(scales[s]);
+            double start = bench_seconds();
+            for (int step = 0; step < steps; step++)
+            {
+                if (step % 1000 == 0)
+                {
+                    env_reset(env, obs, ram);
+                }
+                env_step(env, (uint8_t)(step * 13), frameskips[f], obs, ram);
+            }
+            double elapsed = bench_seconds() - start;
+            printf("env_step frameskip %u, %3ux%-3u obs: %8.0f steps/s, %8.0f frames/s\n",
+                   frameskips[f], env->obs_width, env->obs_height, steps / elapsed,
+                   steps * frameskips[f] / elapsed);
+            free_env(env);
+        }
+    }
+
+    env_t *env = new_bench_env(2);
+    double start = bench_seconds();
+    for (int i = 0; i < steps; i++)
+    {
+        env_reset(env, NULL, NULL);
+    }
+    printf("env_reset:                       %8.1f us\n", (bench_seconds() - start) / steps * 1e6);
+    free_env(env);
+}
+
+/**
+ * Env frames per second of a vector environment as the pool grows from one
+ * thread to one per CPU, with the environment count fixed so each row does
+ * the same work.
+ */
+void bench_vec_env_scaling()
+{
+    const int steps = 200;
+    const uint32_t frameskip = 4;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t max_threads = cpus < 1 ? 1 : (uint32_t)cpus;
+    uint32_t count = max_threads * 4 < 64 ? 64 : max_threads * 4;
+    double base = 0;
+    // Powers of two, then every CPU
+    for (uint32_t threads = 1;; threads = threads * 2 < max_threads ? threads * 2 : max_threads)
+    {
+        vec_env_t *vec = new_vec_env(count, 2, threads);
+        if (vec == NULL)
+        {
+            printf("Could not allocate the benchmark vector environment\n");
+            exit(1);
+        }
+        for (uint32_t i = 0; i < count; i++)
+        {
+            load_bench_program(vec->envs[i]);
+        }
+        vec->episode_steps = 100;
+        uint8_t *obs = malloc(count * vec->obs_size);
+        uint8_t *ram = malloc(count * 4);
+        uint8_t *actions = malloc(count);
+        uint8_t *dones = malloc(count);
+        if (obs == NULL || ram == NULL || actions == NULL || dones == NULL)
+        {
+            printf("Could not allocate the benchmark buffers\n");
+            exit(1);
+        }
+        vec_env_reset(vec, obs, ram);
+        double start = bench_seconds();
+        for (int step = 0; step < steps; step++)
+        {
+            for (uint32_t i = 0; i < count; i++)
+            {
+                actions[i] = (uint8_t)((step + i) * 13);
+            }
+            vec_env_step(vec, actions, frameskip, obs, ram, dones);
+        }
+        double rate = (double)steps * count * frameskip / (bench_seconds() - start);
+        base = threads == 1 ? rate : base;
+        printf("vec_env %3u envs, %3u threads: %10.0f frames/s, %5.2fx, %3.0f%% efficiency\n",
+               count, threads, rate, rate / base, 100 * rate / base / threads);
+        free(obs);
+        free(ram);
+        free(actions);
+        free(dones);
+        free_vec_env(vec);
+        if (threads == max_threads)
+        {
+            break;
+        }
+    }
+}
+
+/**
+ * An exploration run keeping a state after every step: how much the page
+ * dedup saves and what saving and restoring a state cost, against a plain
+ * save_emulator_state.
+ */
+void bench_state_archive()
+{
+    const uint32_t states = 5000;
+    const uint32_t page_sizes[] = {128, 256, 1024, 4096};
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/gameboy_bench_archive_%d", (int)getpid());
+    emulator_state_t *state = new_emulator_state();
+    if (state == NULL)
+    {
+        printf("Could not allocate the benchmark state\n");
+        exit(1);
+    }
+    for (size_t s = 0; s < sizeof(page_sizes) / sizeof(page_sizes[0]); s++)
+    {
+        env_t *env = new_bench_env(2);
+        state_archive_t *archive = new_state_archive(path, page_sizes[s], 1 << 20, states);
+        if (archive == NULL)
+        {
+            printf("Could not create the benchmark archive\n");
+            exit(1);
+        }
+        double plain = 0, save = 0, restore = 0;
+        for (uint32_t i = 0; i < states; i++)
+        {
+            env_step(env, (uint8_t)(i * 13), 1, NULL, NULL);
+            double start = bench_seconds();
+            save_emulator_state(env->emulator, state);
+            double saved = bench_seconds();
+            if (state_archive_write(archive, state) < 0)
+            {
+                printf("The benchmark archive is full\n");
+                exit(1);
+            }
+            double written = bench_seconds();
+            plain += saved - start;
+            save += written - start;
+        }
+        // Restore states in a scattered order, as a search would
+        for (uint32_t i = 0; i < states; i++)
+        {
+            double start = bench_seconds();
+            state_archive_read(archive, (i * 7919) % states, state);
+            load_emulator_state(env->emulator, state);
+            restore += bench_seconds() - start;
+        }
+        state_archive_header_t *header = archive->header;
+        double stored = (double)atomic_load(&header->page_count) * header->page_size
+                        + (double)states * header->pages_per_state * sizeof(uint32_t);
+        printf("state archive %4u-byte pages: dedup x%6.1f, %7.0f bytes/state of %zu, "
+               "save %5.1f us (plain %4.1f), restore %5.1f us\n",
+               header->page_size, state_archive_dedup_ratio(archive), stored / states,
+               sizeof(emulator_state_t), save / states * 1e6, plain / states * 1e6, restore / states * 1e6);
+        free_state_archive(archive);
+        free_env(env);
+    }
+    free_emulator_state(state);
+    unlink(path);
+}
+
+/**
+ * Fuzzer runs per second on the workload, from a seed of 256 steps of 4
+ * frames: one instance in this process, then one instance per CPU.
+ */
+void bench_fuzzer()
+{
+    const uint32_t seeds = 40;
+    char directory[] = "/tmp/gameboy_bench_fuzz_XXXXXX";
+    env_t *env = new_bench_env(1);
+    if (mkdtemp(directory) == NULL)
+    {
+        printf("Could not create the benchmark directory\n");
+        exit(1);
+    }
+    fuzzer_t *fuzzer = new_fuzzer(directory, env->snapshot, 2);
+    if (fuzzer == NULL)
+    {
+        printf("Could not allocate the benchmark fuzzer\n");
+        exit(1);
+    }
+    fuzzer->max_steps = 256;
+    uint8_t buttons[256];
+    for (int i = 0; i < 256; i++)
+    {
+        buttons[i] = (uint8_t)(i * 13);
+    }
+    fuzzer_add_seed(fuzzer, buttons, 256);
+    double start = bench_seconds();
+    for (uint32_t i = 0; i < seeds; i++)
+    {
+        fuzzer_fuzz_one(fuzzer);
+    }
+    double elapsed = bench_seconds() - start;
+    printf("fuzzer, 1 instance:   %8.0f execs/s, corpus %u, %llu edges\n", fuzzer->execs / elapsed,
+           fuzzer->corpus_count, (unsigned long long)coverage_count_edges(fuzzer->total));
+
+    uint32_t instances = sysconf(_SC_NPROCESSORS_ONLN);
+    instances = instances > FUZZ_MAX_INSTANCES ? FUZZ_MAX_INSTANCES : instances;
+    uint64_t execs = fuzzer->execs;
+    fuzzer->execs = 0;
+    start = bench_seconds();
+    fuzzer_run(fuzzer, instances, execs);
+    elapsed = bench_seconds() - start;
+    printf("fuzzer, %2u instances: %8.0f execs/s\n", instances, fuzzer->execs / elapsed);
+
+    free_fuzzer(fuzzer);
+    free_env(env);
+    nftw(directory, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+void main_bench_env()
+{
+    printf("Running environment benchmarks...\n");
+    bench_env_step();
+    bench_vec_env_scaling();
+    bench_state_archive();
+    bench_fuzzer();
+}
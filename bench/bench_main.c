@@ -0,0 +1,21 @@
+#include "./bench.h"
+
+#include <time.h>
+
+
+double bench_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int main() {
+    main_bench_cpu();
+    main_bench_ppu();
+    main_bench_apu();
+    main_bench_video();
+    main_bench_env();
+    printf("All benchmarks done!\n");
+    return 0;
+}
@@ -0,0 +1,315 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "./bench.h"
+#include "../src/emulator.h"
+#include "../test/test_programs.h"
+
+// ==================================================================================
+//                                  Workload
+// ==================================================================================
+
+// Game-like frame from the tests: wait for VBlank, read the joypad, scroll
+static emulator_t *new_frame_emulator(bool lazy)
+{
+    emulator_t *emulator = new_emulator();
+    if (emulator == NULL)
+    {
+        printf("Could not allocate the benchmark emulator\n");
+        exit(1);
+    }
+    load_agent_program(emulator->cpu, 0);
+    uint8_t *memory = emulator->cpu->memorybus;
+    for (int i = 0; i < 10; i++)
+    {
+        memory[0xFE00 + i * 4] = 40 + i * 8;
+        memory[0xFE00 + i * 4 + 1] = 20 + i * 12;
+    }
+    emulator->ppu->LCDC = 0x93;
+    emulator->ppu->lazy = lazy;
+    emulator->cpu->idle_skip = false;
+    return emulator;
+}
+
+static double run_frames(emulator_t *emulator, int frames)
+{
+    double start = bench_seconds();
+    for (int i = 0; i < frames; i++)
+    {
+        tick_emulator(emulator);
+    }
+    return bench_seconds() - start;
+}
+
+// ==================================================================================
+//                                  Benchmarks
+// ==================================================================================
+
+void bench_lazy_rendering()
+{
+    const int frames = 3000;
+
+    emulator_t *emulator = new_frame_emulator(false);
+    double eager = run_frames(emulator, frames);
+    free_emulator(emulator);
+
+    emulator = new_frame_emulator(true);
+    double lazy = run_frames(emulator, frames);
+    free_emulator(emulator);
+
+    printf("Eager rendering: %8.0f frames/s\n", frames / eager);
+    printf("Lazy rendering:  %8.0f frames/s (x%.2f)\n", frames / lazy, eager / lazy);
+}
+
+void bench_render_skip()
+{
+    const int frames = 3000;
+    const uint32_t intervals[] = {1, 4, 0};
+    double every = 0;
+    for (size_t i = 0; i < sizeof(intervals) / sizeof(intervals[0]); i++)
+    {
+        emulator_t *emulator = new_frame_emulator(true);
+        ppu_set_render_interval(emulator->ppu, intervals[i]);
+        double elapsed = run_frames(emulator, frames);
+        free_emulator(emulator);
+        if (i == 0)
+        {
+            every = elapsed;
+        }
+        char label[64];
+        if (intervals[i] == 0)
+        {
+            snprintf(label, sizeof(label), "Timing only:");
+        }
+        else
+        {
+            snprintf(label, sizeof(label), "Rendering 1 frame in %u:", intervals[i]);
+        }
+        printf("%-24s %8.0f frames/s (x%.2f)\n", label, frames / elapsed, every / elapsed);
+    }
+}
+
+typedef struct FrameConsumer
+{
+    triple_buffer_t *frames;
+    long period_ns;         // Pause between acquires, 0 to poll continuously
+    atomic_bool stop;
+    uint64_t checksum;
+} frame_consumer_t;
+
+static void *consume_frames(void *argument)
+{
+    frame_consumer_t *consumer = argument;
+    struct timespec pause = {0, consumer->period_ns};
+    while (!atomic_load(&consumer->stop))
+    {
+        const uint8_t *frame = triple_buffer_acquire(consumer->frames, NULL);
+        if (frame != NULL)
+        {
+            consumer->checksum += frame[SCREEN_WIDTH * SCREEN_HEIGHT / 2];
+        }
+        if (consumer->period_ns > 0)
+        {
+            nanosleep(&pause, NULL);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Emulation thread publishing every frame to a consumer faster than the
+ * emulator and to one reading at display rate.
+ */
+void bench_frame_handoff()
+{
+    const int frames = 3000;
+    const long periods[] = {100000, 16666667};
+    const char *names[] = {"10 kHz consumer", "60 Hz consumer"};
+    for (int i = 0; i < 2; i++)
+    {
+        emulator_t *emulator = new_frame_emulator(true);
+        frame_consumer_t consumer = {emulator->frames, periods[i], false, 0};
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, consume_frames, &consumer) != 0)
+        {
+            printf("Could not start the consumer thread\n");
+            exit(1);
+        }
+        double elapsed = run_frames(emulator, frames);
+        atomic_store(&consumer.stop, true);
+        pthread_join(thread, NULL);
+
+        triple_buffer_t *handoff = emulator->frames;
+        printf("Handoff, %-16s %8.0f frames/s, %lu published, %lu dropped, %lu duplicated\n",
+               names[i], frames / elapsed, (unsigned long)handoff->published,
+               (unsigned long)atomic_load(&handoff->dropped), (unsigned long)handoff->duplicated);
+        free_emulator(emulator);
+    }
+}
+
+/**
+ * Rendering alone, with the tile data untouched between frames and with every
+ * tile rewritten through the bus once per frame.
+ */
+void bench_tile_cache()
+{
+    const int frames = 5000;
+    uint8_t *memory = calloc(0x10000, 1);
+    ppu_t *ppu = new_ppu();
+    if (memory == NULL || ppu == NULL)
+    {
+        printf("Could not allocate the benchmark PPU\n");
+        exit(1);
+    }
+    for (int i = 0; i < 0x2000; i++)
+    {
+        memory[0x8000 + i] = (uint8_t)(i * 37 + (i >> 4));
+    }
+    for (int i = 0; i < 10; i++)
+    {
+        memory[0xFE00 + i * 4] = 40 + i * 8;
+        memory[0xFE00 + i * 4 + 1] = 20 + i * 12;
+        memory[0xFE00 + i * 4 + 3] = (i & 1) << 5;
+    }
+    ppu_attach_memory(ppu, memory);
+    ppu->LCDC = 0xB3;
+    ppu->WY = 100;
+    ppu->WX = 87;
+
+    const char *patterns[] = {"static VRAM", "streaming tiles"};
+    uint64_t cycle = 0;
+    for (int streaming = 0; streaming < 2; streaming++)
+    {
+        double start = bench_seconds();
+        for (int i = 0; i < frames; i++)
+        {
+            cycle += CYCLES_PER_FRAME;
+            if (streaming)
+            {
+                for (uint16_t address = 0x8000; address < 0x9800; address += 16)
+                {
+                    ppu_write_memory(ppu, address, memory[address], cycle);
+                }
+            }
+            ppu_catch_up(ppu, cycle);
+        }
+        double elapsed = bench_seconds() - start;
+        printf("Rendering, %-15s %8.0f frames/s\n", patterns[streaming], frames / elapsed);
+    }
+
+    free_ppu(ppu);
+    free(memory);
+}
+
+/**
+ * Rendering with all 40 sprites on screen, every sprite moving down a line
+ * per frame through OAM writes.
+ */
+void bench_sprite_lines()
+{
+    const int frames = 5000;
+    uint8_t *memory = calloc(0x10000, 1);
+    ppu_t *ppu = new_ppu();
+    if (memory == NULL || ppu == NULL)
+    {
+        printf("Could not allocate the benchmark PPU\n");
+        exit(1);
+    }
+    for (int i = 0; i < 0x1800; i++)
+    {
+        memory[0x8000 + i] = (uint8_t)(i * 37 + (i >> 4));
+    }
+    for (int i = 0; i < SPRITE_COUNT; i++)
+    {
+        memory[0xFE00 + i * 4] = 16 + i * 4;
+        memory[0xFE00 + i * 4 + 1] = 8 + i * 4;
+        memory[0xFE00 + i * 4 + 2] = i;
+    }
+    ppu_attach_memory(ppu, memory);
+    ppu->LCDC = 0x93;
+
+    uint64_t cycle = 0;
+    double start = bench_seconds();
+    for (int i = 0; i < frames; i++)
+    {
+        cycle += CYCLES_PER_FRAME;
+        for (int sprite = 0; sprite < SPRITE_COUNT; sprite++)
+        {
+            uint16_t address = 0xFE00 + sprite * 4;
+            uint8_t y = memory[address] + 1;
+            ppu_write_memory(ppu, address, y, cycle);
+            memory[address] = y;
+        }
+        ppu_catch_up(ppu, cycle);
+    }
+    double elapsed = bench_seconds() - start;
+    printf("Rendering, 40 moving sprites %8.0f frames/s\n", frames / elapsed);
+
+    free_ppu(ppu);
+    free(memory);
+}
+
+/**
+ * Run-ahead: host time per presented frame for 0 to 3 frames ahead, and what
+ * one save plus one load of the state costs on its own.
+ */
+void bench_run_ahead()
+{
+    const int frames = 3000;
+    double base = 0;
+    for (uint32_t ahead = 0; ahead <= 3; ahead++)
+    {
+        emulator_t *emulator = new_frame_emulator(true);
+        if (set_run_ahead(emulator, ahead) != 0)
+        {
+            printf("Could not allocate the run-ahead state\n");
+            exit(1);
+        }
+        double per_frame = run_frames(emulator, frames) / frames * 1e6;
+        free_emulator(emulator);
+        if (ahead == 0)
+        {
+            base = per_frame;
+            printf("Run-ahead off:            %7.1f us/frame\n", per_frame);
+        }
+        else
+        {
+            printf("Run-ahead %u frame%s:       %7.1f us/frame, +%.1f us per run-ahead frame\n", ahead,
+                   ahead > 1 ? "s" : " ", per_frame, (per_frame - base) / ahead);
+        }
+    }
+
+    emulator_t *emulator = new_frame_emulator(true);
+    emulator_state_t *state = new_emulator_state();
+    if (state == NULL)
+    {
+        printf("Could not allocate the benchmark state\n");
+        exit(1);
+    }
+    run_frames(emulator, 10);
+    double start = bench_seconds();
+    for (int i = 0; i < frames; i++)
+    {
+        save_emulator_state(emulator, state);
+        load_emulator_state(emulator, state);
+    }
+    printf("State save + load:        %7.1f us (%zu bytes)\n", (bench_seconds() - start) / frames * 1e6,
+           sizeof(emulator_state_t));
+    free_emulator_state(state);
+    free_emulator(emulator);
+}
+
+void main_bench_ppu()
+{
+    printf("Running PPU benchmarks...\n");
+    bench_lazy_rendering();
+    bench_render_skip();
+    bench_frame_handoff();
+    bench_tile_cache();
+    bench_sprite_lines();
+    bench_run_ahead();
+}
@@ -0,0 +1,80 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "./bench.h"
+#include "../src/video.h"
+
+// ==================================================================================
+//                                  Benchmarks
+// ==================================================================================
+
+/**
+ * Converts `frames` 160x144 frames read from and written to `batch`
+ * consecutive slots, so a batch larger than the caches streams from memory.
+ *
+ * @return the throughput in megapixels per second.
+ */
+static double convert_frames(video_output_t *output, const uint8_t *shades, uint8_t *pixels,
+                             int batch, int frames)
+{
+    const size_t frame_pixels = SCREEN_WIDTH * SCREEN_HEIGHT;
+    const size_t stride = SCREEN_WIDTH * pixel_format_size(output->format);
+    double start = bench_seconds();
+    for (int i = 0; i < frames; i++)
+    {
+        int slot = i % batch;
+        video_convert(output, shades + slot * frame_pixels, SCREEN_WIDTH, SCREEN_WIDTH,
+                      SCREEN_HEIGHT, pixels + slot * stride * SCREEN_HEIGHT, stride);
+    }
+    double elapsed = bench_seconds() - start;
+    return frames * (double)frame_pixels / elapsed / 1e6;
+}
+
+void bench_pixel_conversion()
+{
+    const int frames = 20000;
+    const int batch = 1024;
+    const size_t frame_pixels = SCREEN_WIDTH * SCREEN_HEIGHT;
+    uint8_t *shades = malloc(batch * frame_pixels);
+    uint8_t *pixels = malloc(batch * frame_pixels * 4);
+    if (shades == NULL || pixels == NULL)
+    {
+        printf("Could not allocate the benchmark frames\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < batch * frame_pixels; i++)
+    {
+        shades[i] = (uint8_t)(i * 7 + (i >> 5)) & 3;
+    }
+
+    const pixel_format_t formats[] = {PIXEL_FORMAT_RGBA8888, PIXEL_FORMAT_RGB565, PIXEL_FORMAT_GRAY8};
+    const char *names[] = {"RGBA8888", "RGB565", "GRAY8"};
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+    {
+        video_output_t *output = new_video_output(formats[i]);
+        if (output == NULL)
+        {
+            printf("Could not allocate the video output\n");
+            exit(1);
+        }
+        for (int simd = 1; simd >= 0; simd--)
+        {
+            output->simd = simd;
+            double single = convert_frames(output, shades, pixels, 1, frames);
+            double batched = convert_frames(output, shades, pixels, batch, frames);
+            printf("%-8s %-6s 1 frame: %7.0f Mpixel/s, %d frames: %7.0f Mpixel/s\n",
+                   names[i], simd ? "SIMD" : "scalar", single, batch, batched);
+        }
+        free_video_output(output);
+    }
+
+    free(shades);
+    free(pixels);
+}
+
+void main_bench_video()
+{
+    printf("Running video output benchmarks...\n");
+    bench_pixel_conversion();
+}
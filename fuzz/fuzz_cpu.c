@@ -0,0 +1,74 @@
+/**
+ * libFuzzer target diffing execute_instruction against the reference model
+ * in cpu_reference.c. Each input is one CPU state and the bytes at PC, laid
+ * out as described by CPU_DIFF_INPUT_SIZE. On any difference in registers,
+ * flags, IME, memory or M-cycles the report goes to stderr and the run
+ * aborts, so libFuzzer saves the input as a crash.
+ *
+ * Build from the repository root:
+ *
+ *   clang -O1 -g -fsanitize=fuzzer,address,undefined fuzz/fuzz_cpu.c $(find src -name '*.c') \
+ *      -o fuzz_cpu -pthread -lm
+ *
+ * and run it on a corpus directory with one worker per core:
+ *
+ *   mkdir -p corpus && ./fuzz_cpu -jobs=$(nproc) -workers=$(nproc) corpus
+ *
+ * With -DFUZZ_STANDALONE any C compiler builds a main that replays the
+ * inputs named on its command line, e.g. a corpus or saved crashes.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/cpu_reference.h"
+
+
+static cpu_diff_t *diff = NULL;
+
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+    (void)argc;
+    (void)argv;
+    diff = new_cpu_diff(0);
+    if (diff == NULL)
+    {
+        fprintf(stderr, "Out of memory for the CPU diff.\n");
+        exit(1);
+    }
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (cpu_diff_run(diff, data, size) != 0)
+    {
+        fprintf(stderr, "execute_instruction differs from the reference: %s\n", diff->report);
+        abort();
+    }
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+int main(int argc, char **argv)
+{
+    LLVMFuzzerInitialize(&argc, &argv);
+    for (int i = 1; i < argc; i++)
+    {
+        uint8_t data[CPU_DIFF_INPUT_SIZE];
+        FILE *file = fopen(argv[i], "rb");
+        if (file == NULL)
+        {
+            fprintf(stderr, "Cannot open %s.\n", argv[i]);
+            return 1;
+        }
+        size_t size = fread(data, 1, sizeof(data), file);
+        fclose(file);
+        LLVMFuzzerTestOneInput(data, size);
+    }
+    printf("%d inputs agree with the reference.\n", argc - 1);
+    return 0;
+}
+#endif
@@ -0,0 +1,85 @@
+"""Python-side step throughput of the gameboy extension.
+
+Compares reading the framebuffer and WRAM through zero-copy views with
+copying them out every step, then runs one emulator per thread to show the
+released GIL. Build the module first (see python/gameboy_module.c) and run
+from the directory holding it.
+"""
+
+import os
+import threading
+import time
+
+import gameboy
+
+
+# The agent program of test/test_programs.c, which the C benchmarks also run:
+# wait for VBlank, scroll by the P1 input lines, keep a frame counter and the
+# last P1 read in WRAM. The extension cannot link the C test helpers, so the
+# bytes are mirrored here; keep them in step with agent_program.
+AGENT_PROGRAM = bytes([
+    0xF0, 0x44, 0xFE, 0x90, 0x20, 0xFA,  # 0100: LDH A,(LY); CP 0x90; JR NZ,0x0100
+    0xF0, 0x00, 0xEA, 0x01, 0xC0,        # 0106: LDH A,(P1); LD (0xC001),A
+    0x0E, 0x0F, 0xA1, 0x47,              # 010B: LD C,0x0F; AND C; LD B,A
+    0xF0, 0x42, 0x90, 0xE0, 0x42,        # 010F: LDH A,(SCY); SUB B; LDH (SCY),A
+    0x21, 0x00, 0xC0, 0x34,              # 0114: LD HL,0xC000; INC (HL)
+    0xF0, 0x44, 0xFE, 0x90, 0x28, 0xFA,  # 0118: LDH A,(LY); CP 0x90; JR Z,0x0118
+    0x18, 0xE0,                          # 011E: JR 0x0100
+])
+
+STEPS = 2000
+
+
+def new_bench_emulator():
+    emulator = gameboy.Emulator()
+    # Tile data and map as load_agent_program fills them
+    emulator.load(bytes((i * 37 + (i >> 7)) & 0xFF for i in range(0x1800)), 0x8000)
+    emulator.load(bytes((i * 7) & 0xFF for i in range(0x400)), 0x9800)
+    emulator.load(AGENT_PROGRAM, 0x0100)
+    emulator.pc = 0x0100
+    return emulator
+
+
+def run_steps(emulator, steps, copy):
+    """Steps with a changing action, touching the observation each time."""
+    framebuffer = emulator.framebuffer
+    wram = emulator.wram
+    checksum = 0
+    for step in range(steps):
+        emulator.step(1, (step * 13) & 0xFF)
+        if copy:
+            pixels = framebuffer.tobytes()
+            ram = wram.tobytes()
+            checksum += pixels[step % len(pixels)] + ram[0]
+        else:
+            checksum += framebuffer[step % 144, step % 160] + wram[0]
+    return checksum
+
+
+def bench_views():
+    for copy in (False, True):
+        emulator = new_bench_emulator()
+        start = time.perf_counter()
+        run_steps(emulator, STEPS, copy)
+        elapsed = time.perf_counter() - start
+        label = "copied buffers" if copy else "zero-copy views"
+        print(f"step + {label:15}: {STEPS / elapsed:8.0f} steps/s")
+
+
+def bench_threads():
+    threads_max = os.cpu_count() or 1
+    for count in sorted({1, 2, 4, threads_max}):
+        emulators = [new_bench_emulator() for _ in range(count)]
+        threads = [threading.Thread(target=run_steps, args=(e, STEPS, False)) for e in emulators]
+        start = time.perf_counter()
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        elapsed = time.perf_counter() - start
+        print(f"{count:2} threads, one emulator each: {count * STEPS / elapsed:8.0f} steps/s")
+
+
+if __name__ == "__main__":
+    bench_views()
+    bench_threads()
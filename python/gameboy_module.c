@@ -0,0 +1,474 @@
+/**
+ * CPython bindings for emulator_t.
+ *
+ * gameboy.Emulator owns one emulator. Its framebuffer, WRAM, HRAM and
+ * register file are exported through the buffer protocol, so memoryview,
+ * NumPy and friends read and write the emulator's own memory without a copy.
+ * step() releases the GIL while the frames run, so Python threads driving
+ * separate instances run in parallel.
+ *
+ * Build from the repository root:
+ *
+ *   cc -O2 -shared -fPIC $(python3-config --includes) python/gameboy_module.c $(find src -name '*.c') \
+ *      -o gameboy$(python3-config --extension-suffix) -pthread -lm
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../src/emulator.h"
+
+
+#define WRAM_START      0xC000
+#define WRAM_SIZE       0x2000
+#define HRAM_START      0xFF80
+#define HRAM_SIZE       0x7F
+
+
+typedef struct EmulatorObject
+{
+    PyObject_HEAD
+    emulator_t *emulator;
+    bool stepping;              // step() is running with the GIL released
+    // Writable RAM views may have changed memory behind write_memory: the
+    // RAM hash is rebuilt while any is exported, and once after the last goes
+    Py_ssize_t ram_exports;
+    bool ram_dirty;
+} emulator_object_t;
+
+
+/**
+ * One exported region of an emulator. Views keep the buffer object alive,
+ * and the buffer object keeps its emulator alive.
+ */
+typedef struct BufferObject
+{
+    PyObject_HEAD
+    emulator_object_t *owner;
+    void *data;
+    const char *format;         // struct module syntax, "B" or "H"
+    Py_ssize_t itemsize;
+    int ndim;
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+    bool readonly;
+    bool ram;                   // Inside the RAM covered by cpu->ram_hash
+} buffer_object_t;
+
+
+static PyTypeObject emulator_type;
+static PyTypeObject buffer_type;
+
+
+// =================================================================================
+//                          Buffers
+// =================================================================================
+
+static void buffer_dealloc(buffer_object_t *self)
+{
+    Py_XDECREF(self->owner);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int buffer_get(buffer_object_t *self, Py_buffer *view, int flags)
+{
+    if ((flags & PyBUF_WRITABLE) && self->readonly)
+    {
+        PyErr_SetString(PyExc_BufferError, "buffer is read-only");
+        view->obj = NULL;
+        return -1;
+    }
+    Py_ssize_t items = 1;
+    for (int i = 0; i < self->ndim; i++)
+    {
+        items *= self->shape[i];
+    }
+
+    // The regions are C-contiguous, so every request can be served as is
+    view->buf = self->data;
+    view->obj = (PyObject *)self;
+    Py_INCREF(self);
+    view->len = items * self->itemsize;
+    view->readonly = self->readonly;
+    view->itemsize = self->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? (char *)self->format : NULL;
+    view->ndim = self->ndim;
+    view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    if (self->ram && !self->readonly)
+    {
+        self->owner->ram_exports++;
+    }
+    return 0;
+}
+
+static void buffer_release(buffer_object_t *self, Py_buffer *view)
+{
+    if (self->ram && !self->readonly)
+    {
+        self->owner->ram_exports--;
+        self->owner->ram_dirty = true;
+    }
+}
+
+static PyBufferProcs buffer_procs = {
+    .bf_getbuffer = (getbufferproc)buffer_get,
+    .bf_releasebuffer = (releasebufferproc)buffer_release,
+};
+
+static PyTypeObject buffer_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "gameboy.Buffer",
+    .tp_doc = "Zero-copy view of an emulator region, exported through the buffer protocol.",
+    .tp_basicsize = sizeof(buffer_object_t),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor)buffer_dealloc,
+    .tp_as_buffer = &buffer_procs,
+};
+
+/**
+ * @return a new memoryview of `ndim` rows of `shape` items at `data`, or NULL
+ * with an exception set. `ram` marks memory covered by the RAM hash.
+ */
+static PyObject *new_view(emulator_object_t *owner, void *data, const char *format, Py_ssize_t itemsize,
+                          int ndim, const Py_ssize_t *shape, bool readonly, bool ram)
+{
+    buffer_object_t *buffer = PyObject_New(buffer_object_t, &buffer_type);
+    if (buffer == NULL)
+    {
+        return NULL;
+    }
+    Py_INCREF(owner);
+    buffer->owner = owner;
+    buffer->data = data;
+    buffer->format = format;
+    buffer->itemsize = itemsize;
+    buffer->ndim = ndim;
+    buffer->readonly = readonly;
+    buffer->ram = ram;
+    Py_ssize_t stride = itemsize;
+    for (int i = ndim - 1; i >= 0; i--)
+    {
+        buffer->shape[i] = shape[i];
+        buffer->strides[i] = stride;
+        stride *= shape[i];
+    }
+    PyObject *view = PyMemoryView_FromObject((PyObject *)buffer);
+    Py_DECREF(buffer);
+    return view;
+}
+
+
+// =================================================================================
+//                          Emulator
+// =================================================================================
+
+/**
+ * Emulator state may only change while no step() is running on it.
+ *
+ * @return 0, or -1 with RuntimeError set.
+ */
+static int check_idle(emulator_object_t *self)
+{
+    if (self->stepping)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "emulator is being stepped by another thread");
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *emulator_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, ":Emulator", keywords))
+    {
+        return NULL;
+    }
+    emulator_object_t *self = (emulator_object_t *)type->tp_alloc(type, 0);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->emulator = new_emulator();
+    if (self->emulator == NULL)
+    {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+    self->stepping = false;
+    self->ram_exports = 0;
+    self->ram_dirty = false;
+    return (PyObject *)self;
+}
+
+static void emulator_dealloc(emulator_object_t *self)
+{
+    free_emulator(self->emulator);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+/**
+ * step(frames=1, buttons=None): runs `frames` frames, pressing the joypad
+ * buttons mask first when given. The GIL is released for the whole run.
+ */
+static PyObject *emulator_step(emulator_object_t *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"frames", "buttons", NULL};
+    unsigned int frames = 1;
+    int buttons = -1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|Ii:step", keywords, &frames, &buttons))
+    {
+        return NULL;
+    }
+    if (buttons > 0xFF)
+    {
+        PyErr_SetString(PyExc_ValueError, "buttons must be a mask of 8 bits");
+        return NULL;
+    }
+    if (check_idle(self) < 0)
+    {
+        return NULL;
+    }
+
+    // Only flipped with the GIL held, so two threads cannot both get past check_idle
+    self->stepping = true;
+    emulator_t *emulator = self->emulator;
+    bool rehash = emulator->cpu->ram_hashing && (self->ram_exports > 0 || self->ram_dirty);
+    self->ram_dirty = false;
+    Py_BEGIN_ALLOW_THREADS
+    // Python may have written to WRAM through a view, under the fetch window and the RAM hash
+    invalidate_fetch_window(emulator->cpu);
+    if (rehash)
+    {
+        rehash_ram(emulator->cpu);
+    }
+    if (buttons >= 0 && joypad_set_buttons(emulator->joypad, (uint8_t)buttons))
+    {
+        request_interrupt(emulator->cpu, JOYPAD_INTERRUPT);
+    }
+    for (unsigned int frame = 0; frame < frames; frame++)
+    {
+        tick_emulator(emulator);
+    }
+    Py_END_ALLOW_THREADS
+    self->stepping = false;
+    Py_RETURN_NONE;
+}
+
+/**
+ * load(data, address=0x0100): copies a bytes-like program onto the bus,
+ * without write side effects.
+ */
+static PyObject *emulator_load(emulator_object_t *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"data", "address", NULL};
+    Py_buffer data;
+    unsigned int address = 0x0100;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|I:load", keywords, &data, &address))
+    {
+        return NULL;
+    }
+    if (address > 0x10000 || (size_t)data.len > 0x10000 - address)
+    {
+        PyBuffer_Release(&data);
+        PyErr_SetString(PyExc_ValueError, "data does not fit in the address space");
+        return NULL;
+    }
+    if (check_idle(self) < 0)
+    {
+        PyBuffer_Release(&data);
+        return NULL;
+    }
+    memcpy(self->emulator->cpu->memorybus + address, data.buf, data.len);
+    invalidate_fetch_window(self->emulator->cpu);
+    rehash_ram(self->emulator->cpu);
+    PyBuffer_Release(&data);
+    Py_RETURN_NONE;
+}
+
+static PyObject *emulator_get_framebuffer(emulator_object_t *self, void *closure)
+{
+    const Py_ssize_t shape[2] = {SCREEN_HEIGHT, SCREEN_WIDTH};
+    return new_view(self, &self->emulator->ppu->framebuffer[0][0], "B", 1, 2, shape, true, false);
+}
+
+static PyObject *emulator_get_wram(emulator_object_t *self, void *closure)
+{
+    const Py_ssize_t shape[1] = {WRAM_SIZE};
+    return new_view(self, self->emulator->cpu->memorybus + WRAM_START, "B", 1, 1, shape, false, true);
+}
+
+static PyObject *emulator_get_hram(emulator_object_t *self, void *closure)
+{
+    const Py_ssize_t shape[1] = {HRAM_SIZE};
+    return new_view(self, self->emulator->cpu->memorybus + HRAM_START, "B", 1, 1, shape, false, true);
+}
+
+// AF, BC, DE and HL share one allocation, see new_cpu
+static PyObject *emulator_get_registers(emulator_object_t *self, void *closure)
+{
+    const Py_ssize_t shape[1] = {4};
+    return new_view(self, self->emulator->cpu->registers->AF, "H", sizeof(uint16_t), 1, shape, false, false);
+}
+
+static PyObject *emulator_get_pc(emulator_object_t *self, void *closure)
+{
+    return PyLong_FromUnsignedLong(self->emulator->cpu->PC);
+}
+
+static PyObject *emulator_get_sp(emulator_object_t *self, void *closure)
+{
+    return PyLong_FromUnsignedLong(self->emulator->cpu->SP);
+}
+
+/**
+ * Shared setter for PC and SP, `closure` naming the field.
+ */
+static int emulator_set_pointer(emulator_object_t *self, PyObject *value, void *closure)
+{
+    if (value == NULL)
+    {
+        PyErr_SetString(PyExc_AttributeError, "cannot delete a register");
+        return -1;
+    }
+    unsigned long word = PyLong_AsUnsignedLong(value);
+    if (PyErr_Occurred())
+    {
+        return -1;
+    }
+    if (word > 0xFFFF)
+    {
+        PyErr_SetString(PyExc_ValueError, "register value must fit in 16 bits");
+        return -1;
+    }
+    if (check_idle(self) < 0)
+    {
+        return -1;
+    }
+    cpu_t *cpu = self->emulator->cpu;
+    if (strcmp(closure, "pc") == 0)
+    {
+        cpu->PC = (uint16_t)word;
+    }
+    else
+    {
+        cpu->SP = (uint16_t)word;
+    }
+    return 0;
+}
+
+static PyObject *emulator_get_cycles(emulator_object_t *self, void *closure)
+{
+    return PyLong_FromUnsignedLongLong(self->emulator->cpu->cycles);
+}
+
+static PyObject *emulator_get_frame(emulator_object_t *self, void *closure)
+{
+    return PyLong_FromUnsignedLongLong(self->emulator->ppu->frame_count);
+}
+
+static PyObject *emulator_get_ram_hash(emulator_object_t *self, void *closure)
+{
+    cpu_t *cpu = self->emulator->cpu;
+    if (!self->stepping && cpu->ram_hashing && (self->ram_exports > 0 || self->ram_dirty))
+    {
+        rehash_ram(cpu);
+        self->ram_dirty = false;
+    }
+    return PyLong_FromUnsignedLongLong(self->emulator->cpu->ram_hash);
+}
+
+static PyMethodDef emulator_methods[] = {
+    {"step", (PyCFunction)(void (*)(void))emulator_step, METH_VARARGS | METH_KEYWORDS,
+     "step(frames=1, buttons=None)\n--\n\n"
+     "Run `frames` frames without holding the GIL, pressing the `buttons` mask first if given."},
+    {"load", (PyCFunction)(void (*)(void))emulator_load, METH_VARARGS | METH_KEYWORDS,
+     "load(data, address=0x0100)\n--\n\n"
+     "Copy a bytes-like program onto the memory bus at `address`."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef emulator_getset[] = {
+    {"framebuffer", (getter)emulator_get_framebuffer, NULL,
+     "Read-only 144x160 view of the shades, 0 white to 3 black.", NULL},
+    {"wram", (getter)emulator_get_wram, NULL,
+     "Writable view of work RAM, 0xC000-0xDFFF. Writes bypass the memory bus until step().", NULL},
+    {"hram", (getter)emulator_get_hram, NULL,
+     "Writable view of high RAM, 0xFF80-0xFFFE. Writes bypass the memory bus until step().", NULL},
+    {"registers", (getter)emulator_get_registers, NULL,
+     "Writable view of AF, BC, DE and HL as native-endian 16-bit words.", NULL},
+    {"pc", (getter)emulator_get_pc, (setter)emulator_set_pointer, "Program counter.", "pc"},
+    {"sp", (getter)emulator_get_sp, (setter)emulator_set_pointer, "Stack pointer.", "sp"},
+    {"cycles", (getter)emulator_get_cycles, NULL, "M-cycles executed since power on.", NULL},
+    {"frame", (getter)emulator_get_frame, NULL, "Frames completed since power on.", NULL},
+    {"ram_hash", (getter)emulator_get_ram_hash, NULL,
+     "Hash of cartridge, work and high RAM, including writes through the views.", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject emulator_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "gameboy.Emulator",
+    .tp_doc = "A Game Boy. Memory views are zero-copy and stay valid while the emulator lives.",
+    .tp_basicsize = sizeof(emulator_object_t),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = emulator_new,
+    .tp_dealloc = (destructor)emulator_dealloc,
+    .tp_methods = emulator_methods,
+    .tp_getset = emulator_getset,
+};
+
+
+// =================================================================================
+//                          Module
+// =================================================================================
+
+static struct PyModuleDef gameboy_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "gameboy",
+    .m_doc = "Game Boy emulator with zero-copy memory views.",
+    .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_gameboy(void)
+{
+    if (PyType_Ready(&buffer_type) < 0 || PyType_Ready(&emulator_type) < 0)
+    {
+        return NULL;
+    }
+    PyObject *module = PyModule_Create(&gameboy_module);
+    if (module == NULL)
+    {
+        return NULL;
+    }
+    Py_INCREF(&emulator_type);
+    if (PyModule_AddObject(module, "Emulator", (PyObject *)&emulator_type) < 0)
+    {
+        Py_DECREF(&emulator_type);
+        Py_DECREF(module);
+        return NULL;
+    }
+    const struct { const char *name; long value; } constants[] = {
+        {"SCREEN_WIDTH", SCREEN_WIDTH},   {"SCREEN_HEIGHT", SCREEN_HEIGHT},
+        {"BUTTON_RIGHT", BUTTON_RIGHT},   {"BUTTON_LEFT", BUTTON_LEFT},
+        {"BUTTON_UP", BUTTON_UP},         {"BUTTON_DOWN", BUTTON_DOWN},
+        {"BUTTON_A", BUTTON_A},           {"BUTTON_B", BUTTON_B},
+        {"BUTTON_SELECT", BUTTON_SELECT}, {"BUTTON_START", BUTTON_START},
+    };
+    for (size_t i = 0; i < sizeof(constants) / sizeof(constants[0]); i++)
+    {
+        if (PyModule_AddIntConstant(module, constants[i].name, constants[i].value) < 0)
+        {
+            Py_DECREF(module);
+            return NULL;
+        }
+    }
+    return module;
+}
@@ -0,0 +1,124 @@
+"""Checks of the gameboy extension.
+
+Build the module first (see python/gameboy_module.c) and run from the
+directory holding it: python3 -m unittest test_gameboy
+"""
+
+import gc
+import threading
+import unittest
+
+import gameboy
+
+
+class RamHashTest(unittest.TestCase):
+
+    def test_view_writes_are_hashed_by_step(self):
+        emulator = gameboy.Emulator()
+        emulator.wram[0x0010] = 0x5A
+        emulator.hram[0x02] = 0xA5
+        emulator.step(0)
+
+        # load() rehashes with a full pass over RAM
+        recomputed = gameboy.Emulator()
+        recomputed.load(bytes([0x5A]), 0xC010)
+        recomputed.load(bytes([0xA5]), 0xFF82)
+        self.assertNotEqual(emulator.ram_hash, gameboy.Emulator().ram_hash)
+        self.assertEqual(emulator.ram_hash, recomputed.ram_hash)
+
+    def test_view_writes_are_hashed_without_step(self):
+        emulator = gameboy.Emulator()
+        wram = emulator.wram
+        wram[0x1000] = 0x42
+        recomputed = gameboy.Emulator()
+        recomputed.load(bytes([0x42]), 0xD000)
+        self.assertEqual(emulator.ram_hash, recomputed.ram_hash)
+
+        # A write just before the last view goes is still seen
+        wram[0x1001] = 0x43
+        wram.release()
+        recomputed.load(bytes([0x43]), 0xD001)
+        self.assertEqual(emulator.ram_hash, recomputed.ram_hash)
+
+
+class ViewTest(unittest.TestCase):
+
+    def test_framebuffer_is_read_only(self):
+        framebuffer = gameboy.Emulator().framebuffer
+        self.assertTrue(framebuffer.readonly)
+        self.assertEqual(framebuffer.shape, (144, 160))
+        self.assertEqual(framebuffer.format, "B")
+        with self.assertRaises(TypeError):
+            framebuffer[0, 0] = 3
+
+    def test_ram_writes_reach_the_core(self):
+        emulator = gameboy.Emulator()
+        self.assertFalse(emulator.wram.readonly)
+        self.assertFalse(emulator.hram.readonly)
+        emulator.wram[0x0010] = 0x5A
+        emulator.hram[0x02] = 0xA5
+        emulator.load(bytes([
+            0xFA, 0x10, 0xC0,   # LD A,(0xC010)
+            0x47,               # LD B,A
+            0xF0, 0x82,         # LDH A,(0x82)
+            0x18, 0xFE,         # JR -2
+        ]))
+        emulator.step()
+        af, bc = emulator.registers[0], emulator.registers[1]
+        self.assertEqual(af >> 8, 0xA5)
+        self.assertEqual(bc >> 8, 0x5A)
+
+    def test_registers_are_16_bit(self):
+        registers = gameboy.Emulator().registers
+        self.assertEqual(registers.format, "H")
+        self.assertEqual(registers.itemsize, 2)
+        self.assertEqual(registers.shape, (4,))
+
+    def test_view_keeps_the_emulator_alive(self):
+        emulator = gameboy.Emulator()
+        emulator.step()
+        framebuffer = emulator.framebuffer
+        wram = emulator.wram
+        snapshot = bytes(framebuffer)
+        del emulator
+        gc.collect()
+        self.assertEqual(bytes(framebuffer), snapshot)
+        wram[0] = 0x77
+        self.assertEqual(wram[0], 0x77)
+
+
+class LoadTest(unittest.TestCase):
+
+    def test_load_bounds(self):
+        emulator = gameboy.Emulator()
+        emulator.load(bytes([0x12]), 0xFFFF)
+        emulator.load(bytes(0x10000), 0x0000)
+        emulator.load(b"", 0x10000)
+        with self.assertRaises(ValueError):
+            emulator.load(bytes(2), 0xFFFF)
+        with self.assertRaises(ValueError):
+            emulator.load(bytes(0x10001), 0x0000)
+        with self.assertRaises(ValueError):
+            emulator.load(b"", 0x10001)
+
+
+class ThreadTest(unittest.TestCase):
+
+    def test_concurrent_step_raises(self):
+        emulator = gameboy.Emulator()
+        worker = threading.Thread(target=emulator.step, args=(3000,))
+        worker.start()
+        raised = False
+        # step() releases the GIL while it runs; retry until the worker is inside it
+        while worker.is_alive() and not raised:
+            try:
+                emulator.step(0)
+            except RuntimeError:
+                raised = True
+        worker.join()
+        self.assertTrue(raised)
+        emulator.step(0)
+
+
+if __name__ == "__main__":
+    unittest.main()
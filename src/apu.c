@@ -0,0 +1,655 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "apu.h"
+
+
+// Bits that read back as 1, for 0xFF10-0xFF2F
+static const uint8_t read_masks[0x20] = {
+    0x80, 0x3F, 0x00, 0xFF, 0xBF,   // NR10-NR14
+    0xFF, 0x3F, 0x00, 0xFF, 0xBF,   // NR20-NR24
+    0x7F, 0xFF, 0x9F, 0xFF, 0xBF,   // NR30-NR34
+    0xFF, 0xFF, 0x00, 0x00, 0xBF,   // NR40-NR44
+    0x00, 0x00, 0x70,               // NR50-NR52
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+static const uint8_t duty_patterns[4] = {0x01, 0x81, 0x87, 0x7E};
+
+// Cut off below Nyquist so the short kernel keeps aliasing low
+#define BLIP_CUTOFF 0.9
+
+// Per sample weight of the DC blocking filter, about 20 Hz at 48 kHz
+#define APU_HIGHPASS 0.0026f
+
+// Samples one catch-up span (a sequencer period) covers at most, with the
+// kernel tail; the buffer must hold them on top of the half kept when full
+#define APU_SPAN_SAMPLES \
+    ((uint64_t)APU_SEQUENCER_PERIOD * APU_MAX_SAMPLE_RATE / APU_CLOCK_RATE + 1 + BLIP_TAPS)
+_Static_assert(APU_SPAN_SAMPLES <= APU_BUFFER_SAMPLES / 2, "APU buffer too short for APU_MAX_SAMPLE_RATE");
+
+static void update_gains(apu_t *apu);
+
+static float blip_kernel[BLIP_PHASES][BLIP_TAPS];
+// Emulators may be created on several threads at once, see new_vec_env
+static pthread_once_t blip_kernel_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Fills blip_kernel: for a step at sub-sample offset phase / BLIP_PHASES,
+ * the impulse it adds to the following BLIP_TAPS samples, summing to 1.
+ */
+static void init_blip_kernel()
+{
+    for (int phase = 0; phase < BLIP_PHASES; phase++)
+    {
+        double sum = 0;
+        double taps[BLIP_TAPS];
+        for (int k = 0; k < BLIP_TAPS; k++)
+        {
+            double x = k - BLIP_TAPS / 2 + 1 - (double)phase / BLIP_PHASES;
+            double sinc = x == 0 ? 1.0 : sin(M_PI * BLIP_CUTOFF * x) / (M_PI * BLIP_CUTOFF * x);
+            double w = 2 * M_PI * x / BLIP_TAPS;
+            double window = fabs(x) >= BLIP_TAPS / 2 ? 0 : 0.42 + 0.5 * cos(w) + 0.08 * cos(2 * w);
+            taps[k] = sinc * window;
+            sum += taps[k];
+        }
+        for (int k = 0; k < BLIP_TAPS; k++)
+        {
+            blip_kernel[phase][k] = taps[k] / sum;
+        }
+    }
+}
+
+
+apu_t *new_apu()
+{
+    pthread_once(&blip_kernel_once, init_blip_kernel);
+    apu_t *apu = calloc(1, sizeof(apu_t));
+    if (apu == NULL)
+    {
+        return NULL;
+    }
+    // Post-boot values, with the boot sound already over
+    static const uint8_t boot_registers[0x17] = {
+        0x80, 0xBF, 0xF3, 0xFF, 0xBF, 0xFF, 0x3F, 0x00, 0xFF, 0xBF, 0x7F, 0xFF,
+        0x9F, 0xFF, 0xBF, 0xFF, 0xFF, 0x00, 0x00, 0xBF, 0x77, 0xF3, 0x80
+    };
+    memcpy(apu->registers, boot_registers, sizeof(boot_registers));
+    for (int i = 0; i < 4; i++)
+    {
+        apu->channels[i].lfsr = 0x7FFF;
+    }
+    apu->time = 0;
+    apu->next_sequencer_time = APU_SEQUENCER_PERIOD;
+    apu->sequencer_step = 0;
+    apu->synthesis = true;
+    apu_set_sample_rate(apu, APU_SAMPLE_RATE);
+    apu->position = 0;
+    update_gains(apu);
+    return apu;
+}
+
+void free_apu(apu_t *apu)
+{
+    free(apu);
+    apu = NULL;
+    return;
+}
+
+
+bool is_apu_register(uint16_t address)
+{
+    return address >= NR10_REGISTER && address < WAVE_RAM + 0x10;
+}
+
+static uint8_t reg(apu_t *apu, uint16_t address)
+{
+    return apu->registers[address - NR10_REGISTER];
+}
+
+static bool powered(apu_t *apu)
+{
+    return (reg(apu, NR52_REGISTER) & 0x80) != 0;
+}
+
+// First register (NRx0) of channel `index`
+static uint16_t channel_base(int index)
+{
+    return NR10_REGISTER + index * 5;
+}
+
+static bool dac_enabled(apu_t *apu, int index)
+{
+    if (index == 2)
+    {
+        return (reg(apu, NR30_REGISTER) & 0x80) != 0;
+    }
+    return (reg(apu, channel_base(index) + 2) & 0xF8) != 0;
+}
+
+static uint16_t channel_frequency(apu_t *apu, int index)
+{
+    return reg(apu, channel_base(index) + 3) | ((reg(apu, channel_base(index) + 4) & 0x07) << 8);
+}
+
+// T-cycles between two waveform steps of channel `index`
+static uint32_t channel_period(apu_t *apu, int index)
+{
+    switch (index)
+    {
+    case 0:
+    case 1:
+        return (2048 - channel_frequency(apu, index)) * 4;
+    case 2:
+        return (2048 - channel_frequency(apu, index)) * 2;
+    default:
+    {
+        uint8_t nr43 = reg(apu, NR43_REGISTER);
+        uint32_t divisor = (nr43 & 0x07) ? (nr43 & 0x07) * 16 : 8;
+        return divisor << (nr43 >> 4);
+    }
+    }
+}
+
+
+// =================================================================================
+//                          Band-limited output
+// =================================================================================
+
+void apu_set_sample_rate(apu_t *apu, uint32_t sample_rate)
+{
+    if (sample_rate == 0 || sample_rate > APU_MAX_SAMPLE_RATE)
+    {
+        fprintf(stderr, "Invalid APU sample rate %u.\n", sample_rate);
+        exit(1);
+    }
+    apu->sample_rate = sample_rate;
+    apu->step = ((uint64_t)sample_rate << 32) / APU_CLOCK_RATE;
+}
+
+/**
+ * Adds a band-limited step of height (left, right) at T-cycle `t`, which is
+ * no earlier than apu->time.
+ */
+static void add_step(apu_t *apu, uint64_t t, float left, float right)
+{
+    uint64_t position = apu->position + (t - apu->time) * apu->step;
+    uint32_t sample = position >> 32;
+    const float *kernel = blip_kernel[((position & 0xFFFFFFFF) * BLIP_PHASES) >> 32];
+    float *out_left = &apu->deltas[0][sample];
+    float *out_right = &apu->deltas[1][sample];
+    for (int k = 0; k < BLIP_TAPS; k++)
+    {
+        out_left[k] += left * kernel[k];
+        out_right[k] += right * kernel[k];
+    }
+}
+
+static void set_amplitude(apu_t *apu, int index, uint8_t amplitude, uint64_t t)
+{
+    apu_channel_t *channel = &apu->channels[index];
+    if (!apu->synthesis || amplitude == channel->amplitude)
+    {
+        return;
+    }
+    float delta = (float)amplitude - channel->amplitude;
+    add_step(apu, t, delta * apu->gain[index][0], delta * apu->gain[index][1]);
+    channel->amplitude = amplitude;
+}
+
+// Digital output of channel `index` in its current state
+static uint8_t channel_output(apu_t *apu, int index)
+{
+    apu_channel_t *channel = &apu->channels[index];
+    if (!channel->enabled)
+    {
+        return 0;
+    }
+    switch (index)
+    {
+    case 0:
+    case 1:
+    {
+        uint8_t duty = reg(apu, channel_base(index) + 1) >> 6;
+        return ((duty_patterns[duty] >> channel->position) & 1) ? channel->volume : 0;
+    }
+    case 2:
+    {
+        uint8_t level = (reg(apu, NR32_REGISTER) >> 5) & 0x03;
+        if (level == 0)
+        {
+            return 0;
+        }
+        uint8_t sample = reg(apu, WAVE_RAM + channel->position / 2);
+        sample = (channel->position & 1) ? sample & 0x0F : sample >> 4;
+        return sample >> (level - 1);
+    }
+    default:
+        return (channel->lfsr & 1) ? 0 : channel->volume;
+    }
+}
+
+static void refresh_channel(apu_t *apu, int index)
+{
+    set_amplitude(apu, index, channel_output(apu, index), apu->time);
+}
+
+/**
+ * Recomputes the NR50/NR51 weights, moving the output by the difference for
+ * channels currently playing.
+ */
+static void update_gains(apu_t *apu)
+{
+    uint8_t nr50 = reg(apu, NR50_REGISTER);
+    uint8_t nr51 = reg(apu, NR51_REGISTER);
+    // Full scale is 4 channels at 15 with master volume 8
+    const float scale = 32767.0f / (4 * 15 * 8);
+    for (int index = 0; index < 4; index++)
+    {
+        float left = (nr51 & (0x10 << index)) ? (((nr50 >> 4) & 0x07) + 1) * scale : 0;
+        float right = (nr51 & (0x01 << index)) ? ((nr50 & 0x07) + 1) * scale : 0;
+        float amplitude = apu->channels[index].amplitude;
+        if (apu->synthesis && amplitude != 0)
+        {
+            add_step(apu, apu->time, amplitude * (left - apu->gain[index][0]),
+                     amplitude * (right - apu->gain[index][1]));
+        }
+        apu->gain[index][0] = left;
+        apu->gain[index][1] = right;
+    }
+}
+
+/**
+ * Converts the first `count` buffered samples to int16 and drops them from
+ * the buffer; `samples` may be NULL to discard them.
+ */
+static void take_samples(apu_t *apu, int16_t *samples, size_t count)
+{
+    for (int side = 0; side < 2; side++)
+    {
+        float level = apu->level[side];
+        float dc = apu->dc[side];
+        float *deltas = apu->deltas[side];
+        for (size_t i = 0; i < count; i++)
+        {
+            level += deltas[i];
+            dc += (level - dc) * APU_HIGHPASS;
+            if (samples != NULL)
+            {
+                float value = level - dc;
+                value = value > 32767.0f ? 32767.0f : value < -32768.0f ? -32768.0f : value;
+                samples[i * 2 + side] = (int16_t)lrintf(value);
+            }
+        }
+        apu->level[side] = level;
+        apu->dc[side] = dc;
+
+        size_t kept = (apu->position >> 32) - count + BLIP_TAPS;
+        memmove(deltas, deltas + count, kept * sizeof(float));
+        memset(deltas + kept, 0, count * sizeof(float));
+    }
+    apu->position -= (uint64_t)count << 32;
+}
+
+
+// =================================================================================
+//                          Channels
+// =================================================================================
+
+// Advances channel `index` by one waveform step
+static void step_channel(apu_t *apu, int index)
+{
+    apu_channel_t *channel = &apu->channels[index];
+    switch (index)
+    {
+    case 0:
+    case 1:
+        channel->position = (channel->position + 1) & 7;
+        break;
+    case 2:
+        channel->position = (channel->position + 1) & 31;
+        break;
+    default:
+    {
+        uint16_t bit = (channel->lfsr ^ (channel->lfsr >> 1)) & 1;
+        channel->lfsr = (channel->lfsr >> 1) | (bit << 14);
+        if (reg(apu, NR43_REGISTER) & 0x08)
+        {
+            channel->lfsr = (channel->lfsr & ~0x40) | (bit << 6);
+        }
+        break;
+    }
+    }
+}
+
+/**
+ * Runs the waveform of channel `index` for steps before T-cycle `end`,
+ * adding a band-limited step each time its output changes.
+ */
+static void run_channel(apu_t *apu, int index, uint64_t end)
+{
+    apu_channel_t *channel = &apu->channels[index];
+    if (!channel->enabled)
+    {
+        return;
+    }
+    uint32_t period = channel_period(apu, index);
+    if (channel->next_step < apu->time)
+    {
+        // Synthesis was off, the waveform did not run
+        channel->next_step = apu->time;
+    }
+    bool silent = index != 2 ? channel->volume == 0 : (reg(apu, NR32_REGISTER) & 0x60) == 0;
+    if (silent && index != 3 && channel->next_step < end)
+    {
+        // Only the position matters, skip to it directly
+        uint64_t steps = (end - channel->next_step + period - 1) / period;
+        channel->position = (channel->position + steps) & (index == 2 ? 31 : 7);
+        channel->next_step += steps * period;
+        return;
+    }
+    while (channel->next_step < end)
+    {
+        step_channel(apu, index);
+        set_amplitude(apu, index, channel_output(apu, index), channel->next_step);
+        channel->next_step += period;
+    }
+}
+
+static void disable_channel(apu_t *apu, int index)
+{
+    apu->channels[index].enabled = false;
+    refresh_channel(apu, index);
+}
+
+// @return the channel 1 frequency after the next sweep step, disabling the channel on overflow
+static uint16_t sweep_target(apu_t *apu)
+{
+    uint8_t nr10 = reg(apu, NR10_REGISTER);
+    uint16_t delta = apu->sweep_frequency >> (nr10 & 0x07);
+    uint16_t target = (nr10 & 0x08) ? apu->sweep_frequency - delta : apu->sweep_frequency + delta;
+    if (target > 2047)
+    {
+        disable_channel(apu, 0);
+    }
+    return target;
+}
+
+static void clock_sweep(apu_t *apu)
+{
+    uint8_t nr10 = reg(apu, NR10_REGISTER);
+    uint8_t pace = (nr10 >> 4) & 0x07;
+    if (--apu->sweep_timer > 0)
+    {
+        return;
+    }
+    apu->sweep_timer = pace ? pace : 8;
+    if (!apu->sweep_enabled || pace == 0)
+    {
+        return;
+    }
+    uint16_t target = sweep_target(apu);
+    if (target <= 2047 && (nr10 & 0x07))
+    {
+        apu->sweep_frequency = target;
+        apu->registers[NR13_REGISTER - NR10_REGISTER] = target & 0xFF;
+        apu->registers[NR14_REGISTER - NR10_REGISTER] =
+            (reg(apu, NR14_REGISTER) & 0xF8) | (target >> 8);
+        sweep_target(apu);
+    }
+}
+
+static void clock_envelope(apu_t *apu, int index)
+{
+    apu_channel_t *channel = &apu->channels[index];
+    uint8_t envelope = reg(apu, channel_base(index) + 2);
+    uint8_t pace = envelope & 0x07;
+    if (pace == 0 || --channel->envelope_timer > 0)
+    {
+        return;
+    }
+    channel->envelope_timer = pace;
+    if ((envelope & 0x08) && channel->volume < 15)
+    {
+        channel->volume++;
+    }
+    else if (!(envelope & 0x08) && channel->volume > 0)
+    {
+        channel->volume--;
+    }
+    refresh_channel(apu, index);
+}
+
+// One 512 Hz frame sequencer step: length at 256 Hz, sweep at 128 Hz, envelope at 64 Hz
+static void clock_sequencer(apu_t *apu)
+{
+    uint8_t step = apu->sequencer_step;
+    apu->sequencer_step = (step + 1) & 7;
+    if (!powered(apu))
+    {
+        return;
+    }
+    if ((step & 1) == 0)
+    {
+        for (int index = 0; index < 4; index++)
+        {
+            apu_channel_t *channel = &apu->channels[index];
+            bool length_enabled = reg(apu, channel_base(index) + 4) & 0x40;
+            if (length_enabled && channel->length > 0 && --channel->length == 0)
+            {
+                disable_channel(apu, index);
+            }
+        }
+    }
+    if (step == 2 || step == 6)
+    {
+        clock_sweep(apu);
+    }
+    if (step == 7)
+    {
+        clock_envelope(apu, 0);
+        clock_envelope(apu, 1);
+        clock_envelope(apu, 3);
+    }
+}
+
+static void trigger_channel(apu_t *apu, int index)
+{
+    apu_channel_t *channel = &apu->channels[index];
+    channel->enabled = dac_enabled(apu, index);
+    if (channel->length == 0)
+    {
+        channel->length = index == 2 ? 256 : 64;
+    }
+    channel->next_step = apu->time + channel_period(apu, index);
+    if (index != 2)
+    {
+        uint8_t envelope = reg(apu, channel_base(index) + 2);
+        channel->volume = envelope >> 4;
+        channel->envelope_timer = envelope & 0x07;
+    }
+    if (index == 2)
+    {
+        channel->position = 0;
+    }
+    if (index == 3)
+    {
+        channel->lfsr = 0x7FFF;
+    }
+    if (index == 0)
+    {
+        uint8_t nr10 = reg(apu, NR10_REGISTER);
+        apu->sweep_frequency = channel_frequency(apu, 0);
+        apu->sweep_timer = (nr10 & 0x70) ? (nr10 >> 4) & 0x07 : 8;
+        apu->sweep_enabled = (nr10 & 0x77) != 0;
+        if (nr10 & 0x07)
+        {
+            sweep_target(apu);
+        }
+    }
+    refresh_channel(apu, index);
+}
+
+
+// =================================================================================
+//                          Catching up and registers
+// =================================================================================
+
+/**
+ * Runs the channels and frame sequencer up to CPU cycle `cycle`.
+ */
+void apu_catch_up(apu_t *apu, uint64_t cycle)
+{
+    uint64_t until = cycle * 4;
+    while (apu->time < until)
+    {
+        uint64_t end = until < apu->next_sequencer_time ? until : apu->next_sequencer_time;
+        if (apu->synthesis)
+        {
+            // Drop the oldest samples if the host is not pulling and this
+            // span, at most a sequencer period, might not fit
+            uint64_t span = (((end - apu->time) * apu->step) >> 32) + 1 + BLIP_TAPS;
+            if ((apu->position >> 32) + span > APU_BUFFER_SAMPLES)
+            {
+                take_samples(apu, NULL, APU_BUFFER_SAMPLES / 2);
+            }
+            for (int index = 0; index < 4; index++)
+            {
+                run_channel(apu, index, end);
+            }
+            apu->position += (end - apu->time) * apu->step;
+        }
+        apu->time = end;
+        if (end == apu->next_sequencer_time)
+        {
+            clock_sequencer(apu);
+            apu->next_sequencer_time += APU_SEQUENCER_PERIOD;
+        }
+    }
+}
+
+/**
+ * The register as read, without running the channels: NR52's channel bits
+ * are as of the last catch-up.
+ */
+uint8_t apu_peek_register(apu_t *apu, uint16_t address)
+{
+    if (address >= WAVE_RAM)
+    {
+        return reg(apu, address);
+    }
+    uint8_t value = reg(apu, address) | read_masks[address - NR10_REGISTER];
+    if (address == NR52_REGISTER)
+    {
+        for (int index = 0; index < 4; index++)
+        {
+            value |= apu->channels[index].enabled << index;
+        }
+    }
+    return value;
+}
+
+uint8_t apu_read_register(apu_t *apu, uint16_t address, uint64_t cycle)
+{
+    // Length counters may have turned channels off since the last catch-up
+    if (address == NR52_REGISTER)
+    {
+        apu_catch_up(apu, cycle);
+    }
+    return apu_peek_register(apu, address);
+}
+
+void apu_write_register(apu_t *apu, uint16_t address, uint8_t value, uint64_t cycle)
+{
+    // Samples up to now use the old value
+    apu_catch_up(apu, cycle);
+
+    if (address >= WAVE_RAM)
+    {
+        apu->registers[address - NR10_REGISTER] = value;
+        return;
+    }
+    if (address == NR52_REGISTER)
+    {
+        if (powered(apu) && !(value & 0x80))
+        {
+            // Power off clears every register and silences all channels
+            memset(apu->registers, 0, NR52_REGISTER - NR10_REGISTER);
+            for (int index = 0; index < 4; index++)
+            {
+                apu->channels[index].length = 0;
+                disable_channel(apu, index);
+            }
+            update_gains(apu);
+        }
+        else if (!powered(apu) && (value & 0x80))
+        {
+            apu->sequencer_step = 0;
+        }
+        apu->registers[NR52_REGISTER - NR10_REGISTER] = value & 0x80;
+        return;
+    }
+    if (!powered(apu))
+    {
+        return;
+    }
+    apu->registers[address - NR10_REGISTER] = value;
+
+    int index = (address - NR10_REGISTER) / 5;
+    switch (address)
+    {
+    case NR11_REGISTER:
+    case NR21_REGISTER:
+    case NR41_REGISTER:
+        apu->channels[index].length = 64 - (value & 0x3F);
+        break;
+    case NR31_REGISTER:
+        apu->channels[2].length = 256 - value;
+        break;
+    case NR12_REGISTER:
+    case NR22_REGISTER:
+    case NR42_REGISTER:
+    case NR30_REGISTER:
+        if (!dac_enabled(apu, index))
+        {
+            disable_channel(apu, index);
+        }
+        break;
+    case NR32_REGISTER:
+        refresh_channel(apu, 2);
+        break;
+    case NR14_REGISTER:
+    case NR24_REGISTER:
+    case NR34_REGISTER:
+    case NR44_REGISTER:
+        if (value & 0x80)
+        {
+            trigger_channel(apu, index);
+        }
+        break;
+    case NR50_REGISTER:
+    case NR51_REGISTER:
+        update_gains(apu);
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * Pulls up to `frames` interleaved stereo samples produced up to CPU cycle
+ * `cycle`.
+ *
+ * @return the number of frames written to `samples`.
+ */
+size_t apu_read_samples(apu_t *apu, uint64_t cycle, int16_t *samples, size_t frames)
+{
+    apu_catch_up(apu, cycle);
+    size_t available = apu->position >> 32;
+    size_t count = available < frames ? available : frames;
+    take_samples(apu, samples, count);
+    return count;
+}
@@ -0,0 +1,102 @@
+#ifndef APU_H
+#define APU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+// Channel timers run on T-cycles (4 per CPU M-cycle)
+#define APU_CLOCK_RATE          4194304
+#define APU_SEQUENCER_PERIOD    8192        // 512 Hz frame sequencer
+#define APU_SAMPLE_RATE         48000
+#define APU_MAX_SAMPLE_RATE     192000      // Highest rate apu_set_sample_rate accepts
+
+// Band-limited steps: a windowed sinc impulse of BLIP_TAPS samples, at
+// BLIP_PHASES sub-sample offsets
+#define BLIP_TAPS               16
+#define BLIP_PHASES             32
+#define APU_BUFFER_SAMPLES      4096        // Samples kept until the host pulls them
+
+
+typedef enum ApuRegister
+{
+    NR10_REGISTER = 0xFF10,
+    NR11_REGISTER = 0xFF11,
+    NR12_REGISTER = 0xFF12,
+    NR13_REGISTER = 0xFF13,
+    NR14_REGISTER = 0xFF14,
+    NR21_REGISTER = 0xFF16,
+    NR22_REGISTER = 0xFF17,
+    NR23_REGISTER = 0xFF18,
+    NR24_REGISTER = 0xFF19,
+    NR30_REGISTER = 0xFF1A,
+    NR31_REGISTER = 0xFF1B,
+    NR32_REGISTER = 0xFF1C,
+    NR33_REGISTER = 0xFF1D,
+    NR34_REGISTER = 0xFF1E,
+    NR41_REGISTER = 0xFF20,
+    NR42_REGISTER = 0xFF21,
+    NR43_REGISTER = 0xFF22,
+    NR44_REGISTER = 0xFF23,
+    NR50_REGISTER = 0xFF24,
+    NR51_REGISTER = 0xFF25,
+    NR52_REGISTER = 0xFF26,
+    WAVE_RAM      = 0xFF30      // 0xFF30-0xFF3F
+} apu_register_t;
+
+
+typedef struct ApuChannel
+{
+    bool enabled;               // Reported in NR52, cleared by length expiry or DAC off
+    uint16_t length;            // Length counter ticks left
+    uint8_t volume;             // Envelope volume (0-15)
+    uint8_t envelope_timer;
+    uint64_t next_step;         // T-cycle of the next waveform step
+    uint8_t position;           // Duty step (0-7) or wave sample (0-31)
+    uint16_t lfsr;              // Noise shift register
+    uint8_t amplitude;          // Digital output (0-15) last sent to the mixer
+} apu_channel_t;
+
+
+typedef struct Apu
+{
+    uint8_t registers[0x30];    // 0xFF10-0xFF3F as written, wave RAM included
+    apu_channel_t channels[4];
+    uint8_t sweep_timer;
+    uint16_t sweep_frequency;   // Channel 1 sweep shadow frequency
+    bool sweep_enabled;
+
+    // Channels are only run when a register is accessed or samples are
+    // pulled, from `time` up to the current cycle
+    uint64_t time;              // T-cycles
+    uint64_t next_sequencer_time;
+    uint8_t sequencer_step;
+
+    // Output: every amplitude change adds a band-limited step to `deltas`,
+    // and pulling samples integrates them
+    bool synthesis;             // Off: registers and NR52 status only, no samples
+    uint32_t sample_rate;
+    uint64_t step;              // Output samples per T-cycle, 32.32 fixed point
+    uint64_t position;          // Output sample position of `time`, 32.32 fixed point
+    float gain[4][2];           // NR50 x NR51 weight of each channel, left and right
+    float level[2];
+    float dc[2];
+    float deltas[2][APU_BUFFER_SAMPLES + BLIP_TAPS];
+} apu_t;
+
+
+apu_t *new_apu();
+void free_apu(apu_t *apu);
+
+bool is_apu_register(uint16_t address);
+uint8_t apu_read_register(apu_t *apu, uint16_t address, uint64_t cycle);
+uint8_t apu_peek_register(apu_t *apu, uint16_t address);
+void apu_write_register(apu_t *apu, uint16_t address, uint8_t value, uint64_t cycle);
+
+void apu_set_sample_rate(apu_t *apu, uint32_t sample_rate);
+void apu_catch_up(apu_t *apu, uint64_t cycle);
+size_t apu_read_samples(apu_t *apu, uint64_t cycle, int16_t *samples, size_t frames);
+
+
+#endif
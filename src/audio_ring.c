@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "audio_ring.h"
+
+
+/**
+ * @return a ring holding `capacity` frames, rounded up to a power of two.
+ */
+audio_ring_t *new_audio_ring(uint32_t capacity)
+{
+    audio_ring_t *ring = malloc(sizeof(audio_ring_t));
+    if (ring == NULL)
+    {
+        return NULL;
+    }
+    uint32_t size = 1;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+    ring->frames = calloc(size, 2 * sizeof(int16_t));
+    if (ring->frames == NULL)
+    {
+        free(ring);
+        return NULL;
+    }
+    ring->capacity = size;
+    atomic_init(&ring->write, 0);
+    atomic_init(&ring->read, 0);
+    ring->overrun = 0;
+    ring->underrun = 0;
+    return ring;
+}
+
+void free_audio_ring(audio_ring_t *ring)
+{
+    if (ring != NULL)
+    {
+        free(ring->frames);
+    }
+    free(ring);
+    ring = NULL;
+    return;
+}
+
+
+/**
+ * @return the number of frames queued, as seen from either side.
+ */
+size_t audio_ring_fill(audio_ring_t *ring)
+{
+    uint64_t write = atomic_load_explicit(&ring->write, memory_order_acquire);
+    uint64_t read = atomic_load_explicit(&ring->read, memory_order_acquire);
+    return write - read;
+}
+
+// Copies `count` frames between the ring starting at frame `index` and `frames`
+static void copy_frames(audio_ring_t *ring, uint64_t index, int16_t *frames, size_t count, bool into_ring)
+{
+    uint32_t start = index & (ring->capacity - 1);
+    size_t first = ring->capacity - start < count ? ring->capacity - start : count;
+    int16_t *slot = ring->frames + start * 2;
+    if (into_ring)
+    {
+        memcpy(slot, frames, first * 2 * sizeof(int16_t));
+        memcpy(ring->frames, frames + first * 2, (count - first) * 2 * sizeof(int16_t));
+    }
+    else
+    {
+        memcpy(frames, slot, first * 2 * sizeof(int16_t));
+        memcpy(frames + first * 2, ring->frames, (count - first) * 2 * sizeof(int16_t));
+    }
+}
+
+/**
+ * Producer side: queues up to `count` frames. Never blocks; what does not
+ * fit is dropped and counted as overrun.
+ *
+ * @return the number of frames queued.
+ */
+size_t audio_ring_push(audio_ring_t *ring, const int16_t *frames, size_t count)
+{
+    uint64_t write = atomic_load_explicit(&ring->write, memory_order_relaxed);
+    uint64_t read = atomic_load_explicit(&ring->read, memory_order_acquire);
+    size_t space = ring->capacity - (write - read);
+    size_t queued = count < space ? count : space;
+    copy_frames(ring, write, (int16_t *)frames, queued, true);
+    atomic_store_explicit(&ring->write, write + queued, memory_order_release);
+    ring->overrun += count - queued;
+    return queued;
+}
+
+/**
+ * Consumer side: takes up to `count` frames. Never blocks; missing frames are
+ * written as silence and counted as underrun.
+ *
+ * @return the number of frames taken from the ring.
+ */
+size_t audio_ring_pop(audio_ring_t *ring, int16_t *frames, size_t count)
+{
+    uint64_t read = atomic_load_explicit(&ring->read, memory_order_relaxed);
+    uint64_t write = atomic_load_explicit(&ring->write, memory_order_acquire);
+    size_t available = write - read;
+    size_t taken = count < available ? count : available;
+    copy_frames(ring, read, frames, taken, false);
+    atomic_store_explicit(&ring->read, read + taken, memory_order_release);
+    memset(frames + taken * 2, 0, (count - taken) * 2 * sizeof(int16_t));
+    ring->underrun += count - taken;
+    return taken;
+}
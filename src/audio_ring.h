@@ -0,0 +1,36 @@
+#ifndef AUDIO_RING_H
+#define AUDIO_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+
+/**
+ * Lock-free single-producer/single-consumer ring of interleaved int16 stereo
+ * frames. The producer only moves `write` and the consumer only `read`,
+ * both counting frames since creation.
+ */
+typedef struct AudioRing
+{
+    int16_t *frames;
+    uint32_t capacity;          // In frames, a power of two
+
+    _Alignas(64) _Atomic uint64_t write;
+    uint64_t overrun;           // Frames dropped because the ring was full
+
+    _Alignas(64) _Atomic uint64_t read;
+    uint64_t underrun;          // Frames the consumer asked for but did not get
+} audio_ring_t;
+
+
+audio_ring_t *new_audio_ring(uint32_t capacity);
+void free_audio_ring(audio_ring_t *ring);
+
+size_t audio_ring_fill(audio_ring_t *ring);
+size_t audio_ring_push(audio_ring_t *ring, const int16_t *frames, size_t count);
+size_t audio_ring_pop(audio_ring_t *ring, int16_t *frames, size_t count);
+
+
+#endif
@@ -0,0 +1,391 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "capture.h"
+
+
+#define WAV_HEADER_BYTES    44
+#define Y4M_FRAME_HEADER    "FRAME\n"
+
+// How long the writer sleeps on an empty queue, and a blocked producer on a full one
+#define CAPTURE_IDLE_NS     1000000
+#define CAPTURE_STALL_NS    100000
+
+
+static void *run_writer(void *argument);
+
+static void put_u16(uint8_t *bytes, uint16_t value)
+{
+    bytes[0] = value & 0xFF;
+    bytes[1] = value >> 8;
+}
+
+static void put_u32(uint8_t *bytes, uint32_t value)
+{
+    put_u16(bytes, value & 0xFFFF);
+    put_u16(bytes + 2, value >> 16);
+}
+
+static void sleep_ns(long nanoseconds)
+{
+    struct timespec delay = {0, nanoseconds};
+    nanosleep(&delay, NULL);
+}
+
+/**
+ * Writes all of `bytes`, retrying short writes.
+ *
+ * @return false on error, with errno set.
+ */
+static bool write_all(int fd, const uint8_t *bytes, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+// 16-bit stereo PCM header; the two sizes are patched when the capture ends
+static void wav_header(uint8_t header[WAV_HEADER_BYTES], uint32_t sample_rate, uint32_t data_bytes)
+{
+    memcpy(header, "RIFF", 4);
+    put_u32(header + 4, 36 + data_bytes);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put_u32(header + 16, 16);
+    put_u16(header + 20, 1);                    // PCM
+    put_u16(header + 22, 2);                    // Channels
+    put_u32(header + 24, sample_rate);
+    put_u32(header + 28, sample_rate * 4);      // Bytes per second
+    put_u16(header + 32, 4);                    // Bytes per frame
+    put_u16(header + 34, 16);                   // Bits per sample
+    memcpy(header + 36, "data", 4);
+    put_u32(header + 40, data_bytes);
+}
+
+static int open_output(const char *path)
+{
+    if (path == NULL)
+    {
+        return -1;
+    }
+    return open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+}
+
+
+/**
+ * Opens the outputs and starts the writer thread. Either path may be NULL to
+ * capture only the other stream. Samples are expected at `sample_rate`.
+ *
+ * @return NULL if a file cannot be created or memory runs out.
+ */
+capture_t *new_capture(const char *video_path, const char *audio_path, uint32_t sample_rate)
+{
+    capture_t *capture = calloc(1, sizeof(capture_t));
+    if (capture == NULL)
+    {
+        return NULL;
+    }
+    capture->video_fd = open_output(video_path);
+    capture->audio_fd = open_output(audio_path);
+    capture->slots = malloc(CAPTURE_SLOTS * sizeof(capture_slot_t));
+    capture->buffers[0] = malloc(CAPTURE_BUFFER_BYTES);
+    capture->buffers[1] = malloc(CAPTURE_BUFFER_BYTES);
+    capture->luma = new_video_output(PIXEL_FORMAT_GRAY8);
+    bool ok = capture->slots != NULL && capture->buffers[0] != NULL && capture->buffers[1] != NULL
+              && capture->luma != NULL && (video_path == NULL || capture->video_fd >= 0)
+              && (audio_path == NULL || capture->audio_fd >= 0);
+
+    // 4194304 Hz / 70224 cycles per frame, about 59.73 fps, luma only
+    if (ok && capture->video_fd >= 0)
+    {
+        char header[80];
+        int length = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F4194304:%d Ip A1:1 Cmono\n",
+                              SCREEN_WIDTH, SCREEN_HEIGHT, CYCLES_PER_FRAME * 4);
+        ok = write_all(capture->video_fd, (const uint8_t *)header, length);
+    }
+    if (ok && capture->audio_fd >= 0)
+    {
+        uint8_t header[WAV_HEADER_BYTES];
+        wav_header(header, sample_rate, 0);
+        ok = write_all(capture->audio_fd, header, WAV_HEADER_BYTES);
+    }
+
+    capture->sample_rate = sample_rate;
+    capture->block = false;
+    atomic_init(&capture->write, 0);
+    atomic_init(&capture->read, 0);
+    atomic_init(&capture->running, true);
+    atomic_init(&capture->failed, false);
+    if (!ok || pthread_create(&capture->thread, NULL, run_writer, capture) != 0)
+    {
+        if (capture->video_fd >= 0)
+        {
+            close(capture->video_fd);
+        }
+        if (capture->audio_fd >= 0)
+        {
+            close(capture->audio_fd);
+        }
+        free_video_output(capture->luma);
+        free(capture->buffers[0]);
+        free(capture->buffers[1]);
+        free(capture->slots);
+        free(capture);
+        return NULL;
+    }
+    return capture;
+}
+
+
+// =================================================================================
+//                          Producer side
+// =================================================================================
+
+/**
+ * @return the number of slots waiting for the writer.
+ */
+uint32_t capture_queued(capture_t *capture)
+{
+    uint64_t write = atomic_load_explicit(&capture->write, memory_order_acquire);
+    uint64_t read = atomic_load_explicit(&capture->read, memory_order_acquire);
+    return write - read;
+}
+
+/**
+ * @return the next free slot, or NULL if the queue is full and the capture
+ * does not block.
+ */
+static capture_slot_t *reserve_slot(capture_t *capture)
+{
+    uint64_t write = atomic_load_explicit(&capture->write, memory_order_relaxed);
+    uint32_t queued = capture_queued(capture);
+    if (queued > capture->max_queued)
+    {
+        capture->max_queued = queued;
+    }
+    if (queued == CAPTURE_SLOTS)
+    {
+        if (!capture->block)
+        {
+            return NULL;
+        }
+        capture->stalls++;
+        while (capture_queued(capture) == CAPTURE_SLOTS)
+        {
+            sleep_ns(CAPTURE_STALL_NS);
+        }
+    }
+    return &capture->slots[write & (CAPTURE_SLOTS - 1)];
+}
+
+static void commit_slot(capture_t *capture)
+{
+    atomic_fetch_add_explicit(&capture->write, 1, memory_order_release);
+}
+
+/**
+ * Queues a SCREEN_HEIGHT x SCREEN_WIDTH frame of shades for the Y4M file.
+ *
+ * @return false if the frame was dropped because the writer is behind.
+ */
+bool capture_push_frame(capture_t *capture, const uint8_t *shades)
+{
+    if (capture->video_fd < 0)
+    {
+        return true;
+    }
+    capture_slot_t *slot = reserve_slot(capture);
+    if (slot == NULL)
+    {
+        capture->dropped_frames++;
+        return false;
+    }
+    slot->kind = CAPTURE_VIDEO;
+    slot->size = SCREEN_WIDTH * SCREEN_HEIGHT;
+    memcpy(slot->data, shades, SCREEN_WIDTH * SCREEN_HEIGHT);
+    commit_slot(capture);
+    return true;
+}
+
+// Queues the gathered samples as one slot
+static bool push_pending(capture_t *capture)
+{
+    uint32_t frames = capture->pending_frames;
+    capture->pending_frames = 0;
+    capture_slot_t *slot = reserve_slot(capture);
+    if (slot == NULL)
+    {
+        capture->dropped_samples += frames;
+        return false;
+    }
+    slot->kind = CAPTURE_AUDIO;
+    slot->size = frames * 2 * sizeof(int16_t);
+    memcpy(slot->data, capture->pending, slot->size);
+    commit_slot(capture);
+    return true;
+}
+
+/**
+ * Gathers interleaved stereo samples for the WAV file, queueing them a full
+ * slot at a time.
+ *
+ * @return false if a block of samples was dropped because the writer is behind.
+ */
+bool capture_push_samples(capture_t *capture, const int16_t *samples, size_t frames)
+{
+    if (capture->audio_fd < 0)
+    {
+        return true;
+    }
+    bool queued = true;
+    while (frames > 0)
+    {
+        size_t space = CAPTURE_SLOT_SAMPLES - capture->pending_frames;
+        size_t count = frames < space ? frames : space;
+        memcpy(capture->pending + capture->pending_frames * 2, samples, count * 2 * sizeof(int16_t));
+        capture->pending_frames += count;
+        samples += count * 2;
+        frames -= count;
+        if (capture->pending_frames == CAPTURE_SLOT_SAMPLES)
+        {
+            queued = push_pending(capture) && queued;
+        }
+    }
+    return queued;
+}
+
+
+// =================================================================================
+//                          Writer thread
+// =================================================================================
+
+// Writes out one stream's buffer; after a failure everything is discarded
+static void flush_buffer(capture_t *capture, int stream)
+{
+    int fd = stream == 0 ? capture->video_fd : capture->audio_fd;
+    if (capture->buffered[stream] > 0 && !atomic_load(&capture->failed)
+        && !write_all(fd, capture->buffers[stream], capture->buffered[stream]))
+    {
+        fprintf(stderr, "Capture write failed: %s.\n", strerror(errno));
+        atomic_store(&capture->failed, true);
+    }
+    capture->buffered[stream] = 0;
+}
+
+// Makes room for `size` more bytes in a stream's buffer
+static uint8_t *buffer_space(capture_t *capture, int stream, size_t size)
+{
+    if (capture->buffered[stream] + size > CAPTURE_BUFFER_BYTES)
+    {
+        flush_buffer(capture, stream);
+    }
+    uint8_t *space = capture->buffers[stream] + capture->buffered[stream];
+    capture->buffered[stream] += size;
+    return space;
+}
+
+static void write_slot(capture_t *capture, capture_slot_t *slot)
+{
+    if (slot->kind == CAPTURE_VIDEO)
+    {
+        size_t header = strlen(Y4M_FRAME_HEADER);
+        uint8_t *out = buffer_space(capture, 0, header + SCREEN_WIDTH * SCREEN_HEIGHT);
+        memcpy(out, Y4M_FRAME_HEADER, header);
+        video_convert(capture->luma, slot->data, SCREEN_WIDTH, SCREEN_WIDTH, SCREEN_HEIGHT,
+                      out + header, SCREEN_WIDTH);
+    }
+    else
+    {
+        // WAV is little endian, as are the hosts we run on
+        memcpy(buffer_space(capture, 1, slot->size), slot->data, slot->size);
+        capture->audio_bytes += slot->size;
+    }
+}
+
+static void *run_writer(void *argument)
+{
+    capture_t *capture = argument;
+    uint64_t read = 0;
+    while (true)
+    {
+        uint64_t write = atomic_load_explicit(&capture->write, memory_order_acquire);
+        if (read == write)
+        {
+            // Stopping: anything queued before `running` was cleared is still written
+            if (!atomic_load(&capture->running)
+                && read == atomic_load_explicit(&capture->write, memory_order_acquire))
+            {
+                break;
+            }
+            sleep_ns(CAPTURE_IDLE_NS);
+            continue;
+        }
+        for (; read < write; read++)
+        {
+            write_slot(capture, &capture->slots[read & (CAPTURE_SLOTS - 1)]);
+            atomic_store_explicit(&capture->read, read + 1, memory_order_release);
+        }
+    }
+    flush_buffer(capture, 0);
+    flush_buffer(capture, 1);
+    return NULL;
+}
+
+
+/**
+ * Queues the last samples, waits for the writer to finish, completes the
+ * WAV header and closes the files.
+ */
+void free_capture(capture_t *capture)
+{
+    if (capture == NULL)
+    {
+        return;
+    }
+    if (capture->pending_frames > 0)
+    {
+        capture->block = true;
+        push_pending(capture);
+    }
+    atomic_store(&capture->running, false);
+    pthread_join(capture->thread, NULL);
+
+    if (capture->video_fd >= 0)
+    {
+        close(capture->video_fd);
+    }
+    if (capture->audio_fd >= 0)
+    {
+        uint8_t header[WAV_HEADER_BYTES];
+        uint32_t data_bytes = capture->audio_bytes > UINT32_MAX - 36 ? UINT32_MAX - 36 : capture->audio_bytes;
+        wav_header(header, capture->sample_rate, data_bytes);
+        if (!atomic_load(&capture->failed) && pwrite(capture->audio_fd, header, WAV_HEADER_BYTES, 0) != WAV_HEADER_BYTES)
+        {
+            fprintf(stderr, "Capture write failed: %s.\n", strerror(errno));
+        }
+        close(capture->audio_fd);
+    }
+    free_video_output(capture->luma);
+    free(capture->buffers[0]);
+    free(capture->buffers[1]);
+    free(capture->slots);
+    free(capture);
+    capture = NULL;
+    return;
+}
@@ -0,0 +1,78 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "ppu.h"
+#include "video.h"
+
+
+#define CAPTURE_SLOTS           64          // Queued blocks, a power of two
+#define CAPTURE_SLOT_BYTES      (SCREEN_WIDTH * SCREEN_HEIGHT)
+#define CAPTURE_SLOT_SAMPLES    (CAPTURE_SLOT_BYTES / 4)    // Stereo int16 frames per audio block
+#define CAPTURE_BUFFER_BYTES    (1 << 20)   // Written to disk in chunks of this size
+
+
+typedef enum CaptureKind
+{
+    CAPTURE_VIDEO,      // One frame of shades
+    CAPTURE_AUDIO       // Interleaved int16 stereo samples
+} capture_kind_t;
+
+
+typedef struct CaptureSlot
+{
+    capture_kind_t kind;
+    uint32_t size;      // Bytes used in `data`
+    uint8_t data[CAPTURE_SLOT_BYTES];
+} capture_slot_t;
+
+
+/**
+ * Records frames to a Y4M file and samples to a WAV file from a writer
+ * thread. The emulation thread only copies into a single-producer/single-
+ * consumer queue of slots; conversion and disk writes happen on the writer.
+ */
+typedef struct Capture
+{
+    int video_fd;               // -1 when not capturing video
+    int audio_fd;               // -1 when not capturing audio
+    uint32_t sample_rate;
+    bool block;                 // When the queue is full, wait for the writer instead of dropping
+
+    capture_slot_t *slots;
+
+    // Producer side
+    _Alignas(64) _Atomic uint64_t write;
+    int16_t pending[CAPTURE_SLOT_SAMPLES * 2];  // Samples gathered into a full slot before queueing
+    uint32_t pending_frames;
+    uint64_t dropped_frames;    // Video frames lost to a full queue
+    uint64_t dropped_samples;   // Audio frames lost to a full queue
+    uint64_t stalls;            // Pushes that waited for the writer
+    uint32_t max_queued;        // Highest queue occupancy seen by a push
+
+    // Writer side
+    _Alignas(64) _Atomic uint64_t read;
+    _Atomic bool running;
+    _Atomic bool failed;        // A write failed; the writer discards everything after it
+    pthread_t thread;
+    video_output_t *luma;
+    uint8_t *buffers[2];        // Video, audio
+    size_t buffered[2];
+    uint64_t audio_bytes;       // WAV data size, patched into the header on close
+} capture_t;
+
+
+capture_t *new_capture(const char *video_path, const char *audio_path, uint32_t sample_rate);
+void free_capture(capture_t *capture);
+
+bool capture_push_frame(capture_t *capture, const uint8_t *shades);
+bool capture_push_samples(capture_t *capture, const int16_t *samples, size_t frames);
+uint32_t capture_queued(capture_t *capture);
+
+
+#endif
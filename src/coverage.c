@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "coverage.h"
+
+
+#if defined(__x86_64__) || defined(__i386__)
+#define COVERAGE_X86 1
+#endif
+
+#define ROM_BYTES(banks)    ((size_t)(banks) * COVERAGE_BANK_SIZE / 8)
+
+// Edge chunks at each kernel's native width: wider vectors than the target
+// has get split into scalar code
+typedef uint8_t edge_bytes16_t __attribute__((vector_size(16))) __attribute__((aligned(16)));
+typedef uint8_t edge_bytes32_t __attribute__((vector_size(32))) __attribute__((aligned(32)));
+typedef uint8_t edge_bytes64_t __attribute__((vector_size(64))) __attribute__((aligned(64)));
+typedef uint64_t edge_words16_t __attribute__((vector_size(16))) __attribute__((aligned(16)));
+typedef uint64_t edge_words32_t __attribute__((vector_size(32))) __attribute__((aligned(32)));
+typedef uint64_t edge_words64_t __attribute__((vector_size(64))) __attribute__((aligned(64)));
+
+
+/**
+ * Tracks `banks` ROM banks of 16 KiB, at least 2.
+ *
+ * @return NULL if memory runs out.
+ */
+coverage_t *new_coverage(uint32_t banks)
+{
+    if (banks < 2)
+    {
+        fprintf(stderr, "Coverage needs at least 2 ROM banks, not %u.\n", banks);
+        exit(1);
+    }
+    coverage_t *coverage = calloc(1, sizeof(coverage_t));
+    if (coverage == NULL)
+    {
+        return NULL;
+    }
+    coverage->banks = banks;
+    coverage->bank = 1;
+    coverage->rom = calloc(ROM_BYTES(banks), 1);
+    coverage->edges = aligned_alloc(64, COVERAGE_EDGES);
+    if (coverage->rom == NULL || coverage->edges == NULL)
+    {
+        free(coverage->rom);
+        free(coverage->edges);
+        free(coverage);
+        return NULL;
+    }
+    memset(coverage->edges, 0, COVERAGE_EDGES);
+    return coverage;
+}
+
+void free_coverage(coverage_t *coverage)
+{
+    if (coverage == NULL)
+    {
+        return;
+    }
+    free(coverage->rom);
+    free(coverage->edges);
+    free(coverage);
+    coverage = NULL;
+    return;
+}
+
+/**
+ * Clears both maps, as before a new run.
+ */
+void coverage_reset(coverage_t *coverage)
+{
+    memset(coverage->rom, 0, ROM_BYTES(coverage->banks));
+    memset(coverage->edges, 0, COVERAGE_EDGES);
+}
+
+/**
+ * Makes `to`, tracking as many banks as `from`, a copy of it.
+ */
+void coverage_copy(coverage_t *to, const coverage_t *from)
+{
+    if (to->banks != from->banks)
+    {
+        fprintf(stderr, "Cannot copy coverage of %u banks into %u.\n", from->banks, to->banks);
+        exit(1);
+    }
+    to->bank = from->bank;
+    memcpy(to->rom, from->rom, ROM_BYTES(from->banks));
+    memcpy(to->edges, from->edges, COVERAGE_EDGES);
+}
+
+
+// =================================================================================
+//                          Merging
+// =================================================================================
+
+/**
+ * One pass of coverage_merge over the edges, `bytes_t` at a time: ORs the
+ * AFL class of each count in `run` into `total` (1, 2, 3, 4-7, 8-15,
+ * 16-31, 32-127, 128+ hits as bits 0 to 7) and adds the edges `total` had
+ * never seen to `fresh`. A macro, so each kernel's target lowers the vectors.
+ */
+#define MERGE_EDGES(bytes_t, words_t, total, run, fresh)                                    \
+    for (size_t i = 0; i < COVERAGE_EDGES; i += sizeof(bytes_t))                            \
+    {                                                                                       \
+        bytes_t counts = *(const bytes_t *)((run) + i);                                     \
+        bytes_t *seen = (bytes_t *)((total) + i);                                           \
+        bytes_t classes = ((bytes_t)(counts == 1) & 1) | ((bytes_t)(counts == 2) & 2)       \
+                          | ((bytes_t)(counts == 3) & 4)                                    \
+                          | ((bytes_t)((counts >= 4) & (counts < 8)) & 8)                   \
+                          | ((bytes_t)((counts >= 8) & (counts < 16)) & 16)                 \
+                          | ((bytes_t)((counts >= 16) & (counts < 32)) & 32)                \
+                          | ((bytes_t)((counts >= 32) & (counts < 128)) & 64)               \
+                          | ((bytes_t)(counts >= 128) & 128);                               \
+        words_t first = (words_t)((*seen == 0) & (counts != 0)) & 0x0101010101010101ULL;    \
+        for (size_t w = 0; w < sizeof(words_t) / 8; w++)                                    \
+        {                                                                                   \
+            (fresh) += __builtin_popcountll(first[w]);                                      \
+        }                                                                                   \
+        *seen |= classes;                                                                   \
+    }
+
+static uint64_t merge_edges_generic(uint8_t *total, const uint8_t *run)
+{
+    uint64_t fresh = 0;
+    MERGE_EDGES(edge_bytes16_t, edge_words16_t, total, run, fresh);
+    return fresh;
+}
+
+#ifdef COVERAGE_X86
+__attribute__((target("avx2,popcnt")))
+static uint64_t merge_edges_avx2(uint8_t *total, const uint8_t *run)
+{
+    uint64_t fresh = 0;
+    MERGE_EDGES(edge_bytes32_t, edge_words32_t, total, run, fresh);
+    return fresh;
+}
+
+__attribute__((target("avx512bw,popcnt")))
+static uint64_t merge_edges_avx512(uint8_t *total, const uint8_t *run)
+{
+    uint64_t fresh = 0;
+    MERGE_EDGES(edge_bytes64_t, edge_words64_t, total, run, fresh);
+    return fresh;
+}
+#endif
+
+/**
+ * ORs the hit-count classes of `run`'s edges and its ROM bits into `total`.
+ * `run` holds raw counts from a CPU; `total` is a map only ever merged into.
+ * When `new_rom` is not NULL it receives the number of ROM bytes run first.
+ *
+ * @return the number of edges `total` had never seen, the novelty of `run`.
+ */
+uint64_t coverage_merge(coverage_t *total, const coverage_t *run, uint64_t *new_rom)
+{
+    uint64_t fresh;
+#ifdef COVERAGE_X86
+    if (__builtin_cpu_supports("avx512bw"))
+    {
+        fresh = merge_edges_avx512(total->edges, run->edges);
+    }
+    else if (__builtin_cpu_supports("avx2"))
+    {
+        fresh = merge_edges_avx2(total->edges, run->edges);
+    }
+    else
+#endif
+    {
+        fresh = merge_edges_generic(total->edges, run->edges);
+    }
+
+    uint64_t rom = 0;
+    uint32_t banks = total->banks < run->banks ? total->banks : run->banks;
+    const uint64_t *run_rom = (const uint64_t *)run->rom;
+    uint64_t *total_rom = (uint64_t *)total->rom;
+    for (size_t i = 0; i < ROM_BYTES(banks) / 8; i++)
+    {
+        rom += __builtin_popcountll(run_rom[i] & ~total_rom[i]);
+        total_rom[i] |= run_rom[i];
+    }
+    if (new_rom != NULL)
+    {
+        *new_rom = rom;
+    }
+    return fresh;
+}
+
+/**
+ * @return the number of edges hit at least once.
+ */
+uint64_t coverage_count_edges(const coverage_t *coverage)
+{
+    uint64_t count = 0;
+    const uint64_t *edges = (const uint64_t *)coverage->edges;
+    for (size_t i = 0; i < COVERAGE_EDGES / 8; i++)
+    {
+        // Top bit of each byte set when the byte is not zero
+        uint64_t low = (edges[i] & 0x7F7F7F7F7F7F7F7FULL) + 0x7F7F7F7F7F7F7F7FULL;
+        count += __builtin_popcountll((low | edges[i]) & 0x8080808080808080ULL);
+    }
+    return count;
+}
+
+/**
+ * @return the number of ROM bytes an instruction started at.
+ */
+uint64_t coverage_count_rom(const coverage_t *coverage)
+{
+    uint64_t count = 0;
+    const uint64_t *rom = (const uint64_t *)coverage->rom;
+    for (size_t i = 0; i < ROM_BYTES(coverage->banks) / 8; i++)
+    {
+        count += __builtin_popcountll(rom[i]);
+    }
+    return count;
+}
@@ -0,0 +1,42 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+
+#define COVERAGE_BANK_SIZE  0x4000
+#define COVERAGE_EDGES      (1 << 16)   // Edge map entries, AFL-style
+
+
+/**
+ * What one emulator executed: a bit per ROM byte an instruction starts at,
+ * per bank, and a saturating hit count per (branch PC, next PC) edge of
+ * every JR/JP/CALL/RET/RST, taken or not, hashed into COVERAGE_EDGES
+ * entries. Attach with cpu->coverage.
+ *
+ * A map filled by coverage_merge instead holds, per edge, the AFL hit-count
+ * classes seen so far (1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+ hits as
+ * bits 0 to 7), and the union of the ROM bits.
+ */
+typedef struct Coverage
+{
+    uint32_t banks;             // ROM banks tracked, 2 for a cartridge without a mapper
+    uint32_t bank;              // Bank mapped at 0x4000-0x7FFF
+    uint8_t *rom;               // banks * COVERAGE_BANK_SIZE bits
+    uint8_t *edges;             // COVERAGE_EDGES hit counts or classes, 64-byte aligned
+} coverage_t;
+
+
+coverage_t *new_coverage(uint32_t banks);
+void free_coverage(coverage_t *coverage);
+void coverage_reset(coverage_t *coverage);
+void coverage_copy(coverage_t *to, const coverage_t *from);
+
+uint64_t coverage_merge(coverage_t *total, const coverage_t *run, uint64_t *new_rom);
+uint64_t coverage_count_edges(const coverage_t *coverage);
+uint64_t coverage_count_rom(const coverage_t *coverage);
+
+
+#endif
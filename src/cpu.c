@@ -3,6 +3,10 @@
 #include <stdint.h>
 #include <string.h>
 #include "cpu.h"
+#include "ppu.h"
+#include "apu.h"
+#include "joypad.h"
+#include "coverage.h"
 
 
 
@@ -135,10 +139,19 @@ cpu_t *new_cpu()
         return NULL;
     }
 
-    uint8_t *memorybus = malloc(0xFFFF * sizeof(uint8_t));
+    // Backing storage for AF, BC, DE and HL
+    uint16_t *register_file = calloc(4, sizeof(uint16_t));
+    if (register_file == NULL)
+    {
+        free(registers);
+        return NULL;
+    }
+
+    uint8_t *memorybus = calloc(0x10000, sizeof(uint8_t));
     if (memorybus == NULL)
     {
         free(registers);
+        free(register_file);
         return NULL;
     }
 
@@ -146,25 +159,53 @@ cpu_t *new_cpu()
     if (new_cpu == NULL) 
     {
         free(registers);
+        free(register_file);
         free(memorybus);
         return NULL;
     }
+    registers->AF = &register_file[0];
+    registers->BC = &register_file[1];
+    registers->DE = &register_file[2];
+    registers->HL = &register_file[3];
+    // SP and PC live in the cpu itself so LD SP,nn and the stack agree
+    registers->SP = &new_cpu->SP;
+    registers->PC = &new_cpu->PC;
+
     new_cpu->registers = registers;
     new_cpu->memorybus = memorybus;
-    new_cpu->PC = *registers->PC;
-    new_cpu->SP = *registers->SP;
+    new_cpu->PC = 0x0000;
+    new_cpu->SP = 0x0000;
     new_cpu->IME = false;
+    new_cpu->IME_pending = false;
+    new_cpu->fusion = FUSE_ALL;
+    new_cpu->opcode_pairs = NULL;
+    new_cpu->previous_opcode = 0x00;
+    new_cpu->cycles = 0;
+    new_cpu->ppu = NULL;
+    new_cpu->apu = NULL;
+    new_cpu->joypad = NULL;
+    new_cpu->coverage = NULL;
+    new_cpu->idle_skip = true;
+    new_cpu->idle_limit = 0;
+    new_cpu->idle_loop.valid = false;
+    new_cpu->ram_hashing = true;
+    invalidate_fetch_window(new_cpu);
+    rehash_ram(new_cpu);
     return new_cpu;
 }
 
 //TODO complete
 void free_cpu(cpu_t *cpu) 
 {   
+    free(cpu->registers->AF);
     free(cpu->registers);
     cpu->registers = NULL;
     
     free(cpu->memorybus);
     cpu->memorybus = NULL;
+
+    free(cpu->opcode_pairs);
+    cpu->opcode_pairs = NULL;
     
     free(cpu);
     cpu = NULL;
@@ -181,8 +222,122 @@ uint8_t read_memory(cpu_t *cpu, uint16_t address)
         exit(1);
     }
 
+    if (cpu->ppu != NULL && is_ppu_register(address))
+    {
+        return ppu_read_register(cpu->ppu, address, cpu->cycles);
+    }
+    if (cpu->apu != NULL && is_apu_register(address))
+    {
+        return apu_read_register(cpu->apu, address, cpu->cycles);
+    }
+    if (cpu->joypad != NULL && address == JOYPAD_REGISTER)
+    {
+        return joypad_read_register(cpu->joypad);
+    }
+    if (cpu->ppu != NULL && address == IF_REGISTER)
+    {
+        // VBlank and STAT requests up to now
+        ppu_catch_up(cpu->ppu, cpu->cycles);
+    }
+    return cpu->memorybus[address];
+}
+
+/**
+ * Reads like read_memory without side effects, for observers outside the
+ * emulated program: the PPU and APU are not caught up and a P1 read is not
+ * counted as a poll.
+ */
+uint8_t peek_memory(cpu_t *cpu, uint16_t address)
+{
+    if (cpu->ppu != NULL && is_ppu_register(address))
+    {
+        return ppu_peek_register(cpu->ppu, address, cpu->cycles);
+    }
+    if (cpu->apu != NULL && is_apu_register(address))
+    {
+        return apu_peek_register(cpu->apu, address);
+    }
+    if (cpu->joypad != NULL && address == JOYPAD_REGISTER)
+    {
+        return joypad_peek_register(cpu->joypad);
+    }
+    if (cpu->ppu != NULL && address == IF_REGISTER)
+    {
+        return cpu->memorybus[address] | ppu_peek_interrupts(cpu->ppu, cpu->cycles);
+    }
     return cpu->memorybus[address];
 }
+
+/**
+ * Sets `interrupts` in IF.
+ */
+void request_interrupt(cpu_t *cpu, uint8_t interrupts)
+{
+    cpu->memorybus[IF_REGISTER] |= interrupts;
+}
+
+// =================================================================================
+//                          RAM hash
+// =================================================================================
+
+/**
+ * Zobrist key of `value` stored at `address`, from the splitmix64 finalizer
+ * rather than a table of 24K x 256 keys.
+ */
+static inline uint64_t ram_key(uint16_t address, uint8_t value)
+{
+    uint64_t key = ((uint64_t)address << 8 | value) + 0x9E3779B97F4A7C15ULL;
+    key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    key = (key ^ (key >> 27)) * 0x94D049BB133111EBULL;
+    return key ^ (key >> 31);
+}
+
+static inline bool is_hashed_ram(uint16_t address)
+{
+    return (uint16_t)(address - RAM_HASH_START) < RAM_HASH_END - RAM_HASH_START
+           || (uint16_t)(address - HRAM_HASH_START) < HRAM_HASH_END - HRAM_HASH_START;
+}
+
+/**
+ * @return the RAM hash from a full pass over the hashed regions.
+ */
+uint64_t compute_ram_hash(cpu_t *cpu)
+{
+    uint64_t hash = 0;
+    for (uint32_t address = RAM_HASH_START; address < RAM_HASH_END; address++)
+    {
+        hash ^= ram_key(address, cpu->memorybus[address]);
+    }
+    for (uint32_t address = HRAM_HASH_START; address < HRAM_HASH_END; address++)
+    {
+        hash ^= ram_key(address, cpu->memorybus[address]);
+    }
+    return hash;
+}
+
+/**
+ * Brings cpu->ram_hash back in line with memory after writes that bypassed
+ * write_memory, or when turning ram_hashing back on.
+ */
+void rehash_ram(cpu_t *cpu)
+{
+    cpu->ram_hash = compute_ram_hash(cpu);
+}
+
+
+/**
+ * Copies the 160 bytes at `page` * 0x100 to OAM. The transfer happens at once
+ * instead of over 160 M-cycles, and the CPU keeps access to the whole bus.
+ */
+static void oam_dma(cpu_t *cpu, uint8_t page)
+{
+    if (cpu->ppu != NULL)
+    {
+        ppu_oam_dma(cpu->ppu, cpu->cycles);
+    }
+    memmove(&cpu->memorybus[0xFE00], &cpu->memorybus[page << 8], 0xA0);
+}
+
 /**
  * Writes a value to the specified memory address.
  *
@@ -198,11 +353,212 @@ void write_memory(cpu_t *cpu, uint16_t address, uint8_t value)
         exit(1);
     }
 
+    if (cpu->ppu != NULL)
+    {
+        if (is_ppu_register(address))
+        {
+            ppu_write_register(cpu->ppu, address, value, cpu->cycles);
+            return;
+        }
+        if (is_ppu_memory(address))
+        {
+            ppu_write_memory(cpu->ppu, address, value, cpu->cycles);
+        }
+    }
+    if (cpu->apu != NULL && is_apu_register(address))
+    {
+        apu_write_register(cpu->apu, address, value, cpu->cycles);
+        return;
+    }
+    if (cpu->joypad != NULL && address == JOYPAD_REGISTER)
+    {
+        if (joypad_write_register(cpu->joypad, value))
+        {
+            request_interrupt(cpu, JOYPAD_INTERRUPT);
+        }
+        return;
+    }
+    if (address == DMA_REGISTER)
+    {
+        oam_dma(cpu, value);
+    }
+    if (cpu->ppu != NULL && address == IF_REGISTER)
+    {
+        // Requests made before the write are cleared by it
+        ppu_catch_up(cpu->ppu, cpu->cycles);
+    }
+    uint8_t old = cpu->memorybus[address];
+    if (cpu->ram_hashing && old != value && is_hashed_ram(address))
+    {
+        cpu->ram_hash ^= ram_key(address, old) ^ ram_key(address, value);
+    }
     cpu->memorybus[address] = value;
     return;
 }
 
 
+void invalidate_fetch_window(cpu_t *cpu)
+{
+    cpu->fetch.base = NULL;
+    cpu->fetch.start = 0;
+    cpu->fetch.size = 0;
+}
+
+/**
+ * Points the fetch window at the memory region containing PC.
+ * Regions with side effects or mirroring (echo RAM, OAM, I/O, IE) get an
+ * empty window, so fetches from there keep going through read_memory.
+ */
+static void refill_fetch_window(cpu_t *cpu)
+{
+    uint16_t pc = cpu->PC;
+    uint16_t start;
+    uint16_t size;
+
+    if (pc < 0x4000)        { start = 0x0000; size = 0x4000; } // ROM bank 0
+    else if (pc < 0x8000)   { start = 0x4000; size = 0x4000; } // ROM bank N
+    else if (pc < 0xA000)   { start = 0x8000; size = 0x2000; } // VRAM
+    else if (pc < 0xC000)   { start = 0xA000; size = 0x2000; } // External RAM
+    else if (pc < 0xE000)   { start = 0xC000; size = 0x2000; } // WRAM
+    else if (pc >= 0xFF80 && pc < 0xFFFF) { start = 0xFF80; size = 0x7F; } // HRAM
+    else
+    {
+        invalidate_fetch_window(cpu);
+        return;
+    }
+
+    cpu->fetch.base = cpu->memorybus + start;
+    cpu->fetch.start = start;
+    cpu->fetch.size = size;
+}
+
+/**
+ * Fetches the byte at PC and advances PC.
+ */
+uint8_t fetch_8(cpu_t *cpu)
+{
+    uint16_t offset = cpu->PC - cpu->fetch.start;
+    if (offset >= cpu->fetch.size)
+    {
+        refill_fetch_window(cpu);
+        offset = cpu->PC - cpu->fetch.start;
+        if (offset >= cpu->fetch.size)
+        {
+            uint8_t value = read_memory(cpu, cpu->PC); cpu->PC++;
+            return value;
+        }
+    }
+    cpu->PC++;
+    return cpu->fetch.base[offset];
+}
+
+/**
+ * Fetches the little-endian 16-bit immediate at PC and advances PC by 2.
+ * Inside the window this is a single unaligned load; an immediate that
+ * straddles a region boundary falls back to two byte fetches.
+ */
+uint16_t fetch_16(cpu_t *cpu)
+{
+    uint16_t offset = cpu->PC - cpu->fetch.start;
+    if ((uint32_t)offset + 1 >= cpu->fetch.size)
+    {
+        refill_fetch_window(cpu);
+        offset = cpu->PC - cpu->fetch.start;
+        if ((uint32_t)offset + 1 >= cpu->fetch.size)
+        {
+            uint8_t Z = fetch_8(cpu);
+            uint8_t W = fetch_8(cpu);
+            return (uint16_t)(((uint16_t)W << 8) | Z);
+        }
+    }
+    const uint8_t *p = cpu->fetch.base + offset;
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = (uint16_t)((value >> 8) | (value << 8));
+#endif
+    cpu->PC += 2;
+    return value;
+}
+
+
+// =================================================================================
+//                          Coverage
+// =================================================================================
+
+// Opcodes that end a basic block: JR, JP, CALL, RET, RETI and RST
+static const bool branch_opcodes[256] = {
+    [0x18] = true, [0x20] = true, [0x28] = true, [0x30] = true, [0x38] = true,     // JR
+    [0xC3] = true, [0xC2] = true, [0xCA] = true, [0xD2] = true, [0xDA] = true,     // JP
+    [0xE9] = true,                                                                 // JP HL
+    [0xCD] = true, [0xC4] = true, [0xCC] = true, [0xD4] = true, [0xDC] = true,     // CALL
+    [0xC9] = true, [0xC0] = true, [0xC8] = true, [0xD0] = true, [0xD8] = true,     // RET
+    [0xD9] = true,                                                                 // RETI
+    [0xC7] = true, [0xCF] = true, [0xD7] = true, [0xDF] = true,                    // RST
+    [0xE7] = true, [0xEF] = true, [0xF7] = true, [0xFF] = true,
+};
+
+// Bank and address of a PC, as one key
+static inline uint32_t coverage_location(const coverage_t *coverage, uint16_t address)
+{
+    uint32_t bank = address >= COVERAGE_BANK_SIZE && address < 2 * COVERAGE_BANK_SIZE ? coverage->bank : 0;
+    return bank << 16 | address;
+}
+
+static inline void mark_rom(coverage_t *coverage, uint16_t address)
+{
+    if (address < 2 * COVERAGE_BANK_SIZE)
+    {
+        uint32_t bit = address < COVERAGE_BANK_SIZE ? address
+                       : coverage->bank * COVERAGE_BANK_SIZE + address - COVERAGE_BANK_SIZE;
+        if (bit < coverage->banks * COVERAGE_BANK_SIZE)
+        {
+            coverage->rom[bit >> 3] |= 1 << (bit & 7);
+        }
+    }
+}
+
+static inline void hit_edge(coverage_t *coverage, uint16_t from, uint16_t to)
+{
+    uint32_t key = coverage_location(coverage, from) * 0x9E3779B1u ^ coverage_location(coverage, to) * 0x85EBCA77u;
+    uint8_t *count = &coverage->edges[key >> 16];
+    *count += *count != 0xFF;
+}
+
+// `opcode` ran at `pc`, and execution went on at `next`
+static inline void record_coverage(coverage_t *coverage, uint16_t pc, uint8_t opcode, uint16_t next)
+{
+    mark_rom(coverage, pc);
+    if (branch_opcodes[opcode])
+    {
+        hit_edge(coverage, pc, next);
+    }
+}
+
+// A fused idiom counts as the instructions it stands for, so coverage does
+// not depend on cpu->fusion
+static void record_fused_coverage(coverage_t *coverage, uint16_t pc, uint8_t opcode, uint16_t next)
+{
+    mark_rom(coverage, pc);
+    switch (opcode)
+    {
+    case 0x2A: // LD A,(HL+); LD (DE),A; INC DE
+        mark_rom(coverage, pc + 1);
+        mark_rom(coverage, pc + 2);
+        break;
+    case 0xF0: // LDH A,(n); CP n; JR NZ,e
+        mark_rom(coverage, pc + 2);
+        mark_rom(coverage, pc + 4);
+        hit_edge(coverage, pc + 4, next);
+        break;
+    default:   // DEC r; JR NZ,e
+        mark_rom(coverage, pc + 1);
+        hit_edge(coverage, pc + 1, next);
+        break;
+    }
+}
+
+
 int execute_next_instruction(cpu_t *cpu)
 {
     if (cpu == NULL)
@@ -211,16 +567,485 @@ int execute_next_instruction(cpu_t *cpu)
         exit(1);
     }
     
-    uint8_t instruction_byte = read_memory(cpu, cpu->PC); cpu->PC++;
-    bool prefixed = instruction_byte == 0xCB;
-    if (prefixed) 
+    uint16_t start_pc = cpu->PC;
+    int timing = 0;
+    uint8_t instruction_byte = fetch_8(cpu);
+    uint8_t opcode = instruction_byte;
+    if (cpu->opcode_pairs != NULL)
     {
-        instruction_byte = read_memory(cpu, cpu->PC); cpu->PC++;
+        cpu->opcode_pairs[(cpu->previous_opcode << 8) | instruction_byte]++;
+        cpu->previous_opcode = instruction_byte;
+    }
+    else if (cpu->fusion != FUSE_NONE)
+    {
+        timing = execute_fused_instruction(cpu, instruction_byte);
+        if (timing != 0 && cpu->coverage != NULL)
+        {
+            record_fused_coverage(cpu->coverage, start_pc, opcode, cpu->PC);
+        }
+    }
+    if (timing == 0)
+    {
+        bool prefixed = instruction_byte == 0xCB;
+        if (prefixed) 
+        {
+            instruction_byte = fetch_8(cpu);
+        }
+        timing = execute_instruction(cpu, instruction_byte, prefixed);
+        if (cpu->coverage != NULL)
+        {
+            record_coverage(cpu->coverage, start_pc, opcode, cpu->PC);
+        }
+    }
+    cpu->cycles += timing;
+
+    if (cpu->idle_skip)
+    {
+        idle_loop_t *loop = &cpu->idle_loop;
+        // A short backward jump may close a busy-wait loop
+        if (cpu->PC <= start_pc && start_pc - cpu->PC < IDLE_MAX_LOOP_BYTES)
+        {
+            timing += skip_idle_loop(cpu, start_pc);
+        }
+        // Falling through or branching out leaves the loop, re-entering it decodes it again
+        else if (loop->valid && (cpu->PC < loop->head || cpu->PC > loop->branch_pc))
+        {
+            loop->valid = false;
+        }
     }
     // Output : number of cycles took by instruction
-    return execute_instruction(cpu, instruction_byte, prefixed); 
+    return timing;
+}
+
+
+
+// =================================================================================
+//                          Fused instructions
+// =================================================================================
+
+/**
+ * Returns a pointer to the `count` bytes at PC if they all lie in the
+ * fetch window, NULL otherwise.
+ */
+static const uint8_t *peek_window(cpu_t *cpu, uint16_t count)
+{
+    uint16_t offset = cpu->PC - cpu->fetch.start;
+    if ((uint32_t)offset + count > cpu->fetch.size)
+    {
+        return NULL;
+    }
+    return cpu->fetch.base + offset;
+}
+
+// LD A,(HL+); LD (DE),A; INC DE
+static int fused_copy_HLI_DE(cpu_t *cpu)
+{
+    uint16_t *HL = cpu->registers->HL;
+    uint16_t *DE = cpu->registers->DE;
+    uint8_t Z = read_memory(cpu, *HL); (*HL)++;
+    set_8bit_register(cpu, A, Z);
+    // The store is stamped when the unfused LD (DE),A would make it, 2 M-cycles in
+    cpu->cycles += 2;
+    write_memory(cpu, *DE, Z); (*DE)++;
+    cpu->cycles -= 2;
+    cpu->PC += 2;
+    return 2 + 2 + 2;
+}
+
+// DEC r; JR NZ,e
+static int fused_DEC_r8_JR_NZ(cpu_t *cpu, reg_8bits_t reg, int8_t e)
+{
+    uint8_t result = get_8bit_register(cpu, reg) - 1;
+    set_8bit_register(cpu, reg, result);
+    // Z from the result, N set, H on borrow from bit 4, C untouched
+    uint16_t flags = 0x40;
+    flags |= result == 0 ? 0x80 : 0x00;
+    flags |= (result & 0x0F) == 0x0F ? 0x20 : 0x00;
+    *cpu->registers->AF = (*cpu->registers->AF & 0xFF1F) | flags;
+    cpu->PC += 2;
+    if (result != 0)
+    {
+        cpu->PC += e;
+        return 1 + 3;
+    }
+    return 1 + 2;
+}
+
+// LDH A,(n); CP n; JR NZ,e
+static int fused_poll_LDH_CP_JR_NZ(cpu_t *cpu, uint8_t n, uint8_t k, int8_t e)
+{
+    uint8_t a = read_memory(cpu, 0xFF00 | n);
+    set_8bit_register(cpu, A, a);
+    operation_result_t result = sub(a, k);
+    uint16_t flags = 0x40;
+    flags |= (uint8_t)result.result == 0 ? 0x80 : 0x00;
+    flags |= result.halfcarry ? 0x20 : 0x00;
+    flags |= result.carry ? 0x10 : 0x00;
+    *cpu->registers->AF = (*cpu->registers->AF & 0xFF0F) | flags;
+    cpu->PC += 5;
+    if ((uint8_t)result.result != 0)
+    {
+        cpu->PC += e;
+        return 3 + 2 + 3;
+    }
+    return 3 + 2 + 2;
+}
+
+/**
+ * Runs the idiom starting with `instruction_byte` (already fetched) as a
+ * single handler when it is enabled in cpu->fusion and its remaining bytes
+ * are in the fetch window.
+ *
+ * @return the combined number of cycles, or 0 if nothing was fused.
+ */
+int execute_fused_instruction(cpu_t *cpu, uint8_t instruction_byte)
+{
+    const uint8_t *ops;
+    switch (instruction_byte)
+    {
+    case 0x2A: // LD A,(HL+); LD (DE),A; INC DE
+        if ((cpu->fusion & FUSE_COPY_HLI_DE) && (ops = peek_window(cpu, 2)) != NULL
+            && ops[0] == 0x12 && ops[1] == 0x13)
+        {
+            return fused_copy_HLI_DE(cpu);
+        }
+        break;
+    case 0x05: // DEC B; JR NZ,e
+    case 0x0D: // DEC C; JR NZ,e
+    case 0x15: // DEC D; JR NZ,e
+    case 0x1D: // DEC E; JR NZ,e
+    case 0x25: // DEC H; JR NZ,e
+    case 0x2D: // DEC L; JR NZ,e
+    case 0x3D: // DEC A; JR NZ,e
+        if ((cpu->fusion & FUSE_DEC_JR_NZ) && (ops = peek_window(cpu, 2)) != NULL
+            && ops[0] == 0x20)
+        {
+            static const reg_8bits_t dec_registers[8] = { B, C, D, E, H, L, A, A }; // 6 is (HL)
+            return fused_DEC_r8_JR_NZ(cpu, dec_registers[instruction_byte >> 3], (int8_t)ops[1]);
+        }
+        break;
+    case 0xF0: // LDH A,(n); CP n; JR NZ,e
+        if ((cpu->fusion & FUSE_POLL_LDH_CP) && (ops = peek_window(cpu, 5)) != NULL
+            && ops[1] == 0xFE && ops[3] == 0x20)
+        {
+            return fused_poll_LDH_CP_JR_NZ(cpu, ops[0], ops[2], (int8_t)ops[4]);
+        }
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+// =================================================================================
+//                          Idle loop detection
+// =================================================================================
+
+/**
+ * Classifies a read the loop body makes.
+ *
+ * @return 1 for a register that changes on its own (LY, STAT, P1), 0 for
+ * memory only the CPU can change, -1 for anything else (serial, timers,
+ * OAM...).
+ */
+static int classify_idle_read(uint16_t address)
+{
+    if (address == LY_REGISTER || address == STAT_REGISTER || address == JOYPAD_REGISTER)
+    {
+        return 1;
+    }
+    if (address >= 0xFE00 && address < 0xFF80 && !is_ppu_register(address))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * First cycle at which a read of `address`, one of the registers
+ * classify_idle_read returns 1 for, may differ from a read made at `cycle`.
+ * P1 only changes at the next queued input event.
+ */
+static uint64_t next_idle_read_change(cpu_t *cpu, uint16_t address, uint64_t cycle)
+{
+    if (address == JOYPAD_REGISTER)
+    {
+        return cpu->joypad != NULL ? joypad_next_event(cpu->joypad) : UINT64_MAX;
+    }
+    if (cpu->ppu == NULL)
+    {
+        return UINT64_MAX;
+    }
+    return ppu_next_register_change(cpu->ppu, address, cycle);
+}
+
+/**
+ * Decodes the loop starting at `head`. The body may only contain
+ * instructions that read memory or registers and write A and F, plus
+ * branches; it must close with a branch back to `head`.
+ *
+ * @return true if the loop is a candidate idle loop.
+ */
+static bool decode_idle_loop(cpu_t *cpu, uint16_t head, idle_loop_t *loop)
+{
+    uint16_t pc = head;
+    uint8_t offset = 0;
+    loop->poll_count = 0;
+
+    while ((uint16_t)(pc - head) < IDLE_MAX_LOOP_BYTES)
+    {
+        uint8_t op = read_memory(cpu, pc);
+        uint8_t n = read_memory(cpu, pc + 1);
+        uint16_t nn = unsigned_16(read_memory(cpu, pc + 2), n);
+        int32_t read_address = -1;
+        uint16_t length;
+        uint8_t cycles;
+        int32_t target = -1;
+        bool conditional = false;
+
+        switch (op)
+        {
+        case 0x00: // NOP
+        case 0xA7: // AND A
+        case 0xB7: // OR A
+        case 0xBF: // CP A
+            length = 1; cycles = 1;
+            break;
+        case 0xFE: // CP n
+        case 0xE6: // AND n
+        case 0xF6: // OR n
+        case 0xEE: // XOR n
+            length = 2; cycles = 2;
+            break;
+        case 0xF0: // LDH A,(n)
+            length = 2; cycles = 3; read_address = 0xFF00 | n;
+            break;
+        case 0xF2: // LDH A,(C)
+            length = 1; cycles = 2; read_address = 0xFF00 | get_8bit_register(cpu, C);
+            break;
+        case 0xFA: // LD A,(nn)
+            length = 3; cycles = 4; read_address = nn;
+            break;
+        case 0x0A: // LD A,(BC)
+            length = 1; cycles = 2; read_address = *cpu->registers->BC;
+            break;
+        case 0x1A: // LD A,(DE)
+            length = 1; cycles = 2; read_address = *cpu->registers->DE;
+            break;
+        case 0x7E: // LD A,(HL)
+            length = 1; cycles = 2; read_address = *cpu->registers->HL;
+            break;
+        case 0xCB: // BIT b,r and BIT b,(HL) only write F
+            if (n < 0x40 || n > 0x7F)
+            {
+                return false;
+            }
+            length = 2;
+            cycles = 2;
+            if ((n & 0x07) == 0x06)
+            {
+                cycles = 3;
+                read_address = *cpu->registers->HL;
+            }
+            break;
+        case 0x18: // JR e
+        case 0x20: case 0x28: case 0x30: case 0x38: // JR cc,e
+            length = 2; cycles = 2;
+            target = (uint16_t)(pc + 2 + (int8_t)n);
+            conditional = op != 0x18;
+            break;
+        case 0xC3: // JP nn
+        case 0xC2: case 0xCA: case 0xD2: case 0xDA: // JP cc,nn
+            length = 3; cycles = 3;
+            target = nn;
+            conditional = op != 0xC3;
+            break;
+        default:
+            return false;
+        }
+
+        if (read_address >= 0)
+        {
+            int kind = classify_idle_read((uint16_t)read_address);
+            if (kind < 0)
+            {
+                return false;
+            }
+            if (kind == 1)
+            {
+                if (loop->poll_count == IDLE_MAX_POLLS)
+                {
+                    return false;
+                }
+                loop->poll_address[loop->poll_count] = (uint16_t)read_address;
+                loop->poll_offset[loop->poll_count] = offset;
+                loop->poll_count++;
+            }
+        }
+
+        if (target == head)
+        {
+            loop->length = offset + cycles + 1;
+            return true;
+        }
+        if (target >= 0 && !conditional)
+        {
+            return false;   // Unconditional jump elsewhere: not a simple loop
+        }
+        if (target >= head && target < head + IDLE_MAX_LOOP_BYTES)
+        {
+            return false;   // Branch inside the body: path length is not fixed
+        }
+        pc += length;
+        offset += cycles;
+    }
+    return false;
 }
 
+/**
+ * Called after a backward branch from `branch_pc` landed on cpu->PC.
+ * The first pass decodes the loop, the second confirms AF came back
+ * unchanged after exactly one iteration; from then on every iteration
+ * that reads the same LY/STAT/P1 values is a no-op, so those iterations are
+ * skipped by advancing the cycle counter by whole iterations. The skip
+ * stops before the first iteration whose reads could see a new value and
+ * never passes cpu->idle_limit. The decode is dropped once the loop is
+ * left, or when BC, DE or HL no longer match the read addresses.
+ *
+ * @return the number of cycles skipped.
+ */
+int skip_idle_loop(cpu_t *cpu, uint16_t branch_pc)
+{
+    idle_loop_t *loop = &cpu->idle_loop;
+    uint16_t head = cpu->PC;
+    uint16_t AF = *cpu->registers->AF;
+    uint16_t BC = *cpu->registers->BC;
+    uint16_t DE = *cpu->registers->DE;
+    uint16_t HL = *cpu->registers->HL;
+    uint64_t input_changes = cpu->joypad != NULL ? cpu->joypad->changes : 0;
+
+    if (!loop->valid || loop->head != head || loop->branch_pc != branch_pc
+        || loop->BC != BC || loop->DE != DE || loop->HL != HL)
+    {
+        loop->valid = true;
+        loop->head = head;
+        loop->branch_pc = branch_pc;
+        loop->idle = decode_idle_loop(cpu, head, loop);
+        loop->AF = AF;
+        loop->BC = BC;
+        loop->DE = DE;
+        loop->HL = HL;
+        loop->head_cycle = cpu->cycles;
+        loop->input_changes = input_changes;
+        return 0;
+    }
+
+    uint64_t now = cpu->cycles;
+    uint64_t length = loop->length;
+    // Anything but one plain iteration since the last visit, such as an interrupt, proves nothing
+    // Input that changed since the last visit may not have been polled yet
+    bool repeated = loop->idle && loop->AF == AF && now - loop->head_cycle == length
+        && loop->input_changes == input_changes;
+    loop->AF = AF;
+    loop->head_cycle = now;
+    loop->input_changes = input_changes;
+    if (!repeated || cpu->idle_limit <= now)
+    {
+        return 0;
+    }
+    // Whole iterations ending by the limit; the rest runs instruction by instruction
+    uint64_t iterations = (cpu->idle_limit - now) / length;
+    for (int i = 0; i < loop->poll_count; i++)
+    {
+        // The last iteration read its value at previous_read; it stays valid until change
+        uint64_t previous_read = now - length + loop->poll_offset[i];
+        uint64_t change = next_idle_read_change(cpu, loop->poll_address[i], previous_read);
+        uint64_t next_read = now + loop->poll_offset[i];
+        if (change <= next_read)
+        {
+            iterations = 0;
+            break;
+        }
+        // Iterations whose read lands before change
+        uint64_t safe = (change - next_read + length - 1) / length;
+        if (safe < iterations)
+        {
+            iterations = safe;
+        }
+    }
+
+    uint64_t skipped = iterations * length;
+    cpu->cycles += skipped;
+    loop->head_cycle = cpu->cycles;
+    return (int)skipped;
+}
+
+
+// =================================================================================
+//                          Opcode pair profiling
+// =================================================================================
+
+/**
+ * Starts counting executed opcode pairs, to check fusion candidates against.
+ * Fusion is bypassed while profiling so every opcode is seen.
+ *
+ * @return 0 on success, -1 if the counters could not be allocated.
+ */
+int start_opcode_profile(cpu_t *cpu)
+{
+    if (cpu->opcode_pairs == NULL)
+    {
+        cpu->opcode_pairs = calloc(0x10000, sizeof(uint32_t));
+        if (cpu->opcode_pairs == NULL)
+        {
+            return -1;
+        }
+    }
+    cpu->previous_opcode = 0x00;
+    return 0;
+}
+
+void stop_opcode_profile(cpu_t *cpu)
+{
+    free(cpu->opcode_pairs);
+    cpu->opcode_pairs = NULL;
+}
+
+/**
+ * Prints the `count` most frequent opcode pairs seen since profiling started.
+ */
+void print_top_opcode_pairs(cpu_t *cpu, int count)
+{
+    if (cpu->opcode_pairs == NULL)
+    {
+        return;
+    }
+    uint32_t last_max = UINT32_MAX;
+    int last_pair = -1;
+    for (int rank = 0; rank < count; rank++)
+    {
+        int best_pair = -1;
+        uint32_t best = 0;
+        for (int pair = 0; pair < 0x10000; pair++)
+        {
+            uint32_t n = cpu->opcode_pairs[pair];
+            // Strictly below the previous rank, or equal to it but after it
+            bool eligible = n < last_max || (n == last_max && pair > last_pair);
+            if (eligible && n > best)
+            {
+                best = n;
+                best_pair = pair;
+            }
+        }
+        if (best_pair < 0)
+        {
+            break;
+        }
+        printf("%2d. %02X %02X  %u\n", rank + 1, best_pair >> 8, best_pair & 0xFF, best);
+        last_max = best;
+        last_pair = best_pair;
+    }
+}
 
 
 int execute_instruction(cpu_t *cpu, uint8_t instruction_byte, bool prefixed)
@@ -281,7 +1106,7 @@ int execute_instruction(cpu_t *cpu, uint8_t instruction_byte, bool prefixed)
         case 0x16: // LD D,n
             return LD_r8_n8(cpu, D);
         case 0x17: // RLA
-            return RLCA(cpu);
+            return RLA(cpu);
         case 0x18: // JR e
             return JR_e(cpu);
         case 0x19: // ADD HL,DE
@@ -312,7 +1137,8 @@ int execute_instruction(cpu_t *cpu, uint8_t instruction_byte, bool prefixed)
             return DEC_r8(cpu, H);
         case 0x26: // LD H,n
             return LD_r8_n8(cpu, H);
-        //case 0x27: // DAA
+        case 0x27: // DAA
+            return DAA(cpu);
         case 0x28: // JR Z,n
             return JR_cc_e(cpu, get_flag(cpu, ZERO));
         case 0x29: // ADD HL,HL
@@ -724,7 +1550,7 @@ int execute_instruction(cpu_t *cpu, uint8_t instruction_byte, bool prefixed)
         case 0xF0: // LDH A,(n)
             return LDH_A_n16(cpu);   
         case 0xF1: // POP AF
-            return POP_r16(cpu, cpu->registers->AF);
+            return POP_AF(cpu);
         case 0xF2: // LD A,(C)
             return LDH_A_C(cpu);
         case 0xF3: // DI
@@ -893,390 +1719,390 @@ int execute_instruction(cpu_t *cpu, uint8_t instruction_byte, bool prefixed)
         case 0x3F: // SRL A
             return SRL_r8(cpu, A);
         case 0x40: // BIT 0,B
-            return BIT_r8(cpu, 0, B);
+            return BIT_r8(cpu, B, 0);
         case 0x41: // BIT 0,C
-            return BIT_r8(cpu, 0, C);
+            return BIT_r8(cpu, C, 0);
         case 0x42: // BIT 0,D
-            return BIT_r8(cpu, 0, D);
+            return BIT_r8(cpu, D, 0);
         case 0x43: // BIT 0,E
-            return BIT_r8(cpu, 0, E);
+            return BIT_r8(cpu, E, 0);
         case 0x44: // BIT 0,H
-            return BIT_r8(cpu, 0, H);
+            return BIT_r8(cpu, H, 0);
         case 0x45: // BIT 0,L
-            return BIT_r8(cpu, 0, L);
+            return BIT_r8(cpu, L, 0);
         case 0x46: // BIT 0,(HL)
             return BIT_HL(cpu, 0);
         case 0x47: // BIT 0,A
-            return BIT_r8(cpu, 0, A);
+            return BIT_r8(cpu, A, 0);
         case 0x48: // BIT 1,B
-            return BIT_r8(cpu, 1, B);
+            return BIT_r8(cpu, B, 1);
         case 0x49: // BIT 1,C
-            return BIT_r8(cpu, 1, C);
+            return BIT_r8(cpu, C, 1);
         case 0x4A: // BIT 1,D
-            return BIT_r8(cpu, 1, D);
+            return BIT_r8(cpu, D, 1);
         case 0x4B: // BIT 1,E
-            return BIT_r8(cpu, 1, E);
+            return BIT_r8(cpu, E, 1);
         case 0x4C: // BIT 1,H
-            return BIT_r8(cpu, 1, H);
+            return BIT_r8(cpu, H, 1);
         case 0x4D: // BIT 1,L
-            return BIT_r8(cpu, 1, L);
+            return BIT_r8(cpu, L, 1);
         case 0x4E: // BIT 1,(HL)
             return BIT_HL(cpu, 1);
         case 0x4F: // BIT 1,A
-            return BIT_r8(cpu, 1, A);
+            return BIT_r8(cpu, A, 1);
         case 0x50: // BIT 2,B
-            return BIT_r8(cpu, 2, B);
+            return BIT_r8(cpu, B, 2);
         case 0x51: // BIT 2,C
-            return BIT_r8(cpu, 2, C);
+            return BIT_r8(cpu, C, 2);
         case 0x52: // BIT 2,D
-            return BIT_r8(cpu, 2, D);
+            return BIT_r8(cpu, D, 2);
         case 0x53: // BIT 2,E
-            return BIT_r8(cpu, 2, E);
+            return BIT_r8(cpu, E, 2);
         case 0x54: // BIT 2,H
-            return BIT_r8(cpu, 2, H);
+            return BIT_r8(cpu, H, 2);
         case 0x55: // BIT 2,L
-            return BIT_r8(cpu, 2, L);
+            return BIT_r8(cpu, L, 2);
         case 0x56: // BIT 2,(HL)
             return BIT_HL(cpu, 2);
         case 0x57: // BIT 2,A
-            return BIT_r8(cpu, 2, A);
+            return BIT_r8(cpu, A, 2);
         case 0x58: // BIT 3,B
-            return BIT_r8(cpu, 3, B);
+            return BIT_r8(cpu, B, 3);
         case 0x59: // BIT 3,C
-            return BIT_r8(cpu, 3, C);
+            return BIT_r8(cpu, C, 3);
         case 0x5A: // BIT 3,D
-            return BIT_r8(cpu, 3, D);
+            return BIT_r8(cpu, D, 3);
         case 0x5B: // BIT 3,E
-            return BIT_r8(cpu, 3, E);
+            return BIT_r8(cpu, E, 3);
         case 0x5C: // BIT 3,H
-            return BIT_r8(cpu, 3, H);
+            return BIT_r8(cpu, H, 3);
         case 0x5D: // BIT 3,L
-            return BIT_r8(cpu, 3, L);
+            return BIT_r8(cpu, L, 3);
         case 0x5E: // BIT 3,(HL)
             return BIT_HL(cpu, 3);
         case 0x5F: // BIT 3,A
-            return BIT_r8(cpu, 3, A);
+            return BIT_r8(cpu, A, 3);
         case 0x60: // BIT 4,B
-            return BIT_r8(cpu, 4, B);
+            return BIT_r8(cpu, B, 4);
         case 0x61: // BIT 4,C
-            return BIT_r8(cpu, 4, C);
+            return BIT_r8(cpu, C, 4);
         case 0x62: // BIT 4,D
-            return BIT_r8(cpu, 4, D);
+            return BIT_r8(cpu, D, 4);
         case 0x63: // BIT 4,E
-            return BIT_r8(cpu, 4, E);
+            return BIT_r8(cpu, E, 4);
         case 0x64: // BIT 4,H
-            return BIT_r8(cpu, 4, H);
+            return BIT_r8(cpu, H, 4);
         case 0x65: // BIT 4,L
-            return BIT_r8(cpu, 4, L);
+            return BIT_r8(cpu, L, 4);
         case 0x66: // BIT 4,(HL)
             return BIT_HL(cpu, 4);
         case 0x67: // BIT 4,A
-            return BIT_r8(cpu, 4, A);
+            return BIT_r8(cpu, A, 4);
         case 0x68: // BIT 5,B
-            return BIT_r8(cpu, 5, B);
+            return BIT_r8(cpu, B, 5);
         case 0x69: // BIT 5,C
-            return BIT_r8(cpu, 5, C);
+            return BIT_r8(cpu, C, 5);
         case 0x6A: // BIT 5,D
-            return BIT_r8(cpu, 5, D);
+            return BIT_r8(cpu, D, 5);
         case 0x6B: // BIT 5,E
-            return BIT_r8(cpu, 5, E);
+            return BIT_r8(cpu, E, 5);
         case 0x6C: // BIT 5,H
-            return BIT_r8(cpu, 5, H);
+            return BIT_r8(cpu, H, 5);
         case 0x6D: // BIT 5,L
-            return BIT_r8(cpu, 5, L);
+            return BIT_r8(cpu, L, 5);
         case 0x6E: // BIT 5,(HL)
             return BIT_HL(cpu, 5);
         case 0x6F: // BIT 5,A
-            return BIT_r8(cpu, 5, A);
+            return BIT_r8(cpu, A, 5);
         case 0x70: // BIT 6,B
-            return BIT_r8(cpu, 6, B);
+            return BIT_r8(cpu, B, 6);
         case 0x71: // BIT 6,C
-            return BIT_r8(cpu, 6, C);
+            return BIT_r8(cpu, C, 6);
         case 0x72: // BIT 6,D
-            return BIT_r8(cpu, 6, D);
+            return BIT_r8(cpu, D, 6);
         case 0x73: // BIT 6,E
-            return BIT_r8(cpu, 6, E);
+            return BIT_r8(cpu, E, 6);
         case 0x74: // BIT 6,H
-            return BIT_r8(cpu, 6, H);
+            return BIT_r8(cpu, H, 6);
         case 0x75: // BIT 6,L
-            return BIT_r8(cpu, 6, L);
+            return BIT_r8(cpu, L, 6);
         case 0x76: // BIT 6,(HL)
             return BIT_HL(cpu, 6);
         case 0x77: // BIT 6,A
-            return BIT_r8(cpu, 6, A);
+            return BIT_r8(cpu, A, 6);
         case 0x78: // BIT 7,B
-            return BIT_r8(cpu, 7, B);
+            return BIT_r8(cpu, B, 7);
         case 0x79: // BIT 7,C
-            return BIT_r8(cpu, 7, C);
+            return BIT_r8(cpu, C, 7);
         case 0x7A: // BIT 7,D
-            return BIT_r8(cpu, 7, D);
+            return BIT_r8(cpu, D, 7);
         case 0x7B: // BIT 7,E
-            return BIT_r8(cpu, 7, E);
+            return BIT_r8(cpu, E, 7);
         case 0x7C: // BIT 7,H
-            return BIT_r8(cpu, 7, H);
+            return BIT_r8(cpu, H, 7);
         case 0x7D: // BIT 7,L
-            return BIT_r8(cpu, 7, L);
+            return BIT_r8(cpu, L, 7);
         case 0x7E: // BIT 7,(HL)
             return BIT_HL(cpu, 7);
         case 0x7F: // BIT 7,A
-            return BIT_r8(cpu, 7, A);
+            return BIT_r8(cpu, A, 7);
         case 0x80: // RES 0,B
-            return RES_r8(cpu, 0, B);
+            return RES_r8(cpu, B, 0);
         case 0x81: // RES 0,C
-            return RES_r8(cpu, 0, C);
+            return RES_r8(cpu, C, 0);
         case 0x82: // RES 0,D
-            return RES_r8(cpu, 0, D);
+            return RES_r8(cpu, D, 0);
         case 0x83: // RES 0,E
-            return RES_r8(cpu, 0, E);
+            return RES_r8(cpu, E, 0);
         case 0x84: // RES 0,H
-            return RES_r8(cpu, 0, H);
+            return RES_r8(cpu, H, 0);
         case 0x85: // RES 0,L
-            return RES_r8(cpu, 0, L);
+            return RES_r8(cpu, L, 0);
         case 0x86: // RES 0,(HL)
             return RES_HL(cpu, 0);
         case 0x87: // RES 0,A
-            return RES_r8(cpu, 0, A);
+            return RES_r8(cpu, A, 0);
         case 0x88: // RES 1,B
-            return RES_r8(cpu, 1, B);
+            return RES_r8(cpu, B, 1);
         case 0x89: // RES 1,C
-            return RES_r8(cpu, 1, C);
+            return RES_r8(cpu, C, 1);
         case 0x8A: // RES 1,D
-            return RES_r8(cpu, 1, D);
+            return RES_r8(cpu, D, 1);
         case 0x8B: // RES 1,E
-            return RES_r8(cpu, 1, E);
+            return RES_r8(cpu, E, 1);
         case 0x8C: // RES 1,H
-            return RES_r8(cpu, 1, H);
+            return RES_r8(cpu, H, 1);
         case 0x8D: // RES 1,L
-            return RES_r8(cpu, 1, L);
+            return RES_r8(cpu, L, 1);
         case 0x8E: // RES 1,(HL)
             return RES_HL(cpu, 1);
         case 0x8F: // RES 1,A
-            return RES_r8(cpu, 1, A);
+            return RES_r8(cpu, A, 1);
         case 0x90: // RES 2,B
-            return RES_r8(cpu, 2, B);
+            return RES_r8(cpu, B, 2);
         case 0x91: // RES 2,C
-            return RES_r8(cpu, 2, C);
+            return RES_r8(cpu, C, 2);
         case 0x92: // RES 2,D
-            return RES_r8(cpu, 2, D);
+            return RES_r8(cpu, D, 2);
         case 0x93: // RES 2,E
-            return RES_r8(cpu, 2, E);
+            return RES_r8(cpu, E, 2);
         case 0x94: // RES 2,H
-            return RES_r8(cpu, 2, H);
+            return RES_r8(cpu, H, 2);
         case 0x95: // RES 2,L
-            return RES_r8(cpu, 2, L);
+            return RES_r8(cpu, L, 2);
         case 0x96: // RES 2,(HL)
             return RES_HL(cpu, 2);
         case 0x97: // RES 2,A
-            return RES_r8(cpu, 2, A);
+            return RES_r8(cpu, A, 2);
         case 0x98: // RES 3,B
-            return RES_r8(cpu, 3, B);
+            return RES_r8(cpu, B, 3);
         case 0x99: // RES 3,C
-            return RES_r8(cpu, 3, C);
+            return RES_r8(cpu, C, 3);
         case 0x9A: // RES 3,D
-            return RES_r8(cpu, 3, D);
+            return RES_r8(cpu, D, 3);
         case 0x9B: // RES 3,E
-            return RES_r8(cpu, 3, E);
+            return RES_r8(cpu, E, 3);
         case 0x9C: // RES 3,H
-            return RES_r8(cpu, 3, H);
+            return RES_r8(cpu, H, 3);
         case 0x9D: // RES 3,L
-            return RES_r8(cpu, 3, L);
+            return RES_r8(cpu, L, 3);
         case 0x9E: // RES 3,(HL)
             return RES_HL(cpu, 3);
         case 0x9F: // RES 3,A
-            return RES_r8(cpu, 3, A);
+            return RES_r8(cpu, A, 3);
         case 0xA0: // RES 4,B
-            return RES_r8(cpu, 4, B);
+            return RES_r8(cpu, B, 4);
         case 0xA1: // RES 4,C
-            return RES_r8(cpu, 4, C);
+            return RES_r8(cpu, C, 4);
         case 0xA2: // RES 4,D
-            return RES_r8(cpu, 4, D);
+            return RES_r8(cpu, D, 4);
         case 0xA3: // RES 4,E
-            return RES_r8(cpu, 4, E);
+            return RES_r8(cpu, E, 4);
         case 0xA4: // RES 4,H
-            return RES_r8(cpu, 4, H);
+            return RES_r8(cpu, H, 4);
         case 0xA5: // RES 4,L
-            return RES_r8(cpu, 4, L);
+            return RES_r8(cpu, L, 4);
         case 0xA6: // RES 4,(HL)
             return RES_HL(cpu, 4);
         case 0xA7: // RES 4,A
-            return RES_r8(cpu, 4, A);
+            return RES_r8(cpu, A, 4);
         case 0xA8: // RES 5,B
-            return RES_r8(cpu, 5, B);
+            return RES_r8(cpu, B, 5);
         case 0xA9: // RES 5,C
-            return RES_r8(cpu, 5, C);
+            return RES_r8(cpu, C, 5);
         case 0xAA: // RES 5,D
-            return RES_r8(cpu, 5, D);
+            return RES_r8(cpu, D, 5);
         case 0xAB: // RES 5,E
-            return RES_r8(cpu, 5, E);
+            return RES_r8(cpu, E, 5);
         case 0xAC: // RES 5,H
-            return RES_r8(cpu, 5, H);
+            return RES_r8(cpu, H, 5);
         case 0xAD: // RES 5,L
-            return RES_r8(cpu, 5, L);
+            return RES_r8(cpu, L, 5);
         case 0xAE: // RES 5,(HL)
             return RES_HL(cpu, 5);
         case 0xAF: // RES 5,A
-            return RES_r8(cpu, 5, A);
+            return RES_r8(cpu, A, 5);
         case 0xB0: // RES 6,B
-            return RES_r8(cpu, 6, B);
+            return RES_r8(cpu, B, 6);
         case 0xB1: // RES 6,C
-            return RES_r8(cpu, 6, C);
+            return RES_r8(cpu, C, 6);
         case 0xB2: // RES 6,D
-            return RES_r8(cpu, 6, D);
+            return RES_r8(cpu, D, 6);
         case 0xB3: // RES 6,E
-            return RES_r8(cpu, 6, E);
+            return RES_r8(cpu, E, 6);
         case 0xB4: // RES 6,H
-            return RES_r8(cpu, 6, H);
+            return RES_r8(cpu, H, 6);
         case 0xB5: // RES 6,L
-            return RES_r8(cpu, 6, L);
+            return RES_r8(cpu, L, 6);
         case 0xB6: // RES 6,(HL)
             return RES_HL(cpu, 6);
         case 0xB7: // RES 6,A
-            return RES_r8(cpu, 6, A);
+            return RES_r8(cpu, A, 6);
         case 0xB8: // RES 7,B
-            return RES_r8(cpu, 7, B);
+            return RES_r8(cpu, B, 7);
         case 0xB9: // RES 7,C
-            return RES_r8(cpu, 7, C);
+            return RES_r8(cpu, C, 7);
         case 0xBA: // RES 7,D
-            return RES_r8(cpu, 7, D);
+            return RES_r8(cpu, D, 7);
         case 0xBB: // RES 7,E
-            return RES_r8(cpu, 7, E);
+            return RES_r8(cpu, E, 7);
         case 0xBC: // RES 7,H
-            return RES_r8(cpu, 7, H);
+            return RES_r8(cpu, H, 7);
         case 0xBD: // RES 7,L
-            return RES_r8(cpu, 7, L);
+            return RES_r8(cpu, L, 7);
         case 0xBE: // RES 7,(HL)
             return RES_HL(cpu, 7);
         case 0xBF: // RES 7,A
-            return RES_r8(cpu, 7, A);
+            return RES_r8(cpu, A, 7);
         
         case 0xC0: // SET 0,B
-            return SET_r8(cpu, 0, B);
+            return SET_r8(cpu, B, 0);
         case 0xC1: // SET 0,C
-            return SET_r8(cpu, 0, C);
+            return SET_r8(cpu, C, 0);
         case 0xC2: // SET 0,D
-            return SET_r8(cpu, 0, D);
+            return SET_r8(cpu, D, 0);
         case 0xC3: // SET 0,E
-            return SET_r8(cpu, 0, E);
+            return SET_r8(cpu, E, 0);
         case 0xC4: // SET 0,H
-            return SET_r8(cpu, 0, H);
+            return SET_r8(cpu, H, 0);
         case 0xC5: // SET 0,L
-            return SET_r8(cpu, 0, L);
+            return SET_r8(cpu, L, 0);
         case 0xC6: // SET 0,(HL)
             return SET_HL(cpu, 0);
         case 0xC7: // SET 0,A
-            return SET_r8(cpu, 0, A);
+            return SET_r8(cpu, A, 0);
         case 0xC8: // SET 1,B
-            return SET_r8(cpu, 1, B);
+            return SET_r8(cpu, B, 1);
         case 0xC9: // SET 1,C
-            return SET_r8(cpu, 1, C);
+            return SET_r8(cpu, C, 1);
         case 0xCA: // SET 1,D
-            return SET_r8(cpu, 1, D);
+            return SET_r8(cpu, D, 1);
         case 0xCB: // SET 1,E
-            return SET_r8(cpu, 1, E);
+            return SET_r8(cpu, E, 1);
         case 0xCC: // SET 1,H
-            return SET_r8(cpu, 1, H);
+            return SET_r8(cpu, H, 1);
         case 0xCD: // SET 1,L
-            return SET_r8(cpu, 1, L);
+            return SET_r8(cpu, L, 1);
         case 0xCE: // SET 1,(HL)
             return SET_HL(cpu, 1);
         case 0xCF: // SET 1,A
-            return SET_r8(cpu, 1, A);
+            return SET_r8(cpu, A, 1);
         case 0xD0: // SET 2,B
-            return SET_r8(cpu, 2, B);
+            return SET_r8(cpu, B, 2);
         case 0xD1: // SET 2,C
-            return SET_r8(cpu, 2, C);
+            return SET_r8(cpu, C, 2);
         case 0xD2: // SET 2,D
-            return SET_r8(cpu, 2, D);
+            return SET_r8(cpu, D, 2);
         case 0xD3: // SET 2,E
-            return SET_r8(cpu, 2, E);
+            return SET_r8(cpu, E, 2);
         case 0xD4: // SET 2,H
-            return SET_r8(cpu, 2, H);
+            return SET_r8(cpu, H, 2);
         case 0xD5: // SET 2,L
-            return SET_r8(cpu, 2, L);
+            return SET_r8(cpu, L, 2);
         case 0xD6: // SET 2,(HL)
             return SET_HL(cpu, 2);
         case 0xD7: // SET 2,A
-            return SET_r8(cpu, 2, A);
+            return SET_r8(cpu, A, 2);
         case 0xD8: // SET 3,B
-            return SET_r8(cpu, 3, B);
+            return SET_r8(cpu, B, 3);
         case 0xD9: // SET 3,C
-            return SET_r8(cpu, 3, C);
+            return SET_r8(cpu, C, 3);
         case 0xDA: // SET 3,D
-            return SET_r8(cpu, 3, D);
+            return SET_r8(cpu, D, 3);
         case 0xDB: // SET 3,E
-            return SET_r8(cpu, 3, E);
+            return SET_r8(cpu, E, 3);
         case 0xDC: // SET 3,H
-            return SET_r8(cpu, 3, H);
+            return SET_r8(cpu, H, 3);
         case 0xDD: // SET 3,L
-            return SET_r8(cpu, 3, L);
+            return SET_r8(cpu, L, 3);
         case 0xDE: // SET 3,(HL)
             return SET_HL(cpu, 3);
         case 0xDF: // SET 3,A
-            return SET_r8(cpu, 3, A);
+            return SET_r8(cpu, A, 3);
         case 0xE0: // SET 4,B
-            return SET_r8(cpu, 4, B);
+            return SET_r8(cpu, B, 4);
         case 0xE1: // SET 4,C
-            return SET_r8(cpu, 4, C);
+            return SET_r8(cpu, C, 4);
         case 0xE2: // SET 4,D
-            return SET_r8(cpu, 4, D);
+            return SET_r8(cpu, D, 4);
         case 0xE3: // SET 4,E
-            return SET_r8(cpu, 4, E);
+            return SET_r8(cpu, E, 4);
         case 0xE4: // SET 4,H
-            return SET_r8(cpu, 4, H);
+            return SET_r8(cpu, H, 4);
         case 0xE5: // SET 4,L
-            return SET_r8(cpu, 4, L);
+            return SET_r8(cpu, L, 4);
         case 0xE6: // SET 4,(HL)
             return SET_HL(cpu, 4);
         case 0xE7: // SET 4,A
-            return SET_r8(cpu, 4, A);
+            return SET_r8(cpu, A, 4);
         case 0xE8: // SET 5,B
-            return SET_r8(cpu, 5, B);
+            return SET_r8(cpu, B, 5);
         case 0xE9: // SET 5,C
-            return SET_r8(cpu, 5, C);
+            return SET_r8(cpu, C, 5);
         case 0xEA: // SET 5,D
-            return SET_r8(cpu, 5, D);
+            return SET_r8(cpu, D, 5);
         case 0xEB: // SET 5,E
-            return SET_r8(cpu, 5, E);
+            return SET_r8(cpu, E, 5);
         case 0xEC: // SET 5,H
-            return SET_r8(cpu, 5, H);
+            return SET_r8(cpu, H, 5);
         case 0xED: // SET 5,L
-            return SET_r8(cpu, 5, L);
+            return SET_r8(cpu, L, 5);
         case 0xEE: // SET 5,(HL)
             return SET_HL(cpu, 5);
         case 0xEF: // SET 5,A
-            return SET_r8(cpu, 5, A);
+            return SET_r8(cpu, A, 5);
         case 0xF0: // SET 6,B
-            return SET_r8(cpu, 6, B);
+            return SET_r8(cpu, B, 6);
         case 0xF1: // SET 6,C
-            return SET_r8(cpu, 6, C);
+            return SET_r8(cpu, C, 6);
         case 0xF2: // SET 6,D
-            return SET_r8(cpu, 6, D);
+            return SET_r8(cpu, D, 6);
         case 0xF3: // SET 6,E
-            return SET_r8(cpu, 6, E);
+            return SET_r8(cpu, E, 6);
         case 0xF4: // SET 6,H
-            return SET_r8(cpu, 6, H);
+            return SET_r8(cpu, H, 6);
         case 0xF5: // SET 6,L
-            return SET_r8(cpu, 6, L);
+            return SET_r8(cpu, L, 6);
         case 0xF6: // SET 6,(HL)
             return SET_HL(cpu, 6);
         case 0xF7: // SET 6,A
-            return SET_r8(cpu, 6, A);
+            return SET_r8(cpu, A, 6);
         case 0xF8: // SET 7,B
-            return SET_r8(cpu, 7, B);
+            return SET_r8(cpu, B, 7);
         case 0xF9: // SET 7,C
-            return SET_r8(cpu, 7, C);
+            return SET_r8(cpu, C, 7);
         case 0xFA: // SET 7,D
-            return SET_r8(cpu, 7, D);
+            return SET_r8(cpu, D, 7);
         case 0xFB: // SET 7,E
-            return SET_r8(cpu, 7, E);
+            return SET_r8(cpu, E, 7);
         case 0xFC: // SET 7,H
-            return SET_r8(cpu, 7, H);
+            return SET_r8(cpu, H, 7);
         case 0xFD: // SET 7,L
-            return SET_r8(cpu, 7, L);
+            return SET_r8(cpu, L, 7);
         case 0xFE: // SET 7,(HL)
             return SET_HL(cpu, 7);
         case 0xFF: // SET 7,A
-            return SET_r8(cpu, 7, A);
+            return SET_r8(cpu, A, 7);
         default:
             break;
         }
@@ -1301,17 +2127,14 @@ int LD_r8_r8(cpu_t *cpu, reg_8bits_t reg_dest, reg_8bits_t reg_src)
 }
 int LD_r8_n8(cpu_t *cpu, reg_8bits_t reg_dest) 
 {
-    uint8_t Z = read_memory(cpu, cpu->PC);
-    cpu->PC ++;
+    uint8_t Z = fetch_8(cpu);
     set_8bit_register(cpu, reg_dest, Z);
     return 2;
 }
 
 int LD_r16_n16(cpu_t *cpu, uint16_t *reg)
 {
-    uint8_t Z = read_memory(cpu, cpu->PC); cpu->PC++;
-    uint8_t W = read_memory(cpu, cpu->PC); cpu->PC++;
-    *reg = unsigned_16(W, Z);
+    *reg = fetch_16(cpu);
     return 3;
 }
 int LD_HL_r8(cpu_t *cpu, reg_8bits_t reg)
@@ -1321,14 +2144,14 @@ int LD_HL_r8(cpu_t *cpu, reg_8bits_t reg)
 }
 int LD_HL_n8(cpu_t *cpu)
 {
-    uint8_t Z = read_memory(cpu, cpu->PC); cpu->PC++;
+    uint8_t Z = fetch_8(cpu);
     write_memory(cpu, *cpu->registers->HL, Z);
     return 3; 
 }
 int LD_r8_HL(cpu_t *cpu, reg_8bits_t reg_dest) 
 {
     set_8bit_register(cpu, reg_dest, read_memory(cpu, *cpu->registers->HL));
-    return 1;
+    return 2;
 }
 int LD_r16_A(cpu_t *cpu, uint16_t *reg)
 {
@@ -1337,21 +2160,19 @@ int LD_r16_A(cpu_t *cpu, uint16_t *reg)
 }
 int LD_n16_A(cpu_t *cpu)
 {
-    uint8_t Z = read_memory(cpu, cpu->PC); cpu->PC++;
-    uint8_t W = read_memory(cpu, cpu->PC); cpu->PC++;
-    write_memory(cpu, unsigned_16(W,Z), get_8bit_register(cpu, A));
+    uint16_t WZ = fetch_16(cpu);
+    write_memory(cpu, WZ, get_8bit_register(cpu, A));
     return 4;    
 }
 int LDH_n8_A(cpu_t *cpu) 
 {
-    uint8_t Z = read_memory(cpu, cpu->PC); cpu->PC++;
+    uint8_t Z = fetch_8(cpu);
     write_memory(cpu, unsigned_16(0xFF,Z), get_8bit_register(cpu, A));
     return 3;
 }
 int LDH_C_A(cpu_t *cpu)
 {
     write_memory(cpu, unsigned_16(0xFF, get_8bit_register(cpu, C)), get_8bit_register(cpu, A));
-    cpu->PC++;
     return 2;
 }
 int LD_A_r16(cpu_t *cpu, uint16_t *reg)
@@ -1363,9 +2184,8 @@ int LD_A_r16(cpu_t *cpu, uint16_t *reg)
 }
 int LD_A_n16(cpu_t *cpu)
 {
-    uint8_t Z = read_memory(cpu, cpu->PC); cpu->PC++;
-    uint8_t W = read_memory(cpu, cpu->PC); cpu->PC++;
-    Z = read_memory(cpu, unsigned_16(W,Z));
+    uint16_t WZ = fetch_16(cpu);
+    uint8_t Z = read_memory(cpu, WZ);
     set_8bit_register(cpu, A, Z);
     return 4;
 }
@@ -1379,30 +2199,30 @@ int LDH_A_C(cpu_t *cpu)
 
 int LDH_A_n16(cpu_t *cpu)
 {
-    uint8_t n = read_memory(cpu, cpu->PC); cpu->PC++;
+    uint8_t n = fetch_8(cpu);
     set_8bit_register(cpu, A, read_memory(cpu, unsigned_16(0xFF, n)));
     return 3;
 }
 
 int LD_HLI_A(cpu_t *cpu)
 {
-    write_memory(cpu, *cpu->registers->HL, get_8bit_register(cpu, A)); cpu->registers->HL++;
+    write_memory(cpu, *cpu->registers->HL, get_8bit_register(cpu, A)); (*cpu->registers->HL)++;
     return 2;
 }
 int LD_HLD_A(cpu_t *cpu)
 {
-    write_memory(cpu, *cpu->registers->HL, get_8bit_register(cpu, A)); cpu->registers->HL--;
+    write_memory(cpu, *cpu->registers->HL, get_8bit_register(cpu, A)); (*cpu->registers->HL)--;
     return 2;
 }
 int LD_A_HLI(cpu_t *cpu)
 {
-    uint8_t Z = read_memory(cpu, *cpu->registers->HL); cpu->registers->HL++;
+    uint8_t Z = read_memory(cpu, *cpu->registers->HL); (*cpu->registers->HL)++;
     set_8bit_register(cpu, A, Z);
     return 2;
 }
 int LD_A_HLD(cpu_t *cpu)
 {
-    uint8_t Z = read_memory(cpu, *cpu->registers->HL); cpu->registers->HL--;
+    uint8_t Z = read_memory(cpu, *cpu->registers->HL); (*cpu->registers->HL)--;
     set_8bit_register(cpu, A, Z);
     return 2;
 }
@@ -1414,8 +2234,7 @@ int ADC_r8(cpu_t *cpu, reg_8bits_t reg)
 {
     uint8_t a = get_8bit_register(cpu,A);
     uint8_t r = get_8bit_register(cpu,reg);
-    uint8_t carry = get_flag(cpu, CARRY) ? 1 : 0;
-    operation_result_t result = add(a, r + carry);
+    operation_result_t result = add_carry(a, r, get_flag(cpu, CARRY));
     set_8bit_register(cpu, A, result.result);
     if (result.result == 0)
     {
@@ -1444,10 +2263,8 @@ int ADC_r8(cpu_t *cpu, reg_8bits_t reg)
 int ADC_HL(cpu_t *cpu)
 {
     uint8_t Z = read_memory(cpu, *cpu->registers->HL);
-    uint8_t A = get_8bit_register(cpu, A);
-    uint8_t carry = get_flag(cpu, CARRY) ? 1: 0;
-    operation_result_t result = add(A, Z + carry);
-    set_8bit_register(cpu, A, result .result);
+    operation_result_t result = add_carry(get_8bit_register(cpu, A), Z, get_flag(cpu, CARRY));
+    set_8bit_register(cpu, A, result.result);
     if (result.result == 0)
     {
         set_flag(cpu, ZERO, 1);
@@ -1474,8 +2291,8 @@ int ADC_HL(cpu_t *cpu)
 }
 int ADC_n8(cpu_t *cpu)
 {
-    uint8_t Z = read_memory(cpu, cpu->PC); cpu->PC++;
-    operation_result_t result = add(get_8bit_register(cpu, A), Z + (uint8_t)get_flag(cpu, CARRY));
+    uint8_t Z = fetch_8(cpu);
+    operation_result_t result = add_carry(get_8bit_register(cpu, A), Z, get_flag(cpu, CARRY));
     set_8bit_register(cpu, A, result.result);
     result.result == 0 ? set_flag(cpu, ZERO, 1) : set_flag(cpu, ZERO, 0);
     result.carry ? set_flag(cpu, CARRY, 1) : set_flag(cpu, CARRY, 0);
@@ -1486,7 +2303,7 @@ int ADC_n8(cpu_t *cpu)
 int ADD_r8(cpu_t *cpu, reg_8bits_t reg)
 {
     uint8_t a = get_8bit_register(cpu,A);
-    uint8_t r = get_8bit_register(cpu,r);
+    uint8_t r = get_8bit_register(cpu,reg);
     operation_result_t result = add(a, r);
     set_8bit_register(cpu, A, result.result);
     if (result.result == 0)
@@ -1510,14 +2327,14 @@ int ADD_r8(cpu_t *cpu, reg_8bits_t reg)
     {
         set_flag(cpu, CARRY, 0);   
     }
+    set_flag(cpu, SUB, 0);
     return 1;
 }
 int ADD_HL(cpu_t *cpu)
 {
     uint8_t Z = read_memory(cpu, *cpu->registers->HL);
-    uint8_t A = get_8bit_register(cpu, A);
-    operation_result_t result = add(A, Z);
-    set_8bit_register(cpu, A, result .result);
+    operation_result_t result = add(get_8bit_register(cpu, A), Z);
+    set_8bit_register(cpu, A, result.result);
     if (result.result == 0)
     {
         set_flag(cpu, ZERO, 1);
@@ -1544,7 +2361,7 @@ int ADD_HL(cpu_t *cpu)
 }
 int ADD_n8(cpu_t *cpu)
 {
-    uint8_t Z = read_memory(cpu, cpu->PC); cpu->PC++;
+    uint8_t Z = fetch_8(cpu);
     operation_result_t result = add(get_8bit_register(cpu, A), Z);
     set_8bit_register(cpu, A, result.result);
     result.result == 0 ? set_flag(cpu, ZERO, 1) : set_flag(cpu, ZERO, 0);
@@ -1586,8 +2403,7 @@ int CP_r8(cpu_t *cpu, reg_8bits_t reg)
 int CP_HL(cpu_t *cpu)
 {
     uint8_t Z = read_memory(cpu, *cpu->registers->HL);
-    uint8_t A = get_8bit_register(cpu, A);
-    operation_result_t result = sub(A, Z);
+    operation_result_t result = sub(get_8bit_register(cpu, A), Z);
     if (result.result == 0)
     {
         set_flag(cpu, ZERO, 1);
@@ -1614,7 +2430,7 @@ int CP_HL(cpu_t *cpu)
 }
 int CP_n8(cpu_t *cpu)
 {
-    uint8_t Z = read_memory(cpu, cpu->PC); cpu->PC++;
+    uint8_t Z = fetch_8(cpu);
     operation_result_t result = sub(get_8bit_register(cpu, A), Z);
     result.result == 0 ? set_flag(cpu, ZERO, 1) : set_flag(cpu, ZERO, 0);
     result.carry ? set_flag(cpu, CARRY, 1) : set_flag(cpu, CARRY, 0);
@@ -1646,7 +2462,25 @@ int DEC_r8(cpu_t *cpu, reg_8bits_t reg)
 }
 int DEC_HL(cpu_t *cpu)
 {
-    return DEC_r16(cpu, cpu->registers->HL);   
+    uint8_t Z = read_memory(cpu, *cpu->registers->HL);
+    operation_result_t result = sub(Z, 1);
+    if (result.halfcarry) 
+    {
+        set_flag(cpu, HALF_CARRY, 1);
+    } else
+    {
+        set_flag(cpu, HALF_CARRY, 0);    
+    }
+    if (result.result == 0)
+    {
+        set_flag(cpu, ZERO, 1);
+    } else 
+    {
+        set_flag(cpu, ZERO, 0);    
+    }
+    set_flag(cpu, SUB, 1);
+    write_memory(cpu, *cpu->registers->HL, result.result);
+    return 3;
 }
 int INC_r8(cpu_t *cpu, reg_8bits_t reg)
 {
@@ -1698,8 +2532,7 @@ int SBC_r8(cpu_t *cpu, reg_8bits_t reg)
 {
     uint8_t a = get_8bit_register(cpu,A);
     uint8_t r = get_8bit_register(cpu,reg);
-    uint8_t carry = get_flag(cpu, CARRY);
-    operation_result_t result = sub(a, r + carry); // Peut etre un pb si r = 0xFF et carry =1 ?? TODO
+    operation_result_t result = sub_carry(a, r, get_flag(cpu, CARRY));
     set_8bit_register(cpu, A, result.result);
     if (result.result == 0)
     {
@@ -1729,8 +2562,7 @@ int SBC_HL(cpu_t *cpu)
 {
     uint8_t a = get_8bit_register(cpu,A);
     uint8_t r = read_memory(cpu, *cpu->registers->HL);
-    uint8_t carry = get_flag(cpu, CARRY);
-    operation_result_t result = sub(a, r + carry); // Peut etre un pb si r = 0xFF et carry =1 ?? TODO
+    operation_result_t result = sub_carry(a, r, get_flag(cpu, CARRY));
     set_8bit_register(cpu, A, result.result);
     if (result.result == 0)
     {
@@ -1754,12 +2586,12 @@ int SBC_HL(cpu_t *cpu)
         set_flag(cpu, CARRY, 0);   
     }
     set_flag(cpu, SUB, 1);
-    return 4;
+    return 2;
 }
 int SBC_n8(cpu_t *cpu)
 {
-    uint8_t Z = read_memory(cpu, cpu->PC); cpu->PC++;
-    operation_result_t r = sub(A, Z + get_flag(cpu, CARRY));
+    uint8_t Z = fetch_8(cpu);
+    operation_result_t r = sub_carry(get_8bit_register(cpu, A), Z, get_flag(cpu, CARRY));
     set_8bit_register(cpu, A, r.result);
     if (r.result == 0)
     {
@@ -1844,7 +2676,7 @@ int SUB_HL(cpu_t *cpu)
 }
 int SUB_n8(cpu_t *cpu)
 {
-    uint8_t n = read_memory(cpu, cpu->PC); cpu->PC++;
+    uint8_t n = fetch_8(cpu);
     operation_result_t result = sub(get_8bit_register(cpu, A), n);
     set_8bit_register(cpu, A, (uint8_t)result.result);
     result.result == 0 ? set_flag(cpu, ZERO, 1) : set_flag(cpu, ZERO, 0);
@@ -1911,8 +2743,9 @@ int AND_HL(cpu_t *cpu)
 }
 int AND_n8(cpu_t *cpu)
 {
-    uint8_t Z = read_memory(cpu, cpu->PC); cpu->PC++;
+    uint8_t Z = fetch_8(cpu);
     uint8_t result = get_8bit_register(cpu, A) & Z;
+    set_8bit_register(cpu, A, result);
     result == 0 ? set_flag(cpu, ZERO, 1) : set_flag(cpu, ZERO, 0);
     set_flag(cpu, CARRY, 0);
     set_flag(cpu, HALF_CARRY, 1);
@@ -1939,7 +2772,7 @@ int OR_r8(cpu_t *cpu, reg_8bits_t reg)
     {
         set_flag(cpu, ZERO, 0);
     }
-    set_flag(cpu, HALF_CARRY, 1);
+    set_flag(cpu, HALF_CARRY, 0);
     set_flag(cpu, SUB, 0);
     set_flag(cpu, CARRY, 0);
     return 1;
@@ -1956,7 +2789,7 @@ int OR_HL(cpu_t *cpu)
     {
         set_flag(cpu, ZERO, 0);
     }
-    set_flag(cpu, HALF_CARRY, 1);
+    set_flag(cpu, HALF_CARRY, 0);
     set_flag(cpu, SUB, 0);
     set_flag(cpu, CARRY, 0);
     return 2;
@@ -1964,8 +2797,9 @@ int OR_HL(cpu_t *cpu)
 }
 int OR_n8(cpu_t *cpu)
 {
-    uint8_t Z = read_memory(cpu, cpu->PC); cpu->PC++;
+    uint8_t Z = fetch_8(cpu);
     uint8_t result = get_8bit_register(cpu, A) | Z;
+    set_8bit_register(cpu, A, result);
     result == 0 ? set_flag(cpu, ZERO, 1) : set_flag(cpu, ZERO, 0);
     set_flag(cpu, CARRY, 0);
     set_flag(cpu, HALF_CARRY, 0);
@@ -1983,7 +2817,7 @@ int XOR_r8(cpu_t *cpu, reg_8bits_t reg)
     {
         set_flag(cpu, ZERO, 0);
     }
-    set_flag(cpu, HALF_CARRY, 1);
+    set_flag(cpu, HALF_CARRY, 0);
     set_flag(cpu, SUB, 0);
     set_flag(cpu, CARRY, 0);
     return 1;
@@ -2000,7 +2834,7 @@ int XOR_HL(cpu_t *cpu)
     {
         set_flag(cpu, ZERO, 0);
     }
-    set_flag(cpu, HALF_CARRY, 1);
+    set_flag(cpu, HALF_CARRY, 0);
     set_flag(cpu, SUB, 0);
     set_flag(cpu, CARRY, 0);
     return 2;
@@ -2008,8 +2842,9 @@ int XOR_HL(cpu_t *cpu)
 }
 int XOR_n8(cpu_t *cpu)
 {
-    uint8_t Z = read_memory(cpu, cpu->PC); cpu->PC++;
+    uint8_t Z = fetch_8(cpu);
     uint8_t result = get_8bit_register(cpu, A) ^ Z;
+    set_8bit_register(cpu, A, result);
     result == 0 ? set_flag(cpu, ZERO, 1) : set_flag(cpu, ZERO, 0);
     set_flag(cpu, CARRY, 0);
     set_flag(cpu, HALF_CARRY, 0);
@@ -2053,12 +2888,12 @@ int RES_r8(cpu_t *cpu, reg_8bits_t reg, uint8_t b)
 }
 int RES_HL(cpu_t *cpu, uint8_t b)
 {
-    write_memory(cpu, *cpu->registers->HL, (read_memory(cpu, *cpu->registers->HL) | ~(1 << b)));
+    write_memory(cpu, *cpu->registers->HL, (read_memory(cpu, *cpu->registers->HL) & ~(1 << b)));
     return 4;
 }
 int SET_r8(cpu_t *cpu, reg_8bits_t reg, uint8_t b)
 {
-    set_8bit_register(cpu, reg,(get_8bit_register(cpu, reg) & (1 << b)));
+    set_8bit_register(cpu, reg,(get_8bit_register(cpu, reg) | (1 << b)));
     return 2;
 }
 int SET_HL(cpu_t *cpu, uint8_t b)
@@ -2350,7 +3185,7 @@ int SLA_r8(cpu_t *cpu, reg_8bits_t reg)
     {
         set_flag(cpu, ZERO, 0);
     }
-    if (b7 == 0)
+    if (b7 == 1)
     {
         set_flag(cpu, CARRY, 1);
     } else
@@ -2373,7 +3208,7 @@ int SLA_HL(cpu_t *cpu)
     {
         set_flag(cpu, ZERO, 0);
     }
-    if (b7 == 0)
+    if (b7 == 1)
     {
         set_flag(cpu, CARRY, 1);
     } else
@@ -2386,7 +3221,7 @@ int SRA_r8(cpu_t *cpu, reg_8bits_t reg)
 {
     uint8_t r = get_8bit_register(cpu, reg);
     int b0 = bit(0, r);
-    r = r>>1;
+    r = (r>>1) | (r & 0x80);
     set_8bit_register(cpu, reg, r);
     set_flag(cpu, HALF_CARRY, 0);
     set_flag(cpu, SUB, 0);
@@ -2396,7 +3231,7 @@ int SRA_r8(cpu_t *cpu, reg_8bits_t reg)
     {
         set_flag(cpu, ZERO, 0);
     }
-    if (b0 == 0)
+    if (b0 == 1)
     {
         set_flag(cpu, CARRY, 1);
     } else
@@ -2409,7 +3244,7 @@ int SRA_HL(cpu_t *cpu)
 {
     uint8_t hl = read_memory(cpu, *cpu->registers->HL);
     int b0 = bit(0, hl);
-    hl = hl>>1;
+    hl = (hl>>1) | (hl & 0x80);
     write_memory(cpu, *cpu->registers->HL, hl);
     set_flag(cpu, HALF_CARRY, 0);
     set_flag(cpu, SUB, 0);
@@ -2419,7 +3254,7 @@ int SRA_HL(cpu_t *cpu)
     {
         set_flag(cpu, ZERO, 0);
     }
-    if (b0 == 0)
+    if (b0 == 1)
     {
         set_flag(cpu, CARRY, 1);
     } else
@@ -2520,9 +3355,7 @@ int SWAP_HL(cpu_t *cpu)
 // Jumps and subroutine instructions
 int CALL_n16(cpu_t *cpu)
 {
-    uint8_t nn_lsb = read_memory(cpu, cpu->PC); cpu->PC++;
-    uint8_t nn_msb = read_memory(cpu, cpu->PC); cpu->PC++;
-    uint16_t nn = unsigned_16(nn_msb, nn_lsb);
+    uint16_t nn = fetch_16(cpu);
     cpu->SP--;
     write_memory(cpu, cpu->SP, msb(cpu->PC)); cpu->SP--;
     write_memory(cpu, cpu->SP, lsb(cpu->PC));
@@ -2532,9 +3365,7 @@ int CALL_n16(cpu_t *cpu)
 
 int CALL_cc_n16(cpu_t *cpu, bool cc)
 {
-    uint8_t nn_lsb = read_memory(cpu, cpu->PC); cpu->PC++;
-    uint8_t nn_msb = read_memory(cpu, cpu->PC); cpu->PC++;
-    uint16_t nn = unsigned_16(nn_msb, nn_lsb);
+    uint16_t nn = fetch_16(cpu);
     if (cc)
     {
         cpu->SP--;
@@ -2553,17 +3384,13 @@ int JP_HL(cpu_t *cpu)
 }
 int JP_n16(cpu_t *cpu)
 {
-    uint8_t nn_lsb = read_memory(cpu, cpu->PC); cpu->PC++;
-    uint8_t nn_msb = read_memory(cpu, cpu->PC); cpu->PC++;
-    uint16_t nn = unsigned_16(nn_msb, nn_lsb);
+    uint16_t nn = fetch_16(cpu);
     cpu->PC = nn;
     return 4;
 }
 int JP_cc_n16(cpu_t *cpu, bool cc)
 {
-    uint8_t nn_lsb = read_memory(cpu, cpu->PC); cpu->PC++;
-    uint8_t nn_msb = read_memory(cpu, cpu->PC); cpu->PC++;
-    uint16_t nn = unsigned_16(nn_msb, nn_lsb);
+    uint16_t nn = fetch_16(cpu);
     if (cc) 
     {
         cpu->PC = nn;
@@ -2573,7 +3400,7 @@ int JP_cc_n16(cpu_t *cpu, bool cc)
 }
 int JR_e(cpu_t *cpu)
 {
-    uint8_t Z = read_memory(cpu, cpu->PC); cpu->PC++;
+    uint8_t Z = fetch_8(cpu);
     bool Z_sign = bit(7, Z);
     operation_result_t result = add(Z, lsb(cpu->PC));
     Z = result.result;
@@ -2591,7 +3418,7 @@ int JR_e(cpu_t *cpu)
 }
 int JR_cc_e(cpu_t *cpu, bool cc)
 {
-    uint8_t Z = read_memory(cpu, cpu->PC); cpu->PC++;
+    uint8_t Z = fetch_8(cpu);
     bool Z_sign = bit(7, Z);
     operation_result_t result = add(Z, lsb(cpu->PC));
     Z = result.result;
@@ -2666,7 +3493,7 @@ int SCF(cpu_t *cpu)
 // Stack manipulation instructions
 int ADD_SP_e8(cpu_t *cpu)
 {
-    uint8_t Z = read_memory(cpu, cpu->PC); cpu->PC++;
+    uint8_t Z = fetch_8(cpu);
     operation_result_t result = add(lsb(cpu->SP), Z);
     if (result.carry) {
         set_flag(cpu, CARRY, 1);    
@@ -2691,7 +3518,7 @@ int ADD_SP_e8(cpu_t *cpu)
         adj = 0x00;
     }
     uint8_t W = msb(cpu->SP) + adj + get_flag(cpu, CARRY);
-    uint16_t WZ = unsigned_16(W, Z);
+    uint16_t WZ = unsigned_16(W, result.result);
     cpu->SP = WZ;
     return 4;
 }
@@ -2709,9 +3536,7 @@ int INC_r16(cpu_t *cpu, uint16_t *reg)
 
 int LD_n16_SP(cpu_t *cpu)
 {
-    uint8_t Z = read_memory(cpu, cpu->PC); cpu->PC++;
-    uint8_t W = read_memory(cpu, cpu->PC); cpu->PC++;
-    uint16_t WZ = unsigned_16(W,Z);
+    uint16_t WZ = fetch_16(cpu);
 
     write_memory(cpu, WZ, lsb(cpu->SP)); WZ++;
     write_memory(cpu, WZ, msb(cpu->SP));
@@ -2724,7 +3549,7 @@ int LD_SP_HL(cpu_t *cpu)
 }
 int LD_HL_SP_e8(cpu_t *cpu)
 {
-    uint8_t Z = read_memory(cpu, cpu->PC); cpu->PC++;
+    uint8_t Z = fetch_8(cpu);
     operation_result_t result = add(lsb(cpu->SP), Z);
     set_8bit_register(cpu, L, result.result);
     if (result.carry) {
@@ -2760,6 +3585,13 @@ int POP_r16(cpu_t *cpu, uint16_t *reg)
     *reg = unsigned_16(W,Z);
     return 3;
 }
+int POP_AF(cpu_t *cpu)
+{
+    // The low nibble of F does not exist
+    POP_r16(cpu, cpu->registers->AF);
+    *cpu->registers->AF &= 0xFFF0;
+    return 3;
+}
 int PUSH_r16(cpu_t *cpu, uint16_t *reg)
 {
     cpu->SP--;
@@ -2784,7 +3616,41 @@ int HALT(cpu_t *cpu); //TODO
 
 
 // Miscellaneous instructions
-int DAA(cpu_t *cpu); //TODO
+int DAA(cpu_t *cpu)
+{
+    uint8_t a = get_8bit_register(cpu, A);
+    uint8_t adj = 0;
+    bool carry = get_flag(cpu, CARRY);
+    if (get_flag(cpu, SUB))
+    {
+        if (get_flag(cpu, HALF_CARRY))
+        {
+            adj |= 0x06;
+        }
+        if (carry)
+        {
+            adj |= 0x60;
+        }
+        a -= adj;
+    } else
+    {
+        if (get_flag(cpu, HALF_CARRY) || (a & 0x0F) > 0x09)
+        {
+            adj |= 0x06;
+        }
+        if (carry || a > 0x99)
+        {
+            adj |= 0x60;
+            carry = true;
+        }
+        a += adj;
+    }
+    set_8bit_register(cpu, A, a);
+    set_flag(cpu, ZERO, a == 0);
+    set_flag(cpu, HALF_CARRY, 0);
+    set_flag(cpu, CARRY, carry);
+    return 1;
+}
 int NOP(cpu_t *cpu)
 {
     return 1;
@@ -2800,7 +3666,7 @@ int STOP(cpu_t *cpu); //No licensed rom makes use of STOP outside of CGB speed s
 
 uint16_t unsigned_16(uint8_t msb, uint8_t lsb)
 {
-    return (((uint16_t) msb)<<8) & lsb; 
+    return (((uint16_t) msb)<<8) | lsb; 
 }
 
 uint8_t lsb(uint16_t u) 
@@ -2833,7 +3699,7 @@ operation_result_t add_16(uint16_t a, uint16_t b)
     uint16_t result = a + b;
     uint32_t result32 = (uint32_t) a + (uint32_t) b;
     bool carry = result32 > UINT16_MAX; 
-    bool halfcarry = ((a & 0x00FF) + (b & 0x00FF))>0x00FF;
+    bool halfcarry = ((a & 0x0FFF) + (b & 0x0FFF))>0x0FFF;
     operation_result_t output = {
         result,
         carry,
@@ -2842,6 +3708,20 @@ operation_result_t add_16(uint16_t a, uint16_t b)
     return output;
 }
 
+/**
+ * a + b + carry, with the carries out of bits 3 and 7 of the whole sum
+ */
+operation_result_t add_carry(uint8_t a, uint8_t b, bool carry)
+{
+    uint16_t result16 = (uint16_t) a + (uint16_t) b + carry;
+    operation_result_t output = {
+        (uint8_t) result16,
+        result16 > UINT8_MAX,
+        ((a & 0x0F) + (b & 0x0F) + carry) > 0x0F
+    };
+    return output;
+}
+
 operation_result_t sub(uint8_t a, uint8_t b)
 {
     uint8_t result = a - b;
@@ -2855,6 +3735,18 @@ operation_result_t sub(uint8_t a, uint8_t b)
     };
     return output;
 }
+/**
+ * a - b - carry, with the borrows into bits 3 and 7
+ */
+operation_result_t sub_carry(uint8_t a, uint8_t b, bool carry)
+{
+    operation_result_t output = {
+        (uint8_t) (a - b - carry),
+        (int) b + carry > a,
+        (int) (b & 0x0F) + carry > (a & 0x0F)
+    };
+    return output;
+}
 /**
  * @i: bit position in the uint_8
  */
@@ -39,6 +39,66 @@ typedef struct Registers
 
 
 
+// Idioms execute_next_instruction can run as a single fused handler.
+// cpu->fusion holds the enabled set. The three are picked by hand as the
+// usual copy, countdown and register poll loops; start_opcode_profile on a
+// real ROM (see bench_opcode_pairs) is how to check they are worth it.
+typedef enum Fusion
+{
+    FUSE_NONE        = 0,
+    FUSE_COPY_HLI_DE = 1 << 0, // LD A,(HL+); LD (DE),A; INC DE
+    FUSE_DEC_JR_NZ   = 1 << 1, // DEC r; JR NZ,e
+    FUSE_POLL_LDH_CP = 1 << 2, // LDH A,(n); CP n; JR NZ,e
+    FUSE_ALL         = FUSE_COPY_HLI_DE | FUSE_DEC_JR_NZ | FUSE_POLL_LDH_CP
+} fusion_t;
+
+
+// Idle loop detection: the longest loop body considered and how many
+// timing-register reads it may contain.
+#define IDLE_MAX_LOOP_BYTES 16
+#define IDLE_MAX_POLLS      4
+
+// Last short backward loop seen by the idle detector.
+typedef struct IdleLoop
+{
+    bool valid;
+    bool idle;                  // side-effect free, only reads constant or timing-derived memory
+    uint16_t head;              // PC of the first instruction of the loop
+    uint16_t branch_pc;         // PC of the instruction that jumped back to head
+    uint16_t AF;                // AF when last at head
+    uint16_t BC, DE, HL;        // Read addresses were decoded from these
+    uint64_t head_cycle;        // cpu->cycles when last at head
+    uint64_t input_changes;     // joypad->changes when last at head
+    uint8_t length;             // cycles of one iteration, closing branch taken
+    uint8_t poll_count;
+    uint16_t poll_address[IDLE_MAX_POLLS];
+    uint8_t poll_offset[IDLE_MAX_POLLS];    // cycles from head to the read
+} idle_loop_t;
+
+
+// Host view of the memory region PC is currently executing from.
+// Opcodes and immediates are fetched straight from `base` while PC stays
+// inside [start, start + size); size == 0 means the window is empty.
+typedef struct FetchWindow
+{
+    const uint8_t *base;
+    uint16_t start;
+    uint16_t size;
+} fetch_window_t;
+
+
+// RAM covered by cpu->ram_hash: cartridge RAM, work RAM and high RAM
+#define RAM_HASH_START      0xA000
+#define RAM_HASH_END        0xE000
+#define HRAM_HASH_START     0xFF80
+#define HRAM_HASH_END       0xFFFF
+
+
+struct Ppu;
+struct Apu;
+struct Joypad;
+struct Coverage;
+
 typedef struct cpu
 {
     registers_t *registers;
@@ -47,6 +107,23 @@ typedef struct cpu
     uint16_t SP;
     bool IME;
     bool IME_pending;
+    fetch_window_t fetch;
+    unsigned int fusion;
+    uint32_t *opcode_pairs;     // 256x256 pair counts, NULL when not profiling
+    uint8_t previous_opcode;
+    uint64_t cycles;            // M-cycles executed through execute_next_instruction
+    struct Ppu *ppu;            // Owner of the LCD registers, NULL for a bare bus
+    struct Apu *apu;            // Owner of the sound registers, NULL for a bare bus
+    struct Joypad *joypad;      // Owner of P1, NULL for a bare bus
+    struct Coverage *coverage;  // Execution coverage, owned by the caller, NULL when not tracking
+    bool idle_skip;
+    uint64_t idle_limit;        // An idle loop skip never runs past this cycle
+    idle_loop_t idle_loop;
+    // XOR over the hashed RAM of one key per (address, value), kept up to
+    // date by write_memory. Writes straight to memorybus must be followed by
+    // rehash_ram.
+    bool ram_hashing;
+    uint64_t ram_hash;
 } cpu_t;
 
 
@@ -73,9 +150,23 @@ void free_cpu(cpu_t *cpu);
 
 
 uint8_t read_memory(cpu_t *cpu, uint16_t address);
+uint8_t peek_memory(cpu_t *cpu, uint16_t address);
 void write_memory(cpu_t *cpu, uint16_t address, uint8_t value);
+void request_interrupt(cpu_t *cpu, uint8_t interrupts);
+uint64_t compute_ram_hash(cpu_t *cpu);
+void rehash_ram(cpu_t *cpu);
+
+uint8_t fetch_8(cpu_t *cpu);
+uint16_t fetch_16(cpu_t *cpu);
+void invalidate_fetch_window(cpu_t *cpu);
 
 int execute_instruction(cpu_t *cpu, uint8_t instruction_byte, bool prefixed);
+int execute_fused_instruction(cpu_t *cpu, uint8_t instruction_byte);
+int skip_idle_loop(cpu_t *cpu, uint16_t branch_pc);
+
+int start_opcode_profile(cpu_t *cpu);
+void stop_opcode_profile(cpu_t *cpu);
+void print_top_opcode_pairs(cpu_t *cpu, int count);
 
 
 // =================================================================================
@@ -203,7 +294,6 @@ int CCF(cpu_t *cpu);
 int SCF(cpu_t *cpu);
 
 // Stack manipulation instructions
-int ADD_HL_Sp(cpu_t *cpu);
 int ADD_SP_e8(cpu_t *cpu);
 int DEC_SP(cpu_t *cpu);
 int INC_SP(cpu_t *cpu);
@@ -212,7 +302,7 @@ int LD_SP_HL(cpu_t *cpu);
 int LD_HL_SP_e8(cpu_t *cpu);
 int POP_r16(cpu_t *cpu, uint16_t *reg);
 int PUSH_r16(cpu_t *cpu, uint16_t *reg);
-int PUSH_AF(cpu_t *cpu);
+int POP_AF(cpu_t *cpu);
 
 // Interrupt-related instructions
 int DI(cpu_t *cpu);
@@ -237,8 +327,10 @@ bool compute_halfcarry_sub(uint8_t a, uint8_t b);
 uint16_t unsigned_16(uint8_t msb, uint8_t lsb);
 operation_result_t add(uint8_t a, uint8_t b);
 operation_result_t add_16(uint16_t a, uint16_t b);
+operation_result_t add_carry(uint8_t a, uint8_t b, bool carry);
 
 operation_result_t sub(uint8_t a, uint8_t b);
+operation_result_t sub_carry(uint8_t a, uint8_t b, bool carry);
 int bit(int i, uint8_t n);
 uint8_t lsb(uint16_t u);
 uint8_t msb(uint16_t u);
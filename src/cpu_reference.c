@@ -0,0 +1,743 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "cpu_reference.h"
+#include "ppu.h"
+
+
+#define FLAG_Z  0x80
+#define FLAG_N  0x40
+#define FLAG_H  0x20
+#define FLAG_C  0x10
+
+
+// =================================================================================
+//                          Bus
+// =================================================================================
+
+static uint8_t read8(reference_cpu_t *cpu, uint16_t address)
+{
+    return cpu->memory[address];
+}
+
+// As write_memory on a bare bus: a write to DMA copies a page to OAM at once
+static void write8(reference_cpu_t *cpu, uint16_t address, uint8_t value)
+{
+    if (address == DMA_REGISTER)
+    {
+        memmove(&cpu->memory[0xFE00], &cpu->memory[value << 8], 0xA0);
+    }
+    cpu->memory[address] = value;
+}
+
+static uint8_t immediate8(reference_cpu_t *cpu)
+{
+    return read8(cpu, cpu->pc++);
+}
+
+static uint16_t immediate16(reference_cpu_t *cpu)
+{
+    uint8_t low = immediate8(cpu);
+    return low | immediate8(cpu) << 8;
+}
+
+static void push16(reference_cpu_t *cpu, uint16_t value)
+{
+    write8(cpu, --cpu->sp, value >> 8);
+    write8(cpu, --cpu->sp, value & 0xFF);
+}
+
+static uint16_t pop16(reference_cpu_t *cpu)
+{
+    uint8_t low = read8(cpu, cpu->sp++);
+    return low | read8(cpu, cpu->sp++) << 8;
+}
+
+
+// =================================================================================
+//                          Operands
+// =================================================================================
+
+static uint16_t get_hl(reference_cpu_t *cpu)
+{
+    return cpu->h << 8 | cpu->l;
+}
+
+static void set_hl(reference_cpu_t *cpu, uint16_t value)
+{
+    cpu->h = value >> 8;
+    cpu->l = value & 0xFF;
+}
+
+// Register field of an opcode: B C D E H L (HL) A
+static uint8_t get_r(reference_cpu_t *cpu, uint8_t r)
+{
+    uint8_t *registers[8] = {&cpu->b, &cpu->c, &cpu->d, &cpu->e, &cpu->h, &cpu->l, NULL, &cpu->a};
+    return r == 6 ? read8(cpu, get_hl(cpu)) : *registers[r];
+}
+
+static void set_r(reference_cpu_t *cpu, uint8_t r, uint8_t value)
+{
+    uint8_t *registers[8] = {&cpu->b, &cpu->c, &cpu->d, &cpu->e, &cpu->h, &cpu->l, NULL, &cpu->a};
+    if (r == 6)
+    {
+        write8(cpu, get_hl(cpu), value);
+        return;
+    }
+    *registers[r] = value;
+}
+
+// Register pair field: BC DE HL, then SP, or AF for PUSH and POP
+static uint16_t get_rp(reference_cpu_t *cpu, uint8_t p, bool af)
+{
+    switch (p)
+    {
+    case 0:
+        return cpu->b << 8 | cpu->c;
+    case 1:
+        return cpu->d << 8 | cpu->e;
+    case 2:
+        return get_hl(cpu);
+    default:
+        return af ? cpu->a << 8 | cpu->f : cpu->sp;
+    }
+}
+
+static void set_rp(reference_cpu_t *cpu, uint8_t p, bool af, uint16_t value)
+{
+    switch (p)
+    {
+    case 0:
+        cpu->b = value >> 8;
+        cpu->c = value & 0xFF;
+        break;
+    case 1:
+        cpu->d = value >> 8;
+        cpu->e = value & 0xFF;
+        break;
+    case 2:
+        set_hl(cpu, value);
+        break;
+    default:
+        if (af)
+        {
+            cpu->a = value >> 8;
+            cpu->f = value & 0xF0;
+        }
+        else
+        {
+            cpu->sp = value;
+        }
+        break;
+    }
+}
+
+// Condition field: NZ Z NC C
+static bool condition(reference_cpu_t *cpu, uint8_t cc)
+{
+    bool set = cpu->f & (cc & 2 ? FLAG_C : FLAG_Z);
+    return cc & 1 ? set : !set;
+}
+
+
+// =================================================================================
+//                          Operations
+// =================================================================================
+
+// ADD ADC SUB SBC AND XOR OR CP of `value` into A
+static void alu(reference_cpu_t *cpu, uint8_t operation, uint8_t value)
+{
+    int a = cpu->a;
+    int carry = operation == 1 || operation == 3 ? (cpu->f & FLAG_C) != 0 : 0;
+    int result;
+    uint8_t f;
+    switch (operation)
+    {
+    case 0:
+    case 1:
+        result = a + value + carry;
+        f = ((a & 0x0F) + (value & 0x0F) + carry > 0x0F ? FLAG_H : 0) | (result > 0xFF ? FLAG_C : 0);
+        break;
+    case 2:
+    case 3:
+    case 7:
+        result = a - value - carry;
+        f = FLAG_N | ((a & 0x0F) - (value & 0x0F) - carry < 0 ? FLAG_H : 0) | (result < 0 ? FLAG_C : 0);
+        break;
+    case 4:
+        result = a & value;
+        f = FLAG_H;
+        break;
+    case 5:
+        result = a ^ value;
+        f = 0;
+        break;
+    default:
+        result = a | value;
+        f = 0;
+        break;
+    }
+    cpu->f = f | ((result & 0xFF) == 0 ? FLAG_Z : 0);
+    if (operation != 7)
+    {
+        cpu->a = result & 0xFF;
+    }
+}
+
+// RLC RRC RL RR SLA SRA SWAP SRL of `value`, setting all four flags
+static uint8_t rotate(reference_cpu_t *cpu, uint8_t operation, uint8_t value)
+{
+    int carry_in = (cpu->f & FLAG_C) != 0;
+    int carry = operation & 1 ? value & 1 : value >> 7;
+    uint8_t result;
+    switch (operation)
+    {
+    case 0:
+        result = value << 1 | value >> 7;
+        break;
+    case 1:
+        result = value >> 1 | value << 7;
+        break;
+    case 2:
+        result = value << 1 | carry_in;
+        break;
+    case 3:
+        result = value >> 1 | carry_in << 7;
+        break;
+    case 4:
+        result = value << 1;
+        break;
+    case 5:
+        result = value >> 1 | (value & 0x80);
+        break;
+    case 6:
+        result = value << 4 | value >> 4;
+        carry = 0;
+        break;
+    default:
+        result = value >> 1;
+        break;
+    }
+    cpu->f = (result == 0 ? FLAG_Z : 0) | (carry ? FLAG_C : 0);
+    return result;
+}
+
+// SP plus a signed immediate, with H and C from the unsigned low byte sum
+static uint16_t sp_offset(reference_cpu_t *cpu)
+{
+    uint8_t e = immediate8(cpu);
+    cpu->f = ((cpu->sp & 0x0F) + (e & 0x0F) > 0x0F ? FLAG_H : 0)
+             | ((cpu->sp & 0xFF) + e > 0xFF ? FLAG_C : 0);
+    return cpu->sp + (int8_t)e;
+}
+
+static void daa(reference_cpu_t *cpu)
+{
+    uint8_t correction = 0;
+    bool carry = cpu->f & FLAG_C;
+    if (cpu->f & FLAG_N)
+    {
+        correction = (cpu->f & FLAG_H ? 0x06 : 0) | (carry ? 0x60 : 0);
+        cpu->a -= correction;
+    }
+    else
+    {
+        if ((cpu->f & FLAG_H) || (cpu->a & 0x0F) > 0x09)
+        {
+            correction |= 0x06;
+        }
+        if (carry || cpu->a > 0x99)
+        {
+            correction |= 0x60;
+            carry = true;
+        }
+        cpu->a += correction;
+    }
+    cpu->f = (cpu->f & FLAG_N) | (cpu->a == 0 ? FLAG_Z : 0) | (carry ? FLAG_C : 0);
+}
+
+
+// =================================================================================
+//                          Decoding
+// =================================================================================
+
+static int step_prefixed(reference_cpu_t *cpu)
+{
+    uint8_t opcode = immediate8(cpu);
+    uint8_t y = (opcode >> 3) & 7;
+    uint8_t z = opcode & 7;
+    uint8_t value = get_r(cpu, z);
+    switch (opcode >> 6)
+    {
+    case 0:
+        set_r(cpu, z, rotate(cpu, y, value));
+        break;
+    case 1: // BIT
+        cpu->f = (cpu->f & FLAG_C) | FLAG_H | ((value >> y) & 1 ? 0 : FLAG_Z);
+        return z == 6 ? 3 : 2;
+    case 2:
+        set_r(cpu, z, value & ~(1 << y));
+        break;
+    default:
+        set_r(cpu, z, value | 1 << y);
+        break;
+    }
+    return z == 6 ? 4 : 2;
+}
+
+static int step_block0(reference_cpu_t *cpu, uint8_t y, uint8_t z)
+{
+    uint8_t p = y >> 1;
+    bool q = y & 1;
+    switch (z)
+    {
+    case 0:
+        if (y == 0)
+        {
+            return 1;
+        }
+        if (y == 1) // LD (nn),SP
+        {
+            uint16_t address = immediate16(cpu);
+            write8(cpu, address, cpu->sp & 0xFF);
+            write8(cpu, address + 1, cpu->sp >> 8);
+            return 5;
+        }
+        if (y == 2) // STOP
+        {
+            return 0;
+        }
+        {
+            int8_t e = immediate8(cpu);
+            if (y == 3 || condition(cpu, y - 4))
+            {
+                cpu->pc += e;
+                return 3;
+            }
+            return 2;
+        }
+    case 1:
+        if (!q)
+        {
+            set_rp(cpu, p, false, immediate16(cpu));
+            return 3;
+        }
+        {
+            // ADD HL,rr keeps Z
+            uint32_t hl = get_hl(cpu);
+            uint32_t rr = get_rp(cpu, p, false);
+            cpu->f = (cpu->f & FLAG_Z) | ((hl & 0x0FFF) + (rr & 0x0FFF) > 0x0FFF ? FLAG_H : 0)
+                     | (hl + rr > 0xFFFF ? FLAG_C : 0);
+            set_hl(cpu, hl + rr);
+            return 2;
+        }
+    case 2:
+    {
+        // (BC) (DE) (HL+) (HL-)
+        uint16_t address = p < 2 ? get_rp(cpu, p, false) : get_hl(cpu);
+        if (q)
+        {
+            cpu->a = read8(cpu, address);
+        }
+        else
+        {
+            write8(cpu, address, cpu->a);
+        }
+        if (p == 2)
+        {
+            set_hl(cpu, address + 1);
+        }
+        else if (p == 3)
+        {
+            set_hl(cpu, address - 1);
+        }
+        return 2;
+    }
+    case 3:
+        set_rp(cpu, p, false, get_rp(cpu, p, false) + (q ? -1 : 1));
+        return 2;
+    case 4:
+    case 5:
+    {
+        // INC r and DEC r keep C
+        uint8_t value = get_r(cpu, y) + (z == 4 ? 1 : -1);
+        bool half = z == 4 ? (value & 0x0F) == 0 : (value & 0x0F) == 0x0F;
+        cpu->f = (cpu->f & FLAG_C) | (z == 5 ? FLAG_N : 0) | (half ? FLAG_H : 0) | (value == 0 ? FLAG_Z : 0);
+        set_r(cpu, y, value);
+        return y == 6 ? 3 : 1;
+    }
+    case 6:
+        set_r(cpu, y, immediate8(cpu));
+        return y == 6 ? 3 : 2;
+    default:
+        switch (y)
+        {
+        case 0:
+        case 1:
+        case 2:
+        case 3:
+            // RLCA RRCA RLA RRA always clear Z
+            cpu->a = rotate(cpu, y, cpu->a);
+            cpu->f &= FLAG_C;
+            break;
+        case 4:
+            daa(cpu);
+            break;
+        case 5:
+            cpu->a = ~cpu->a;
+            cpu->f |= FLAG_N | FLAG_H;
+            break;
+        case 6:
+            cpu->f = (cpu->f & FLAG_Z) | FLAG_C;
+            break;
+        default:
+            cpu->f = (cpu->f & (FLAG_Z | FLAG_C)) ^ FLAG_C;
+            break;
+        }
+        return 1;
+    }
+}
+
+static int step_block3(reference_cpu_t *cpu, uint8_t y, uint8_t z)
+{
+    uint8_t p = y >> 1;
+    bool q = y & 1;
+    switch (z)
+    {
+    case 0:
+        switch (y)
+        {
+        case 4:
+            write8(cpu, 0xFF00 | immediate8(cpu), cpu->a);
+            return 3;
+        case 5:
+            cpu->sp = sp_offset(cpu);
+            return 4;
+        case 6:
+            cpu->a = read8(cpu, 0xFF00 | immediate8(cpu));
+            return 3;
+        case 7:
+            set_hl(cpu, sp_offset(cpu));
+            return 3;
+        default:
+            if (condition(cpu, y))
+            {
+                cpu->pc = pop16(cpu);
+                return 5;
+            }
+            return 2;
+        }
+    case 1:
+        if (!q)
+        {
+            set_rp(cpu, p, true, pop16(cpu));
+            return 3;
+        }
+        switch (p)
+        {
+        case 0:
+            cpu->pc = pop16(cpu);
+            return 4;
+        case 1:
+            cpu->pc = pop16(cpu);
+            cpu->ime = true;
+            return 4;
+        case 2:
+            cpu->pc = get_hl(cpu);
+            return 1;
+        default:
+            cpu->sp = get_hl(cpu);
+            return 2;
+        }
+    case 2:
+        switch (y)
+        {
+        case 4:
+            write8(cpu, 0xFF00 | cpu->c, cpu->a);
+            return 2;
+        case 5:
+            write8(cpu, immediate16(cpu), cpu->a);
+            return 4;
+        case 6:
+            cpu->a = read8(cpu, 0xFF00 | cpu->c);
+            return 2;
+        case 7:
+            cpu->a = read8(cpu, immediate16(cpu));
+            return 4;
+        default:
+        {
+            uint16_t address = immediate16(cpu);
+            if (condition(cpu, y))
+            {
+                cpu->pc = address;
+                return 4;
+            }
+            return 3;
+        }
+        }
+    case 3:
+        switch (y)
+        {
+        case 0:
+            cpu->pc = immediate16(cpu);
+            return 4;
+        case 1:
+            return step_prefixed(cpu);
+        case 6:
+            cpu->ime = false;
+            cpu->ime_pending = false;
+            return 1;
+        case 7:
+            cpu->ime_pending = true;
+            return 1;
+        default:
+            return 0;
+        }
+    case 4:
+    case 5:
+        if (z == 5 && !q)
+        {
+            push16(cpu, get_rp(cpu, p, true));
+            return 4;
+        }
+        if (z == 5 ? y != 1 : y > 3)
+        {
+            return 0;
+        }
+        {
+            uint16_t address = immediate16(cpu);
+            if (z == 5 || condition(cpu, y))
+            {
+                push16(cpu, cpu->pc);
+                cpu->pc = address;
+                return 6;
+            }
+            return 3;
+        }
+    case 6:
+        alu(cpu, y, immediate8(cpu));
+        return 2;
+    default:
+        push16(cpu, cpu->pc);
+        cpu->pc = y << 3;
+        return 4;
+    }
+}
+
+/**
+ * Runs the instruction at PC.
+ *
+ * @return the M-cycles it took, 0 with the state undefined for STOP, HALT
+ * and the unused opcodes, which the reference does not model.
+ */
+int reference_step(reference_cpu_t *cpu)
+{
+    uint8_t opcode = immediate8(cpu);
+    uint8_t y = (opcode >> 3) & 7;
+    uint8_t z = opcode & 7;
+    switch (opcode >> 6)
+    {
+    case 0:
+        return step_block0(cpu, y, z);
+    case 1:
+        if (opcode == 0x76) // HALT
+        {
+            return 0;
+        }
+        set_r(cpu, y, get_r(cpu, z));
+        return y == 6 || z == 6 ? 2 : 1;
+    case 2:
+        alu(cpu, y, get_r(cpu, z));
+        return z == 6 ? 2 : 1;
+    default:
+        return step_block3(cpu, y, z);
+    }
+}
+
+
+// =================================================================================
+//                          Differential runs
+// =================================================================================
+
+/**
+ * Both CPUs on memory filled from `seed`.
+ *
+ * @return NULL if memory runs out.
+ */
+cpu_diff_t *new_cpu_diff(uint64_t seed)
+{
+    cpu_diff_t *diff = calloc(1, sizeof(cpu_diff_t));
+    if (diff == NULL)
+    {
+        return NULL;
+    }
+    diff->cpu = new_cpu();
+    diff->image = malloc(0x10000);
+    diff->reference.memory = malloc(0x10000);
+    if (diff->cpu == NULL || diff->image == NULL || diff->reference.memory == NULL)
+    {
+        if (diff->cpu != NULL)
+        {
+            free_cpu(diff->cpu);
+        }
+        free(diff->image);
+        free(diff->reference.memory);
+        free(diff);
+        return NULL;
+    }
+    // Memory gets overwritten for every case, so no hash to keep up
+    diff->cpu->ram_hashing = false;
+
+    // splitmix64
+    for (uint32_t i = 0; i < 0x10000; i += 8)
+    {
+        uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z ^= z >> 31;
+        memcpy(&diff->image[i], &z, 8);
+    }
+    return diff;
+}
+
+void free_cpu_diff(cpu_diff_t *diff)
+{
+    if (diff == NULL)
+    {
+        return;
+    }
+    free_cpu(diff->cpu);
+    free(diff->image);
+    free(diff->reference.memory);
+    free(diff);
+    diff = NULL;
+    return;
+}
+
+static uint16_t input16(const uint8_t *input, size_t offset)
+{
+    return input[offset] | input[offset + 1] << 8;
+}
+
+// Appends to the report, dropping what does not fit
+static void report(cpu_diff_t *diff, const char *name, unsigned int actual, unsigned int expected)
+{
+    size_t used = strlen(diff->report);
+    snprintf(diff->report + used, sizeof(diff->report) - used, " %s 0x%X, expected 0x%X;", name, actual, expected);
+}
+
+/**
+ * Runs the case in `input` (see CPU_DIFF_INPUT_SIZE) through
+ * execute_instruction and through the reference, then compares registers,
+ * flags, IME, memory and M-cycles.
+ *
+ * @return 0 if they agree or the reference does not model the opcode, -1
+ * with diff->report saying what differed otherwise.
+ */
+int cpu_diff_run(cpu_diff_t *diff, const uint8_t *input, size_t size)
+{
+    uint8_t bytes[CPU_DIFF_INPUT_SIZE] = {0};
+    memcpy(bytes, input, size < sizeof(bytes) ? size : sizeof(bytes));
+    uint16_t af = input16(bytes, 4) & 0xFFF0;
+    uint16_t bc = input16(bytes, 6);
+    uint16_t de = input16(bytes, 8);
+    uint16_t hl = input16(bytes, 10);
+    uint16_t sp = input16(bytes, 12);
+    uint16_t pc = input16(bytes, 14);
+
+    reference_cpu_t *reference = &diff->reference;
+    uint8_t *memory = reference->memory;
+    memcpy(memory, diff->image, 0x10000);
+    memory[sp] = bytes[18];
+    memory[(uint16_t)(sp + 1)] = bytes[19];
+    memory[hl] = bytes[17];
+    for (int i = 0; i < 4; i++)
+    {
+        memory[(uint16_t)(pc + i)] = bytes[i];
+    }
+    cpu_t *cpu = diff->cpu;
+    memcpy(cpu->memorybus, memory, 0x10000);
+
+    reference->a = af >> 8;
+    reference->f = af & 0xFF;
+    reference->b = bc >> 8;
+    reference->c = bc & 0xFF;
+    reference->d = de >> 8;
+    reference->e = de & 0xFF;
+    reference->h = hl >> 8;
+    reference->l = hl & 0xFF;
+    reference->sp = sp;
+    reference->pc = pc;
+    reference->ime = bytes[16] & 1;
+    reference->ime_pending = bytes[16] & 2;
+    int expected_cycles = reference_step(reference);
+    diff->cases++;
+    if (expected_cycles == 0)
+    {
+        diff->skipped++;
+        return 0;
+    }
+
+    *cpu->registers->AF = af;
+    *cpu->registers->BC = bc;
+    *cpu->registers->DE = de;
+    *cpu->registers->HL = hl;
+    cpu->SP = sp;
+    cpu->PC = pc;
+    cpu->IME = bytes[16] & 1;
+    cpu->IME_pending = bytes[16] & 2;
+    invalidate_fetch_window(cpu);
+    uint8_t opcode = fetch_8(cpu);
+    bool prefixed = opcode == 0xCB;
+    if (prefixed)
+    {
+        opcode = fetch_8(cpu);
+    }
+    int cycles = execute_instruction(cpu, opcode, prefixed);
+
+    snprintf(diff->report, sizeof(diff->report), "%s%02X at 0x%04X:", prefixed ? "CB " : "", opcode, pc);
+    size_t header = strlen(diff->report);
+    uint16_t actual[6] = {*cpu->registers->AF, *cpu->registers->BC, *cpu->registers->DE,
+                          *cpu->registers->HL, cpu->SP, cpu->PC};
+    uint16_t expected[6] = {reference->a << 8 | reference->f, reference->b << 8 | reference->c,
+                            reference->d << 8 | reference->e, get_hl(reference), reference->sp, reference->pc};
+    const char *names[6] = {"AF", "BC", "DE", "HL", "SP", "PC"};
+    for (int i = 0; i < 6; i++)
+    {
+        if (actual[i] != expected[i])
+        {
+            report(diff, names[i], actual[i], expected[i]);
+        }
+    }
+    if (cpu->IME != reference->ime)
+    {
+        report(diff, "IME", cpu->IME, reference->ime);
+    }
+    if (cpu->IME_pending != reference->ime_pending)
+    {
+        report(diff, "pending EI", cpu->IME_pending, reference->ime_pending);
+    }
+    if (cycles != expected_cycles)
+    {
+        report(diff, "cycles", cycles, expected_cycles);
+    }
+    if (memcmp(cpu->memorybus, memory, 0x10000) != 0)
+    {
+        for (uint32_t address = 0; address < 0x10000; address++)
+        {
+            if (cpu->memorybus[address] != memory[address])
+            {
+                char name[16];
+                snprintf(name, sizeof(name), "(0x%04X)", address);
+                report(diff, name, cpu->memorybus[address], memory[address]);
+            }
+        }
+    }
+    if (strlen(diff->report) == header)
+    {
+        return 0;
+    }
+    diff->mismatches++;
+    return -1;
+}
@@ -0,0 +1,58 @@
+#ifndef CPU_REFERENCE_H
+#define CPU_REFERENCE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+
+
+// Bytes of a differential case, as cpu_diff_run reads them: the 4 bytes at
+// PC, AF BC DE HL SP PC (little-endian), IME in bit 0 and a pending EI in
+// bit 1, the byte at HL, then the 2 bytes at SP. Shorter inputs are padded
+// with zeros.
+#define CPU_DIFF_INPUT_SIZE 20
+
+
+/**
+ * Plain model of the SM83 on a bare bus, the oracle execute_instruction is
+ * checked against. Opcodes are decoded from their bit fields instead of a
+ * table of handlers, so the two share nothing but the memory layout.
+ */
+typedef struct ReferenceCpu
+{
+    uint8_t a, f, b, c, d, e, h, l;
+    uint16_t sp;
+    uint16_t pc;
+    bool ime;
+    bool ime_pending;
+    uint8_t *memory;            // 64 KiB, owned by the caller
+} reference_cpu_t;
+
+
+/**
+ * A production cpu_t and a reference_cpu_t run from the same states, one
+ * instruction at a time.
+ */
+typedef struct CpuDiff
+{
+    cpu_t *cpu;                 // Bare bus, no PPU, APU or joypad
+    reference_cpu_t reference;
+    uint8_t *image;             // Memory both start from before each case
+
+    uint64_t cases;
+    uint64_t skipped;           // Opcodes the reference does not model
+    uint64_t mismatches;
+    char report[512];           // What differed in the last mismatch
+} cpu_diff_t;
+
+
+int reference_step(reference_cpu_t *cpu);
+
+cpu_diff_t *new_cpu_diff(uint64_t seed);
+void free_cpu_diff(cpu_diff_t *diff);
+int cpu_diff_run(cpu_diff_t *diff, const uint8_t *input, size_t size);
+
+
+#endif
@@ -2,6 +2,15 @@
 #include "cpu.h"
 
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+
+#define AUDIO_RING_FRAMES   4096
+#define AUDIO_TARGET_FRAMES 1600    // Two video frames
+#define AUDIO_RATE_RANGE    0.005
+#define AUDIO_FILL_GAIN     4.0
+#define AUDIO_DRIFT_GAIN    0.002
 
 
 
@@ -18,7 +27,70 @@ emulator_t *new_emulator()
         return NULL;
     }
 
+    ppu_t *ppu = new_ppu();
+    if (!ppu) {
+        free_cpu(cpu);
+        free(emulator);
+        return NULL;
+    }
+
+    apu_t *apu = new_apu();
+    if (!apu) {
+        free_ppu(ppu);
+        free_cpu(cpu);
+        free(emulator);
+        return NULL;
+    }
+
+    joypad_t *joypad = new_joypad();
+    if (!joypad) {
+        free_apu(apu);
+        free_ppu(ppu);
+        free_cpu(cpu);
+        free(emulator);
+        return NULL;
+    }
+
+    audio_ring_t *audio = new_audio_ring(AUDIO_RING_FRAMES);
+    if (!audio) {
+        free_joypad(joypad);
+        free_apu(apu);
+        free_ppu(ppu);
+        free_cpu(cpu);
+        free(emulator);
+        return NULL;
+    }
+
+    triple_buffer_t *frames = new_triple_buffer();
+    if (!frames) {
+        free_audio_ring(audio);
+        free_joypad(joypad);
+        free_apu(apu);
+        free_ppu(ppu);
+        free_cpu(cpu);
+        free(emulator);
+        return NULL;
+    }
+
     emulator->cpu = cpu;
+    emulator->ppu = ppu;
+    emulator->apu = apu;
+    emulator->joypad = joypad;
+    emulator->frames = frames;
+    emulator->published_frame = 0;
+    emulator->audio = audio;
+    emulator->audio_rate = APU_SAMPLE_RATE;
+    emulator->audio_target = AUDIO_TARGET_FRAMES;
+    emulator->audio_rate_range = AUDIO_RATE_RANGE;
+    emulator->audio_drift = 0;
+    emulator->resampler = NULL;
+    emulator->capture = NULL;
+    emulator->run_ahead = 0;
+    emulator->run_ahead_state = NULL;
+    cpu->ppu = ppu;
+    cpu->apu = apu;
+    cpu->joypad = joypad;
+    ppu_attach_memory(ppu, cpu->memorybus);
 
 
     return emulator;
@@ -28,6 +100,13 @@ void free_emulator(emulator_t *emulator)
 {
     if (emulator) {
         free_cpu(emulator->cpu);
+        free_ppu(emulator->ppu);
+        free_apu(emulator->apu);
+        free_joypad(emulator->joypad);
+        free_triple_buffer(emulator->frames);
+        free_audio_ring(emulator->audio);
+        free_resampler(emulator->resampler);
+        free_emulator_state(emulator->run_ahead_state);
         free(emulator);
         emulator = NULL;
     }
@@ -35,25 +114,250 @@ void free_emulator(emulator_t *emulator)
 }
 
 
+// Hands samples at the host rate to the audio ring and the capture
+static void push_audio(emulator_t *emulator, const int16_t *samples, size_t count) {
+    audio_ring_push(emulator->audio, samples, count);
+    if (emulator->capture) {
+        capture_push_samples(emulator->capture, samples, count);
+    }
+}
+
+// Converts APU samples to the host rate, pushing the output as it comes
+static void push_resampled_audio(emulator_t *emulator, const int16_t *samples, size_t count) {
+    int16_t block[512 * 2];
+    size_t written = 0;
+    while (written < count) {
+        written += resampler_write(emulator->resampler, samples + written * 2, count - written);
+        size_t produced;
+        while ((produced = resampler_read(emulator->resampler, block, 512)) > 0) {
+            push_audio(emulator, block, produced);
+        }
+    }
+}
 
-void tick_emulator(emulator_t *emulator) {
-    if (emulator == NULL) {
+/**
+ * Moves the frame's samples to the audio ring, then retunes the APU output
+ * rate from how far the ring is from its target fill.
+ */
+static void queue_audio(emulator_t *emulator) {
+    apu_t *apu = emulator->apu;
+    if (!apu->synthesis) {
         return;
     }
+    int16_t block[512 * 2];
+    size_t count;
+    while ((count = apu_read_samples(apu, emulator->cpu->cycles, block, 512)) > 0) {
+        if (emulator->resampler) {
+            push_resampled_audio(emulator, block, count);
+        } else {
+            push_audio(emulator, block, count);
+        }
+    }
+
+    // Proportional plus integral control: the integral absorbs a steady
+    // clock difference so the fill settles on the target itself
+    double range = emulator->audio_rate_range;
+    double error = ((double)emulator->audio_target - (double)audio_ring_fill(emulator->audio))
+                   / emulator->audio_target;
+    error = fmax(-1.0, fmin(1.0, error));
+    emulator->audio_drift = fmax(-1.0, fmin(1.0, emulator->audio_drift + error * AUDIO_DRIFT_GAIN));
+    double correction = fmax(-1.0, fmin(1.0, error * AUDIO_FILL_GAIN + emulator->audio_drift));
+    apu_set_sample_rate(apu, (uint32_t)lround(emulator->audio_rate * (1.0 + range * correction)));
+}
+
+// =================================================================================
+//                          Save states
+// =================================================================================
+
+emulator_state_t *new_emulator_state()
+{
+    return malloc(sizeof(emulator_state_t));
+}
+
+void free_emulator_state(emulator_state_t *state)
+{
+    free(state);
+    state = NULL;
+    return;
+}
+
+void save_emulator_state(emulator_t *emulator, emulator_state_t *state)
+{
+    cpu_t *cpu = emulator->cpu;
+    state->cpu = *cpu;
+    state->register_file[0] = *cpu->registers->AF;
+    state->register_file[1] = *cpu->registers->BC;
+    state->register_file[2] = *cpu->registers->DE;
+    state->register_file[3] = *cpu->registers->HL;
+    memcpy(state->memory, cpu->memorybus, sizeof(state->memory));
+    state->ppu = *emulator->ppu;
+    state->apu = *emulator->apu;
+    state->joypad = *emulator->joypad;
+}
+
+/**
+ * Restores `state`, keeping the emulator's own buffers and host-side settings
+ * such as opcode profiling and the audio output rate.
+ */
+void load_emulator_state(emulator_t *emulator, const emulator_state_t *state)
+{
+    cpu_t *cpu = emulator->cpu;
+    cpu_t live = *cpu;
+    *cpu = state->cpu;
+    cpu->registers = live.registers;
+    cpu->memorybus = live.memorybus;
+    cpu->opcode_pairs = live.opcode_pairs;
+    cpu->ppu = live.ppu;
+    cpu->apu = live.apu;
+    cpu->joypad = live.joypad;
+    cpu->coverage = live.coverage;
+    cpu->ram_hashing = live.ram_hashing;
+    invalidate_fetch_window(cpu);
+    *cpu->registers->AF = state->register_file[0];
+    *cpu->registers->BC = state->register_file[1];
+    *cpu->registers->DE = state->register_file[2];
+    *cpu->registers->HL = state->register_file[3];
+    memcpy(cpu->memorybus, state->memory, sizeof(state->memory));
+    if (cpu->ram_hashing && !state->cpu.ram_hashing)
+    {
+        rehash_ram(cpu);
+    }
+
+    ppu_t *ppu = emulator->ppu;
+    const uint8_t *vram = ppu->vram, *oam = ppu->oam;
+    uint8_t *interrupt_flags = ppu->interrupt_flags;
+    *ppu = state->ppu;
+    ppu->vram = vram;
+    ppu->oam = oam;
+    ppu->interrupt_flags = interrupt_flags;
+
+    apu_t *apu = emulator->apu;
+    uint32_t sample_rate = apu->sample_rate;
+    *apu = state->apu;
+    apu_set_sample_rate(apu, sample_rate);
 
-    const int MAX_FPS = 60;
-    const int MAX_TICKS_PER_SECOND = 4194304;
-    const int MAX_CYCLES = MAX_TICKS_PER_SECOND / MAX_FPS;
+    *emulator->joypad = state->joypad;
+}
+
+
+// =================================================================================
+//                          Frames
+// =================================================================================
+
+/**
+ * Sets the rate the audio ring and the capture receive samples at, for a
+ * host device that does not run at audio_rate. The APU keeps synthesizing
+ * at audio_rate and a resampler converts its output; audio_target counts
+ * frames at the new rate.
+ *
+ * @return 0 on success, -1 if the resampler could not be allocated.
+ */
+int set_audio_output_rate(emulator_t *emulator, uint32_t rate)
+{
+    free_resampler(emulator->resampler);
+    emulator->resampler = NULL;
+    if (rate != emulator->audio_rate) {
+        emulator->resampler = new_resampler(emulator->audio_rate, rate);
+        if (!emulator->resampler) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Keeps `frames` frames of run-ahead, 0 to turn it off.
+ *
+ * @return 0 on success, -1 if the state buffer could not be allocated.
+ */
+int set_run_ahead(emulator_t *emulator, uint32_t frames)
+{
+    if (frames > 0 && emulator->run_ahead_state == NULL) {
+        emulator->run_ahead_state = new_emulator_state();
+        if (!emulator->run_ahead_state) {
+            return -1;
+        }
+    }
+    emulator->run_ahead = frames;
+    return 0;
+}
 
-    int cycle_count = 0;
+// Runs up to the start of the next VBlank, when the frame is complete
+static void run_frame(emulator_t *emulator) {
+    cpu_t *cpu = emulator->cpu;
+    ppu_t *ppu = emulator->ppu;
+    uint64_t frame_end = ppu_next_vblank(ppu, cpu->cycles);
+    uint64_t next_input = joypad_next_event(emulator->joypad);
+    cpu->idle_limit = frame_end < next_input ? frame_end : next_input;
 
-    while (cycle_count < MAX_CYCLES) {
-        // Execute one instruction on the CPU
-        int intruction_timing = execute_next_instruction(emulator->cpu);
-        cycle_count += intruction_timing;
+    while (cpu->cycles < frame_end) {
+        // Queued input lands before the first instruction starting at or after its cycle
+        if (cpu->cycles >= next_input) {
+            if (joypad_apply_events(emulator->joypad, cpu->cycles)) {
+                request_interrupt(cpu, JOYPAD_INTERRUPT);
+            }
+            next_input = joypad_next_event(emulator->joypad);
+            cpu->idle_limit = frame_end < next_input ? frame_end : next_input;
+        }
+        // Execute one instruction on the CPU (may skip an idle loop up to the next input or frame_end)
+        execute_next_instruction(cpu);
         //update_timer()
-        //upudate_graphics()
+        if (!ppu->lazy) {
+            ppu_catch_up(ppu, cpu->cycles);
+        }
         //do_interrupts() A creuser 
     }
+    ppu_catch_up(ppu, cpu->cycles);
+}
+
+// Hands a newly completed frame to the frame consumer and the capture
+static void publish_frame(emulator_t *emulator) {
+    ppu_t *ppu = emulator->ppu;
+    if (ppu->rendered_frame > emulator->published_frame) {
+        triple_buffer_publish(emulator->frames, &ppu->framebuffer[0][0], ppu->rendered_frame);
+        emulator->published_frame = ppu->rendered_frame;
+        if (emulator->capture) {
+            capture_push_frame(emulator->capture, &ppu->framebuffer[0][0]);
+        }
+    }
+}
+
+/**
+ * The real frame runs without pixels and keeps its sound. The speculative
+ * frames after it run silent, and only the last one is drawn and presented
+ * before the state goes back to the end of the real frame.
+ */
+static void run_ahead_frame(emulator_t *emulator) {
+    ppu_t *ppu = emulator->ppu;
+    uint32_t interval = ppu->render_interval;
+
+    ppu_set_render_interval(ppu, 0);
+    run_frame(emulator);
+    queue_audio(emulator);
+    save_emulator_state(emulator, emulator->run_ahead_state);
+
+    emulator->apu->synthesis = false;
+    for (uint32_t i = 1; i <= emulator->run_ahead; i++) {
+        if (i == emulator->run_ahead && interval != 0) {
+            ppu_request_frame(ppu);
+        }
+        run_frame(emulator);
+    }
+    publish_frame(emulator);
 
-}
\ No newline at end of file
+    load_emulator_state(emulator, emulator->run_ahead_state);
+    ppu_set_render_interval(ppu, interval);
+}
+
+void tick_emulator(emulator_t *emulator) {
+    if (emulator == NULL) {
+        return;
+    }
+    if (emulator->run_ahead > 0) {
+        run_ahead_frame(emulator);
+        return;
+    }
+    run_frame(emulator);
+    publish_frame(emulator);
+    queue_audio(emulator);
+}
@@ -3,13 +3,64 @@
 
 #include <stdint.h>
 #include "cpu.h"  
+#include "ppu.h"
+#include "apu.h"
+#include "joypad.h"
+#include "triple_buffer.h"
+#include "audio_ring.h"
+#include "resampler.h"
+#include "capture.h"
 
 
 
+/**
+ * Everything that decides how emulation continues: CPU registers and memory,
+ * PPU, APU and joypad. Host-side queues (frames, audio ring, capture) are not
+ * part of it. A state may be loaded into any emulator.
+ */
+typedef struct EmulatorState
+{
+    cpu_t cpu;
+    uint16_t register_file[4];  // AF, BC, DE, HL
+    uint8_t memory[0x10000];
+    ppu_t ppu;
+    apu_t apu;
+    joypad_t joypad;
+} emulator_state_t;
+
 
 typedef struct Emulator
 {
     cpu_t *cpu;
+    ppu_t *ppu;
+    apu_t *apu;
+    joypad_t *joypad;           // Queue input with joypad_queue_input to land at an exact cycle
+    triple_buffer_t *frames;    // Completed frames, for a consumer thread
+    uint64_t published_frame;   // ppu->rendered_frame last handed to `frames`
+
+    // Samples for an audio consumer thread. The APU rate is nudged by at
+    // most audio_rate_range around audio_rate so that the ring stays near
+    // audio_target frames whatever the consumer's real clock.
+    audio_ring_t *audio;
+    uint32_t audio_rate;
+    uint32_t audio_target;
+    double audio_rate_range;    // 0 turns rate control off
+    double audio_drift;         // Integral term of the rate control
+    // The APU always synthesizes at audio_rate; for another host rate this
+    // converts its samples before the ring and the capture. NULL when the
+    // host takes audio_rate as is, see set_audio_output_rate.
+    resampler_t *resampler;
+
+    // Optional recording of rendered frames and samples, owned by the caller.
+    // Headless captures should set audio_rate_range to 0 so the WAV keeps
+    // its nominal rate.
+    capture_t *capture;
+
+    // Run-ahead: each tick runs the real frame without pixels, saves the
+    // state, runs run_ahead more frames with the same input and presents the
+    // last one, then restores the state.
+    uint32_t run_ahead;
+    emulator_state_t *run_ahead_state;
     // Add other components of the emulator here, such as memory, input/output, etc.
     // For example:
     // memory_t memory;
@@ -24,6 +75,13 @@ void free_emulator(emulator_t *emulator);
 
 
 void tick_emulator(emulator_t *emulator);
+int set_run_ahead(emulator_t *emulator, uint32_t frames);
+int set_audio_output_rate(emulator_t *emulator, uint32_t rate);
+
+emulator_state_t *new_emulator_state();
+void free_emulator_state(emulator_state_t *state);
+void save_emulator_state(emulator_t *emulator, emulator_state_t *state);
+void load_emulator_state(emulator_t *emulator, const emulator_state_t *state);
 void reset_emulator(emulator_t *emulator);
 
 void load_rom(emulator_t *emulator, const char *rom_path);
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "env.h"
+
+
+/**
+ * @return an environment over a fresh emulator, with the power-on state as
+ * snapshot, or NULL if memory runs out. `obs_scale` must be 1, 2, 4 or 8.
+ * Sound synthesis is turned off; agents only see frames and RAM.
+ */
+env_t *new_env(uint32_t obs_scale)
+{
+    if (obs_scale == 0 || obs_scale > 8 || (obs_scale & (obs_scale - 1)) != 0)
+    {
+        fprintf(stderr, "Invalid observation scale %u.\n", obs_scale);
+        exit(1);
+    }
+    env_t *env = malloc(sizeof(env_t));
+    if (env == NULL)
+    {
+        return NULL;
+    }
+    env->emulator = new_emulator();
+    env->snapshot = new_emulator_state();
+    env->gray = new_video_output(PIXEL_FORMAT_GRAY8);
+    if (env->emulator == NULL || env->snapshot == NULL || env->gray == NULL)
+    {
+        free_emulator(env->emulator);
+        free_emulator_state(env->snapshot);
+        free_video_output(env->gray);
+        free(env);
+        return NULL;
+    }
+    env->obs_scale = obs_scale;
+    env->obs_width = SCREEN_WIDTH / obs_scale;
+    env->obs_height = SCREEN_HEIGHT / obs_scale;
+    env->ram_count = 0;
+    env->steps = 0;
+    env->emulator->apu->synthesis = false;
+    env_save_snapshot(env);
+    return env;
+}
+
+void free_env(env_t *env)
+{
+    if (env != NULL)
+    {
+        free_emulator(env->emulator);
+        free_emulator_state(env->snapshot);
+        free_video_output(env->gray);
+    }
+    free(env);
+    env = NULL;
+    return;
+}
+
+
+/**
+ * Chooses the RAM bytes written to `ram_out`, in order.
+ *
+ * @return 0 on success, -1 if there are more than ENV_MAX_RAM_BYTES.
+ */
+int env_set_ram_addresses(env_t *env, const uint16_t *addresses, uint32_t count)
+{
+    if (count > ENV_MAX_RAM_BYTES)
+    {
+        return -1;
+    }
+    memcpy(env->ram_addresses, addresses, count * sizeof(uint16_t));
+    env->ram_count = count;
+    return 0;
+}
+
+/**
+ * @return the number of bytes of one observation.
+ */
+size_t env_obs_size(env_t *env)
+{
+    return (size_t)env->obs_width * env->obs_height;
+}
+
+/**
+ * Makes the current state the one env_reset returns to, e.g. after loading a
+ * game and playing through its title screen.
+ */
+void env_save_snapshot(env_t *env)
+{
+    save_emulator_state(env->emulator, env->snapshot);
+}
+
+
+// =================================================================================
+//                          Observations
+// =================================================================================
+
+// Luma of the last rendered frame, averaged over obs_scale x obs_scale boxes
+static void write_observation(env_t *env, uint8_t *obs_out)
+{
+    video_convert_ppu(env->gray, env->emulator->ppu, env->luma, SCREEN_WIDTH);
+    uint32_t scale = env->obs_scale;
+    if (scale == 1)
+    {
+        memcpy(obs_out, env->luma, SCREEN_WIDTH * SCREEN_HEIGHT);
+        return;
+    }
+    // Rows of each box summed column by column, then the columns of each box
+    uint32_t bits = __builtin_ctz(scale);
+    uint32_t shift = bits * 2;
+    for (uint32_t y = 0; y < env->obs_height; y++)
+    {
+        uint16_t sums[SCREEN_WIDTH] = {0};
+        for (uint32_t row = 0; row < scale; row++)
+        {
+            const uint8_t *luma = env->luma[y * scale + row];
+            for (uint32_t x = 0; x < SCREEN_WIDTH; x++)
+            {
+                sums[x] += luma[x];
+            }
+        }
+        for (uint32_t x = 0; x < env->obs_width; x++)
+        {
+            uint32_t sum = 0;
+            for (uint32_t column = 0; column < scale; column++)
+            {
+                sum += sums[(x << bits) + column];
+            }
+            obs_out[y * env->obs_width + x] = (sum + (1 << (shift - 1))) >> shift;
+        }
+    }
+}
+
+static void write_ram(env_t *env, uint8_t *ram_out)
+{
+    for (uint32_t i = 0; i < env->ram_count; i++)
+    {
+        ram_out[i] = peek_memory(env->emulator->cpu, env->ram_addresses[i]);
+    }
+}
+
+/**
+ * Loads the snapshot and writes its observation. Either output may be NULL.
+ */
+void env_reset(env_t *env, uint8_t *obs_out, uint8_t *ram_out)
+{
+    load_emulator_state(env->emulator, env->snapshot);
+    env->steps = 0;
+    if (obs_out != NULL)
+    {
+        write_observation(env, obs_out);
+    }
+    if (ram_out != NULL)
+    {
+        write_ram(env, ram_out);
+    }
+}
+
+/**
+ * Holds the buttons in `action` (a joypad_button_t mask) for `frameskip`
+ * frames, then writes the observation of the last one and the chosen RAM
+ * bytes. Only the last frame's pixels are drawn. Either output may be NULL.
+ */
+void env_step(env_t *env, uint8_t action, uint32_t frameskip, uint8_t *obs_out, uint8_t *ram_out)
+{
+    emulator_t *emulator = env->emulator;
+    if (joypad_set_buttons(emulator->joypad, action))
+    {
+        request_interrupt(emulator->cpu, JOYPAD_INTERRUPT);
+    }
+    ppu_set_render_interval(emulator->ppu, 0);
+    for (uint32_t frame = 1; frame <= frameskip; frame++)
+    {
+        if (frame == frameskip && obs_out != NULL)
+        {
+            ppu_request_frame(emulator->ppu);
+        }
+        tick_emulator(emulator);
+    }
+    env->steps++;
+    if (obs_out != NULL)
+    {
+        write_observation(env, obs_out);
+    }
+    if (ram_out != NULL)
+    {
+        write_ram(env, ram_out);
+    }
+}
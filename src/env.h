@@ -0,0 +1,49 @@
+#ifndef ENV_H
+#define ENV_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "emulator.h"
+#include "video.h"
+
+
+#define ENV_MAX_RAM_BYTES   256     // RAM addresses reported per step
+
+
+/**
+ * Step interface for reinforcement learning: an action is a joypad button
+ * mask held for a number of frames, an observation a downsampled grayscale
+ * frame plus chosen RAM bytes. Every buffer is allocated up front, so steps
+ * and resets never allocate.
+ */
+typedef struct Env
+{
+    emulator_t *emulator;
+    emulator_state_t *snapshot;         // Where env_reset goes back to
+    video_output_t *gray;
+
+    uint32_t obs_scale;                 // Observation is SCREEN / obs_scale on each side
+    uint32_t obs_width;
+    uint32_t obs_height;
+
+    uint16_t ram_addresses[ENV_MAX_RAM_BYTES];
+    uint32_t ram_count;
+
+    uint64_t steps;                     // Since the last reset
+    uint8_t luma[SCREEN_HEIGHT][SCREEN_WIDTH];
+} env_t;
+
+
+env_t *new_env(uint32_t obs_scale);
+void free_env(env_t *env);
+
+int env_set_ram_addresses(env_t *env, const uint16_t *addresses, uint32_t count);
+size_t env_obs_size(env_t *env);
+
+void env_save_snapshot(env_t *env);
+void env_reset(env_t *env, uint8_t *obs_out, uint8_t *ram_out);
+void env_step(env_t *env, uint8_t action, uint32_t frameskip, uint8_t *obs_out, uint8_t *ram_out);
+
+
+#endif
@@ -0,0 +1,702 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "fuzzer.h"
+
+
+#define FUZZ_FRAMES_PER_STEP    4
+#define FUZZ_DEFAULT_STEPS      1024
+#define FUZZ_HANG_STEPS         150     // 10 seconds at 4 frames a step
+#define FUZZ_MAX_RUN            16      // Longest run of steps one mutation touches
+#define FUZZ_SYNC_INTERVAL      16      // Seeds fuzzed between syncs
+
+
+// splitmix64
+static uint64_t next_random(fuzzer_t *fuzzer)
+{
+    uint64_t z = (fuzzer->rng += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static uint32_t random_below(fuzzer_t *fuzzer, uint32_t bound)
+{
+    return (uint32_t)(((next_random(fuzzer) >> 32) * bound) >> 32);
+}
+
+// max_steps, within the buffers
+static uint32_t step_limit(fuzzer_t *fuzzer)
+{
+    return fuzzer->max_steps < FUZZ_MAX_STEPS ? fuzzer->max_steps : FUZZ_MAX_STEPS;
+}
+
+// FNV-1a, naming hangs and crashes so that one input is saved once
+static uint64_t hash_input(const uint8_t *buttons, uint32_t length)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (uint32_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ buttons[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+
+// =================================================================================
+//                          Files
+// =================================================================================
+
+static bool make_directory(const char *path)
+{
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+/**
+ * Writes the input next to `path` and renames it there, so that instances
+ * syncing never read half an input.
+ */
+static bool write_input(const char *path, const uint8_t *buttons, uint32_t length)
+{
+    char temporary[PATH_MAX];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+    FILE *file = fopen(temporary, "wb");
+    if (file == NULL)
+    {
+        return false;
+    }
+    bool written = fwrite(buttons, 1, length, file) == length;
+    written = fclose(file) == 0 && written;
+    return written && rename(temporary, path) == 0;
+}
+
+// @return the length read, at most `capacity`, or -1 if there is no such file
+static int64_t read_input(const char *path, uint8_t *buttons, uint32_t capacity)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+    size_t length = fread(buttons, 1, capacity, file);
+    fclose(file);
+    return length;
+}
+
+static void queue_path(fuzzer_t *fuzzer, char *path, uint32_t instance, uint32_t id)
+{
+    snprintf(path, PATH_MAX, "%s/queue-%02u/%06u", fuzzer->directory, instance, id);
+}
+
+// Saves an input under `kind` (hangs or crashes), named by its hash
+static void save_finding(fuzzer_t *fuzzer, const char *kind, const uint8_t *buttons, uint32_t length)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s/%016llx", fuzzer->directory, kind,
+             (unsigned long long)hash_input(buttons, length));
+    write_input(path, buttons, length);
+}
+
+
+// =================================================================================
+//                          Lifetime
+// =================================================================================
+
+/**
+ * Fuzzes from `start`, a state with the game loaded, e.g. past its title
+ * screen, tracking coverage of `banks` ROM banks as for new_coverage. The
+ * directory is created if needed; inputs already in it are only taken by
+ * fuzzer_sync.
+ *
+ * @return NULL if the directory cannot be created or memory runs out.
+ */
+fuzzer_t *new_fuzzer(const char *directory, const emulator_state_t *start, uint32_t banks)
+{
+    fuzzer_t *fuzzer = calloc(1, sizeof(fuzzer_t));
+    if (fuzzer == NULL)
+    {
+        return NULL;
+    }
+    char path[PATH_MAX];
+    fuzzer->directory = strdup(directory);
+    fuzzer->env = new_env(1);
+    fuzzer->run = new_coverage(banks);
+    fuzzer->total = new_coverage(banks);
+    fuzzer->hang_total = new_coverage(banks);
+    bool allocated = fuzzer->directory != NULL && fuzzer->env != NULL && fuzzer->run != NULL
+                     && fuzzer->total != NULL && fuzzer->hang_total != NULL;
+    for (int i = 0; i <= FUZZ_CHECKPOINTS; i++)
+    {
+        fuzzer->checkpoints[i].state = new_emulator_state();
+        fuzzer->checkpoints[i].coverage = new_coverage(banks);
+        allocated = allocated && fuzzer->checkpoints[i].state != NULL && fuzzer->checkpoints[i].coverage != NULL;
+    }
+    bool created = allocated && make_directory(directory);
+    snprintf(path, sizeof(path), "%s/hangs", directory);
+    created = created && make_directory(path);
+    snprintf(path, sizeof(path), "%s/crashes", directory);
+    created = created && make_directory(path);
+    if (!created)
+    {
+        if (allocated)
+        {
+            fprintf(stderr, "Could not create the fuzzing directory %s: %s.\n", directory, strerror(errno));
+        }
+        free_fuzzer(fuzzer);
+        return NULL;
+    }
+
+    fuzzer->banks = banks;
+    fuzzer->frames_per_step = FUZZ_FRAMES_PER_STEP;
+    fuzzer->max_steps = FUZZ_DEFAULT_STEPS;
+    fuzzer->hang_steps = FUZZ_HANG_STEPS;
+    fuzzer->rng = 0x853C49E6748FEA9BULL;
+    memcpy(fuzzer->env->snapshot, start, sizeof(emulator_state_t));
+    cpu_t *cpu = fuzzer->env->emulator->cpu;
+    cpu->coverage = fuzzer->run;
+    cpu->ram_hashing = true;
+    // Stored hashed, so that runs do not rehash the RAM as they start
+    env_reset(fuzzer->env, NULL, NULL);
+    env_save_snapshot(fuzzer->env);
+    return fuzzer;
+}
+
+void free_fuzzer(fuzzer_t *fuzzer)
+{
+    if (fuzzer == NULL)
+    {
+        return;
+    }
+    for (uint32_t i = 0; i < fuzzer->corpus_count; i++)
+    {
+        free(fuzzer->corpus[i].buttons);
+    }
+    for (int i = 0; i <= FUZZ_CHECKPOINTS; i++)
+    {
+        free_emulator_state(fuzzer->checkpoints[i].state);
+        free_coverage(fuzzer->checkpoints[i].coverage);
+    }
+    free(fuzzer->corpus);
+    free_coverage(fuzzer->run);
+    free_coverage(fuzzer->total);
+    free_coverage(fuzzer->hang_total);
+    free_env(fuzzer->env);
+    free(fuzzer->directory);
+    free(fuzzer);
+    fuzzer = NULL;
+    return;
+}
+
+
+// =================================================================================
+//                          Runs
+// =================================================================================
+
+static void save_checkpoint(fuzzer_t *fuzzer, uint32_t step)
+{
+    fuzz_checkpoint_t *checkpoint = &fuzzer->checkpoints[fuzzer->checkpoint_count++];
+    checkpoint->step = step;
+    save_emulator_state(fuzzer->env->emulator, checkpoint->state);
+    coverage_copy(checkpoint->coverage, fuzzer->run);
+    checkpoint->unpolled = fuzzer->unpolled;
+    checkpoint->ignored = fuzzer->ignored;
+}
+
+// Puts the emulator and the run's coverage at `from`, or at the start state
+static void restore(fuzzer_t *fuzzer, const fuzz_checkpoint_t *from)
+{
+    if (from == NULL)
+    {
+        env_reset(fuzzer->env, NULL, NULL);
+        coverage_reset(fuzzer->run);
+        fuzzer->unpolled = 0;
+        fuzzer->ignored = 0;
+        return;
+    }
+    load_emulator_state(fuzzer->env->emulator, from->state);
+    coverage_copy(fuzzer->run, from->coverage);
+    fuzzer->unpolled = from->unpolled;
+    fuzzer->ignored = from->ignored;
+}
+
+/**
+ * Plays buttons[step, length), checkpointing the seed's run along the way if
+ * asked, and stops at a soft-lock.
+ *
+ * @return true on a soft-lock, with `length` cut to the steps played.
+ */
+static bool play(fuzzer_t *fuzzer, const uint8_t *buttons, uint32_t step, uint32_t *length, bool checkpointing)
+{
+    emulator_t *emulator = fuzzer->env->emulator;
+    uint32_t interval = (*length + FUZZ_CHECKPOINTS - 1) / FUZZ_CHECKPOINTS;
+    for (; step < *length; step++)
+    {
+        if (checkpointing && step % interval == 0)
+        {
+            save_checkpoint(fuzzer, step);
+        }
+        uint64_t polls = emulator->joypad->polls;
+        uint64_t hash = emulator->cpu->ram_hash;
+        bool changed = buttons[step] != emulator->joypad->buttons;
+        env_step(fuzzer->env, buttons[step], fuzzer->frames_per_step, NULL, NULL);
+
+        fuzzer->unpolled = emulator->joypad->polls == polls ? fuzzer->unpolled + 1 : 0;
+        if (emulator->cpu->ram_hash != hash)
+        {
+            fuzzer->ignored = 0;
+        }
+        else if (changed)
+        {
+            fuzzer->ignored++;
+        }
+        if (fuzzer->hang_steps != 0 && (fuzzer->unpolled >= fuzzer->hang_steps || fuzzer->ignored >= fuzzer->hang_steps))
+        {
+            *length = step + 1;
+            return true;
+        }
+    }
+    if (checkpointing)
+    {
+        save_checkpoint(fuzzer, *length);
+    }
+    return false;
+}
+
+/**
+ * Runs `buttons` into fuzzer->run: a seed from the start, checkpointing it,
+ * or a mutant of the last seed checkpointed, whose steps before `first` are
+ * the seed's, from the latest checkpoint up to there.
+ *
+ * @return true on a soft-lock, with `length` cut to the steps played.
+ */
+static bool execute(fuzzer_t *fuzzer, const uint8_t *buttons, uint32_t *length, uint32_t first, bool checkpointing)
+{
+    if (fuzzer->slot != NULL)
+    {
+        memcpy(fuzzer->slot->buttons, buttons, *length);
+        fuzzer->slot->length = *length;
+        atomic_fetch_add_explicit(&fuzzer->slot->execs, 1, memory_order_relaxed);
+    }
+    fuzzer->execs++;
+
+    const fuzz_checkpoint_t *from = NULL;
+    if (checkpointing)
+    {
+        fuzzer->checkpoint_count = 0;
+    }
+    else
+    {
+        for (uint32_t i = fuzzer->checkpoint_count; i-- > 0;)
+        {
+            if (fuzzer->checkpoints[i].step <= first)
+            {
+                from = &fuzzer->checkpoints[i];
+                break;
+            }
+        }
+    }
+    restore(fuzzer, from);
+    return play(fuzzer, buttons, from == NULL ? 0 : from->step, length, checkpointing);
+}
+
+static bool add_entry(fuzzer_t *fuzzer, const uint8_t *buttons, uint32_t length)
+{
+    if (fuzzer->corpus_count == fuzzer->corpus_capacity)
+    {
+        uint32_t capacity = fuzzer->corpus_capacity == 0 ? 64 : fuzzer->corpus_capacity * 2;
+        fuzz_entry_t *corpus = realloc(fuzzer->corpus, capacity * sizeof(fuzz_entry_t));
+        if (corpus == NULL)
+        {
+            return false;
+        }
+        fuzzer->corpus = corpus;
+        fuzzer->corpus_capacity = capacity;
+    }
+    fuzz_entry_t *entry = &fuzzer->corpus[fuzzer->corpus_count];
+    entry->buttons = malloc(length == 0 ? 1 : length);
+    if (entry->buttons == NULL)
+    {
+        return false;
+    }
+    memcpy(entry->buttons, buttons, length);
+    entry->length = length;
+    fuzzer->corpus_count++;
+    return true;
+}
+
+// Appends the input to this instance's queue
+static bool persist(fuzzer_t *fuzzer, const uint8_t *buttons, uint32_t length)
+{
+    char path[PATH_MAX];
+    if (fuzzer->next_id == 0)
+    {
+        snprintf(path, sizeof(path), "%s/queue-%02u", fuzzer->directory, fuzzer->instance);
+        make_directory(path);
+    }
+    queue_path(fuzzer, path, fuzzer->instance, fuzzer->next_id);
+    if (!write_input(path, buttons, length))
+    {
+        return false;
+    }
+    fuzzer->synced[fuzzer->instance] = ++fuzzer->next_id;
+    return true;
+}
+
+/**
+ * Merges the run of the input's `length` steps. Soft-locks along a new path
+ * are saved to hangs/; other inputs with new edges or ROM bytes join the
+ * corpus, and its queue if `persisting`.
+ *
+ * @return true if the input joined the corpus.
+ */
+static bool judge(fuzzer_t *fuzzer, const uint8_t *buttons, uint32_t length, bool locked, bool persisting)
+{
+    if (locked)
+    {
+        if (coverage_merge(fuzzer->hang_total, fuzzer->run, NULL) > 0)
+        {
+            save_finding(fuzzer, "hangs", buttons, length);
+            fuzzer->hangs++;
+            if (fuzzer->slot != NULL)
+            {
+                atomic_fetch_add_explicit(&fuzzer->slot->hangs, 1, memory_order_relaxed);
+            }
+        }
+        return false;
+    }
+    uint64_t new_rom;
+    if (coverage_merge(fuzzer->total, fuzzer->run, &new_rom) == 0 && new_rom == 0)
+    {
+        return false;
+    }
+    if (persisting)
+    {
+        persist(fuzzer, buttons, length);
+    }
+    return add_entry(fuzzer, buttons, length);
+}
+
+
+// =================================================================================
+//                          Mutation
+// =================================================================================
+
+// A random mask held over [at, at + count)
+static void hold_buttons(fuzzer_t *fuzzer, uint32_t at, uint32_t count)
+{
+    memset(fuzzer->mutant + at, (uint8_t)next_random(fuzzer), count);
+}
+
+/**
+ * Writes a mutant of corpus entry `index` to fuzzer->mutant: 1 to 8 stacked
+ * bit flips, new masks, held runs, insertions, deletions, copied blocks,
+ * appended steps and splices with another entry.
+ *
+ * @return the first step where the mutant differs from the entry.
+ */
+static uint32_t mutate(fuzzer_t *fuzzer, uint32_t index)
+{
+    const fuzz_entry_t *seed = &fuzzer->corpus[index];
+    uint32_t length = seed->length;
+    uint32_t max = step_limit(fuzzer) > length ? step_limit(fuzzer) : length;
+    memcpy(fuzzer->mutant, seed->buttons, length);
+    uint32_t first = length;
+    uint32_t mutations = 1 << random_below(fuzzer, 4);
+    for (uint32_t m = 0; m < mutations; m++)
+    {
+        uint32_t at = random_below(fuzzer, length + 1);
+        uint32_t count = 1 + random_below(fuzzer, FUZZ_MAX_RUN);
+        switch (random_below(fuzzer, 8))
+        {
+        case 0: // Flip a button
+            if (at == length)
+            {
+                continue;
+            }
+            fuzzer->mutant[at] ^= 1 << random_below(fuzzer, 8);
+            break;
+        case 1: // New mask
+            if (at == length)
+            {
+                continue;
+            }
+            fuzzer->mutant[at] = (uint8_t)next_random(fuzzer);
+            break;
+        case 2: // Hold a mask over a run
+            count = count < length - at ? count : length - at;
+            hold_buttons(fuzzer, at, count);
+            break;
+        case 3: // Insert a held run
+            count = count < max - length ? count : max - length;
+            memmove(fuzzer->mutant + at + count, fuzzer->mutant + at, length - at);
+            hold_buttons(fuzzer, at, count);
+            length += count;
+            break;
+        case 4: // Delete a run
+            count = count < length - at ? count : length - at;
+            memmove(fuzzer->mutant + at, fuzzer->mutant + at + count, length - at - count);
+            length -= count;
+            break;
+        case 5: // Copy a block over another place
+        {
+            uint32_t from = random_below(fuzzer, length + 1);
+            count = count < length - from ? count : length - from;
+            count = count < length - at ? count : length - at;
+            memmove(fuzzer->mutant + at, fuzzer->mutant + from, count);
+            break;
+        }
+        case 6: // Play on after the end
+            at = length;
+            count = count < max - length ? count : max - length;
+            hold_buttons(fuzzer, at, count);
+            length += count;
+            break;
+        case 7: // Go on as another entry does
+        {
+            const fuzz_entry_t *other = &fuzzer->corpus[random_below(fuzzer, fuzzer->corpus_count)];
+            uint32_t end = other->length < max ? other->length : max;
+            at = at < end ? at : end;
+            length = end;
+            memcpy(fuzzer->mutant + at, other->buttons + at, length - at);
+            break;
+        }
+        }
+        first = at < first ? at : first;
+    }
+    fuzzer->mutant_length = length;
+    return first;
+}
+
+
+// =================================================================================
+//                          Fuzzing
+// =================================================================================
+
+/**
+ * Runs `buttons` from the start state and adds it to the corpus and the
+ * queue, new coverage or not. Up to max_steps steps.
+ *
+ * @return 0 on success, -1 if it is too long, soft-locks, or cannot be
+ * stored.
+ */
+int fuzzer_add_seed(fuzzer_t *fuzzer, const uint8_t *buttons, uint32_t length)
+{
+    uint32_t played = length;
+    if (length > step_limit(fuzzer) || execute(fuzzer, buttons, &played, 0, false))
+    {
+        return -1;
+    }
+    coverage_merge(fuzzer->total, fuzzer->run, NULL);
+    if (!persist(fuzzer, buttons, length) || !add_entry(fuzzer, buttons, length))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Runs the inputs the queues gained since the last sync, this instance's
+ * own included after a restart, keeping those new to this fuzzer.
+ *
+ * @return the number of inputs added to the corpus.
+ */
+uint32_t fuzzer_sync(fuzzer_t *fuzzer)
+{
+    char path[PATH_MAX];
+    uint32_t added = 0;
+    for (uint32_t instance = 0; instance < FUZZ_MAX_INSTANCES; instance++)
+    {
+        while (true)
+        {
+            queue_path(fuzzer, path, instance, fuzzer->synced[instance]);
+            int64_t length = read_input(path, fuzzer->mutant, step_limit(fuzzer));
+            if (length < 0)
+            {
+                break;
+            }
+            fuzzer->synced[instance]++;
+            uint32_t played = length;
+            bool locked = execute(fuzzer, fuzzer->mutant, &played, 0, false);
+            added += judge(fuzzer, fuzzer->mutant, played, locked, false);
+        }
+    }
+    fuzzer->next_id = fuzzer->synced[fuzzer->instance];
+    return added;
+}
+
+/**
+ * Picks a corpus entry and runs it with FUZZ_MUTANTS of its mutants, which
+ * start from the checkpoint nearest their first change. An empty corpus is
+ * first seeded with a step of no buttons.
+ *
+ * @return the number of mutants that joined the corpus.
+ */
+uint32_t fuzzer_fuzz_one(fuzzer_t *fuzzer)
+{
+    if (fuzzer->corpus_count == 0)
+    {
+        uint8_t idle = 0;
+        if (fuzzer_add_seed(fuzzer, &idle, 1) != 0)
+        {
+            return 0;
+        }
+    }
+    uint32_t index = random_below(fuzzer, fuzzer->corpus_count);
+    const fuzz_entry_t *seed = &fuzzer->corpus[index];
+    uint32_t played = seed->length;
+    if (execute(fuzzer, seed->buttons, &played, 0, true))
+    {
+        return 0;
+    }
+    coverage_merge(fuzzer->total, fuzzer->run, NULL);
+
+    uint32_t added = 0;
+    for (int i = 0; i < FUZZ_MUTANTS; i++)
+    {
+        uint32_t first = mutate(fuzzer, index);
+        uint32_t played = fuzzer->mutant_length;
+        bool locked = execute(fuzzer, fuzzer->mutant, &played, first, false);
+        added += judge(fuzzer, fuzzer->mutant, played, locked, true);
+    }
+    return added;
+}
+
+
+// =================================================================================
+//                          Instances
+// =================================================================================
+
+// The body of an instance process: sync, fuzz until the shared count of
+// runs reaches `execs`, syncing now and then
+static void run_instance(fuzzer_t *fuzzer, fuzz_slot_t *slot, uint32_t instance, uint64_t execs)
+{
+    // Invalid instructions report on stderr; the supervisor collects them
+    int null = open("/dev/null", O_WRONLY);
+    if (null >= 0)
+    {
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        close(null);
+    }
+    fuzzer->instance = instance;
+    fuzzer->slot = slot;
+    // A restarted instance must not draw the mutants that brought it down again
+    fuzzer->rng ^= (instance + 1) * 0xD6E8FEB86659FD93ULL + atomic_load(&slot->execs);
+    fuzzer_sync(fuzzer);
+    for (uint32_t picked = 1; atomic_load_explicit(&slot->execs, memory_order_relaxed) < execs; picked++)
+    {
+        fuzzer_fuzz_one(fuzzer);
+        if (picked % FUZZ_SYNC_INTERVAL == 0)
+        {
+            fuzzer_sync(fuzzer);
+        }
+    }
+    _exit(0);
+}
+
+static pid_t start_instance(fuzzer_t *fuzzer, fuzz_slot_t *slots, uint32_t instance, uint64_t execs)
+{
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        run_instance(fuzzer, &slots[instance], instance, execs);
+    }
+    return pid;
+}
+
+/**
+ * Fuzzes with `instances` processes forked from this one, each until it has
+ * made `execs` runs. They start with the corpus and coverage of `fuzzer`,
+ * then share their finds through the directory. An instance that dies is
+ * counted as a crash: its input goes to crashes/ and it is restarted, taking
+ * the queues again. The supervisor reaps any child of the process. The runs
+ * and hangs of all instances are then added to the fuzzer's counts.
+ *
+ * @return 0 on success, -1 if shared memory or a process could not be had.
+ */
+int fuzzer_run(fuzzer_t *fuzzer, uint32_t instances, uint64_t execs)
+{
+    if (instances == 0 || instances > FUZZ_MAX_INSTANCES)
+    {
+        fprintf(stderr, "Invalid number of fuzzing instances %u.\n", instances);
+        exit(1);
+    }
+    size_t size = instances * sizeof(fuzz_slot_t);
+    fuzz_slot_t *slots = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    pid_t *pids = calloc(instances, sizeof(pid_t));
+    if (slots == MAP_FAILED || pids == NULL)
+    {
+        if (slots != MAP_FAILED)
+        {
+            munmap(slots, size);
+        }
+        free(pids);
+        return -1;
+    }
+
+    int result = 0;
+    uint32_t running = 0;
+    for (uint32_t i = 0; i < instances; i++)
+    {
+        pids[i] = start_instance(fuzzer, slots, i, execs);
+        if (pids[i] < 0)
+        {
+            result = -1;
+            break;
+        }
+        running++;
+    }
+    while (running > 0)
+    {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        uint32_t i = 0;
+        while (i < instances && pids[i] != pid)
+        {
+            i++;
+        }
+        if (i == instances)
+        {
+            continue;
+        }
+        pids[i] = 0;
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        {
+            running--;
+            continue;
+        }
+        save_finding(fuzzer, "crashes", slots[i].buttons, slots[i].length);
+        fuzzer->crashes++;
+        if (atomic_load(&slots[i].execs) >= execs || (pids[i] = start_instance(fuzzer, slots, i, execs)) < 0)
+        {
+            pids[i] = 0;
+            running--;
+        }
+    }
+
+    for (uint32_t i = 0; i < instances; i++)
+    {
+        fuzzer->execs += atomic_load(&slots[i].execs);
+        fuzzer->hangs += atomic_load(&slots[i].hangs);
+    }
+    munmap(slots, size);
+    free(pids);
+    return result;
+}
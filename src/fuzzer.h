@@ -0,0 +1,110 @@
+#ifndef FUZZER_H
+#define FUZZER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "env.h"
+#include "coverage.h"
+
+
+#define FUZZ_MAX_STEPS      4096    // Button masks in one input
+#define FUZZ_MAX_INSTANCES  64
+#define FUZZ_CHECKPOINTS    8       // States kept along the seed being mutated
+#define FUZZ_MUTANTS        64      // Runs per seed picked
+
+
+/**
+ * An input: the joypad_button_t mask held for each step of frames_per_step
+ * frames, played from the fuzzer's start state. On disk it is just those
+ * bytes.
+ */
+typedef struct FuzzEntry
+{
+    uint32_t length;
+    uint8_t *buttons;
+} fuzz_entry_t;
+
+// The seed's run as it was before step `step`, for mutants that only change
+// what comes after
+typedef struct FuzzCheckpoint
+{
+    uint32_t step;
+    emulator_state_t *state;
+    coverage_t *coverage;
+    uint32_t unpolled;          // Steps since the joypad was last read
+    uint32_t ignored;           // Button changes since the RAM last changed
+} fuzz_checkpoint_t;
+
+// An instance's page shared with the supervisor. The input is written before
+// every run, so it is still there when the run brings the process down.
+typedef struct FuzzSlot
+{
+    _Atomic uint64_t execs;
+    _Atomic uint64_t hangs;
+    uint32_t length;
+    uint8_t buttons[FUZZ_MAX_STEPS];
+} fuzz_slot_t;
+
+
+/**
+ * Coverage-guided fuzzer of joypad input. Inputs are mutated from a corpus
+ * and replayed from a start state; those reaching new branch edges or ROM
+ * bytes join the corpus and its directory. A run ends early as a soft-lock
+ * when, for hang_steps steps, the joypad is not read or the RAM (as hashed
+ * by compute_ram_hash) ignores every change of buttons.
+ *
+ * The directory holds queue-NN/ per instance, with inputs numbered in the
+ * order found, plus hangs/ and crashes/, named by a hash of the input.
+ * Instances started by fuzzer_run each take the other instances' finds from
+ * there, and a fuzzer created on an existing directory resumes from it.
+ */
+typedef struct Fuzzer
+{
+    env_t *env;                 // The snapshot is the start state
+    char *directory;
+    uint32_t instance;
+    uint32_t banks;
+
+    // Settings, changed before fuzzing
+    uint32_t frames_per_step;
+    uint32_t max_steps;         // At most FUZZ_MAX_STEPS
+    uint32_t hang_steps;        // 0 turns soft-lock detection off
+    uint64_t rng;
+
+    coverage_t *run;            // Attached to the CPU
+    coverage_t *total;
+    coverage_t *hang_total;     // Of the hangs saved
+
+    fuzz_entry_t *corpus;
+    uint32_t corpus_count;
+    uint32_t corpus_capacity;
+    uint32_t next_id;           // Next file of this instance's queue
+    uint32_t synced[FUZZ_MAX_INSTANCES];    // Files taken from each queue
+
+    fuzz_checkpoint_t checkpoints[FUZZ_CHECKPOINTS + 1];
+    uint32_t checkpoint_count;
+    uint8_t mutant[FUZZ_MAX_STEPS];
+    uint32_t mutant_length;
+    uint32_t unpolled;          // Of the run in progress, as in a checkpoint
+    uint32_t ignored;
+
+    fuzz_slot_t *slot;          // Set in instances started by fuzzer_run
+    uint64_t execs;
+    uint64_t hangs;
+    uint64_t crashes;           // Counted by fuzzer_run
+} fuzzer_t;
+
+
+fuzzer_t *new_fuzzer(const char *directory, const emulator_state_t *start, uint32_t banks);
+void free_fuzzer(fuzzer_t *fuzzer);
+
+int fuzzer_add_seed(fuzzer_t *fuzzer, const uint8_t *buttons, uint32_t length);
+uint32_t fuzzer_sync(fuzzer_t *fuzzer);
+uint32_t fuzzer_fuzz_one(fuzzer_t *fuzzer);
+int fuzzer_run(fuzzer_t *fuzzer, uint32_t instances, uint64_t execs);
+
+
+#endif
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "joypad.h"
+
+
+joypad_t *new_joypad()
+{
+    joypad_t *joypad = malloc(sizeof(joypad_t));
+    if (joypad == NULL)
+    {
+        return NULL;
+    }
+    joypad->select = 0x30;
+    joypad->buttons = 0;
+    joypad->dropped = 0;
+    joypad->polls = 0;
+    joypad->changes = 0;
+    joypad->head = 0;
+    joypad->count = 0;
+    return joypad;
+}
+
+void free_joypad(joypad_t *joypad)
+{
+    free(joypad);
+    joypad = NULL;
+    return;
+}
+
+
+// P1 bits 0-3 for the selected groups, 0 = pressed
+static uint8_t input_lines(joypad_t *joypad)
+{
+    uint8_t pressed = 0;
+    if (!(joypad->select & 0x10))
+    {
+        pressed |= joypad->buttons & 0x0F;
+    }
+    if (!(joypad->select & 0x20))
+    {
+        pressed |= joypad->buttons >> 4;
+    }
+    return ~pressed & 0x0F;
+}
+
+/**
+ * Sets the select bits and the held buttons.
+ *
+ * @return true if an input line went from high to low, which requests the
+ * joypad interrupt.
+ */
+static bool update_lines(joypad_t *joypad, uint8_t select, uint8_t buttons)
+{
+    uint8_t before = input_lines(joypad);
+    joypad->select = select;
+    joypad->buttons = buttons;
+    joypad->changes++;
+    return (before & ~input_lines(joypad)) != 0;
+}
+
+uint8_t joypad_read_register(joypad_t *joypad)
+{
+    if ((joypad->select & 0x30) != 0x30)
+    {
+        joypad->polls++;
+    }
+    return joypad_peek_register(joypad);
+}
+
+/**
+ * P1 as read, without counting a poll.
+ */
+uint8_t joypad_peek_register(joypad_t *joypad)
+{
+    return 0xC0 | joypad->select | input_lines(joypad);
+}
+
+/**
+ * Only the select bits are writable.
+ *
+ * @return true if the joypad interrupt is requested.
+ */
+bool joypad_write_register(joypad_t *joypad, uint8_t value)
+{
+    return update_lines(joypad, value & 0x30, joypad->buttons);
+}
+
+/**
+ * Changes the held buttons now, between instructions.
+ *
+ * @return true if the joypad interrupt is requested.
+ */
+bool joypad_set_buttons(joypad_t *joypad, uint8_t buttons)
+{
+    return update_lines(joypad, joypad->select, buttons);
+}
+
+
+// =================================================================================
+//                          Input queue
+// =================================================================================
+
+static joypad_event_t *event_at(joypad_t *joypad, uint32_t index)
+{
+    return &joypad->events[(joypad->head + index) % JOYPAD_QUEUE_EVENTS];
+}
+
+/**
+ * Queues `buttons` to be held from M-cycle `cycle` on. Events may be queued
+ * in any order; events for the same cycle apply in the order queued.
+ *
+ * @return false if the queue is full and the event was dropped.
+ */
+bool joypad_queue_input(joypad_t *joypad, uint64_t cycle, uint8_t buttons)
+{
+    if (joypad->count == JOYPAD_QUEUE_EVENTS)
+    {
+        joypad->dropped++;
+        return false;
+    }
+    // Insertion from the back: appending in order costs one comparison
+    uint32_t index = joypad->count;
+    while (index > 0 && event_at(joypad, index - 1)->cycle > cycle)
+    {
+        *event_at(joypad, index) = *event_at(joypad, index - 1);
+        index--;
+    }
+    event_at(joypad, index)->cycle = cycle;
+    event_at(joypad, index)->buttons = buttons;
+    joypad->count++;
+    return true;
+}
+
+/**
+ * @return the cycle of the earliest pending event, UINT64_MAX if none.
+ */
+uint64_t joypad_next_event(joypad_t *joypad)
+{
+    return joypad->count > 0 ? event_at(joypad, 0)->cycle : UINT64_MAX;
+}
+
+/**
+ * Applies every event due at or before `cycle`.
+ *
+ * @return true if the joypad interrupt is requested.
+ */
+bool joypad_apply_events(joypad_t *joypad, uint64_t cycle)
+{
+    bool interrupt = false;
+    while (joypad->count > 0 && event_at(joypad, 0)->cycle <= cycle)
+    {
+        interrupt |= joypad_set_buttons(joypad, event_at(joypad, 0)->buttons);
+        joypad->head = (joypad->head + 1) % JOYPAD_QUEUE_EVENTS;
+        joypad->count--;
+    }
+    return interrupt;
+}
@@ -0,0 +1,65 @@
+#ifndef JOYPAD_H
+#define JOYPAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define JOYPAD_REGISTER     0xFF00  // P1
+#define IF_REGISTER         0xFF0F
+#define JOYPAD_INTERRUPT    0x10    // IF bit 4
+#define JOYPAD_QUEUE_EVENTS 256
+
+
+// Host button mask, 1 = held. The low nibble is the P1 direction group and
+// the high nibble the action group, in P1 bit order.
+typedef enum JoypadButton
+{
+    BUTTON_RIGHT  = 0x01,
+    BUTTON_LEFT   = 0x02,
+    BUTTON_UP     = 0x04,
+    BUTTON_DOWN   = 0x08,
+    BUTTON_A      = 0x10,
+    BUTTON_B      = 0x20,
+    BUTTON_SELECT = 0x40,
+    BUTTON_START  = 0x80
+} joypad_button_t;
+
+
+// The buttons held from M-cycle `cycle` on
+typedef struct JoypadEvent
+{
+    uint64_t cycle;
+    uint8_t buttons;
+} joypad_event_t;
+
+
+typedef struct Joypad
+{
+    uint8_t select;             // P1 bits 4-5 as written, 0 selects a group
+    uint8_t buttons;            // Held now
+    uint64_t dropped;           // Events refused because the queue was full
+    uint64_t polls;             // P1 reads with a button group selected
+    uint64_t changes;           // Updates of the select bits or held buttons
+
+    // Pending events in cycle order, a ring starting at `head`
+    joypad_event_t events[JOYPAD_QUEUE_EVENTS];
+    uint32_t head;
+    uint32_t count;
+} joypad_t;
+
+
+joypad_t *new_joypad();
+void free_joypad(joypad_t *joypad);
+
+uint8_t joypad_read_register(joypad_t *joypad);
+uint8_t joypad_peek_register(joypad_t *joypad);
+bool joypad_write_register(joypad_t *joypad, uint8_t value);
+
+bool joypad_set_buttons(joypad_t *joypad, uint8_t buttons);
+bool joypad_queue_input(joypad_t *joypad, uint64_t cycle, uint8_t buttons);
+uint64_t joypad_next_event(joypad_t *joypad);
+bool joypad_apply_events(joypad_t *joypad, uint64_t cycle);
+
+
+#endif
@@ -0,0 +1,459 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "lockstep.h"
+
+
+// Vector comparisons give -1 in every true element
+typedef int8_t lane_masks8_t __attribute__((vector_size(LOCKSTEP_MAX_LANES))) __attribute__((aligned(16)));
+typedef int16_t lane_masks16_t __attribute__((vector_size(LOCKSTEP_MAX_LANES * 2))) __attribute__((aligned(32)));
+typedef int64_t lane_masks64_t __attribute__((vector_size(LOCKSTEP_MAX_LANES * 8))) __attribute__((aligned(64)));
+
+// The run loop is also built for AVX2 and AVX-512 hosts, picked at load time:
+// 16 lanes of PC fill one AVX2 register, 16 cycle counters two AVX-512 ones
+#if defined(__x86_64__)
+#define LOCKSTEP_CLONES __attribute__((target_clones("arch=skylake-avx512", "avx2", "default")))
+#else
+#define LOCKSTEP_CLONES
+#endif
+
+
+// =================================================================================
+//                          Lanes
+// =================================================================================
+
+// Bare buses only: below the I/O page memory has no side effects
+static inline uint8_t lane_read(cpu_t *cpu, uint16_t address)
+{
+    return address < 0xFE00 ? cpu->memorybus[address] : read_memory(cpu, address);
+}
+
+// Copies one lane's registers out of its cpu_t
+static void load_lane(lockstep_t *lockstep, uint32_t lane)
+{
+    cpu_t *cpu = lockstep->cpus[lane];
+    registers_t *registers = cpu->registers;
+    lockstep->r8[LANE_A][lane] = *registers->AF >> 8;
+    lockstep->r8[LANE_F][lane] = *registers->AF & 0xFF;
+    lockstep->r8[LANE_B][lane] = *registers->BC >> 8;
+    lockstep->r8[LANE_C][lane] = *registers->BC & 0xFF;
+    lockstep->r8[LANE_D][lane] = *registers->DE >> 8;
+    lockstep->r8[LANE_E][lane] = *registers->DE & 0xFF;
+    lockstep->r8[LANE_H][lane] = *registers->HL >> 8;
+    lockstep->r8[LANE_L][lane] = *registers->HL & 0xFF;
+    lockstep->pc[lane] = cpu->PC;
+    lockstep->sp[lane] = cpu->SP;
+    lockstep->cycles[lane] = cpu->cycles;
+}
+
+// Copies one lane's registers into its cpu_t
+static void store_lane(lockstep_t *lockstep, uint32_t lane)
+{
+    cpu_t *cpu = lockstep->cpus[lane];
+    registers_t *registers = cpu->registers;
+    *registers->AF = unsigned_16(lockstep->r8[LANE_A][lane], lockstep->r8[LANE_F][lane]);
+    *registers->BC = unsigned_16(lockstep->r8[LANE_B][lane], lockstep->r8[LANE_C][lane]);
+    *registers->DE = unsigned_16(lockstep->r8[LANE_D][lane], lockstep->r8[LANE_E][lane]);
+    *registers->HL = unsigned_16(lockstep->r8[LANE_H][lane], lockstep->r8[LANE_L][lane]);
+    cpu->PC = lockstep->pc[lane];
+    cpu->SP = lockstep->sp[lane];
+    cpu->cycles = lockstep->cycles[lane];
+}
+
+// Divergent lanes and opcodes without a vector form go through the interpreter
+static void run_scalar(lockstep_t *lockstep, uint32_t lane)
+{
+    store_lane(lockstep, lane);
+    execute_next_instruction(lockstep->cpus[lane]);
+    load_lane(lockstep, lane);
+}
+
+
+/**
+ * @return an engine of `lanes` CPUs at power-on, each with its own cleared
+ * memory, or NULL if memory runs out.
+ */
+lockstep_t *new_lockstep(uint32_t lanes)
+{
+    if (lanes == 0 || lanes > LOCKSTEP_MAX_LANES)
+    {
+        fprintf(stderr, "Invalid lockstep lane count %u.\n", lanes);
+        exit(1);
+    }
+    lockstep_t *lockstep = aligned_alloc(_Alignof(lockstep_t), sizeof(lockstep_t));
+    if (lockstep == NULL)
+    {
+        return NULL;
+    }
+    memset(lockstep, 0, sizeof(lockstep_t));
+    lockstep->lanes = lanes;
+    for (uint32_t lane = 0; lane < lanes; lane++)
+    {
+        lockstep->cpus[lane] = new_cpu();
+        if (lockstep->cpus[lane] == NULL)
+        {
+            free_lockstep(lockstep);
+            return NULL;
+        }
+        // One instruction per call, so lanes meet at instruction boundaries
+        lockstep->cpus[lane]->fusion = FUSE_NONE;
+        lockstep->cpus[lane]->idle_skip = false;
+    }
+    lockstep_load_registers(lockstep);
+    return lockstep;
+}
+
+void free_lockstep(lockstep_t *lockstep)
+{
+    if (lockstep != NULL)
+    {
+        for (uint32_t lane = 0; lane < lockstep->lanes; lane++)
+        {
+            if (lockstep->cpus[lane] != NULL)
+            {
+                free_cpu(lockstep->cpus[lane]);
+            }
+        }
+    }
+    free(lockstep);
+    lockstep = NULL;
+    return;
+}
+
+/**
+ * Takes the registers of every lane from its cpu_t, e.g. after setting a
+ * lane up through lockstep->cpus.
+ */
+void lockstep_load_registers(lockstep_t *lockstep)
+{
+    for (uint32_t lane = 0; lane < lockstep->lanes; lane++)
+    {
+        load_lane(lockstep, lane);
+    }
+}
+
+/**
+ * Writes the registers of every lane back to its cpu_t, to inspect or run it
+ * on its own.
+ */
+void lockstep_store_registers(lockstep_t *lockstep)
+{
+    for (uint32_t lane = 0; lane < lockstep->lanes; lane++)
+    {
+        store_lane(lockstep, lane);
+    }
+}
+
+
+// =================================================================================
+//                          Vector instructions
+// =================================================================================
+
+static inline void blend_bytes(lane_bytes_t *row, lane_bytes_t value, lane_bytes_t mask)
+{
+    *row = (value & mask) | (*row & ~mask);
+}
+
+static inline void blend_words(lane_words_t *row, const lane_words_t *value, const lane_words_t *mask)
+{
+    *row = (*value & *mask) | (*row & ~*mask);
+}
+
+// Byte mask to word mask, each element sign extended
+#define WIDEN_MASK(mask) ((lane_words_t)__builtin_convertvector((lane_masks8_t)(mask), lane_masks16_t))
+
+// Byte `offset` after PC on each lane of a group at `pc`
+static inline lane_bytes_t gather_immediate(lockstep_t *lockstep, lane_bytes_t mask, uint16_t pc, uint16_t offset)
+{
+    lane_bytes_t values = {0};
+    for (uint32_t lane = 0; lane < lockstep->lanes; lane++)
+    {
+        if (mask[lane])
+        {
+            values[lane] = lane_read(lockstep->cpus[lane], pc + offset);
+        }
+    }
+    return values;
+}
+
+// Z, N, H and C of a - b, as sub() computes them
+static inline lane_bytes_t sub_flags(lane_bytes_t a, lane_bytes_t b)
+{
+    lane_bytes_t zero = (lane_bytes_t)(a - b == 0) & 0x80;
+    lane_bytes_t half = (lane_bytes_t)((b & 0x0F) > (a & 0x0F)) & 0x20;
+    lane_bytes_t carry = (lane_bytes_t)(b > a) & 0x10;
+    return zero | 0x40 | half | carry;
+}
+
+// Lanes where the NZ, Z, NC or C condition in bits 3-4 of `opcode` holds
+static inline lane_bytes_t condition(lane_bytes_t flags, uint8_t opcode)
+{
+    lane_bytes_t flag = flags & (uint8_t)(opcode & 0x10 ? 0x10 : 0x80);
+    lane_bytes_t set = (lane_bytes_t)(flag != 0);
+    return opcode & 0x08 ? set : ~set;
+}
+
+/**
+ * Runs `opcode`, fetched at `pc`, on every lane in `mask` at once. The
+ * vector set is limited to handlers that agree bit for bit with
+ * execute_instruction: register loads, INC/DEC, SUB, AND and CP on
+ * registers and immediates, 16-bit INC/DEC and loads, JR and JP.
+ *
+ * @return false, with nothing changed, if the opcode has no vector form.
+ */
+static inline __attribute__((always_inline))
+bool execute_vector(lockstep_t *lockstep, uint8_t opcode, uint16_t pc, lane_bytes_t mask)
+{
+    lane_bytes_t *r8 = lockstep->r8;
+    lane_words_t mask16 = WIDEN_MASK(mask);
+    uint8_t dest = (opcode >> 3) & 7;
+    uint8_t source = opcode & 7;
+    uint16_t length = 1;
+    uint16_t cycles = 1;
+    lane_words_t taken = {0};       // Lanes that branch to `target` instead
+    lane_words_t target = {0};
+    uint16_t taken_cycles = 0;
+
+    if (opcode >= 0x40 && opcode < 0x80)
+    {
+        // LD r,r'
+        if (dest == 6 || source == 6)
+        {
+            return false;
+        }
+        blend_bytes(&r8[dest], r8[source], mask);
+    }
+    else if ((opcode & 0xC7) == 0x06 && dest != 6)
+    {
+        // LD r,n
+        blend_bytes(&r8[dest], gather_immediate(lockstep, mask, pc, 1), mask);
+        length = 2;
+        cycles = 2;
+    }
+    else if ((opcode & 0xC6) == 0x04 && dest != 6)
+    {
+        // INC r and DEC r keep C
+        bool decrement = opcode & 1;
+        lane_bytes_t value = decrement ? r8[dest] - 1 : r8[dest] + 1;
+        lane_bytes_t half = (lane_bytes_t)(((decrement ? r8[dest] : value) & 0x0F) == 0);
+        lane_bytes_t flags = (r8[LANE_F] & 0x10) | ((lane_bytes_t)(value == 0) & 0x80)
+                             | (half & 0x20) | (uint8_t)(decrement ? 0x40 : 0);
+        blend_bytes(&r8[dest], value, mask);
+        blend_bytes(&r8[LANE_F], flags, mask);
+    }
+    else if ((opcode >= 0x90 && opcode < 0x98) || (opcode >= 0xB8 && opcode < 0xC0)
+             || opcode == 0xD6 || opcode == 0xFE)
+    {
+        // SUB and CP, on a register or an immediate
+        if (opcode < 0xC0 && source == 6)
+        {
+            return false;
+        }
+        lane_bytes_t operand = r8[source];
+        if (opcode >= 0xC0)
+        {
+            operand = gather_immediate(lockstep, mask, pc, 1);
+            length = 2;
+            cycles = 2;
+        }
+        lane_bytes_t a = r8[LANE_A];
+        blend_bytes(&r8[LANE_F], sub_flags(a, operand), mask);
+        if ((opcode & 0xF8) != 0xB8 && opcode != 0xFE)
+        {
+            blend_bytes(&r8[LANE_A], a - operand, mask);
+        }
+    }
+    else if (opcode >= 0xA0 && opcode < 0xA8)
+    {
+        // AND r
+        if (source == 6)
+        {
+            return false;
+        }
+        lane_bytes_t value = r8[LANE_A] & r8[source];
+        blend_bytes(&r8[LANE_A], value, mask);
+        blend_bytes(&r8[LANE_F], ((lane_bytes_t)(value == 0) & 0x80) | 0x20, mask);
+    }
+    else
+    {
+        uint8_t pair = opcode >> 4;
+        switch (opcode)
+        {
+        case 0x00: // NOP
+            break;
+        case 0x01: case 0x11: case 0x21: // LD rr,nn
+            blend_bytes(&r8[pair * 2 + 1], gather_immediate(lockstep, mask, pc, 1), mask);
+            blend_bytes(&r8[pair * 2], gather_immediate(lockstep, mask, pc, 2), mask);
+            length = 3;
+            cycles = 3;
+            break;
+        case 0x31: // LD SP,nn
+        {
+            lane_words_t low = __builtin_convertvector(gather_immediate(lockstep, mask, pc, 1), lane_words_t);
+            lane_words_t high = __builtin_convertvector(gather_immediate(lockstep, mask, pc, 2), lane_words_t);
+            lane_words_t sp = low | (high << 8);
+            blend_words(&lockstep->sp, &sp, &mask16);
+            length = 3;
+            cycles = 3;
+            break;
+        }
+        case 0x03: case 0x13: case 0x23: // INC rr: the carry out of the low byte is -1 where it wrapped
+        {
+            lane_bytes_t low = r8[pair * 2 + 1] + 1;
+            blend_bytes(&r8[pair * 2], r8[pair * 2] - (lane_bytes_t)(low == 0), mask);
+            blend_bytes(&r8[pair * 2 + 1], low, mask);
+            cycles = 2;
+            break;
+        }
+        case 0x0B: case 0x1B: case 0x2B: // DEC rr
+        {
+            lane_bytes_t low = r8[pair * 2 + 1];
+            blend_bytes(&r8[pair * 2], r8[pair * 2] + (lane_bytes_t)(low == 0), mask);
+            blend_bytes(&r8[pair * 2 + 1], low - 1, mask);
+            cycles = 2;
+            break;
+        }
+        case 0x33: case 0x3B: // INC SP, DEC SP
+        {
+            lane_words_t sp = opcode == 0x33 ? lockstep->sp + 1 : lockstep->sp - 1;
+            blend_words(&lockstep->sp, &sp, &mask16);
+            cycles = 2;
+            break;
+        }
+        case 0x18: // JR e
+        case 0x20: case 0x28: case 0x30: case 0x38: // JR cc,e
+        {
+            lane_bytes_t e = gather_immediate(lockstep, mask, pc, 1);
+            lane_words_t offset = (lane_words_t)__builtin_convertvector((lane_masks8_t)e, lane_masks16_t);
+            target = offset + (uint16_t)(pc + 2);
+            taken = opcode == 0x18 ? mask16 : WIDEN_MASK(condition(r8[LANE_F], opcode));
+            length = 2;
+            cycles = 2;
+            taken_cycles = 3;
+            break;
+        }
+        case 0xC3: // JP nn
+        case 0xC2: case 0xCA: case 0xD2: case 0xDA: // JP cc,nn
+        {
+            lane_words_t low = __builtin_convertvector(gather_immediate(lockstep, mask, pc, 1), lane_words_t);
+            lane_words_t high = __builtin_convertvector(gather_immediate(lockstep, mask, pc, 2), lane_words_t);
+            target = low | (high << 8);
+            taken = opcode == 0xC3 ? mask16 : WIDEN_MASK(condition(r8[LANE_F], opcode));
+            length = 3;
+            cycles = 3;
+            taken_cycles = 4;
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+
+    lane_words_t zero = {0};
+    lane_words_t next = (target & taken) | ((zero + (uint16_t)(pc + length)) & ~taken);
+    lane_words_t timing = ((zero + taken_cycles) & taken) | ((zero + cycles) & ~taken);
+    blend_words(&lockstep->pc, &next, &mask16);
+    lockstep->cycles += __builtin_convertvector(timing & mask16, lane_cycles_t);
+    return true;
+}
+
+
+// =================================================================================
+//                          Scheduling
+// =================================================================================
+
+/**
+ * Runs every lane for at least `cycles` more M-cycles. Each round picks the
+ * lowest PC among the lanes still short of their target, so lanes that
+ * branched ahead wait for the others to catch up, and issues its opcode to
+ * every lane there. Groups of one lane run scalar.
+ *
+ * @return the number of rounds issued.
+ */
+LOCKSTEP_CLONES
+uint64_t lockstep_run(lockstep_t *lockstep, uint64_t cycles)
+{
+    lane_bytes_t present = {0};
+    for (uint32_t lane = 0; lane < lockstep->lanes; lane++)
+    {
+        present[lane] = 0xFF;
+    }
+    lane_cycles_t target = lockstep->cycles + cycles;
+    uint64_t groups = lockstep->groups;
+    while (true)
+    {
+        lane_masks64_t below = lockstep->cycles < target;
+        lane_bytes_t active = (lane_bytes_t)__builtin_convertvector(below, lane_masks8_t) & present;
+
+        int leader = -1;
+        for (uint32_t lane = 0; lane < lockstep->lanes; lane++)
+        {
+            if (active[lane] && (leader < 0 || lockstep->pc[lane] < lockstep->pc[leader]))
+            {
+                leader = lane;
+            }
+        }
+        if (leader < 0)
+        {
+            break;
+        }
+
+        // Lanes at the same PC join unless their memory holds different code
+        uint16_t pc = lockstep->pc[leader];
+        uint8_t opcode = lane_read(lockstep->cpus[leader], pc);
+        lane_masks16_t same_pc = lockstep->pc == pc;
+        lane_bytes_t mask = active & (lane_bytes_t)__builtin_convertvector(same_pc, lane_masks8_t);
+        uint32_t count = 0;
+        for (uint32_t lane = 0; lane < lockstep->lanes; lane++)
+        {
+            if (mask[lane] && lane_read(lockstep->cpus[lane], pc) != opcode)
+            {
+                mask[lane] = 0;
+            }
+            count += mask[lane] != 0;
+        }
+
+        lockstep->groups++;
+        lockstep->lane_instructions += count;
+        if (count > 1 && execute_vector(lockstep, opcode, pc, mask))
+        {
+            lockstep->vector_groups++;
+            lockstep->vector_instructions += count;
+            continue;
+        }
+        for (uint32_t lane = 0; lane < lockstep->lanes; lane++)
+        {
+            if (mask[lane])
+            {
+                run_scalar(lockstep, lane);
+            }
+        }
+    }
+    return lockstep->groups - groups;
+}
+
+
+/**
+ * @return the average share of the lanes that each round ran.
+ */
+double lockstep_utilization(lockstep_t *lockstep)
+{
+    if (lockstep->groups == 0)
+    {
+        return 0;
+    }
+    return (double)lockstep->lane_instructions / ((double)lockstep->groups * lockstep->lanes);
+}
+
+/**
+ * @return the share of instructions run by the vector path.
+ */
+double lockstep_vector_fraction(lockstep_t *lockstep)
+{
+    if (lockstep->lane_instructions == 0)
+    {
+        return 0;
+    }
+    return (double)lockstep->vector_instructions / lockstep->lane_instructions;
+}
@@ -0,0 +1,70 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+
+
+#define LOCKSTEP_MAX_LANES  16
+
+
+// One element per lane. Alignments are explicit, since the natural one of a
+// vector type depends on the instruction set it is compiled for
+typedef uint8_t lane_bytes_t __attribute__((vector_size(LOCKSTEP_MAX_LANES))) __attribute__((aligned(16)));
+typedef uint16_t lane_words_t __attribute__((vector_size(LOCKSTEP_MAX_LANES * 2))) __attribute__((aligned(32)));
+typedef uint64_t lane_cycles_t __attribute__((vector_size(LOCKSTEP_MAX_LANES * 8))) __attribute__((aligned(64)));
+
+// Rows of lockstep_t.r8 in opcode register order; encoding 6 is (HL), so
+// that row holds F
+typedef enum LaneRegister
+{
+    LANE_B,
+    LANE_C,
+    LANE_D,
+    LANE_E,
+    LANE_H,
+    LANE_L,
+    LANE_F,
+    LANE_A
+} lane_register_t;
+
+
+/**
+ * Experimental engine running up to LOCKSTEP_MAX_LANES CPUs on bare buses
+ * in lockstep. Registers live in structure-of-arrays form, one vector
+ * element per lane. Each round issues one opcode to every lane that
+ * shares the lowest PC. If that opcode has a vector form it runs on all of
+ * them at once; otherwise each lane runs it on its own cpu_t.
+ */
+typedef struct Lockstep
+{
+    uint32_t lanes;
+    cpu_t *cpus[LOCKSTEP_MAX_LANES];    // Memory of each lane, and its scalar fallback
+
+    lane_bytes_t r8[8];
+    lane_words_t pc;
+    lane_words_t sp;
+    lane_cycles_t cycles;               // M-cycles, as cpu->cycles
+
+    // Counted since creation
+    uint64_t groups;                    // Rounds issued
+    uint64_t vector_groups;             // Rounds run by the vector path
+    uint64_t lane_instructions;         // Instructions over all lanes
+    uint64_t vector_instructions;       // Of those, run by the vector path
+} lockstep_t;
+
+
+lockstep_t *new_lockstep(uint32_t lanes);
+void free_lockstep(lockstep_t *lockstep);
+
+void lockstep_load_registers(lockstep_t *lockstep);
+void lockstep_store_registers(lockstep_t *lockstep);
+uint64_t lockstep_run(lockstep_t *lockstep, uint64_t cycles);
+
+double lockstep_utilization(lockstep_t *lockstep);
+double lockstep_vector_fraction(lockstep_t *lockstep);
+
+
+#endif
@@ -0,0 +1,719 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "ppu.h"
+
+
+ppu_t *new_ppu()
+{
+    ppu_t *ppu = malloc(sizeof(ppu_t));
+    if (ppu == NULL)
+    {
+        return NULL;
+    }
+    // Post-boot values
+    ppu->LCDC = 0x91;
+    ppu->STAT = 0x00;
+    ppu->SCY = 0x00;
+    ppu->SCX = 0x00;
+    ppu->LYC = 0x00;
+    ppu->BGP = 0xFC;
+    ppu->OBP0 = 0xFF;
+    ppu->OBP1 = 0xFF;
+    ppu->WY = 0x00;
+    ppu->WX = 0x00;
+    ppu->lcd_on_cycle = 0;
+    ppu->vram = NULL;
+    ppu->oam = NULL;
+    ppu->interrupt_flags = NULL;
+    ppu->interrupt_cycle = 0;
+    ppu->lazy = true;
+    ppu->next_line = 0;
+    ppu->next_line_cycle = OAM_SCAN_CYCLES;
+    ppu->window_line = 0;
+    ppu->frame_count = 0;
+    ppu->render_interval = 1;
+    ppu->frame_requested = false;
+    ppu->rendering = true;
+    ppu->rendered_frame = 0;
+    memset(ppu->framebuffer, 0, sizeof(ppu->framebuffer));
+    ppu_invalidate_memory(ppu);
+    return ppu;
+}
+
+void free_ppu(ppu_t *ppu)
+{
+    free(ppu);
+    ppu = NULL;
+    return;
+}
+
+
+void ppu_attach_memory(ppu_t *ppu, uint8_t *memorybus)
+{
+    ppu->vram = memorybus + 0x8000;
+    ppu->oam = memorybus + 0xFE00;
+    ppu->interrupt_flags = memorybus + 0xFF0F;
+    ppu_invalidate_memory(ppu);
+}
+
+
+static bool lcd_enabled(ppu_t *ppu)
+{
+    return (ppu->LCDC & 0x80) != 0;
+}
+
+// Position of `cycle` inside the current frame, in M-cycles
+static uint64_t frame_position(ppu_t *ppu, uint64_t cycle)
+{
+    return (cycle - ppu->lcd_on_cycle) % CYCLES_PER_FRAME;
+}
+
+uint8_t ppu_ly(ppu_t *ppu, uint64_t cycle)
+{
+    if (!lcd_enabled(ppu))
+    {
+        return 0;
+    }
+    return (uint8_t)(frame_position(ppu, cycle) / CYCLES_PER_LINE);
+}
+
+// STAT mode at frame position `position`
+static uint8_t mode_at(uint64_t position)
+{
+    if (position / CYCLES_PER_LINE >= VISIBLE_LINES)
+    {
+        return 1;
+    }
+    uint64_t dot = position % CYCLES_PER_LINE;
+    if (dot < OAM_SCAN_CYCLES)
+    {
+        return 2;
+    }
+    if (dot < OAM_SCAN_CYCLES + PIXEL_TRANSFER_CYCLES)
+    {
+        return 3;
+    }
+    return 0;
+}
+
+/**
+ * @return the STAT mode at `cycle`: 0 HBlank, 1 VBlank, 2 OAM scan, 3 pixel transfer.
+ */
+uint8_t ppu_mode(ppu_t *ppu, uint64_t cycle)
+{
+    if (!lcd_enabled(ppu))
+    {
+        return 0;
+    }
+    return mode_at(frame_position(ppu, cycle));
+}
+
+// The STAT interrupt line at frame position `position`: any selected source is active
+static bool stat_line(ppu_t *ppu, uint64_t position)
+{
+    uint8_t mode = mode_at(position);
+    return ((ppu->STAT & 0x40) && position / CYCLES_PER_LINE == ppu->LYC)
+           || ((ppu->STAT & 0x20) && mode == 2)
+           || ((ppu->STAT & 0x10) && mode == 1)
+           || ((ppu->STAT & 0x08) && mode == 0);
+}
+
+/**
+ * Interrupts raised by the line and mode changes from ppu->interrupt_cycle
+ * up to and including `cycle`, without raising them. The STAT line only
+ * changes at a line start or at HBlank, and requests an interrupt when it
+ * rises.
+ *
+ * @return the IF bits.
+ */
+uint8_t ppu_peek_interrupts(ppu_t *ppu, uint64_t cycle)
+{
+    uint8_t interrupts = 0;
+    if (!lcd_enabled(ppu))
+    {
+        return 0;
+    }
+    uint64_t from = ppu->interrupt_cycle;
+    while (from <= cycle)
+    {
+        uint64_t position = frame_position(ppu, from);
+        uint64_t dot = position % CYCLES_PER_LINE;
+        uint64_t hblank = OAM_SCAN_CYCLES + PIXEL_TRANSFER_CYCLES;
+        uint64_t event_dot = CYCLES_PER_LINE;
+        if (dot == 0)
+        {
+            event_dot = 0;
+        }
+        else if (dot <= hblank && position / CYCLES_PER_LINE < VISIBLE_LINES)
+        {
+            event_dot = hblank;
+        }
+        uint64_t event = from - dot + event_dot;
+        if (event > cycle)
+        {
+            break;
+        }
+        position = frame_position(ppu, event);
+        if (position == VISIBLE_LINES * CYCLES_PER_LINE)
+        {
+            interrupts |= VBLANK_INTERRUPT;
+        }
+        uint64_t previous = (position == 0 ? CYCLES_PER_FRAME : position) - 1;
+        if (stat_line(ppu, position) && !stat_line(ppu, previous))
+        {
+            interrupts |= STAT_INTERRUPT;
+        }
+        from = event + 1;
+    }
+    return interrupts;
+}
+
+// Raises the interrupts of the line and mode changes up to `cycle` in IF
+static void raise_interrupts(ppu_t *ppu, uint64_t cycle)
+{
+    if (ppu->interrupt_cycle > cycle)
+    {
+        return;
+    }
+    uint8_t interrupts = ppu_peek_interrupts(ppu, cycle);
+    if (interrupts && ppu->interrupt_flags != NULL)
+    {
+        *ppu->interrupt_flags |= interrupts;
+    }
+    ppu->interrupt_cycle = cycle + 1;
+}
+
+
+bool is_ppu_register(uint16_t address)
+{
+    return address >= LCDC_REGISTER && address <= WX_REGISTER && address != DMA_REGISTER;
+}
+
+/**
+ * @return true for VRAM and OAM, whose writes the PPU must see in order.
+ */
+bool is_ppu_memory(uint16_t address)
+{
+    return (address >= 0x8000 && address < 0xA000) || (address >= 0xFE00 && address < 0xFEA0);
+}
+
+/**
+ * The value a read of `address` returns at `cycle`, without drawing the
+ * lines before it.
+ */
+uint8_t ppu_peek_register(ppu_t *ppu, uint16_t address, uint64_t cycle)
+{
+    switch (address)
+    {
+    case LCDC_REGISTER:
+        return ppu->LCDC;
+    case STAT_REGISTER:
+    {
+        uint8_t coincidence = ppu_ly(ppu, cycle) == ppu->LYC ? 0x04 : 0x00;
+        return 0x80 | (ppu->STAT & 0x78) | coincidence | ppu_mode(ppu, cycle);
+    }
+    case SCY_REGISTER:
+        return ppu->SCY;
+    case SCX_REGISTER:
+        return ppu->SCX;
+    case LY_REGISTER:
+        return ppu_ly(ppu, cycle);
+    case LYC_REGISTER:
+        return ppu->LYC;
+    case BGP_REGISTER:
+        return ppu->BGP;
+    case OBP0_REGISTER:
+        return ppu->OBP0;
+    case OBP1_REGISTER:
+        return ppu->OBP1;
+    case WY_REGISTER:
+        return ppu->WY;
+    case WX_REGISTER:
+        return ppu->WX;
+    default:
+        fprintf(stderr, "Invalid PPU register read 0x%04X.\n", address);
+        exit(1);
+    }
+}
+
+uint8_t ppu_read_register(ppu_t *ppu, uint16_t address, uint64_t cycle)
+{
+    // A program polling LY or STAT may be waiting on the lines drawn so far
+    if (address == LY_REGISTER || address == STAT_REGISTER)
+    {
+        ppu_catch_up(ppu, cycle);
+    }
+    return ppu_peek_register(ppu, address, cycle);
+}
+
+void ppu_write_register(ppu_t *ppu, uint16_t address, uint8_t value, uint64_t cycle)
+{
+    // Lines up to now are drawn with the old value
+    ppu_catch_up(ppu, cycle);
+
+    switch (address)
+    {
+    case LCDC_REGISTER:
+        if ((ppu->LCDC ^ value) & 0x04)
+        {
+            // Sprite height changed, every sprite covers different lines
+            ppu->sprite_masks_stale = true;
+        }
+        if (!lcd_enabled(ppu) && (value & 0x80))
+        {
+            ppu->lcd_on_cycle = cycle;
+            ppu->next_line = 0;
+            ppu->next_line_cycle = cycle + OAM_SCAN_CYCLES;
+            ppu->window_line = 0;
+        }
+        else if (lcd_enabled(ppu) && !(value & 0x80))
+        {
+            ppu->next_line_cycle = UINT64_MAX;
+            memset(ppu->framebuffer, 0, sizeof(ppu->framebuffer));
+        }
+        ppu->LCDC = value;
+        break;
+    case STAT_REGISTER:
+        ppu->STAT = value & 0x78;
+        break;
+    case SCY_REGISTER:
+        ppu->SCY = value;
+        break;
+    case SCX_REGISTER:
+        ppu->SCX = value;
+        break;
+    case LY_REGISTER: // Read only
+        break;
+    case LYC_REGISTER:
+        ppu->LYC = value;
+        break;
+    case BGP_REGISTER:
+        ppu->BGP = value;
+        break;
+    case OBP0_REGISTER:
+        ppu->OBP0 = value;
+        break;
+    case OBP1_REGISTER:
+        ppu->OBP1 = value;
+        break;
+    case WY_REGISTER:
+        ppu->WY = value;
+        break;
+    case WX_REGISTER:
+        ppu->WX = value;
+        break;
+    default:
+        fprintf(stderr, "Invalid PPU register write 0x%04X.\n", address);
+        exit(1);
+    }
+}
+
+/**
+ * Earliest cycle after `cycle` at which reading `address` may return a
+ * different value, assuming no register is written in between.
+ *
+ * @return UINT64_MAX if the value cannot change on its own.
+ */
+uint64_t ppu_next_register_change(ppu_t *ppu, uint16_t address, uint64_t cycle)
+{
+    if (!lcd_enabled(ppu) || (address != LY_REGISTER && address != STAT_REGISTER))
+    {
+        return UINT64_MAX;
+    }
+    uint64_t position = frame_position(ppu, cycle);
+    uint64_t line = position / CYCLES_PER_LINE;
+    uint64_t dot = position % CYCLES_PER_LINE;
+    uint64_t line_end = cycle - dot + CYCLES_PER_LINE;
+
+    if (address == LY_REGISTER || line >= VISIBLE_LINES)
+    {
+        return line_end;
+    }
+    if (dot < OAM_SCAN_CYCLES)
+    {
+        return cycle - dot + OAM_SCAN_CYCLES;
+    }
+    if (dot < OAM_SCAN_CYCLES + PIXEL_TRANSFER_CYCLES)
+    {
+        return cycle - dot + OAM_SCAN_CYCLES + PIXEL_TRANSFER_CYCLES;
+    }
+    return line_end;
+}
+
+/**
+ * First cycle after `cycle` at which the LCD enters VBlank, i.e. the end
+ * of the frame being drawn. With the LCD off, one frame's worth of cycles.
+ */
+uint64_t ppu_next_vblank(ppu_t *ppu, uint64_t cycle)
+{
+    if (!lcd_enabled(ppu))
+    {
+        return cycle + CYCLES_PER_FRAME;
+    }
+    uint64_t position = frame_position(ppu, cycle);
+    uint64_t vblank = VISIBLE_LINES * CYCLES_PER_LINE;
+    if (position < vblank)
+    {
+        return cycle - position + vblank;
+    }
+    return cycle - position + CYCLES_PER_FRAME + vblank;
+}
+
+
+// =================================================================================
+//                          Rendering
+// =================================================================================
+
+static void decode_tile(ppu_t *ppu, uint16_t index)
+{
+    const uint8_t *data = ppu->vram + index * 16;
+    for (int y = 0; y < 8; y++)
+    {
+        uint8_t low = data[y * 2];
+        uint8_t high = data[y * 2 + 1];
+        for (int x = 0; x < 8; x++)
+        {
+            uint8_t shift = 7 - x;
+            uint8_t colour = (((high >> shift) & 1) << 1) | ((low >> shift) & 1);
+            ppu->tiles[index][y][x] = colour;
+            ppu->tiles_flipped[index][y][7 - x] = colour;
+        }
+    }
+}
+
+/**
+ * @return the 8 colour indexes of row `y` of tile data entry `index`
+ * (0-383), decoding the tile first if it was written since last use.
+ */
+static const uint8_t *tile_row(ppu_t *ppu, uint16_t index, uint8_t y, bool flipped)
+{
+    uint64_t bit = 1ULL << (index % 64);
+    if (ppu->tile_dirty[index / 64] & bit)
+    {
+        decode_tile(ppu, index);
+        ppu->tile_dirty[index / 64] &= ~bit;
+    }
+    return flipped ? ppu->tiles_flipped[index][y] : ppu->tiles[index][y];
+}
+
+// Tile data entry of map tile number `tile` in the LCDC.4 addressing mode
+static uint16_t tile_index(uint8_t tile, bool unsigned_tiles)
+{
+    return unsigned_tiles ? tile : 256 + (int8_t)tile;
+}
+
+/**
+ * Copies the colour indexes of `count` consecutive tiles of a 32x32 tile map,
+ * starting at tile column `column` of pixel row `y`, wrapping around the map.
+ */
+static void map_row(ppu_t *ppu, uint16_t map, uint8_t column, uint8_t y, int count,
+                    bool unsigned_tiles, uint8_t *out)
+{
+    const uint8_t *row = ppu->vram + map + (y / 8) * 32;
+    for (int i = 0; i < count; i++)
+    {
+        uint8_t tile = row[(column + i) % 32];
+        memcpy(out + i * 8, tile_row(ppu, tile_index(tile, unsigned_tiles), y % 8, false), 8);
+    }
+}
+
+static uint8_t sprite_height(ppu_t *ppu)
+{
+    return (ppu->LCDC & 0x04) ? 16 : 8;
+}
+
+/**
+ * Adds (or removes) OAM entry `sprite` to the masks of the visible lines it
+ * covers when its Y byte is `y`, and marks those lines' lists stale.
+ */
+static void bin_sprite(ppu_t *ppu, uint8_t sprite, uint8_t y, bool add)
+{
+    int top = y - 16;
+    int bottom = top + sprite_height(ppu);
+    if (top < 0)
+    {
+        top = 0;
+    }
+    if (bottom > SCREEN_HEIGHT)
+    {
+        bottom = SCREEN_HEIGHT;
+    }
+    uint64_t bit = 1ULL << sprite;
+    for (int line = top; line < bottom; line++)
+    {
+        if (add)
+        {
+            ppu->line_sprite_mask[line] |= bit;
+        }
+        else
+        {
+            ppu->line_sprite_mask[line] &= ~bit;
+        }
+        ppu->line_sprites_stale[line] = true;
+    }
+}
+
+static void rebuild_sprite_masks(ppu_t *ppu)
+{
+    memset(ppu->line_sprite_mask, 0, sizeof(ppu->line_sprite_mask));
+    memset(ppu->line_sprites_stale, true, sizeof(ppu->line_sprites_stale));
+    for (int sprite = 0; sprite < SPRITE_COUNT; sprite++)
+    {
+        bin_sprite(ppu, sprite, ppu->oam[sprite * 4], true);
+    }
+    ppu->sprite_masks_stale = false;
+}
+
+/**
+ * Selects the first 10 sprites in OAM order overlapping line `ly` and sorts
+ * them by priority: lower X first, then lower OAM index.
+ */
+static void select_line_sprites(ppu_t *ppu, uint8_t ly)
+{
+    uint8_t *selected = ppu->line_sprites[ly];
+    uint64_t mask = ppu->line_sprite_mask[ly];
+    int count = 0;
+    while (mask != 0 && count < SPRITES_PER_LINE)
+    {
+        uint8_t sprite = __builtin_ctzll(mask);
+        mask &= mask - 1;
+        int j = count - 1;
+        while (j >= 0 && ppu->oam[selected[j] * 4 + 1] > ppu->oam[sprite * 4 + 1])
+        {
+            selected[j + 1] = selected[j];
+            j--;
+        }
+        selected[j + 1] = sprite;
+        count++;
+    }
+    ppu->line_sprite_count[ly] = count;
+    ppu->line_sprites_stale[ly] = false;
+}
+
+static uint8_t palette_shade(uint8_t palette, uint8_t colour)
+{
+    return (palette >> (colour * 2)) & 0x03;
+}
+
+static void render_line(ppu_t *ppu, uint8_t ly)
+{
+    uint8_t *line = ppu->framebuffer[ly];
+    uint8_t bg_colour[SCREEN_WIDTH];
+    bool unsigned_tiles = (ppu->LCDC & 0x10) != 0;
+
+    // Background and window
+    if (ppu->LCDC & 0x01)
+    {
+        uint16_t bg_map = (ppu->LCDC & 0x08) ? 0x1C00 : 0x1800;
+        uint16_t window_map = (ppu->LCDC & 0x40) ? 0x1C00 : 0x1800;
+        bool window = (ppu->LCDC & 0x20) && ly >= ppu->WY && ppu->WX <= 166;
+        int window_x = ppu->WX - 7;
+        uint8_t shades[4];
+        for (int colour = 0; colour < 4; colour++)
+        {
+            shades[colour] = palette_shade(ppu->BGP, colour);
+        }
+
+        // One tile more than the screen width to cover the SCX fine scroll
+        uint8_t row[SCREEN_WIDTH + 8];
+        map_row(ppu, bg_map, ppu->SCX / 8, (uint8_t)(ly + ppu->SCY), SCREEN_WIDTH / 8 + 1,
+                unsigned_tiles, row);
+        memcpy(bg_colour, row + ppu->SCX % 8, SCREEN_WIDTH);
+        if (window && window_x < SCREEN_WIDTH)
+        {
+            int start = window_x < 0 ? 0 : window_x;
+            map_row(ppu, window_map, 0, ppu->window_line, (SCREEN_WIDTH - window_x + 7) / 8,
+                    unsigned_tiles, row);
+            memcpy(bg_colour + start, row + (start - window_x), SCREEN_WIDTH - start);
+        }
+        for (int x = 0; x < SCREEN_WIDTH; x++)
+        {
+            line[x] = shades[bg_colour[x]];
+        }
+        if (window && window_x < SCREEN_WIDTH)
+        {
+            ppu->window_line++;
+        }
+    }
+    else
+    {
+        memset(bg_colour, 0, sizeof(bg_colour));
+        memset(line, 0, SCREEN_WIDTH);
+    }
+
+    // Sprites
+    if (!(ppu->LCDC & 0x02))
+    {
+        return;
+    }
+    if (ppu->sprite_masks_stale)
+    {
+        rebuild_sprite_masks(ppu);
+    }
+    if (ppu->line_sprites_stale[ly])
+    {
+        select_line_sprites(ppu, ly);
+    }
+    uint8_t height = sprite_height(ppu);
+    // Highest priority first: the first opaque sprite pixel claims the
+    // screen pixel, and only then does its BG-priority flag decide whether
+    // it shows over the background
+    bool claimed[SCREEN_WIDTH] = {false};
+    for (int i = 0; i < ppu->line_sprite_count[ly]; i++)
+    {
+        const uint8_t *entry = &ppu->oam[ppu->line_sprites[ly][i] * 4];
+        int top = entry[0] - 16;
+        int left = entry[1] - 8;
+        uint8_t tile = entry[2];
+        uint8_t flags = entry[3];
+        uint8_t row = ly - top;
+        if (flags & 0x40)
+        {
+            row = height - 1 - row;
+        }
+        if (height == 16)
+        {
+            tile &= 0xFE;
+        }
+        uint8_t palette = (flags & 0x10) ? ppu->OBP1 : ppu->OBP0;
+        const uint8_t *pixels = tile_row(ppu, tile + row / 8, row % 8, (flags & 0x20) != 0);
+        for (int px = 0; px < 8; px++)
+        {
+            int x = left + px;
+            if (x < 0 || x >= SCREEN_WIDTH || claimed[x])
+            {
+                continue;
+            }
+            uint8_t colour = pixels[px];
+            if (colour == 0)
+            {
+                continue;
+            }
+            claimed[x] = true;
+            if (!(flags & 0x80) || bg_colour[x] == 0)
+            {
+                line[x] = palette_shade(palette, colour);
+            }
+        }
+    }
+}
+
+/**
+ * Called before the CPU writes `value` to VRAM or OAM at `address`: renders
+ * the lines that saw the old contents, marks the written tile for decoding
+ * and moves a sprite between line bins when its Y or X changes.
+ */
+void ppu_write_memory(ppu_t *ppu, uint16_t address, uint8_t value, uint64_t cycle)
+{
+    ppu_catch_up(ppu, cycle);
+    if (address >= 0x8000 && address < 0x8000 + TILE_COUNT * 16)
+    {
+        uint16_t index = (address - 0x8000) / 16;
+        ppu->tile_dirty[index / 64] |= 1ULL << (index % 64);
+    }
+    else if (address >= 0xFE00 && !ppu->sprite_masks_stale)
+    {
+        uint8_t sprite = (address - 0xFE00) / 4;
+        uint8_t old = ppu->oam[address - 0xFE00];
+        if (old == value)
+        {
+            return;
+        }
+        switch (address % 4)
+        {
+        case 0: // Y
+            bin_sprite(ppu, sprite, old, false);
+            bin_sprite(ppu, sprite, value, true);
+            break;
+        case 1: // X, reorders the lines the sprite is on
+            bin_sprite(ppu, sprite, ppu->oam[sprite * 4], true);
+            break;
+        default: // Tile and attributes are read when drawing
+            break;
+        }
+    }
+}
+
+/**
+ * Called before an OAM DMA overwrites OAM.
+ */
+void ppu_oam_dma(ppu_t *ppu, uint64_t cycle)
+{
+    ppu_catch_up(ppu, cycle);
+    ppu->sprite_masks_stale = true;
+}
+
+/**
+ * Marks every tile for decoding and every sprite for binning, for VRAM and
+ * OAM changes that bypass the CPU bus.
+ */
+void ppu_invalidate_memory(ppu_t *ppu)
+{
+    memset(ppu->tile_dirty, 0xFF, sizeof(ppu->tile_dirty));
+    ppu->sprite_masks_stale = true;
+}
+
+/**
+ * Renders one frame out of `interval`, counting from the next frame to start.
+ * 0 turns pixel output off; the PPU then only keeps time.
+ */
+void ppu_set_render_interval(ppu_t *ppu, uint32_t interval)
+{
+    ppu->render_interval = interval;
+}
+
+/**
+ * Renders the next frame to start regardless of the render interval.
+ */
+void ppu_request_frame(ppu_t *ppu)
+{
+    ppu->frame_requested = true;
+}
+
+static bool frame_wanted(ppu_t *ppu)
+{
+    if (ppu->frame_requested)
+    {
+        ppu->frame_requested = false;
+        return true;
+    }
+    return ppu->render_interval != 0 && ppu->frame_count % ppu->render_interval == 0;
+}
+
+/**
+ * Renders every line whose pixel transfer started at or before `cycle` and
+ * raises the interrupts up to it.
+ */
+void ppu_catch_up(ppu_t *ppu, uint64_t cycle)
+{
+    raise_interrupts(ppu, cycle);
+    while (ppu->next_line_cycle <= cycle)
+    {
+        if (ppu->next_line == 0)
+        {
+            ppu->rendering = frame_wanted(ppu);
+        }
+        if (ppu->rendering && ppu->vram != NULL)
+        {
+            render_line(ppu, ppu->next_line);
+        }
+        if (ppu->next_line == VISIBLE_LINES - 1)
+        {
+            ppu->next_line = 0;
+            ppu->next_line_cycle += (LINES_PER_FRAME - VISIBLE_LINES + 1) * CYCLES_PER_LINE;
+            ppu->window_line = 0;
+            ppu->frame_count++;
+            if (ppu->rendering)
+            {
+                ppu->rendered_frame = ppu->frame_count;
+            }
+        }
+        else
+        {
+            ppu->next_line++;
+            ppu->next_line_cycle += CYCLES_PER_LINE;
+        }
+    }
+}
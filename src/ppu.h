@@ -0,0 +1,129 @@
+#ifndef PPU_H
+#define PPU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+// Timings are in CPU M-cycles (4 dots each)
+#define CYCLES_PER_LINE     114
+#define LINES_PER_FRAME     154
+#define VISIBLE_LINES       144
+#define CYCLES_PER_FRAME    (CYCLES_PER_LINE * LINES_PER_FRAME)
+#define OAM_SCAN_CYCLES     20
+#define PIXEL_TRANSFER_CYCLES 43
+
+#define VBLANK_INTERRUPT    0x01
+#define STAT_INTERRUPT      0x02
+
+#define SCREEN_WIDTH        160
+#define SCREEN_HEIGHT       VISIBLE_LINES
+
+#define TILE_COUNT          384     // Tile data at 0x8000-0x97FF, 16 bytes each
+#define SPRITE_COUNT        40
+#define SPRITES_PER_LINE    10
+
+
+typedef enum PpuRegister
+{
+    LCDC_REGISTER = 0xFF40,
+    STAT_REGISTER = 0xFF41,
+    SCY_REGISTER  = 0xFF42,
+    SCX_REGISTER  = 0xFF43,
+    LY_REGISTER   = 0xFF44,
+    LYC_REGISTER  = 0xFF45,
+    DMA_REGISTER  = 0xFF46,     // OAM DMA, handled by the CPU bus
+    BGP_REGISTER  = 0xFF47,
+    OBP0_REGISTER = 0xFF48,
+    OBP1_REGISTER = 0xFF49,
+    WY_REGISTER   = 0xFF4A,
+    WX_REGISTER   = 0xFF4B
+} ppu_register_t;
+
+
+typedef struct Ppu
+{
+    uint8_t LCDC;
+    uint8_t STAT;   // Only the interrupt select bits (3-6) are stored
+    uint8_t SCY;
+    uint8_t SCX;
+    uint8_t LYC;
+    uint8_t BGP;
+    uint8_t OBP0;
+    uint8_t OBP1;
+    uint8_t WY;
+    uint8_t WX;
+    uint64_t lcd_on_cycle;  // CPU cycle at which the LCD was last switched on
+
+    const uint8_t *vram;    // 0x8000-0x9FFF of the memory bus
+    const uint8_t *oam;     // 0xFE00-0xFE9F of the memory bus
+    uint8_t *interrupt_flags;   // IF on the memory bus
+
+    // VBlank and STAT interrupts are raised from cycle math when the PPU is
+    // caught up, so IF is the same whether lines are drawn eagerly, lazily or
+    // not at all. Line and mode changes before this cycle have been raised.
+    uint64_t interrupt_cycle;
+
+    // Lines are rendered when the CPU catches the PPU up to the current
+    // cycle; in lazy mode that only happens on VRAM/OAM/LCD register
+    // accesses and at frame end, otherwise after every instruction.
+    bool lazy;
+    uint8_t next_line;          // Next line to render
+    uint64_t next_line_cycle;   // Cycle at which next_line enters pixel transfer
+    uint8_t window_line;        // Window rows drawn so far this frame
+    uint64_t frame_count;       // Frames completed since power on
+
+    // Frames whose pixels are produced: every render_interval-th frame (0 for
+    // none, timing only) plus the next one after ppu_request_frame. Skipped
+    // frames keep LY/STAT timing exact and leave the framebuffer untouched.
+    uint32_t render_interval;
+    bool frame_requested;
+    bool rendering;             // The current frame is being drawn
+    uint64_t rendered_frame;    // frame_count when the framebuffer was completed
+
+    // Tile data decoded to one colour index per pixel, as stored and mirrored
+    // horizontally. A tile is decoded again on first use after a CPU write
+    // marks it dirty.
+    uint8_t tiles[TILE_COUNT][8][8];
+    uint8_t tiles_flipped[TILE_COUNT][8][8];
+    uint64_t tile_dirty[TILE_COUNT / 64];
+
+    // Sprites overlapping each line, as a bitmask of OAM entries kept up to
+    // date on OAM writes, and the up to 10 of them drawn on the line, highest
+    // priority first. A line's list is rebuilt from its mask once stale.
+    uint64_t line_sprite_mask[SCREEN_HEIGHT];
+    uint8_t line_sprites[SCREEN_HEIGHT][SPRITES_PER_LINE];
+    uint8_t line_sprite_count[SCREEN_HEIGHT];
+    bool line_sprites_stale[SCREEN_HEIGHT];
+    bool sprite_masks_stale;    // Every mask must be recomputed from OAM
+
+    uint8_t framebuffer[SCREEN_HEIGHT][SCREEN_WIDTH];  // Shades, 0 white to 3 black
+} ppu_t;
+
+
+ppu_t *new_ppu();
+void free_ppu(ppu_t *ppu);
+
+void ppu_attach_memory(ppu_t *ppu, uint8_t *memorybus);
+
+bool is_ppu_register(uint16_t address);
+bool is_ppu_memory(uint16_t address);
+uint8_t ppu_read_register(ppu_t *ppu, uint16_t address, uint64_t cycle);
+uint8_t ppu_peek_register(ppu_t *ppu, uint16_t address, uint64_t cycle);
+void ppu_write_register(ppu_t *ppu, uint16_t address, uint8_t value, uint64_t cycle);
+
+uint8_t ppu_ly(ppu_t *ppu, uint64_t cycle);
+uint8_t ppu_mode(ppu_t *ppu, uint64_t cycle);
+uint8_t ppu_peek_interrupts(ppu_t *ppu, uint64_t cycle);
+uint64_t ppu_next_register_change(ppu_t *ppu, uint16_t address, uint64_t cycle);
+uint64_t ppu_next_vblank(ppu_t *ppu, uint64_t cycle);
+
+void ppu_write_memory(ppu_t *ppu, uint16_t address, uint8_t value, uint64_t cycle);
+void ppu_oam_dma(ppu_t *ppu, uint64_t cycle);
+void ppu_invalidate_memory(ppu_t *ppu);
+void ppu_set_render_interval(ppu_t *ppu, uint32_t interval);
+void ppu_request_frame(ppu_t *ppu);
+void ppu_catch_up(ppu_t *ppu, uint64_t cycle);
+
+
+#endif
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "resampler.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESAMPLER_X86 1
+#endif
+
+
+// Passband edge as a fraction of the lower Nyquist frequency
+#define RESAMPLER_CUTOFF 0.9
+
+// Output frames filtered per block before conversion to int16
+#define RESAMPLER_BLOCK 256
+
+
+/**
+ * Fills resampler->taps: for an output frame at sub-frame offset
+ * phase / RESAMPLER_PHASES, the weights of the RESAMPLER_TAPS input frames
+ * around it, summing to 1. Downsampling lowers the cutoff to the output rate.
+ */
+static void init_taps(resampler_t *resampler)
+{
+    double cutoff = RESAMPLER_CUTOFF;
+    if (resampler->output_rate < resampler->input_rate)
+    {
+        cutoff *= (double)resampler->output_rate / resampler->input_rate;
+    }
+    for (int phase = 0; phase < RESAMPLER_PHASES; phase++)
+    {
+        double sum = 0;
+        double taps[RESAMPLER_TAPS];
+        for (int k = 0; k < RESAMPLER_TAPS; k++)
+        {
+            double x = k - RESAMPLER_TAPS / 2 + 1 - (double)phase / RESAMPLER_PHASES;
+            double sinc = x == 0 ? 1.0 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+            double w = 2 * M_PI * x / RESAMPLER_TAPS;
+            double window = fabs(x) >= RESAMPLER_TAPS / 2 ? 0 : 0.42 + 0.5 * cos(w) + 0.08 * cos(2 * w);
+            taps[k] = sinc * window;
+            sum += taps[k];
+        }
+        for (int k = 0; k < RESAMPLER_TAPS; k++)
+        {
+            resampler->taps[phase][k] = taps[k] / sum;
+        }
+    }
+}
+
+
+resampler_t *new_resampler(uint32_t input_rate, uint32_t output_rate)
+{
+    if (input_rate == 0 || output_rate == 0)
+    {
+        fprintf(stderr, "Invalid resampler rates %u to %u.\n", input_rate, output_rate);
+        exit(1);
+    }
+    resampler_t *resampler = calloc(1, sizeof(resampler_t));
+    if (resampler == NULL)
+    {
+        return NULL;
+    }
+    resampler->input_rate = input_rate;
+    resampler->output_rate = output_rate;
+    resampler->kernel = resampler_best_kernel();
+    resampler->volume = 1.0f;
+    resampler->step = ((uint64_t)input_rate << 32) / output_rate;
+    init_taps(resampler);
+
+    // Silence before the first frame, so output frame 0 is centred on input frame 0
+    resampler->count = RESAMPLER_TAPS / 2 - 1;
+    resampler->position = 0;
+    return resampler;
+}
+
+void free_resampler(resampler_t *resampler)
+{
+    free(resampler);
+    resampler = NULL;
+    return;
+}
+
+
+/**
+ * @return the widest filter kernel the host can run.
+ */
+resampler_kernel_t resampler_best_kernel()
+{
+#ifdef RESAMPLER_X86
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return RESAMPLER_KERNEL_AVX2;
+    }
+    if (__builtin_cpu_supports("sse"))
+    {
+        return RESAMPLER_KERNEL_SSE;
+    }
+#endif
+    return RESAMPLER_KERNEL_SCALAR;
+}
+
+const char *resampler_kernel_name(resampler_kernel_t kernel)
+{
+    switch (kernel)
+    {
+    case RESAMPLER_KERNEL_SCALAR:
+        return "scalar";
+    case RESAMPLER_KERNEL_SSE:
+        return "SSE";
+    case RESAMPLER_KERNEL_AVX2:
+        return "AVX2";
+    default:
+        return "unknown";
+    }
+}
+
+
+// =================================================================================
+//                          Filter kernels
+// =================================================================================
+
+// Each kernel filters `frames` output frames starting at resampler->position
+// into interleaved float `out`; the caller checks the history holds them all
+
+static inline const float *phase_taps(resampler_t *resampler, uint64_t position)
+{
+    return resampler->taps[((position & 0xFFFFFFFF) * RESAMPLER_PHASES) >> 32];
+}
+
+static void filter_scalar(resampler_t *resampler, float *out, size_t frames)
+{
+    uint64_t position = resampler->position;
+    for (size_t j = 0; j < frames; j++, position += resampler->step)
+    {
+        size_t first = position >> 32;
+        const float *taps = phase_taps(resampler, position);
+        const float *left = resampler->history[0] + first;
+        const float *right = resampler->history[1] + first;
+        float sum_left = 0, sum_right = 0;
+        for (int k = 0; k < RESAMPLER_TAPS; k++)
+        {
+            sum_left += left[k] * taps[k];
+            sum_right += right[k] * taps[k];
+        }
+        out[j * 2] = sum_left;
+        out[j * 2 + 1] = sum_right;
+    }
+}
+
+#ifdef RESAMPLER_X86
+__attribute__((target("sse")))
+static void filter_sse(resampler_t *resampler, float *out, size_t frames)
+{
+    uint64_t position = resampler->position;
+    for (size_t j = 0; j < frames; j++, position += resampler->step)
+    {
+        size_t first = position >> 32;
+        const float *taps = phase_taps(resampler, position);
+        const float *left = resampler->history[0] + first;
+        const float *right = resampler->history[1] + first;
+        __m128 sum_left = _mm_setzero_ps();
+        __m128 sum_right = _mm_setzero_ps();
+        for (int k = 0; k < RESAMPLER_TAPS; k += 4)
+        {
+            __m128 weights = _mm_loadu_ps(taps + k);
+            sum_left = _mm_add_ps(sum_left, _mm_mul_ps(_mm_loadu_ps(left + k), weights));
+            sum_right = _mm_add_ps(sum_right, _mm_mul_ps(_mm_loadu_ps(right + k), weights));
+        }
+        // Reduce both sums at once: (l0+l2, r0+r2, l1+l3, r1+r3), then pairs
+        __m128 low = _mm_unpacklo_ps(sum_left, sum_right);
+        __m128 high = _mm_unpackhi_ps(sum_left, sum_right);
+        __m128 sum = _mm_add_ps(low, high);
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        _mm_storel_pi((__m64 *)(out + j * 2), sum);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void filter_avx2(resampler_t *resampler, float *out, size_t frames)
+{
+    uint64_t position = resampler->position;
+    for (size_t j = 0; j < frames; j++, position += resampler->step)
+    {
+        size_t first = position >> 32;
+        const float *taps = phase_taps(resampler, position);
+        const float *left = resampler->history[0] + first;
+        const float *right = resampler->history[1] + first;
+        __m256 sum_left = _mm256_setzero_ps();
+        __m256 sum_right = _mm256_setzero_ps();
+        for (int k = 0; k < RESAMPLER_TAPS; k += 8)
+        {
+            __m256 weights = _mm256_loadu_ps(taps + k);
+            sum_left = _mm256_fmadd_ps(_mm256_loadu_ps(left + k), weights, sum_left);
+            sum_right = _mm256_fmadd_ps(_mm256_loadu_ps(right + k), weights, sum_right);
+        }
+        __m128 half_left = _mm_add_ps(_mm256_castps256_ps128(sum_left), _mm256_extractf128_ps(sum_left, 1));
+        __m128 half_right = _mm_add_ps(_mm256_castps256_ps128(sum_right), _mm256_extractf128_ps(sum_right, 1));
+        __m128 low = _mm_unpacklo_ps(half_left, half_right);
+        __m128 high = _mm_unpackhi_ps(half_left, half_right);
+        __m128 sum = _mm_add_ps(low, high);
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        _mm_storel_pi((__m64 *)(out + j * 2), sum);
+    }
+}
+#endif
+
+static void filter(resampler_t *resampler, float *out, size_t frames)
+{
+    switch (resampler->kernel)
+    {
+#ifdef RESAMPLER_X86
+    case RESAMPLER_KERNEL_AVX2:
+        filter_avx2(resampler, out, frames);
+        return;
+    case RESAMPLER_KERNEL_SSE:
+        filter_sse(resampler, out, frames);
+        return;
+#endif
+    default:
+        filter_scalar(resampler, out, frames);
+        return;
+    }
+}
+
+
+// =================================================================================
+//                          Input and output
+// =================================================================================
+
+/**
+ * Buffers interleaved stereo input frames, as many as fit.
+ *
+ * @return the number of frames taken.
+ */
+size_t resampler_write(resampler_t *resampler, const int16_t *samples, size_t frames)
+{
+    size_t space = RESAMPLER_FRAMES - resampler->count;
+    size_t count = frames < space ? frames : space;
+    float *left = resampler->history[0] + resampler->count;
+    float *right = resampler->history[1] + resampler->count;
+    for (size_t i = 0; i < count; i++)
+    {
+        left[i] = samples[i * 2];
+        right[i] = samples[i * 2 + 1];
+    }
+    resampler->count += count;
+    return count;
+}
+
+/**
+ * Filters up to `frames` output frames from the buffered input into
+ * interleaved stereo `samples`, scaled by resampler->volume and saturated.
+ *
+ * @return the number of frames written, fewer when the input runs out.
+ */
+size_t resampler_read(resampler_t *resampler, int16_t *samples, size_t frames)
+{
+    // Frames whose last tap is already buffered
+    size_t available = 0;
+    if (resampler->count >= RESAMPLER_TAPS)
+    {
+        uint64_t last = (uint64_t)(resampler->count - RESAMPLER_TAPS) << 32;
+        if (resampler->position <= last)
+        {
+            available = (last - resampler->position) / resampler->step + 1;
+        }
+    }
+    size_t total = available < frames ? available : frames;
+
+    float block[RESAMPLER_BLOCK * 2];
+    for (size_t done = 0; done < total;)
+    {
+        size_t count = total - done < RESAMPLER_BLOCK ? total - done : RESAMPLER_BLOCK;
+        filter(resampler, block, count);
+        resampler->position += count * resampler->step;
+        for (size_t i = 0; i < count * 2; i++)
+        {
+            float value = block[i] * resampler->volume;
+            value = value > 32767.0f ? 32767.0f : value < -32768.0f ? -32768.0f : value;
+            samples[done * 2 + i] = (int16_t)lrintf(value);
+        }
+        done += count;
+    }
+
+    // Drop input frames no later output frame reaches
+    size_t consumed = resampler->position >> 32;
+    if (consumed > resampler->count)
+    {
+        consumed = resampler->count;
+    }
+    size_t kept = resampler->count - consumed;
+    memmove(resampler->history[0], resampler->history[0] + consumed, kept * sizeof(float));
+    memmove(resampler->history[1], resampler->history[1] + consumed, kept * sizeof(float));
+    resampler->count = kept;
+    resampler->position -= (uint64_t)consumed << 32;
+    return total;
+}
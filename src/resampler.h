@@ -0,0 +1,50 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+// Polyphase windowed sinc: RESAMPLER_TAPS input frames per output frame, the
+// filter picked from RESAMPLER_PHASES sub-frame offsets
+#define RESAMPLER_TAPS          32
+#define RESAMPLER_PHASES        256
+#define RESAMPLER_FRAMES        4096        // Input frames buffered until the output is read
+
+
+typedef enum ResamplerKernel
+{
+    RESAMPLER_KERNEL_SCALAR,
+    RESAMPLER_KERNEL_SSE,       // 4 taps per instruction
+    RESAMPLER_KERNEL_AVX2       // 8 taps per fused multiply-add
+} resampler_kernel_t;
+
+
+typedef struct Resampler
+{
+    uint32_t input_rate;
+    uint32_t output_rate;
+    resampler_kernel_t kernel;  // Defaults to the widest the host supports
+    float volume;               // Applied when converting back to int16
+
+    uint64_t step;              // Input frames per output frame, 32.32 fixed point
+    uint64_t position;          // First tap of the next output frame in `history`, 32.32
+    size_t count;               // Input frames in `history`
+
+    float taps[RESAMPLER_PHASES][RESAMPLER_TAPS];
+    float history[2][RESAMPLER_FRAMES];    // Left and right planes
+} resampler_t;
+
+
+resampler_t *new_resampler(uint32_t input_rate, uint32_t output_rate);
+void free_resampler(resampler_t *resampler);
+
+resampler_kernel_t resampler_best_kernel();
+const char *resampler_kernel_name(resampler_kernel_t kernel);
+
+size_t resampler_write(resampler_t *resampler, const int16_t *samples, size_t frames);
+size_t resampler_read(resampler_t *resampler, int16_t *samples, size_t frames);
+
+
+#endif
@@ -0,0 +1,361 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shm_export.h"
+
+
+// Each region starts on its own cache line
+#define SHM_ALIGNMENT       64
+
+// Waiting on the other process: spin briefly, then sleep between checks
+#define SHM_SPINS           4000
+#define SHM_SLEEP_NS        20000
+
+
+static uint32_t align_up(uint32_t value)
+{
+    return (value + SHM_ALIGNMENT - 1) & ~(uint32_t)(SHM_ALIGNMENT - 1);
+}
+
+static void sleep_ns(long nanoseconds)
+{
+    struct timespec delay = {0, nanoseconds};
+    nanosleep(&delay, NULL);
+}
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/**
+ * Waits until `counter` equals `value`, for at most `timeout_ms` (0 waits
+ * for ever).
+ *
+ * @return false on timeout.
+ */
+static bool wait_for(_Atomic uint32_t *counter, uint32_t value, uint32_t timeout_ms)
+{
+    for (int spin = 0; spin < SHM_SPINS; spin++)
+    {
+        if (atomic_load_explicit(counter, memory_order_acquire) == value)
+        {
+            return true;
+        }
+        cpu_relax();
+    }
+    uint64_t slept = 0;
+    while (atomic_load_explicit(counter, memory_order_acquire) != value)
+    {
+        if (timeout_ms != 0 && slept >= (uint64_t)timeout_ms * 1000000)
+        {
+            return false;
+        }
+        sleep_ns(SHM_SLEEP_NS);
+        slept += SHM_SLEEP_NS;
+    }
+    return true;
+}
+
+
+// =================================================================================
+//                          Server
+// =================================================================================
+
+/**
+ * Shares `env`'s observation and RAM bytes, which env_step then writes
+ * straight into the mapping. With a `name` ("/something") the memory is a
+ * POSIX shared memory object any process can open; with NULL it is an
+ * anonymous memfd, reachable through export->fd by children or over a
+ * Unix socket. The observation shape and RAM addresses are fixed from here.
+ *
+ * @return NULL if the memory cannot be created or mapped.
+ */
+shm_export_t *new_shm_export(env_t *env, const char *name)
+{
+    shm_export_t *export = calloc(1, sizeof(shm_export_t));
+    if (export == NULL)
+    {
+        return NULL;
+    }
+    uint32_t obs_offset = align_up(sizeof(shm_header_t));
+    uint32_t ram_offset = align_up(obs_offset + env_obs_size(env));
+    uint32_t size = align_up(ram_offset + env->ram_count);
+
+    if (name != NULL)
+    {
+        export->name = strdup(name);
+        export->fd = export->name == NULL ? -1 : shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    }
+    else
+    {
+        export->fd = memfd_create("gameboy_env", 0);
+    }
+    void *memory = MAP_FAILED;
+    if (export->fd >= 0 && ftruncate(export->fd, size) == 0)
+    {
+        memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, export->fd, 0);
+    }
+    if (memory == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not create the shared memory export: %s.\n", strerror(errno));
+        if (export->fd >= 0)
+        {
+            close(export->fd);
+            if (export->name != NULL)
+            {
+                shm_unlink(export->name);
+            }
+        }
+        free(export->name);
+        free(export);
+        return NULL;
+    }
+
+    export->env = env;
+    export->header = memory;
+    export->obs = (uint8_t *)memory + obs_offset;
+    export->ram = (uint8_t *)memory + ram_offset;
+    shm_header_t *header = export->header;
+    header->version = SHM_EXPORT_VERSION;
+    header->size = size;
+    header->obs_width = env->obs_width;
+    header->obs_height = env->obs_height;
+    header->obs_offset = obs_offset;
+    header->ram_count = env->ram_count;
+    header->ram_offset = ram_offset;
+    atomic_init(&header->request, 0);
+    atomic_init(&header->response, 0);
+    atomic_init(&header->sequence, 0);
+    header->steps = env->steps;
+
+    // The magic goes last: a client seeing it sees a complete header
+    atomic_thread_fence(memory_order_release);
+    header->magic = SHM_EXPORT_MAGIC;
+    return export;
+}
+
+/**
+ * Unmaps the export and, for a named one, removes the name. Clients keep
+ * their own mappings.
+ */
+void free_shm_export(shm_export_t *export)
+{
+    if (export == NULL)
+    {
+        return;
+    }
+    munmap(export->header, export->header->size);
+    close(export->fd);
+    if (export->name != NULL)
+    {
+        shm_unlink(export->name);
+    }
+    free(export->name);
+    free(export);
+    export = NULL;
+    return;
+}
+
+static void run_command(shm_export_t *export)
+{
+    shm_header_t *header = export->header;
+    if (header->command == SHM_COMMAND_CLOSE)
+    {
+        export->closed = true;
+        return;
+    }
+    uint32_t sequence = atomic_load_explicit(&header->sequence, memory_order_relaxed);
+    atomic_store_explicit(&header->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    if (header->command == SHM_COMMAND_RESET)
+    {
+        env_reset(export->env, export->obs, export->ram);
+    }
+    else
+    {
+        env_step(export->env, header->action, header->frameskip, export->obs, export->ram);
+    }
+    header->steps = export->env->steps;
+    atomic_store_explicit(&header->sequence, sequence + 2, memory_order_release);
+}
+
+/**
+ * Runs the client's command if one is waiting.
+ *
+ * @return true if a command was run.
+ */
+bool shm_export_poll(shm_export_t *export)
+{
+    shm_header_t *header = export->header;
+    uint32_t request = atomic_load_explicit(&header->request, memory_order_acquire);
+    if (request == export->served)
+    {
+        return false;
+    }
+    run_command(export);
+    export->served = request;
+    atomic_store_explicit(&header->response, request, memory_order_release);
+    return true;
+}
+
+/**
+ * Runs commands until the client sends SHM_COMMAND_CLOSE, or none comes for
+ * `idle_ms` (0 waits for ever).
+ *
+ * @return true if the client closed the export.
+ */
+bool shm_export_serve(shm_export_t *export, uint32_t idle_ms)
+{
+    while (!export->closed)
+    {
+        if (!wait_for(&export->header->request, export->served + 1, idle_ms))
+        {
+            return false;
+        }
+        shm_export_poll(export);
+    }
+    return true;
+}
+
+
+// =================================================================================
+//                          Reference client
+// =================================================================================
+
+/**
+ * Maps the export named `name`, or with a NULL name the one behind `fd`
+ * (e.g. an inherited memfd). Only one client may step an export.
+ *
+ * @return NULL if it cannot be mapped or is not an export of this version.
+ */
+shm_client_t *new_shm_client(const char *name, int fd)
+{
+    shm_client_t *client = calloc(1, sizeof(shm_client_t));
+    if (client == NULL)
+    {
+        return NULL;
+    }
+    client->fd = name != NULL ? shm_open(name, O_RDWR, 0) : dup(fd);
+    struct stat status;
+    void *memory = MAP_FAILED;
+    if (client->fd >= 0 && fstat(client->fd, &status) == 0 && (size_t)status.st_size >= sizeof(shm_header_t))
+    {
+        memory = mmap(NULL, status.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, client->fd, 0);
+    }
+    shm_header_t *header = memory;
+    if (memory == MAP_FAILED || header->magic != SHM_EXPORT_MAGIC || header->version != SHM_EXPORT_VERSION
+        || header->size != status.st_size)
+    {
+        if (memory != MAP_FAILED)
+        {
+            munmap(memory, status.st_size);
+        }
+        if (client->fd >= 0)
+        {
+            close(client->fd);
+        }
+        free(client);
+        return NULL;
+    }
+    atomic_thread_fence(memory_order_acquire);
+    client->header = header;
+    client->obs = (const uint8_t *)memory + header->obs_offset;
+    client->ram = (const uint8_t *)memory + header->ram_offset;
+    client->request = atomic_load_explicit(&header->request, memory_order_relaxed);
+    return client;
+}
+
+void free_shm_client(shm_client_t *client)
+{
+    if (client == NULL)
+    {
+        return;
+    }
+    munmap(client->header, client->header->size);
+    close(client->fd);
+    free(client);
+    client = NULL;
+    return;
+}
+
+// Posts a command and waits for the server to run it
+static void send_command(shm_client_t *client, shm_command_t command)
+{
+    shm_header_t *header = client->header;
+    header->command = command;
+    client->request++;
+    atomic_store_explicit(&header->request, client->request, memory_order_release);
+    wait_for(&header->response, client->request, 0);
+}
+
+/**
+ * Steps the environment. On return client->obs and client->ram hold the
+ * new observation and RAM bytes, in place, until the next command.
+ *
+ * @return the steps since the last reset.
+ */
+uint64_t shm_client_step(shm_client_t *client, uint8_t action, uint32_t frameskip)
+{
+    client->header->action = action;
+    client->header->frameskip = frameskip;
+    send_command(client, SHM_COMMAND_STEP);
+    return client->header->steps;
+}
+
+void shm_client_reset(shm_client_t *client)
+{
+    send_command(client, SHM_COMMAND_RESET);
+}
+
+/**
+ * Tells the server to stop serving.
+ */
+void shm_client_close(shm_client_t *client)
+{
+    send_command(client, SHM_COMMAND_CLOSE);
+}
+
+/**
+ * Copies a consistent observation and RAM bytes while another client may be
+ * stepping. Either output may be NULL.
+ *
+ * @return the steps count the copy belongs to.
+ */
+uint64_t shm_client_snapshot(shm_client_t *client, uint8_t *obs_out, uint8_t *ram_out)
+{
+    shm_header_t *header = client->header;
+    while (true)
+    {
+        uint32_t before = atomic_load_explicit(&header->sequence, memory_order_acquire);
+        if (before & 1)
+        {
+            cpu_relax();
+            continue;
+        }
+        if (obs_out != NULL)
+        {
+            memcpy(obs_out, client->obs, (size_t)header->obs_width * header->obs_height);
+        }
+        if (ram_out != NULL)
+        {
+            memcpy(ram_out, client->ram, header->ram_count);
+        }
+        uint64_t steps = header->steps;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&header->sequence, memory_order_relaxed) == before)
+        {
+            return steps;
+        }
+    }
+}
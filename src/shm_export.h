@@ -0,0 +1,95 @@
+#ifndef SHM_EXPORT_H
+#define SHM_EXPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "env.h"
+
+
+#define SHM_EXPORT_MAGIC    0x45424753  // "SGBE"
+#define SHM_EXPORT_VERSION  1
+
+
+typedef enum ShmCommand
+{
+    SHM_COMMAND_STEP,       // env_step with `action` and `frameskip`
+    SHM_COMMAND_RESET,      // env_reset
+    SHM_COMMAND_CLOSE       // The server stops serving
+} shm_command_t;
+
+
+/**
+ * Start of the shared mapping; the observation and RAM bytes follow at the
+ * given offsets. One client steps the environment through the mailbox:
+ * it fills in the command, then bumps `request`; the server runs it and
+ * sets `response` to the same count. Between a response and the next
+ * request the data is stable and can be read in place. Other readers use
+ * `sequence`, odd while the server writes the data.
+ */
+typedef struct ShmHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;              // Bytes in the mapping
+    uint32_t obs_width;
+    uint32_t obs_height;
+    uint32_t obs_offset;
+    uint32_t ram_count;
+    uint32_t ram_offset;
+
+    // Written by the client
+    _Alignas(64) _Atomic uint32_t request;
+    uint32_t command;
+    uint32_t action;
+    uint32_t frameskip;
+
+    // Written by the server
+    _Alignas(64) _Atomic uint32_t response;
+    _Atomic uint32_t sequence;
+    uint64_t steps;             // env->steps with the data, under `sequence`
+} shm_header_t;
+
+
+// Server side, in the emulator's process
+typedef struct ShmExport
+{
+    env_t *env;                 // Not owned
+    int fd;
+    char *name;                 // shm_open name, unlinked on free; NULL for a memfd
+    shm_header_t *header;
+    uint8_t *obs;
+    uint8_t *ram;
+    uint32_t served;            // Last request handled
+    bool closed;
+} shm_export_t;
+
+// Reference client, in the agent's process
+typedef struct ShmClient
+{
+    int fd;
+    shm_header_t *header;
+    const uint8_t *obs;
+    const uint8_t *ram;
+    uint32_t request;
+} shm_client_t;
+
+
+shm_export_t *new_shm_export(env_t *env, const char *name);
+void free_shm_export(shm_export_t *export);
+
+bool shm_export_poll(shm_export_t *export);
+bool shm_export_serve(shm_export_t *export, uint32_t idle_ms);
+
+shm_client_t *new_shm_client(const char *name, int fd);
+void free_shm_client(shm_client_t *client);
+
+uint64_t shm_client_step(shm_client_t *client, uint8_t action, uint32_t frameskip);
+void shm_client_reset(shm_client_t *client);
+void shm_client_close(shm_client_t *client);
+uint64_t shm_client_snapshot(shm_client_t *client, uint8_t *obs_out, uint8_t *ram_out);
+
+
+#endif
@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "state_archive.h"
+
+
+// Four independent multiply chains, so hashing runs at memory speed rather
+// than multiplier latency; pages are a multiple of 32 bytes
+static uint64_t hash_page(const uint8_t *page, uint32_t size)
+{
+    uint64_t lanes[4] = {size, size + 1, size + 2, size + 3};
+    for (uint32_t i = 0; i < size; i += 32)
+    {
+        for (int lane = 0; lane < 4; lane++)
+        {
+            uint64_t word;
+            memcpy(&word, page + i + lane * 8, 8);
+            lanes[lane] = (lanes[lane] ^ word) * 0x9E3779B97F4A7C15ULL;
+            lanes[lane] ^= lanes[lane] >> 29;
+        }
+    }
+    return (lanes[0] ^ (lanes[1] * 0xBF58476D1CE4E5B9ULL)) + (lanes[2] ^ (lanes[3] * 0x94D049BB133111EBULL));
+}
+
+static void *map_archive(int fd, uint64_t size, bool writable)
+{
+    int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    return mmap(NULL, size, protection, MAP_SHARED, fd, 0);
+}
+
+// Points the handle's regions into the mapping at `header`
+static void attach_regions(state_archive_t *archive, state_archive_header_t *header)
+{
+    archive->header = header;
+    archive->pages = (uint8_t *)header + header->pages_offset;
+    archive->states = (uint32_t *)((uint8_t *)header + header->states_offset);
+}
+
+
+/**
+ * Creates the archive file at `path`, replacing any file there, sized for
+ * `page_capacity` distinct pages and `state_capacity` states. The file is
+ * sparse: disk is only used by the pages written. `page_size` must be a
+ * power of two of at least 64, 0 for STATE_ARCHIVE_PAGE_SIZE.
+ *
+ * @return NULL if the file cannot be created or mapped, or memory runs out.
+ */
+state_archive_t *new_state_archive(const char *path, uint32_t page_size, uint32_t page_capacity,
+                                   uint32_t state_capacity)
+{
+    page_size = page_size == 0 ? STATE_ARCHIVE_PAGE_SIZE : page_size;
+    if (page_size < 64 || (page_size & (page_size - 1)) != 0 || page_capacity == 0 || state_capacity == 0
+        || page_capacity > UINT32_MAX / 2)
+    {
+        fprintf(stderr, "Invalid state archive geometry: %u-byte pages, %u pages, %u states.\n",
+                page_size, page_capacity, state_capacity);
+        exit(1);
+    }
+    state_archive_t *archive = calloc(1, sizeof(state_archive_t));
+    if (archive == NULL)
+    {
+        return NULL;
+    }
+    uint32_t pages_per_state = (sizeof(emulator_state_t) + page_size - 1) / page_size;
+    uint64_t pages_offset = STATE_ARCHIVE_HEADER_SIZE;
+    uint64_t states_offset = pages_offset + (uint64_t)page_capacity * page_size;
+    uint64_t size = states_offset + (uint64_t)state_capacity * pages_per_state * sizeof(uint32_t);
+
+    uint32_t index_size = 1;
+    while (index_size < page_capacity * 2)
+    {
+        index_size <<= 1;
+    }
+    archive->writable = true;
+    archive->index_mask = index_size - 1;
+    archive->index = calloc(index_size, sizeof(uint32_t));
+    archive->page_hashes = malloc((size_t)page_capacity * sizeof(uint64_t));
+    archive->tail = calloc(1, page_size);
+    archive->previous = malloc(sizeof(emulator_state_t));
+    archive->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    void *memory = MAP_FAILED;
+    if (archive->index != NULL && archive->page_hashes != NULL && archive->tail != NULL
+        && archive->previous != NULL && archive->fd >= 0 && ftruncate(archive->fd, size) == 0)
+    {
+        memory = map_archive(archive->fd, size, true);
+    }
+    if (memory == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not create the state archive %s: %s.\n", path, strerror(errno));
+        if (archive->fd >= 0)
+        {
+            close(archive->fd);
+        }
+        free(archive->index);
+        free(archive->page_hashes);
+        free(archive->tail);
+        free(archive->previous);
+        free(archive);
+        return NULL;
+    }
+
+    state_archive_header_t *header = memory;
+    header->version = STATE_ARCHIVE_VERSION;
+    header->state_size = sizeof(emulator_state_t);
+    header->page_size = page_size;
+    header->pages_per_state = pages_per_state;
+    header->page_capacity = page_capacity;
+    header->state_capacity = state_capacity;
+    header->size = size;
+    header->pages_offset = pages_offset;
+    header->states_offset = states_offset;
+    atomic_init(&header->page_count, 0);
+    atomic_init(&header->state_count, 0);
+    attach_regions(archive, header);
+
+    // The magic goes last: a reader seeing it sees a complete header
+    atomic_thread_fence(memory_order_release);
+    header->magic = STATE_ARCHIVE_MAGIC;
+    return archive;
+}
+
+/**
+ * Maps an existing archive read-only. States the writer publishes later
+ * become readable through this handle as they appear.
+ *
+ * @return NULL if the file cannot be mapped, or is not an archive of this
+ * version and emulator_state_t layout.
+ */
+state_archive_t *open_state_archive(const char *path)
+{
+    state_archive_t *archive = calloc(1, sizeof(state_archive_t));
+    if (archive == NULL)
+    {
+        return NULL;
+    }
+    archive->fd = open(path, O_RDONLY);
+    struct stat status;
+    void *memory = MAP_FAILED;
+    if (archive->fd >= 0 && fstat(archive->fd, &status) == 0
+        && (size_t)status.st_size >= STATE_ARCHIVE_HEADER_SIZE)
+    {
+        memory = map_archive(archive->fd, status.st_size, false);
+    }
+    state_archive_header_t *header = memory;
+    if (memory == MAP_FAILED || header->magic != STATE_ARCHIVE_MAGIC || header->version != STATE_ARCHIVE_VERSION
+        || header->state_size != sizeof(emulator_state_t) || header->size != (uint64_t)status.st_size)
+    {
+        if (memory != MAP_FAILED)
+        {
+            munmap(memory, status.st_size);
+        }
+        if (archive->fd >= 0)
+        {
+            close(archive->fd);
+        }
+        free(archive);
+        return NULL;
+    }
+    atomic_thread_fence(memory_order_acquire);
+    archive->writable = false;
+    attach_regions(archive, header);
+    return archive;
+}
+
+/**
+ * Unmaps the archive. The file stays; a writer's published states are in it.
+ */
+void free_state_archive(state_archive_t *archive)
+{
+    if (archive == NULL)
+    {
+        return;
+    }
+    munmap(archive->header, archive->header->size);
+    close(archive->fd);
+    free(archive->index);
+    free(archive->page_hashes);
+    free(archive->tail);
+    free(archive->previous);
+    free(archive);
+    archive = NULL;
+    return;
+}
+
+
+// =================================================================================
+//                          Writing and reading
+// =================================================================================
+
+/**
+ * @return the index of the stored page equal to `page`, adding it if new,
+ * or -1 if it is new and the archive has no room for it.
+ */
+static int64_t intern_page(state_archive_t *archive, const uint8_t *page)
+{
+    state_archive_header_t *header = archive->header;
+    uint32_t page_size = header->page_size;
+    uint64_t hash = hash_page(page, page_size);
+    uint32_t slot = hash & archive->index_mask;
+    while (archive->index[slot] != 0)
+    {
+        uint32_t candidate = archive->index[slot] - 1;
+        if (archive->page_hashes[candidate] == hash
+            && memcmp(archive->pages + (size_t)candidate * page_size, page, page_size) == 0)
+        {
+            return candidate;
+        }
+        slot = (slot + 1) & archive->index_mask;
+    }
+
+    uint32_t count = atomic_load_explicit(&header->page_count, memory_order_relaxed);
+    if (count == header->page_capacity)
+    {
+        return -1;
+    }
+    memcpy(archive->pages + (size_t)count * page_size, page, page_size);
+    archive->page_hashes[count] = hash;
+    archive->index[slot] = count + 1;
+    atomic_store_explicit(&header->page_count, count + 1, memory_order_release);
+    return count;
+}
+
+/**
+ * Stores `state`, taken with save_emulator_state, as a vector of page
+ * indices. Only pages not already in the archive are written. Only the
+ * handle from new_state_archive writes, from one thread at a time.
+ *
+ * @return the state's id, or -1 if the archive is read-only or full.
+ */
+int64_t state_archive_write(state_archive_t *archive, const emulator_state_t *state)
+{
+    state_archive_header_t *header = archive->header;
+    uint32_t id = atomic_load_explicit(&header->state_count, memory_order_relaxed);
+    if (!archive->writable || id == header->state_capacity)
+    {
+        return -1;
+    }
+    const uint8_t *bytes = (const uint8_t *)state;
+    uint32_t page_size = header->page_size;
+    uint32_t *refs = archive->states + (size_t)id * header->pages_per_state;
+    const uint32_t *previous_refs = refs - header->pages_per_state;
+    for (uint32_t p = 0; p < header->pages_per_state; p++)
+    {
+        size_t offset = (size_t)p * page_size;
+        size_t size = sizeof(emulator_state_t) - offset < page_size ? sizeof(emulator_state_t) - offset : page_size;
+        const uint8_t *page = bytes + offset;
+
+        // Successive states mostly repeat the one before: those pages skip
+        // the hash and the index, whose lookups miss the cache
+        if (archive->has_previous && memcmp(archive->previous + offset, page, size) == 0)
+        {
+            refs[p] = previous_refs[p];
+            continue;
+        }
+        if (size < page_size)
+        {
+            memcpy(archive->tail, page, size);
+            page = archive->tail;
+        }
+        // A full archive leaves the pages already added unreferenced, which is harmless
+        int64_t index = intern_page(archive, page);
+        if (index < 0)
+        {
+            // `previous` no longer matches the last published state
+            archive->has_previous = false;
+            return -1;
+        }
+        refs[p] = index;
+        memcpy(archive->previous + offset, page, size);
+    }
+    archive->has_previous = true;
+    atomic_store_explicit(&header->state_count, id + 1, memory_order_release);
+    return id;
+}
+
+/**
+ * Reassembles state `id` into `state`, for load_emulator_state. Safe to
+ * call from any number of threads while the writer adds states.
+ *
+ * @return 0 on success, -1 if no such state has been published.
+ */
+int state_archive_read(state_archive_t *archive, uint32_t id, emulator_state_t *state)
+{
+    state_archive_header_t *header = archive->header;
+    if (id >= atomic_load_explicit(&header->state_count, memory_order_acquire))
+    {
+        return -1;
+    }
+    uint8_t *bytes = (uint8_t *)state;
+    uint32_t page_size = header->page_size;
+    const uint32_t *refs = archive->states + (size_t)id * header->pages_per_state;
+    for (uint32_t p = 0; p < header->pages_per_state; p++)
+    {
+        size_t offset = (size_t)p * page_size;
+        size_t size = sizeof(emulator_state_t) - offset < page_size ? sizeof(emulator_state_t) - offset : page_size;
+        memcpy(bytes + offset, archive->pages + (size_t)refs[p] * page_size, size);
+    }
+    return 0;
+}
+
+
+/**
+ * @return the number of states readable so far.
+ */
+uint32_t state_archive_count(state_archive_t *archive)
+{
+    return atomic_load_explicit(&archive->header->state_count, memory_order_acquire);
+}
+
+/**
+ * @return pages referenced by all states over distinct pages stored, 1 for
+ * an empty archive.
+ */
+double state_archive_dedup_ratio(state_archive_t *archive)
+{
+    state_archive_header_t *header = archive->header;
+    uint32_t pages = atomic_load_explicit(&header->page_count, memory_order_acquire);
+    uint32_t states = atomic_load_explicit(&header->state_count, memory_order_acquire);
+    if (pages == 0)
+    {
+        return 1.0;
+    }
+    return (double)states * header->pages_per_state / pages;
+}
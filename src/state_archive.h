@@ -0,0 +1,79 @@
+#ifndef STATE_ARCHIVE_H
+#define STATE_ARCHIVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "emulator.h"
+
+
+#define STATE_ARCHIVE_MAGIC         0x41534247  // "GBSA"
+#define STATE_ARCHIVE_VERSION       1
+#define STATE_ARCHIVE_PAGE_SIZE     256         // Default page size, a power of two
+#define STATE_ARCHIVE_HEADER_SIZE   4096
+
+
+/**
+ * Start of the archive file. Pages of page_size bytes follow at
+ * pages_offset, then one vector of pages_per_state page indices per state at
+ * states_offset. Pages and vectors are never changed once written: the
+ * writer fills them in, then publishes them by bumping the counts.
+ */
+typedef struct StateArchiveHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t state_size;        // sizeof(emulator_state_t) of the writer
+    uint32_t page_size;
+    uint32_t pages_per_state;
+    uint32_t page_capacity;
+    uint32_t state_capacity;
+    uint64_t size;              // Bytes in the file
+    uint64_t pages_offset;
+    uint64_t states_offset;
+
+    _Alignas(64) _Atomic uint32_t page_count;
+    _Atomic uint32_t state_count;
+} state_archive_header_t;
+
+
+/**
+ * Content-addressed store of emulator states on a memory-mapped file. Each
+ * state is split into fixed-size pages and every distinct page is stored
+ * once, so states that differ in a few bytes of RAM cost a few pages plus
+ * their page vector. One handle writes; any number of threads or processes
+ * may read at the same time, from the same handle or their own.
+ */
+typedef struct StateArchive
+{
+    int fd;
+    bool writable;
+    state_archive_header_t *header;
+    uint8_t *pages;
+    uint32_t *states;
+
+    // Writer only: page hashes and an open-addressing index of page + 1
+    uint64_t *page_hashes;
+    uint32_t *index;
+    uint32_t index_mask;
+    uint8_t *tail;              // The state's last page, zero padded
+    uint8_t *previous;          // The last state written, page for page
+    bool has_previous;          // `previous` matches the last published state
+} state_archive_t;
+
+
+state_archive_t *new_state_archive(const char *path, uint32_t page_size, uint32_t page_capacity,
+                                   uint32_t state_capacity);
+state_archive_t *open_state_archive(const char *path);
+void free_state_archive(state_archive_t *archive);
+
+int64_t state_archive_write(state_archive_t *archive, const emulator_state_t *state);
+int state_archive_read(state_archive_t *archive, uint32_t id, emulator_state_t *state);
+
+uint32_t state_archive_count(state_archive_t *archive);
+double state_archive_dedup_ratio(state_archive_t *archive);
+
+
+#endif
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include "triple_buffer.h"
+
+
+triple_buffer_t *new_triple_buffer()
+{
+    triple_buffer_t *buffer = calloc(1, sizeof(triple_buffer_t));
+    if (buffer == NULL)
+    {
+        return NULL;
+    }
+    buffer->back = 0;
+    atomic_init(&buffer->middle, 1);
+    buffer->front = 2;
+    atomic_init(&buffer->dropped, 0);
+    return buffer;
+}
+
+void free_triple_buffer(triple_buffer_t *buffer)
+{
+    free(buffer);
+    buffer = NULL;
+    return;
+}
+
+
+/**
+ * Producer side: copies a completed frame into the back buffer and swaps it
+ * with the middle one. Never blocks; a frame the consumer had not taken yet
+ * is dropped. Frame ids start at 1.
+ */
+void triple_buffer_publish(triple_buffer_t *buffer, const uint8_t *frame, uint64_t frame_id)
+{
+    memcpy(buffer->frames[buffer->back], frame, sizeof(buffer->frames[0]));
+    buffer->frame_ids[buffer->back] = frame_id;
+    uint32_t previous = atomic_exchange_explicit(&buffer->middle,
+                                                 buffer->back | TRIPLE_BUFFER_FRESH,
+                                                 memory_order_acq_rel);
+    if (previous & TRIPLE_BUFFER_FRESH)
+    {
+        atomic_fetch_add_explicit(&buffer->dropped, 1, memory_order_relaxed);
+    }
+    buffer->back = previous & 3;
+    buffer->published++;
+}
+
+/**
+ * Consumer side: takes the latest published frame if there is a new one.
+ *
+ * @return the latest frame, valid until the next acquire, or NULL before
+ * anything was published. `frame_id`, if not NULL, receives its id.
+ */
+const uint8_t *triple_buffer_acquire(triple_buffer_t *buffer, uint64_t *frame_id)
+{
+    bool fresh = atomic_load_explicit(&buffer->middle, memory_order_relaxed) & TRIPLE_BUFFER_FRESH;
+    if (fresh)
+    {
+        uint32_t previous = atomic_exchange_explicit(&buffer->middle, buffer->front,
+                                                     memory_order_acq_rel);
+        buffer->front = previous & 3;
+    }
+    if (buffer->frame_ids[buffer->front] == 0)
+    {
+        return NULL;
+    }
+    if (!fresh)
+    {
+        buffer->duplicated++;
+    }
+    buffer->acquired++;
+    if (frame_id != NULL)
+    {
+        *frame_id = buffer->frame_ids[buffer->front];
+    }
+    return &buffer->frames[buffer->front][0][0];
+}
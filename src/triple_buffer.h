@@ -0,0 +1,44 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "ppu.h"
+
+
+#define TRIPLE_BUFFER_FRESH 0x4     // Set in `middle` until the consumer takes it
+
+
+/**
+ * Lock-free frame handoff between one producer (the emulation thread) and
+ * one consumer. Each side owns one buffer and they trade through the middle
+ * one with a single atomic exchange, so neither ever waits for the other.
+ */
+typedef struct TripleBuffer
+{
+    uint8_t frames[3][SCREEN_HEIGHT][SCREEN_WIDTH];
+    uint64_t frame_ids[3];          // ppu->frame_count when each frame was completed
+
+    // Each side's fields sit on their own cache line so that a consumer
+    // polling for frames does not slow the producer down
+    _Alignas(64) _Atomic uint32_t middle;   // Shared buffer index, with TRIPLE_BUFFER_FRESH
+
+    _Alignas(64) uint32_t back;     // Producer's buffer
+    uint64_t published;
+    _Atomic uint64_t dropped;       // Frames replaced before the consumer saw them
+
+    _Alignas(64) uint32_t front;    // Consumer's buffer
+    uint64_t acquired;
+    uint64_t duplicated;            // Acquires that returned an already seen frame
+} triple_buffer_t;
+
+
+triple_buffer_t *new_triple_buffer();
+void free_triple_buffer(triple_buffer_t *buffer);
+
+void triple_buffer_publish(triple_buffer_t *buffer, const uint8_t *frame, uint64_t frame_id);
+const uint8_t *triple_buffer_acquire(triple_buffer_t *buffer, uint64_t *frame_id);
+
+
+#endif
@@ -0,0 +1,348 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include "vec_env.h"
+
+
+/**
+ * @return the index-th CPU this process may run on, wrapping around, or -1 if
+ * the allowed set cannot be read.
+ */
+static int pick_cpu(uint32_t index)
+{
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        return -1;
+    }
+    int count = CPU_COUNT(&allowed);
+    if (count == 0)
+    {
+        return -1;
+    }
+    int wanted = index % count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &allowed) && wanted-- == 0)
+        {
+            return cpu;
+        }
+    }
+    return -1;
+}
+
+static void pin_thread(vec_worker_t *worker, uint32_t index)
+{
+    worker->cpu = pick_cpu(index);
+    if (worker->cpu < 0)
+    {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(worker->cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    {
+        worker->cpu = -1;
+    }
+}
+
+// Creates the worker's environments from its own thread, so first touch puts
+// their memory next to the CPU that steps them
+static bool create_envs(vec_worker_t *worker)
+{
+    for (uint32_t i = worker->first; i < worker->last; i++)
+    {
+        worker->vec->envs[i] = new_env(worker->vec->obs_scale);
+        if (worker->vec->envs[i] == NULL)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// =================================================================================
+//                          Stepping
+// =================================================================================
+
+static bool episode_done(vec_env_t *vec, env_t *env)
+{
+    if (vec->episode_steps != 0 && env->steps >= vec->episode_steps)
+    {
+        return true;
+    }
+    return vec->done != NULL && vec->done(env, vec->done_context);
+}
+
+// Runs the current request over the worker's slice
+static void run_slice(vec_worker_t *worker)
+{
+    vec_env_t *vec = worker->vec;
+    for (uint32_t i = worker->first; i < worker->last; i++)
+    {
+        env_t *env = vec->envs[i];
+        uint8_t *obs = vec->obs == NULL ? NULL : vec->obs + i * vec->obs_size;
+        uint8_t *ram = vec->ram == NULL ? NULL : vec->ram + (size_t)i * env->ram_count;
+        if (vec->resetting)
+        {
+            env_reset(env, obs, ram);
+            continue;
+        }
+        env_step(env, vec->actions[i], vec->frameskip, obs, ram);
+        bool done = episode_done(vec, env);
+        if (done)
+        {
+            env_reset(env, obs, ram);
+        }
+        if (vec->dones != NULL)
+        {
+            vec->dones[i] = done;
+        }
+    }
+}
+
+static void *run_worker(void *argument)
+{
+    vec_worker_t *worker = argument;
+    vec_env_t *vec = worker->vec;
+    uint32_t index = worker - vec->workers;
+    pin_thread(worker, index);
+
+    // Generation 0 is creating the environments
+    bool created = create_envs(worker);
+    uint64_t generation = 0;
+    pthread_mutex_lock(&vec->lock);
+    if (!created)
+    {
+        vec->failed = true;
+    }
+    while (true)
+    {
+        if (--vec->pending == 0)
+        {
+            pthread_cond_signal(&vec->finished);
+        }
+        while (vec->generation == generation && !vec->stopping)
+        {
+            pthread_cond_wait(&vec->start, &vec->lock);
+        }
+        if (vec->stopping)
+        {
+            break;
+        }
+        generation = vec->generation;
+        pthread_mutex_unlock(&vec->lock);
+        run_slice(worker);
+        pthread_mutex_lock(&vec->lock);
+    }
+    pthread_mutex_unlock(&vec->lock);
+    return NULL;
+}
+
+// Hands the current request to the pool, does the first slice here and waits
+// for the rest
+static void run_request(vec_env_t *vec)
+{
+    pthread_mutex_lock(&vec->lock);
+    vec->generation++;
+    vec->pending = vec->thread_count - 1;
+    pthread_cond_broadcast(&vec->start);
+    pthread_mutex_unlock(&vec->lock);
+
+    run_slice(&vec->workers[0]);
+
+    pthread_mutex_lock(&vec->lock);
+    while (vec->pending > 0)
+    {
+        pthread_cond_wait(&vec->finished, &vec->lock);
+    }
+    pthread_mutex_unlock(&vec->lock);
+}
+
+
+// =================================================================================
+//                          Lifetime
+// =================================================================================
+
+static void stop_workers(vec_env_t *vec, uint32_t started)
+{
+    pthread_mutex_lock(&vec->lock);
+    vec->stopping = true;
+    pthread_cond_broadcast(&vec->start);
+    pthread_mutex_unlock(&vec->lock);
+    for (uint32_t i = 1; i < started; i++)
+    {
+        pthread_join(vec->workers[i].thread, NULL);
+    }
+}
+
+static void release_vec_env(vec_env_t *vec)
+{
+    for (uint32_t i = 0; i < vec->count; i++)
+    {
+        free_env(vec->envs[i]);
+    }
+    pthread_mutex_destroy(&vec->lock);
+    pthread_cond_destroy(&vec->start);
+    pthread_cond_destroy(&vec->finished);
+    free(vec->envs);
+    free(vec->workers);
+    free(vec);
+}
+
+/**
+ * Starts `threads` threads (the caller's counts as the first; clamped to
+ * `count`), each owning an even slice of the `count` environments. The pool
+ * threads are pinned to the process's CPUs in turn; the caller's is not. `obs_scale` is as for new_env.
+ * Each environment starts at power-on; load a game into every
+ * vec->envs[i] and call env_save_snapshot on it before vec_env_reset.
+ *
+ * @return NULL if memory or threads run out.
+ */
+vec_env_t *new_vec_env(uint32_t count, uint32_t obs_scale, uint32_t threads)
+{
+    if (count == 0 || obs_scale == 0 || obs_scale > 8 || (obs_scale & (obs_scale - 1)) != 0)
+    {
+        fprintf(stderr, "Invalid vector environment of %u at scale %u.\n", count, obs_scale);
+        exit(1);
+    }
+    threads = threads == 0 ? 1 : threads > count ? count : threads;
+    vec_env_t *vec = calloc(1, sizeof(vec_env_t));
+    if (vec == NULL)
+    {
+        return NULL;
+    }
+    vec->envs = calloc(count, sizeof(env_t *));
+    vec->workers = calloc(threads, sizeof(vec_worker_t));
+    pthread_mutex_init(&vec->lock, NULL);
+    pthread_cond_init(&vec->start, NULL);
+    pthread_cond_init(&vec->finished, NULL);
+    if (vec->envs == NULL || vec->workers == NULL)
+    {
+        release_vec_env(vec);
+        return NULL;
+    }
+    vec->count = count;
+    vec->obs_scale = obs_scale;
+    vec->obs_width = SCREEN_WIDTH / obs_scale;
+    vec->obs_height = SCREEN_HEIGHT / obs_scale;
+    vec->obs_size = (size_t)vec->obs_width * vec->obs_height;
+    vec->thread_count = threads;
+    for (uint32_t i = 0; i < threads; i++)
+    {
+        vec->workers[i].vec = vec;
+        vec->workers[i].first = (uint64_t)count * i / threads;
+        vec->workers[i].last = (uint64_t)count * (i + 1) / threads;
+    }
+
+    // Pool threads create their own environments, then report in as if done
+    // with a request; the caller's slice is created here
+    vec->pending = threads - 1;
+    uint32_t started = 1;
+    pthread_mutex_lock(&vec->lock);
+    for (; started < threads; started++)
+    {
+        if (pthread_create(&vec->workers[started].thread, NULL, run_worker, &vec->workers[started]) != 0)
+        {
+            vec->pending -= threads - started;
+            vec->failed = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&vec->lock);
+    // The caller's thread is only borrowed, so its affinity is left alone
+    vec->workers[0].cpu = -1;
+    if (!create_envs(&vec->workers[0]))
+    {
+        vec->failed = true;
+    }
+    pthread_mutex_lock(&vec->lock);
+    while (vec->pending > 0)
+    {
+        pthread_cond_wait(&vec->finished, &vec->lock);
+    }
+    pthread_mutex_unlock(&vec->lock);
+
+    if (vec->failed)
+    {
+        stop_workers(vec, started);
+        release_vec_env(vec);
+        return NULL;
+    }
+    return vec;
+}
+
+/**
+ * Stops the pool and frees every environment.
+ */
+void free_vec_env(vec_env_t *vec)
+{
+    if (vec == NULL)
+    {
+        return;
+    }
+    stop_workers(vec, vec->thread_count);
+    release_vec_env(vec);
+    vec = NULL;
+    return;
+}
+
+
+// =================================================================================
+//                          Requests
+// =================================================================================
+
+/**
+ * Chooses the RAM bytes reported by every environment; the RAM array then
+ * holds `count` bytes per environment.
+ *
+ * @return 0 on success, -1 if there are more than ENV_MAX_RAM_BYTES.
+ */
+int vec_env_set_ram_addresses(vec_env_t *vec, const uint16_t *addresses, uint32_t count)
+{
+    for (uint32_t i = 0; i < vec->count; i++)
+    {
+        if (env_set_ram_addresses(vec->envs[i], addresses, count) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Resets every environment. `obs` holds count x obs_height x obs_width
+ * bytes and `ram` count x RAM addresses; either may be NULL.
+ */
+void vec_env_reset(vec_env_t *vec, uint8_t *obs, uint8_t *ram)
+{
+    vec->resetting = true;
+    vec->obs = obs;
+    vec->ram = ram;
+    vec->dones = NULL;
+    run_request(vec);
+}
+
+/**
+ * Steps environment i with actions[i] for `frameskip` frames, as env_step.
+ * An environment whose episode ended gets dones[i] = 1 and is reset, so its
+ * observation and RAM are the first of the next episode. `obs`, `ram` and
+ * `dones` are laid out as for vec_env_reset, with `dones` one byte per
+ * environment; any of them may be NULL.
+ */
+void vec_env_step(vec_env_t *vec, const uint8_t *actions, uint32_t frameskip,
+                  uint8_t *obs, uint8_t *ram, uint8_t *dones)
+{
+    vec->resetting = false;
+    vec->actions = actions;
+    vec->frameskip = frameskip;
+    vec->obs = obs;
+    vec->ram = ram;
+    vec->dones = dones;
+    run_request(vec);
+}
@@ -0,0 +1,77 @@
+#ifndef VEC_ENV_H
+#define VEC_ENV_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "env.h"
+
+
+struct VecEnv;
+
+// A pool thread and the slice of environments it owns
+typedef struct VecWorker
+{
+    struct VecEnv *vec;
+    pthread_t thread;
+    int cpu;                    // Pinned to this CPU, -1 for the caller or if pinning failed
+    uint32_t first;             // Environments [first, last)
+    uint32_t last;
+} vec_worker_t;
+
+
+/**
+ * M environments stepped together by a persistent pool of pinned threads
+ * plus the calling thread, which keeps its own affinity.
+ * Each thread creates its own environments, so their memory is local to it,
+ * and steps the same slice every time. Observations, RAM bytes and done
+ * flags are written into caller arrays laid out environment by environment.
+ */
+typedef struct VecEnv
+{
+    uint32_t count;
+    env_t **envs;
+    uint32_t obs_scale;
+    uint32_t obs_width;
+    uint32_t obs_height;
+    size_t obs_size;            // Bytes per environment in the observation array
+
+    // An episode ends after episode_steps steps (0 for no limit) or when
+    // done() says so; it then restarts from the environment's snapshot.
+    uint32_t episode_steps;
+    bool (*done)(env_t *env, void *context);
+    void *done_context;
+
+    // The current request, read by the workers
+    const uint8_t *actions;
+    uint32_t frameskip;
+    bool resetting;             // Reset every environment instead of stepping
+    uint8_t *obs;
+    uint8_t *ram;
+    uint8_t *dones;
+
+    uint32_t thread_count;      // Worker 0 is the calling thread, never pinned
+    vec_worker_t *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+    uint64_t generation;        // Bumped for every request
+    uint32_t pending;           // Pool threads still working on it
+    bool stopping;
+    _Atomic bool failed;        // A thread could not create its environments
+} vec_env_t;
+
+
+vec_env_t *new_vec_env(uint32_t count, uint32_t obs_scale, uint32_t threads);
+void free_vec_env(vec_env_t *vec);
+
+int vec_env_set_ram_addresses(vec_env_t *vec, const uint16_t *addresses, uint32_t count);
+void vec_env_reset(vec_env_t *vec, uint8_t *obs, uint8_t *ram);
+void vec_env_step(vec_env_t *vec, const uint8_t *actions, uint32_t frameskip,
+                  uint8_t *obs, uint8_t *ram, uint8_t *dones);
+
+
+#endif
@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "video.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#define VIDEO_SSSE3 1
+#endif
+
+
+// Shades 0 (white) to 3 (black) as 0xRRGGBB
+static const uint32_t default_palette[4] = {0xFFFFFF, 0xAAAAAA, 0x555555, 0x000000};
+
+
+video_output_t *new_video_output(pixel_format_t format)
+{
+    video_output_t *output = malloc(sizeof(video_output_t));
+    if (output == NULL)
+    {
+        return NULL;
+    }
+    output->format = format;
+    output->simd = true;
+    video_set_palette(output, default_palette);
+    return output;
+}
+
+void free_video_output(video_output_t *output)
+{
+    free(output);
+    output = NULL;
+    return;
+}
+
+
+/**
+ * @return the number of bytes of one pixel in `format`.
+ */
+size_t pixel_format_size(pixel_format_t format)
+{
+    switch (format)
+    {
+    case PIXEL_FORMAT_RGBA8888:
+        return 4;
+    case PIXEL_FORMAT_RGB565:
+        return 2;
+    case PIXEL_FORMAT_GRAY8:
+        return 1;
+    default:
+        fprintf(stderr, "Invalid pixel format %d.\n", format);
+        exit(1);
+    }
+}
+
+/**
+ * Sets the colours of shades 0 to 3, as 0xRRGGBB.
+ */
+void video_set_palette(video_output_t *output, const uint32_t colours[4])
+{
+    memset(output->lut, 0, sizeof(output->lut));
+    for (int shade = 0; shade < 4; shade++)
+    {
+        uint8_t red = colours[shade] >> 16;
+        uint8_t green = colours[shade] >> 8;
+        uint8_t blue = colours[shade];
+        uint8_t *bytes = output->lut[shade];
+        switch (output->format)
+        {
+        case PIXEL_FORMAT_RGBA8888:
+            bytes[0] = red;
+            bytes[1] = green;
+            bytes[2] = blue;
+            bytes[3] = 0xFF;
+            break;
+        case PIXEL_FORMAT_RGB565:
+        {
+            uint16_t pixel = ((red >> 3) << 11) | ((green >> 2) << 5) | (blue >> 3);
+            bytes[0] = pixel & 0xFF;
+            bytes[1] = pixel >> 8;
+            break;
+        }
+        case PIXEL_FORMAT_GRAY8:
+            bytes[0] = (red * 77 + green * 150 + blue * 29) >> 8;
+            break;
+        default:
+            fprintf(stderr, "Invalid pixel format %d.\n", output->format);
+            exit(1);
+        }
+    }
+}
+
+
+// =================================================================================
+//                          Conversion kernels
+// =================================================================================
+
+// Converts `count` shades of one row, one table lookup per pixel
+static void convert_row_scalar(video_output_t *output, const uint8_t *shades, int count,
+                               uint8_t *pixels)
+{
+    switch (output->format)
+    {
+    case PIXEL_FORMAT_RGBA8888:
+        for (int x = 0; x < count; x++)
+        {
+            memcpy(pixels + x * 4, output->lut[shades[x] & 3], 4);
+        }
+        break;
+    case PIXEL_FORMAT_RGB565:
+        for (int x = 0; x < count; x++)
+        {
+            memcpy(pixels + x * 2, output->lut[shades[x] & 3], 2);
+        }
+        break;
+    case PIXEL_FORMAT_GRAY8:
+        for (int x = 0; x < count; x++)
+        {
+            pixels[x] = output->lut[shades[x] & 3][0];
+        }
+        break;
+    }
+}
+
+#ifdef VIDEO_SSSE3
+/**
+ * Converts 16 shades at a time: each output byte lane is a PSHUFB of the
+ * shades into a 4-entry table, then the lanes are interleaved into pixels.
+ *
+ * @return the number of shades converted, a multiple of 16.
+ */
+__attribute__((target("ssse3")))
+static int convert_row_ssse3(video_output_t *output, const uint8_t *shades, int count,
+                             uint8_t *pixels)
+{
+    __m128i table[4];
+    for (int lane = 0; lane < 4; lane++)
+    {
+        table[lane] = _mm_setr_epi8(output->lut[0][lane], output->lut[1][lane],
+                                    output->lut[2][lane], output->lut[3][lane],
+                                    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    }
+    const __m128i mask = _mm_set1_epi8(3);
+#define LOAD_SHADES(x) _mm_and_si128(_mm_loadu_si128((const __m128i *)(shades + (x))), mask)
+
+    int x = 0;
+    switch (output->format)
+    {
+    case PIXEL_FORMAT_RGBA8888:
+        for (; x + 16 <= count; x += 16)
+        {
+            __m128i index = LOAD_SHADES(x);
+            __m128i lane0 = _mm_shuffle_epi8(table[0], index);
+            __m128i lane1 = _mm_shuffle_epi8(table[1], index);
+            __m128i lane2 = _mm_shuffle_epi8(table[2], index);
+            __m128i lane3 = _mm_shuffle_epi8(table[3], index);
+            __m128i low01 = _mm_unpacklo_epi8(lane0, lane1);
+            __m128i high01 = _mm_unpackhi_epi8(lane0, lane1);
+            __m128i low23 = _mm_unpacklo_epi8(lane2, lane3);
+            __m128i high23 = _mm_unpackhi_epi8(lane2, lane3);
+            __m128i *out = (__m128i *)(pixels + x * 4);
+            _mm_storeu_si128(out, _mm_unpacklo_epi16(low01, low23));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(low01, low23));
+            _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(high01, high23));
+            _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(high01, high23));
+        }
+        break;
+    case PIXEL_FORMAT_RGB565:
+        for (; x + 16 <= count; x += 16)
+        {
+            __m128i index = LOAD_SHADES(x);
+            __m128i lane0 = _mm_shuffle_epi8(table[0], index);
+            __m128i lane1 = _mm_shuffle_epi8(table[1], index);
+            __m128i *out = (__m128i *)(pixels + x * 2);
+            _mm_storeu_si128(out, _mm_unpacklo_epi8(lane0, lane1));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi8(lane0, lane1));
+        }
+        break;
+    case PIXEL_FORMAT_GRAY8:
+        for (; x + 16 <= count; x += 16)
+        {
+            _mm_storeu_si128((__m128i *)(pixels + x), _mm_shuffle_epi8(table[0], LOAD_SHADES(x)));
+        }
+        break;
+    }
+#undef LOAD_SHADES
+    return x;
+}
+#endif
+
+/**
+ * Converts a `width` x `height` block of 2-bit shades, rows `shades_stride`
+ * bytes apart, to `output->format` pixels written straight to `pixels` with
+ * rows `stride` bytes apart.
+ */
+void video_convert(video_output_t *output, const uint8_t *shades, size_t shades_stride,
+                   int width, int height, void *pixels, size_t stride)
+{
+    bool simd = false;
+#ifdef VIDEO_SSSE3
+    simd = output->simd && __builtin_cpu_supports("ssse3");
+#endif
+    size_t pixel_size = pixel_format_size(output->format);
+
+    for (int y = 0; y < height; y++)
+    {
+        const uint8_t *row = shades + y * shades_stride;
+        uint8_t *out = (uint8_t *)pixels + y * stride;
+        int done = 0;
+#ifdef VIDEO_SSSE3
+        if (simd)
+        {
+            done = convert_row_ssse3(output, row, width, out);
+        }
+#endif
+        convert_row_scalar(output, row + done, width - done, out + done * pixel_size);
+    }
+}
+
+/**
+ * Converts the PPU's current frame.
+ */
+void video_convert_ppu(video_output_t *output, ppu_t *ppu, void *pixels, size_t stride)
+{
+    video_convert(output, &ppu->framebuffer[0][0], SCREEN_WIDTH, SCREEN_WIDTH, SCREEN_HEIGHT,
+                  pixels, stride);
+}
@@ -0,0 +1,38 @@
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ppu.h"
+
+
+typedef enum PixelFormat
+{
+    PIXEL_FORMAT_RGBA8888,  // R, G, B, A bytes
+    PIXEL_FORMAT_RGB565,    // 16-bit little endian, red in the high bits
+    PIXEL_FORMAT_GRAY8      // Luma byte
+} pixel_format_t;
+
+
+typedef struct VideoOutput
+{
+    pixel_format_t format;
+    bool simd;              // Use the SSSE3 kernels when the host has them
+    uint8_t lut[4][4];      // Pixel bytes of each shade in `format`
+} video_output_t;
+
+
+video_output_t *new_video_output(pixel_format_t format);
+void free_video_output(video_output_t *output);
+
+size_t pixel_format_size(pixel_format_t format);
+void video_set_palette(video_output_t *output, const uint32_t colours[4]);
+
+void video_convert(video_output_t *output, const uint8_t *shades, size_t shades_stride,
+                   int width, int height, void *pixels, size_t stride);
+void video_convert_ppu(video_output_t *output, ppu_t *ppu, void *pixels, size_t stride);
+
+
+#endif
@@ -0,0 +1,195 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/apu.h"
+
+// ==================================================================================
+//                                  Helpers
+// ==================================================================================
+
+// Channel 2 at 131072 / (2048 - 1917) = 1000.5 Hz, 50% duty, full volume
+static void play_square(apu_t *apu, uint64_t cycle)
+{
+    apu_write_register(apu, NR21_REGISTER, 0x80, cycle);
+    apu_write_register(apu, NR22_REGISTER, 0xF0, cycle);
+    apu_write_register(apu, NR23_REGISTER, 1917 & 0xFF, cycle);
+    apu_write_register(apu, NR24_REGISTER, 0x80 | (1917 >> 8), cycle);
+}
+
+// Noise and wave on top of the square, with a panning change later on
+static void play_mix(apu_t *apu)
+{
+    play_square(apu, 0);
+    for (int i = 0; i < 16; i++)
+    {
+        apu_write_register(apu, WAVE_RAM + i, (uint8_t)(i * 0x11 + 0x37), 0);
+    }
+    apu_write_register(apu, NR30_REGISTER, 0x80, 10);
+    apu_write_register(apu, NR32_REGISTER, 0x20, 10);
+    apu_write_register(apu, NR33_REGISTER, 0x00, 10);
+    apu_write_register(apu, NR34_REGISTER, 0x87, 10);
+    apu_write_register(apu, NR42_REGISTER, 0xA3, 20);
+    apu_write_register(apu, NR43_REGISTER, 0x45, 20);
+    apu_write_register(apu, NR44_REGISTER, 0x80, 20);
+    apu_write_register(apu, NR51_REGISTER, 0x5A, 30000);
+}
+
+// ==================================================================================
+//                                  Tests
+// ==================================================================================
+
+void test_apu_registers()
+{
+    printf("Testing APU registers...\n");
+    apu_t *apu = new_apu();
+    assert(apu != NULL);
+
+    assert(apu_read_register(apu, NR52_REGISTER, 0) == 0xF0);
+    apu_write_register(apu, NR11_REGISTER, 0x80, 0);
+    assert(apu_read_register(apu, NR11_REGISTER, 0) == 0xBF);
+    assert(apu_read_register(apu, NR13_REGISTER, 0) == 0xFF);
+    apu_write_register(apu, WAVE_RAM + 3, 0x5A, 0);
+    assert(apu_read_register(apu, WAVE_RAM + 3, 0) == 0x5A);
+
+    // Channel 2 with length 1 stops at the first length clock (T-cycle 8192)
+    apu_write_register(apu, NR21_REGISTER, 0x3F, 0);
+    apu_write_register(apu, NR22_REGISTER, 0xF0, 0);
+    apu_write_register(apu, NR24_REGISTER, 0xC0, 0);
+    assert(apu_read_register(apu, NR52_REGISTER, 0) == 0xF2);
+    assert(apu_read_register(apu, NR52_REGISTER, 2047) == 0xF2);
+    assert(apu_read_register(apu, NR52_REGISTER, 2048) == 0xF0);
+
+    // Turning a DAC off stops the channel
+    apu_write_register(apu, NR24_REGISTER, 0x80, 3000);
+    assert(apu_read_register(apu, NR52_REGISTER, 3000) == 0xF2);
+    apu_write_register(apu, NR22_REGISTER, 0x00, 3000);
+    assert(apu_read_register(apu, NR52_REGISTER, 3000) == 0xF0);
+
+    // Power off clears the registers and ignores writes
+    apu_write_register(apu, NR52_REGISTER, 0x00, 4000);
+    assert(apu_read_register(apu, NR50_REGISTER, 4000) == 0x00);
+    apu_write_register(apu, NR50_REGISTER, 0x77, 4000);
+    assert(apu_read_register(apu, NR50_REGISTER, 4000) == 0x00);
+    assert(apu_read_register(apu, NR52_REGISTER, 4000) == 0x70);
+
+    free_apu(apu);
+}
+
+void test_apu_square_wave()
+{
+    printf("Testing APU square wave output...\n");
+    apu_t *apu = new_apu();
+    assert(apu != NULL);
+    play_square(apu, 0);
+
+    // One second, pulled once per frame
+    int16_t *samples = malloc(APU_SAMPLE_RATE * 2 * sizeof(int16_t));
+    assert(samples != NULL);
+    size_t total = 0;
+    for (uint64_t cycle = 17556; total < APU_SAMPLE_RATE; cycle += 17556)
+    {
+        total += apu_read_samples(apu, cycle, samples + total * 2, APU_SAMPLE_RATE - total);
+    }
+
+    // 1000.5 Hz: two sign changes per period, once the DC blocker settled
+    int crossings = 0;
+    int16_t peak = 0;
+    for (size_t i = APU_SAMPLE_RATE / 2 + 1; i < APU_SAMPLE_RATE; i++)
+    {
+        crossings += (samples[i * 2] < 0) != (samples[(i - 1) * 2] < 0);
+        peak = samples[i * 2] > peak ? samples[i * 2] : peak;
+        assert(samples[i * 2] == samples[i * 2 + 1]);
+    }
+    assert(crossings >= 998 && crossings <= 1003);
+    // Steps of 15 * 8 / 480 of full scale (8192), centred by the DC blocker,
+    // plus the band-limited overshoot
+    assert(peak > 4096 && peak < 6000);
+
+    free(samples);
+    free_apu(apu);
+}
+
+void test_apu_lazy_pulls()
+{
+    printf("Testing APU output independent of pull points...\n");
+    apu_t *once = new_apu();
+    apu_t *often = new_apu();
+    assert(once != NULL && often != NULL);
+    play_mix(once);
+    play_mix(often);
+
+    int16_t all[3000 * 2];
+    int16_t chunks[3000 * 2];
+    size_t total = 0;
+    for (uint64_t cycle = 0; total < 3000; cycle += 777)
+    {
+        total += apu_read_samples(often, cycle, chunks + total * 2, 3000 - total);
+    }
+    assert(apu_read_samples(once, 80000, all, 3000) == 3000);
+    assert(memcmp(all, chunks, sizeof(all)) == 0);
+
+    // Panning put the square on the right only and noise on the left only
+    bool differs = false;
+    for (int i = 2500; i < 3000; i++)
+    {
+        differs |= all[i * 2] != all[i * 2 + 1];
+    }
+    assert(differs);
+
+    free_apu(once);
+    free_apu(often);
+}
+
+void test_apu_max_sample_rate()
+{
+    printf("Testing APU output at the highest sample rate...\n");
+    apu_t *apu = new_apu();
+    assert(apu != NULL);
+    apu_set_sample_rate(apu, APU_MAX_SAMPLE_RATE);
+    play_mix(apu);
+
+    // Two seconds nobody pulls: the buffer drops its oldest samples, and
+    // every span still fits behind them
+    apu_catch_up(apu, APU_CLOCK_RATE / 2);
+    int16_t samples[APU_BUFFER_SAMPLES * 2];
+    size_t count = apu_read_samples(apu, APU_CLOCK_RATE / 2, samples, APU_BUFFER_SAMPLES);
+    assert(count > APU_BUFFER_SAMPLES / 2 && count < APU_BUFFER_SAMPLES);
+
+    free_apu(apu);
+}
+
+void test_apu_synthesis_off()
+{
+    printf("Testing the APU synthesis switch...\n");
+    apu_t *apu = new_apu();
+    assert(apu != NULL);
+    apu->synthesis = false;
+    play_square(apu, 0);
+    apu_write_register(apu, NR21_REGISTER, 0x3F, 0);
+    apu_write_register(apu, NR24_REGISTER, 0xC0, 0);
+
+    int16_t samples[256];
+    assert(apu_read_samples(apu, 100000, samples, 128) == 0);
+    assert(apu_read_register(apu, NR52_REGISTER, 100000) == 0xF0);
+
+    free_apu(apu);
+}
+
+
+// ==================================================================================
+//                                  Main Test Function
+// ==================================================================================
+
+
+void main_test_apu() {
+    printf("Running APU tests...\n");
+    test_apu_registers();
+    test_apu_square_wave();
+    test_apu_lazy_pulls();
+    test_apu_max_sample_rate();
+    test_apu_synthesis_off();
+    printf("APU tests passed!\n");
+}
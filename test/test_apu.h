@@ -0,0 +1,18 @@
+#ifndef TEST_APU_H
+#define TEST_APU_H
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "../src/apu.h"
+
+
+void test_apu_registers();
+void test_apu_square_wave();
+void test_apu_lazy_pulls();
+void test_apu_synthesis_off();
+
+void main_test_apu();
+
+
+#endif
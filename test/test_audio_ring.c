@@ -0,0 +1,199 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/emulator.h"
+#include "../src/audio_ring.h"
+
+// ==================================================================================
+//                                  Helpers
+// ==================================================================================
+
+#define THREADED_FRAMES 200000
+
+static void *produce_samples(void *argument)
+{
+    audio_ring_t *ring = argument;
+    int16_t block[100 * 2];
+    uint32_t next = 0;
+    while (next < THREADED_FRAMES)
+    {
+        for (int i = 0; i < 100; i++)
+        {
+            block[i * 2] = (int16_t)(next + i);
+            block[i * 2 + 1] = (int16_t)~(next + i);
+        }
+        // Only count what fitted, the rest is sent again
+        size_t queued = 0;
+        while (queued == 0)
+        {
+            queued = audio_ring_push(ring, block, 100);
+        }
+        next += queued;
+    }
+    return NULL;
+}
+
+typedef struct AudioRun
+{
+    uint64_t underrun;
+    // Milliseconds of audio queued when the device pulls, after a settling second
+    double mean_latency;
+    double max_latency;
+    double final_latency;
+} audio_run_t;
+
+/**
+ * Runs an emulator playing a square wave against a simulated audio device
+ * that pulls 256 frames at a time with its clock off by `drift`, for
+ * `seconds` of simulated time. The device starts once the ring reaches its
+ * target fill.
+ */
+static audio_run_t run_audio_device(double drift, double rate_range, int seconds)
+{
+    emulator_t *emulator = new_emulator();
+    assert(emulator != NULL);
+    emulator->audio_rate_range = rate_range;
+    emulator->cpu->memorybus[0x0100] = 0x18;    // JR -2
+    emulator->cpu->memorybus[0x0101] = 0xFE;
+    emulator->cpu->PC = 0x0100;
+    write_memory(emulator->cpu, NR21_REGISTER, 0x80);
+    write_memory(emulator->cpu, NR22_REGISTER, 0xF0);
+    write_memory(emulator->cpu, NR23_REGISTER, 0x00);
+    write_memory(emulator->cpu, NR24_REGISTER, 0x87);
+
+    const double pull_period = 256 / (APU_SAMPLE_RATE * (1 + drift));
+    double frame_time = 0, pull_time = -1;
+    int16_t pulled[256 * 2];
+    audio_run_t run = {0};
+    int pulls = 0;
+
+    while (frame_time < seconds)
+    {
+        if (pull_time < 0 && audio_ring_fill(emulator->audio) >= emulator->audio_target)
+        {
+            pull_time = frame_time;
+        }
+        if (pull_time >= 0 && pull_time <= frame_time)
+        {
+            double latency = audio_ring_fill(emulator->audio) * 1000.0 / APU_SAMPLE_RATE;
+            if (pull_time > 1.0)
+            {
+                run.mean_latency += latency;
+                run.max_latency = latency > run.max_latency ? latency : run.max_latency;
+                run.final_latency = latency;
+                pulls++;
+            }
+            audio_ring_pop(emulator->audio, pulled, 256);
+            pull_time += pull_period;
+        }
+        else
+        {
+            tick_emulator(emulator);
+            frame_time = (double)emulator->cpu->cycles * 4 / APU_CLOCK_RATE;
+        }
+    }
+    run.mean_latency /= pulls;
+    run.underrun = emulator->audio->underrun;
+    free_emulator(emulator);
+    return run;
+}
+
+// ==================================================================================
+//                                  Tests
+// ==================================================================================
+
+void test_audio_ring_push_pop()
+{
+    printf("Testing the audio ring...\n");
+    audio_ring_t *ring = new_audio_ring(6);
+    assert(ring != NULL && ring->capacity == 8);
+    int16_t in[10 * 2], out[10 * 2];
+    for (int i = 0; i < 20; i++)
+    {
+        in[i] = (int16_t)(i * 100);
+    }
+
+    assert(audio_ring_push(ring, in, 5) == 5);
+    assert(audio_ring_pop(ring, out, 3) == 3);
+    assert(memcmp(out, in, 3 * 2 * sizeof(int16_t)) == 0);
+    // Wraps around the end, then overflows
+    assert(audio_ring_push(ring, in, 10) == 6);
+    assert(ring->overrun == 4 && audio_ring_fill(ring) == 8);
+    assert(audio_ring_pop(ring, out, 10) == 8);
+    assert(memcmp(out + 2 * 2, in, 6 * 2 * sizeof(int16_t)) == 0);
+    assert(ring->underrun == 2 && out[8 * 2] == 0 && out[9 * 2 + 1] == 0);
+
+    free_audio_ring(ring);
+}
+
+void test_audio_ring_threads()
+{
+    printf("Testing the audio ring across threads...\n");
+    audio_ring_t *ring = new_audio_ring(1024);
+    assert(ring != NULL);
+    pthread_t producer;
+    assert(pthread_create(&producer, NULL, produce_samples, ring) == 0);
+
+    int16_t block[64 * 2];
+    uint32_t next = 0;
+    while (next < THREADED_FRAMES)
+    {
+        size_t count = audio_ring_pop(ring, block, 64);
+        for (size_t i = 0; i < count; i++)
+        {
+            assert(block[i * 2] == (int16_t)(next + i));
+            assert(block[i * 2 + 1] == (int16_t)~(next + i));
+        }
+        next += count;
+    }
+    pthread_join(producer, NULL);
+
+    free_audio_ring(ring);
+}
+
+void test_audio_rate_control()
+{
+    printf("Testing audio rate control against a drifting device...\n");
+    const double drifts[] = {0.003, -0.003};
+    for (int i = 0; i < 2; i++)
+    {
+        audio_run_t fixed = run_audio_device(drifts[i], 0.0, 60);
+        audio_run_t controlled = run_audio_device(drifts[i], 0.005, 60);
+        printf("  device clock %+.1f%%: fixed rate %lu underrun frames, %.1f ms mean latency, "
+               "%.1f ms max\n", drifts[i] * 100, (unsigned long)fixed.underrun,
+               fixed.mean_latency, fixed.max_latency);
+        printf("  device clock %+.1f%%: controlled %lu underrun frames, %.1f ms mean latency, "
+               "%.1f ms max, %.1f ms at the end\n", drifts[i] * 100, (unsigned long)controlled.underrun,
+               controlled.mean_latency, controlled.max_latency, controlled.final_latency);
+
+        // Target is 1600 frames, 33.3 ms
+        assert(controlled.underrun == 0);
+        assert(controlled.max_latency < 70.0);
+        assert(controlled.final_latency > 10.0 && controlled.final_latency < 40.0);
+        if (drifts[i] > 0)
+        {
+            assert(fixed.underrun > 0);
+        }
+        else
+        {
+            assert(fixed.max_latency > controlled.max_latency);
+        }
+    }
+}
+
+
+// ==================================================================================
+//                                  Main Test Function
+// ==================================================================================
+
+
+void main_test_audio_ring() {
+    printf("Running audio ring tests...\n");
+    test_audio_ring_push_pop();
+    test_audio_ring_threads();
+    test_audio_rate_control();
+    printf("Audio ring tests passed!\n");
+}
@@ -0,0 +1,17 @@
+#ifndef TEST_AUDIO_RING_H
+#define TEST_AUDIO_RING_H
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "../src/audio_ring.h"
+
+
+void test_audio_ring_push_pop();
+void test_audio_ring_threads();
+void test_audio_rate_control();
+
+void main_test_audio_ring();
+
+
+#endif
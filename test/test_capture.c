@@ -0,0 +1,256 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/capture.h"
+#include "../src/emulator.h"
+
+// ==================================================================================
+//                                  Helpers
+// ==================================================================================
+
+#define Y4M_HEADER "YUV4MPEG2 W160 H144 F4194304:70224 Ip A1:1 Cmono\n"
+#define Y4M_FRAME_BYTES (6 + SCREEN_WIDTH * SCREEN_HEIGHT)
+
+static void temp_path(char *path, size_t size, const char *name)
+{
+    snprintf(path, size, "/tmp/gameboy_capture_%d_%s", (int)getpid(), name);
+}
+
+// Reads a whole file; the caller frees the result
+static uint8_t *read_file(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    assert(file != NULL);
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *bytes = malloc(*size + 1);
+    assert(bytes != NULL);
+    assert(fread(bytes, 1, *size, file) == *size);
+    fclose(file);
+    return bytes;
+}
+
+static uint32_t get_u32(const uint8_t *bytes)
+{
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+// ==================================================================================
+//                                  Tests
+// ==================================================================================
+
+void test_capture_files()
+{
+    printf("Testing Y4M and WAV capture files...\n");
+    char video_path[128], audio_path[128];
+    temp_path(video_path, sizeof(video_path), "files.y4m");
+    temp_path(audio_path, sizeof(audio_path), "files.wav");
+    capture_t *capture = new_capture(video_path, audio_path, 44100);
+    assert(capture != NULL);
+    capture->block = true;
+
+    static uint8_t shades[3][SCREEN_HEIGHT][SCREEN_WIDTH];
+    for (int frame = 0; frame < 3; frame++)
+    {
+        for (int y = 0; y < SCREEN_HEIGHT; y++)
+        {
+            for (int x = 0; x < SCREEN_WIDTH; x++)
+            {
+                shades[frame][y][x] = (x + y + frame) & 3;
+            }
+        }
+        assert(capture_push_frame(capture, &shades[frame][0][0]));
+    }
+    // Odd block sizes, spanning several slots with a partial one left at the end
+    const size_t total = CAPTURE_SLOT_SAMPLES * 2 + 1234;
+    int16_t *samples = malloc(total * 2 * sizeof(int16_t));
+    assert(samples != NULL);
+    for (size_t i = 0; i < total * 2; i++)
+    {
+        samples[i] = (int16_t)(i * 37);
+    }
+    for (size_t done = 0; done < total;)
+    {
+        size_t count = total - done < 999 ? total - done : 999;
+        assert(capture_push_samples(capture, samples + done * 2, count));
+        done += count;
+    }
+    assert(capture->dropped_frames == 0 && capture->dropped_samples == 0);
+    free_capture(capture);
+
+    size_t size;
+    uint8_t *video = read_file(video_path, &size);
+    size_t header = strlen(Y4M_HEADER);
+    assert(size == header + 3 * Y4M_FRAME_BYTES);
+    assert(memcmp(video, Y4M_HEADER, header) == 0);
+    const uint8_t luma[4] = {0xFF, 0xAA, 0x55, 0x00};
+    for (int frame = 0; frame < 3; frame++)
+    {
+        const uint8_t *data = video + header + frame * Y4M_FRAME_BYTES;
+        assert(memcmp(data, "FRAME\n", 6) == 0);
+        for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++)
+        {
+            assert(data[6 + i] == luma[(&shades[frame][0][0])[i]]);
+        }
+    }
+    free(video);
+
+    uint8_t *audio = read_file(audio_path, &size);
+    assert(size == 44 + total * 4);
+    assert(memcmp(audio, "RIFF", 4) == 0 && memcmp(audio + 8, "WAVEfmt ", 8) == 0);
+    assert(get_u32(audio + 4) == 36 + total * 4);
+    assert(get_u32(audio + 24) == 44100);
+    assert(memcmp(audio + 36, "data", 4) == 0 && get_u32(audio + 40) == total * 4);
+    assert(memcmp(audio + 44, samples, total * 4) == 0);
+    free(audio);
+    free(samples);
+    unlink(video_path);
+    unlink(audio_path);
+}
+
+void test_capture_backpressure()
+{
+    printf("Testing capture backpressure...\n");
+    char video_path[128];
+    temp_path(video_path, sizeof(video_path), "pressure.y4m");
+    static uint8_t shades[SCREEN_HEIGHT][SCREEN_WIDTH];
+    const int frames = 2000;
+
+    // Pushing much faster than 60 fps: whatever does not fit is dropped and counted
+    capture_t *capture = new_capture(video_path, NULL, 48000);
+    assert(capture != NULL);
+    int accepted = 0;
+    for (int frame = 0; frame < frames; frame++)
+    {
+        accepted += capture_push_frame(capture, &shades[0][0]);
+    }
+    printf("  dropping: %d frames queued, %lu dropped, queue peaked at %u of %d slots\n", accepted,
+           (unsigned long)capture->dropped_frames, capture->max_queued, CAPTURE_SLOTS);
+    assert(accepted + capture->dropped_frames == (uint64_t)frames);
+    assert(capture->max_queued <= CAPTURE_SLOTS && capture->stalls == 0);
+    assert(capture_push_samples(capture, (const int16_t *)shades, 10));    // No audio file: ignored
+    free_capture(capture);
+    size_t size;
+    free(read_file(video_path, &size));
+    assert(size == strlen(Y4M_HEADER) + (size_t)accepted * Y4M_FRAME_BYTES);
+
+    // Blocking: every frame is written, the producer waits instead
+    capture = new_capture(video_path, NULL, 48000);
+    assert(capture != NULL);
+    capture->block = true;
+    for (int frame = 0; frame < frames; frame++)
+    {
+        assert(capture_push_frame(capture, &shades[0][0]));
+    }
+    printf("  blocking: %lu stalls\n", (unsigned long)capture->stalls);
+    assert(capture->dropped_frames == 0);
+    free_capture(capture);
+    free(read_file(video_path, &size));
+    assert(size == strlen(Y4M_HEADER) + (size_t)frames * Y4M_FRAME_BYTES);
+    unlink(video_path);
+
+    assert(new_capture("/nonexistent/directory/out.y4m", NULL, 48000) == NULL);
+}
+
+void test_emulator_capture()
+{
+    printf("Testing capture from the emulator...\n");
+    char video_path[128], audio_path[128];
+    temp_path(video_path, sizeof(video_path), "emulator.y4m");
+    temp_path(audio_path, sizeof(audio_path), "emulator.wav");
+    emulator_t *emulator = new_emulator();
+    assert(emulator != NULL);
+    emulator->audio_rate_range = 0;
+    emulator->capture = new_capture(video_path, audio_path, emulator->audio_rate);
+    assert(emulator->capture != NULL);
+    emulator->capture->block = true;
+    emulator->cpu->memorybus[0x0100] = 0x18;    // JR -2
+    emulator->cpu->memorybus[0x0101] = 0xFE;
+    emulator->cpu->PC = 0x0100;
+    write_memory(emulator->cpu, NR21_REGISTER, 0x80);
+    write_memory(emulator->cpu, NR22_REGISTER, 0xF0);
+    write_memory(emulator->cpu, NR24_REGISTER, 0x87);
+
+    for (int frame = 0; frame < 60; frame++)
+    {
+        tick_emulator(emulator);
+    }
+    free_capture(emulator->capture);
+    emulator->capture = NULL;
+
+    size_t size;
+    free(read_file(video_path, &size));
+    size_t frames = (size - strlen(Y4M_HEADER)) / Y4M_FRAME_BYTES;
+    assert(size == strlen(Y4M_HEADER) + frames * Y4M_FRAME_BYTES && frames >= 59 && frames <= 60);
+
+    // Every sample the APU produced up to the last tick
+    uint8_t *audio = read_file(audio_path, &size);
+    double expected = emulator->cpu->cycles * 4.0 / APU_CLOCK_RATE * APU_SAMPLE_RATE;
+    assert(size - 44 == get_u32(audio + 40) && (size - 44) % 4 == 0);
+    assert((size - 44) / 4 > expected - BLIP_TAPS - 1 && (size - 44) / 4 <= expected);
+    free(audio);
+    free_emulator(emulator);
+    unlink(video_path);
+    unlink(audio_path);
+}
+
+void test_emulator_capture_resampled()
+{
+    printf("Testing capture at a resampled output rate...\n");
+    char audio_path[128];
+    temp_path(audio_path, sizeof(audio_path), "resampled.wav");
+    emulator_t *emulator = new_emulator();
+    assert(emulator != NULL);
+    emulator->audio_rate_range = 0;
+    assert(set_audio_output_rate(emulator, 44100) == 0 && emulator->resampler != NULL);
+    emulator->capture = new_capture(NULL, audio_path, 44100);
+    assert(emulator->capture != NULL);
+    emulator->capture->block = true;
+    emulator->cpu->memorybus[0x0100] = 0x18;    // JR -2
+    emulator->cpu->memorybus[0x0101] = 0xFE;
+    emulator->cpu->PC = 0x0100;
+    write_memory(emulator->cpu, NR21_REGISTER, 0x80);
+    write_memory(emulator->cpu, NR22_REGISTER, 0xF0);
+    write_memory(emulator->cpu, NR24_REGISTER, 0x87);
+
+    for (int frame = 0; frame < 60; frame++)
+    {
+        tick_emulator(emulator);
+    }
+    free_capture(emulator->capture);
+    emulator->capture = NULL;
+
+    // The APU's samples at 44.1 kHz, less what the filters still hold
+    size_t size;
+    uint8_t *audio = read_file(audio_path, &size);
+    assert(get_u32(audio + 24) == 44100);
+    double expected = emulator->cpu->cycles * 4.0 / APU_CLOCK_RATE * 44100;
+    assert((size - 44) / 4 > expected - BLIP_TAPS - RESAMPLER_TAPS && (size - 44) / 4 <= expected);
+    assert(audio_ring_fill(emulator->audio) > 0);
+
+    // Back at the APU rate the resampler is dropped
+    assert(set_audio_output_rate(emulator, emulator->audio_rate) == 0 && emulator->resampler == NULL);
+    free(audio);
+    free_emulator(emulator);
+    unlink(audio_path);
+}
+
+
+// ==================================================================================
+//                                  Main Test Function
+// ==================================================================================
+
+
+void main_test_capture() {
+    printf("Running capture tests...\n");
+    test_capture_files();
+    test_capture_backpressure();
+    test_emulator_capture();
+    test_emulator_capture_resampled();
+    printf("Capture tests passed!\n");
+}
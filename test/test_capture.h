@@ -0,0 +1,17 @@
+#ifndef TEST_CAPTURE_H
+#define TEST_CAPTURE_H
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "../src/capture.h"
+
+
+void test_capture_files();
+void test_capture_backpressure();
+void test_emulator_capture();
+
+void main_test_capture();
+
+
+#endif
@@ -0,0 +1,182 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/coverage.h"
+#include "../src/cpu.h"
+
+// ==================================================================================
+//                                  Helpers
+// ==================================================================================
+
+// Count B down from `loops`, call a subroutine, then spin
+static const uint8_t branch_program[] = {
+    0x06, 0x03,             // 0100: LD B,loops
+    0x05, 0x20, 0xFD,       // 0102: DEC B; JR NZ,0x0102
+    0xCD, 0x10, 0x01,       // 0105: CALL 0x0110
+    0x18, 0xFE,             // 0108: JR 0x0108
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xC9,                   // 0110: RET
+    0x00                    // 0111: never runs
+};
+
+// Runs branch_program at `address` with `coverage` attached
+static void run_branch_program(coverage_t *coverage, unsigned int fusion, uint8_t loops, uint16_t address)
+{
+    cpu_t *cpu = new_cpu();
+    assert(cpu != NULL);
+    cpu->fusion = fusion;
+    cpu->idle_skip = false;
+    cpu->coverage = coverage;
+    memcpy(&cpu->memorybus[address], branch_program, sizeof(branch_program));
+    cpu->memorybus[address + 1] = loops;
+    // The CALL and the spin are relative to 0x0100
+    cpu->memorybus[address + 6] = (address + 0x10) & 0xFF;
+    cpu->memorybus[address + 7] = (address + 0x10) >> 8;
+    cpu->PC = address;
+    cpu->SP = 0xFFFE;
+    // Up to a cycle rather than an instruction count, as fused steps run several
+    while (cpu->cycles < 300)
+    {
+        execute_next_instruction(cpu);
+    }
+    free_cpu(cpu);
+}
+
+static bool rom_bit(const coverage_t *coverage, uint32_t bit)
+{
+    return (coverage->rom[bit >> 3] >> (bit & 7)) & 1;
+}
+
+// AFL hit-count class of a raw count, as coverage_merge computes it
+static uint8_t count_class(uint8_t count)
+{
+    if (count == 0)   return 0;
+    if (count <= 3)   return 1 << (count - 1);
+    if (count < 8)    return 8;
+    if (count < 16)   return 16;
+    if (count < 32)   return 32;
+    if (count < 128)  return 64;
+    return 128;
+}
+
+// ==================================================================================
+//                                  Tests
+// ==================================================================================
+
+void test_coverage_recording()
+{
+    printf("Testing coverage recording...\n");
+    coverage_t *coverage = new_coverage(2);
+    assert(coverage != NULL);
+    run_branch_program(coverage, FUSE_NONE, 3, 0x0100);
+
+    const uint16_t executed[] = {0x0100, 0x0102, 0x0103, 0x0105, 0x0108, 0x0110};
+    for (size_t i = 0; i < sizeof(executed) / sizeof(executed[0]); i++)
+    {
+        assert(rom_bit(coverage, executed[i]));
+    }
+    assert(!rom_bit(coverage, 0x0101) && !rom_bit(coverage, 0x0104) && !rom_bit(coverage, 0x0111));
+    assert(coverage_count_rom(coverage) == 6);
+    // JR back twice, JR on, CALL, RET, the spin
+    assert(coverage_count_edges(coverage) == 5);
+
+    // Fused DEC/JR records the same maps
+    coverage_t *fused = new_coverage(2);
+    assert(fused != NULL);
+    run_branch_program(fused, FUSE_ALL, 3, 0x0100);
+    assert(memcmp(fused->rom, coverage->rom, 2 * COVERAGE_BANK_SIZE / 8) == 0);
+    assert(memcmp(fused->edges, coverage->edges, COVERAGE_EDGES) == 0);
+
+    // The same code in another bank is other coverage
+    coverage_t *banked = new_coverage(4);
+    assert(banked != NULL);
+    banked->bank = 3;
+    run_branch_program(banked, FUSE_ALL, 3, 0x4100);
+    assert(rom_bit(banked, 3 * COVERAGE_BANK_SIZE + 0x0100));
+    assert(!rom_bit(banked, COVERAGE_BANK_SIZE + 0x0100));
+    assert(coverage_count_rom(banked) == 6);
+    assert(coverage_merge(banked, coverage, NULL) == 5);
+
+    coverage_reset(coverage);
+    assert(coverage_count_rom(coverage) == 0 && coverage_count_edges(coverage) == 0);
+    free_coverage(coverage);
+    free_coverage(fused);
+    free_coverage(banked);
+}
+
+void test_coverage_merge()
+{
+    printf("Testing coverage merging...\n");
+    coverage_t *total = new_coverage(2);
+    coverage_t *run = new_coverage(2);
+    assert(total != NULL && run != NULL);
+
+    run_branch_program(run, FUSE_ALL, 3, 0x0100);
+    uint64_t new_rom;
+    assert(coverage_merge(total, run, &new_rom) == 5 && new_rom == 6);
+    assert(coverage_merge(total, run, &new_rom) == 0 && new_rom == 0);
+
+    // More loop iterations: no new edge, but a new hit-count class
+    coverage_reset(run);
+    run_branch_program(run, FUSE_ALL, 6, 0x0100);
+    assert(coverage_merge(total, run, &new_rom) == 0 && new_rom == 0);
+    bool two_classes = false;
+    for (size_t i = 0; i < COVERAGE_EDGES; i++)
+    {
+        two_classes = two_classes || (total->edges[i] == (2 | 8));
+    }
+    assert(two_classes);
+
+    // Against a scalar merge, on random maps
+    uint64_t seed = 0x1234567;
+    coverage_t *expected = new_coverage(2);
+    assert(expected != NULL);
+    for (int round = 0; round < 4; round++)
+    {
+        for (size_t i = 0; i < COVERAGE_EDGES; i++)
+        {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            uint8_t value = seed >> 56;
+            run->edges[i] = (seed >> 40) % 5 == 0 ? value : 0;
+        }
+        for (size_t i = 0; i < 2 * COVERAGE_BANK_SIZE / 8; i++)
+        {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            run->rom[i] = (seed >> 48) & (seed >> 56);
+        }
+        uint64_t fresh = 0, rom = 0;
+        memcpy(expected->edges, total->edges, COVERAGE_EDGES);
+        memcpy(expected->rom, total->rom, 2 * COVERAGE_BANK_SIZE / 8);
+        for (size_t i = 0; i < COVERAGE_EDGES; i++)
+        {
+            fresh += expected->edges[i] == 0 && run->edges[i] != 0;
+            expected->edges[i] |= count_class(run->edges[i]);
+        }
+        for (size_t i = 0; i < 2 * COVERAGE_BANK_SIZE / 8; i++)
+        {
+            rom += __builtin_popcount(run->rom[i] & ~expected->rom[i]);
+            expected->rom[i] |= run->rom[i];
+        }
+        assert(coverage_merge(total, run, &new_rom) == fresh && new_rom == rom);
+        assert(memcmp(total->edges, expected->edges, COVERAGE_EDGES) == 0);
+        assert(memcmp(total->rom, expected->rom, 2 * COVERAGE_BANK_SIZE / 8) == 0);
+    }
+    free_coverage(expected);
+    free_coverage(total);
+    free_coverage(run);
+}
+
+// ==================================================================================
+//                                  Main Test Function
+// ==================================================================================
+
+void main_test_coverage()
+{
+    printf("Running coverage tests...\n");
+    test_coverage_recording();
+    test_coverage_merge();
+    printf("Coverage tests passed!\n");
+}
@@ -0,0 +1,16 @@
+#ifndef TEST_COVERAGE_H
+#define TEST_COVERAGE_H
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "../src/coverage.h"
+
+
+void test_coverage_recording();
+void test_coverage_merge();
+
+void main_test_coverage();
+
+
+#endif
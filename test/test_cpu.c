@@ -3,13 +3,14 @@
 #include <stdio.h>
 
 #include "../src/cpu.h"
+#include "../src/ppu.h"
 
 // ==================================================================================
 //                                  Test Registers
 // ==================================================================================
 
 void test_get_8bit_register() {
-        cpu_t cpu;
+        cpu_t cpu = {0};
     uint8_t memory[0xFFFF] = {0};
     registers_t reg = {
         .AF = (uint16_t[]){0x1234},
@@ -36,7 +37,7 @@ void test_get_8bit_register() {
 
 void test_set_8bit_register() {
         
-    cpu_t cpu;
+    cpu_t cpu = {0};
     uint8_t memory[0xFFFF] = {0};
     registers_t reg = {
         .AF = (uint16_t[]){0x1234},
@@ -80,7 +81,7 @@ void test_set_8bit_register() {
 
 void test_get_flag() {
     
-    cpu_t cpu;
+    cpu_t cpu = {0};
     uint8_t memory[0xFFFF] = {0};
     registers_t reg = {
         .AF = (uint16_t[]){0x1234},
@@ -95,16 +96,16 @@ void test_get_flag() {
     cpu.PC = *reg.PC;
     cpu.SP = *reg.SP;
     
-    // Test getting flags
-    assert(get_flag(&cpu, ZERO) == 0); // Assuming initial value is not zero
+    // Test getting flags: F is 0x34, so H and C are set
+    assert(get_flag(&cpu, ZERO) == 0);
     assert(get_flag(&cpu, SUB) == 0);
-    assert(get_flag(&cpu, HALF_CARRY) == 0);
-    assert(get_flag(&cpu, CARRY) == 0);
+    assert(get_flag(&cpu, HALF_CARRY) == 1);
+    assert(get_flag(&cpu, CARRY) == 1);
 }
 
 void test_set_flag() {
     
-    cpu_t cpu;
+    cpu_t cpu = {0};
     uint8_t memory[0xFFFF] = {0};
     registers_t reg = {
         .AF = (uint16_t[]){0x1234},
@@ -255,7 +256,7 @@ void test_LDH_n8_A(cpu_t *cpu)
     int timing = LDH_n8_A(cpu);
     assert(cpu->memorybus[0xFFDE] == 0x78);
     assert(cpu->PC == old_PC + 1);
-    assert(timing == 2);
+    assert(timing == 3);
 }
 
 void test_LDH_C_A(cpu_t *cpu)
@@ -266,7 +267,7 @@ void test_LDH_C_A(cpu_t *cpu)
     cpu->registers->BC = (uint16_t[]){0x0010};
     int timing = LDH_C_A(cpu);
     assert(cpu->memorybus[0xFF10] == 0x9A);
-    assert(cpu->PC == old_PC + 1);
+    assert(cpu->PC == old_PC);
     assert(timing == 2);
 }
 
@@ -306,7 +307,7 @@ void test_LDH_A_n16(cpu_t *cpu)
     cpu->memorybus[0xFF04] = 0xCD;
     cpu->memorybus[cpu->PC] = 0x04; 
     cpu->registers->AF = (uint16_t[]){0x0000};
-    int timing = LDH_A_C(cpu);
+    int timing = LDH_A_n16(cpu);
     assert(get_8bit_register(cpu, A) == 0xCD);
     assert(cpu->PC == old_PC+1);
     assert(timing == 3);
@@ -329,10 +330,10 @@ void test_LD_HLI_A(cpu_t *cpu)
 {
     uint16_t old_PC = cpu->PC;
     cpu->registers->HL = (uint16_t[]){0x3000};
-    set_8bit_register(cpu, A, 0xEF);
-    int timing = LD_HLD_A(cpu);
+    cpu->registers->AF = (uint16_t[]){0xEF00};
+    int timing = LD_HLI_A(cpu);
     assert(cpu->memorybus[0x3000] == 0xEF);
-    assert(*cpu->registers->HL == 0x3100);
+    assert(*cpu->registers->HL == 0x3001);
     assert(cpu->PC == old_PC);
     assert(timing == 2);
 }
@@ -341,7 +342,7 @@ void test_LD_HLD_A(cpu_t *cpu)
 {
     uint16_t old_PC = cpu->PC;
     cpu->registers->HL = (uint16_t[]){0x3000};
-    set_8bit_register(cpu, A, 0xEF);
+    cpu->registers->AF = (uint16_t[]){0xEF00};
     int timing = LD_HLD_A(cpu);
     assert(cpu->memorybus[0x3000] == 0xEF);
     assert(*cpu->registers->HL == 0x2FFF);
@@ -352,7 +353,7 @@ void test_LD_A_HLI(cpu_t *cpu)
 {
     uint16_t old_PC = cpu->PC;
     cpu->registers->HL = (uint16_t[]){0x3000};
-    set_8bit_register(cpu, A, 0xEF);
+    cpu->registers->AF = (uint16_t[]){0xEF00};
     cpu->memorybus[0x3000] = 0xAB;
     int timing = LD_A_HLI(cpu);
     assert(get_8bit_register(cpu, A) == 0xAB);
@@ -365,6 +366,7 @@ void test_LD_A_HLD(cpu_t *cpu)
 {
     uint16_t old_PC = cpu->PC;
     cpu->registers->HL = (uint16_t[]){0x3000};
+    cpu->registers->AF = (uint16_t[]){0x0000};
     cpu->memorybus[0x3000] = 0xCD;
     int timing = LD_A_HLD(cpu);
     assert(get_8bit_register(cpu, A) == 0xCD);
@@ -377,7 +379,7 @@ void test_LD_A_HLD(cpu_t *cpu)
 
 void test_load_instructions()
 {
-    cpu_t cpu;
+    cpu_t cpu = {0};
     uint8_t memory[0xFFFF] = {0};
     uint16_t AF = 0x0000, BC = 0x0000, DE = 0x0000, HL = 0x0000, SP = 0xFFFE, PC = 0x0000;
     registers_t registers = {
@@ -650,7 +652,7 @@ void test_DEC_HL(cpu_t *cpu)
     uint16_t old_pc = cpu->PC;
     int timing = DEC_HL(cpu);
     assert(read_memory(cpu, *cpu->registers->HL) == (uint8_t) 0xFE);
-    assert(timing == 2);
+    assert(timing == 3);
     assert(cpu->PC == (old_pc));
     assert(get_flag(cpu, ZERO) == 0);
     assert(get_flag(cpu, HALF_CARRY) == 0);
@@ -661,7 +663,7 @@ void test_DEC_HL(cpu_t *cpu)
     cpu->memorybus[*cpu->registers->HL] = (uint8_t) 0x01;
     old_pc = cpu->PC;
     timing = DEC_HL(cpu);
-    assert(*cpu->registers->BC == 0x0000);
+    assert(read_memory(cpu, *cpu->registers->HL) == 0x00);
     assert(timing == 3);
     assert(cpu->PC == (old_pc));
     assert(get_flag(cpu, ZERO) == 1);
@@ -827,7 +829,7 @@ void test_SUB_n8(cpu_t *cpu)
 
 void test_arithmetic_instructions()
 {
-    cpu_t cpu;
+    cpu_t cpu = {0};
     uint8_t memory[0xFFFF] = {0};
     uint16_t AF = 0x0000, BC = 0x0000, DE = 0x0000, HL = 0x0000, SP = 0xFFFE, PC = 0x0000;
     registers_t registers = {
@@ -900,7 +902,7 @@ void test_INC_r16(cpu_t *cpu)
 
 void test_16bit_arithmetic_instructions()
 {
-    cpu_t cpu;
+    cpu_t cpu = {0};
     uint8_t memory[0xFFFF] = {0};
     uint16_t AF = 0x0000, BC = 0x0000, DE = 0x0000, HL = 0x0000, SP = 0xFFFE, PC = 0x0000;
     registers_t registers = {
@@ -1106,7 +1108,7 @@ void test_XOR_n8(cpu_t *cpu);
 
 void test_bitwise_logic_instructions()
 {
-    cpu_t cpu;
+    cpu_t cpu = {0};
     uint8_t memory[0xFFFF] = {0};
     uint16_t AF = 0x0000, BC = 0x0000, DE = 0x0000, HL = 0x0000, SP = 0xFFFE, PC = 0x0000;
     registers_t registers = {
@@ -1147,7 +1149,7 @@ void test_SET_HL(cpu_t *cpu);
 
 void test_bit_flag_instructions()
 {
-    cpu_t cpu;
+    cpu_t cpu = {0};
     uint8_t memory[0xFFFF] = {0};
     uint16_t AF = 0x0000, BC = 0x0000, DE = 0x0000, HL = 0x0000, SP = 0xFFFE, PC = 0x0000;
     registers_t registers = {
@@ -1198,7 +1200,7 @@ void test_SWAP_HL(cpu_t *cpu);
 
 void test_bit_shift_instructions()
 {
-    cpu_t cpu;
+    cpu_t cpu = {0};
     uint8_t memory[0xFFFF] = {0};
     uint16_t AF = 0x0000, BC = 0x0000, DE = 0x0000, HL = 0x0000, SP = 0xFFFE, PC = 0x0000;
     registers_t registers = {
@@ -1281,7 +1283,7 @@ void test_PUSH_AF(cpu_t *cpu);
 
 void test_stack_manipulation_instructions()
 {
-    cpu_t cpu;
+    cpu_t cpu = {0};
     uint8_t memory[0xFFFF] = {0};
     uint16_t AF = 0x0000, BC = 0x0000, DE = 0x0000, HL = 0x0000, SP = 0xFFFE, PC = 0x0000;
     registers_t registers = {
@@ -1326,6 +1328,149 @@ void test_DAA(cpu_t *cpu);
 void test_NOP(cpu_t *cpu);
 void test_STOP(cpu_t *cpu);
 
+// ==================================================================================
+//                         Test Fused Instructions
+// ==================================================================================
+
+// Copy loop, DEC/JR countdown and LDH/CP/JR poll, ending at 0x0119
+static const uint8_t fused_program[] = {
+    0x21, 0x00, 0xC0,                   // LD HL,0xC000
+    0x11, 0x00, 0xD0,                   // LD DE,0xD000
+    0x06, 0x10,                         // LD B,0x10
+    0x2A, 0x12, 0x13, 0x05, 0x20, 0xFA, // loop: LD A,(HL+); LD (DE),A; INC DE; DEC B; JR NZ,loop
+    0x0E, 0x03,                         // LD C,3
+    0xF0, 0x81, 0xFE, 0x01, 0x20, 0x00, // poll: LDH A,(0x81); CP 1; JR NZ,+0
+    0x0D, 0x20, 0xF7                    // DEC C; JR NZ,poll
+};
+
+static int run_fused_program(cpu_t *cpu, unsigned int fusion)
+{
+    for (int i = 0; i < 0x10; i++)
+    {
+        cpu->memorybus[0xC000 + i] = 0xA0 + i;
+        cpu->memorybus[0xD000 + i] = 0x00;
+    }
+    cpu->memorybus[0xFF81] = 0x00;
+    for (size_t i = 0; i < sizeof(fused_program); i++)
+    {
+        cpu->memorybus[0x0100 + i] = fused_program[i];
+    }
+    *cpu->registers->AF = 0x0000;
+    cpu->fusion = fusion;
+    cpu->PC = 0x0100;
+
+    int cycles = 0;
+    while (cpu->PC != 0x0100 + sizeof(fused_program))
+    {
+        cycles += execute_next_instruction(cpu);
+    }
+    return cycles;
+}
+
+void test_fused_instructions()
+{
+    printf("Testing fused instructions...\n");
+    cpu_t cpu = {0};
+    static uint8_t memory[0x10000];
+    uint16_t AF = 0x0000, BC = 0x0000, DE = 0x0000, HL = 0x0000, SP = 0xFFFE, PC = 0x0000;
+    registers_t registers = {
+        .AF = &AF,
+        .BC = &BC,
+        .DE = &DE,
+        .HL = &HL,
+        .SP = &SP,
+        .PC = &PC
+    };
+    cpu.registers = &registers;
+    cpu.memorybus = memory;
+
+    int plain_cycles = run_fused_program(&cpu, FUSE_NONE);
+    uint16_t plain_AF = AF, plain_BC = BC, plain_DE = DE, plain_HL = HL;
+
+    int fused_cycles = run_fused_program(&cpu, FUSE_ALL);
+    assert(fused_cycles == plain_cycles);
+    assert(AF == plain_AF);
+    assert(BC == plain_BC);
+    assert(DE == plain_DE);
+    assert(HL == plain_HL);
+    assert(HL == 0xC010 && DE == 0xD010);
+    for (int i = 0; i < 0x10; i++)
+    {
+        assert(memory[0xD000 + i] == 0xA0 + i);
+    }
+}
+
+// ==================================================================================
+//                         Test Idle Loop Skip
+// ==================================================================================
+
+// Waits for LY == 0x90 with a fusable poll, then for LY == 0x10 with a
+// plain one, ending at 0x010D
+static const uint8_t idle_program[] = {
+    0xF0, 0x44, 0xFE, 0x90, 0x20, 0xFA,         // LDH A,(LY); CP 0x90; JR NZ,-6
+    0x00,                                       // NOP
+    0xF0, 0x44, 0xB7, 0xFE, 0x10, 0xC2, 0x07, 0x01 // LDH A,(LY); OR A; CP 0x10; JP NZ,0x0107
+};
+
+static uint64_t run_idle_program(cpu_t *cpu, ppu_t *ppu, bool idle_skip, unsigned int fusion)
+{
+    for (size_t i = 0; i < sizeof(idle_program); i++)
+    {
+        cpu->memorybus[0x0100 + i] = idle_program[i];
+    }
+    ppu->lcd_on_cycle = 0;
+    *cpu->registers->AF = 0x0000;
+    cpu->cycles = 0;
+    cpu->PC = 0x0100;
+    cpu->idle_skip = idle_skip;
+    cpu->idle_limit = 4 * CYCLES_PER_FRAME;
+    cpu->idle_loop.valid = false;
+    cpu->fusion = fusion;
+
+    uint64_t instructions = 0;
+    while (cpu->PC != 0x0100 + sizeof(idle_program))
+    {
+        execute_next_instruction(cpu);
+        instructions++;
+    }
+    return instructions;
+}
+
+void test_idle_loop_skip()
+{
+    printf("Testing idle loop skip...\n");
+    cpu_t cpu = {0};
+    static uint8_t memory[0x10000];
+    uint16_t AF = 0x0000, BC = 0x0000, DE = 0x0000, HL = 0x0000, SP = 0xFFFE, PC = 0x0000;
+    registers_t registers = {
+        .AF = &AF,
+        .BC = &BC,
+        .DE = &DE,
+        .HL = &HL,
+        .SP = &SP,
+        .PC = &PC
+    };
+    cpu.registers = &registers;
+    cpu.memorybus = memory;
+    ppu_t *ppu = new_ppu();
+    assert(ppu != NULL);
+    cpu.ppu = ppu;
+
+    for (unsigned int fusion = FUSE_NONE; fusion <= FUSE_ALL; fusion += FUSE_ALL)
+    {
+        uint64_t plain_instructions = run_idle_program(&cpu, ppu, false, fusion);
+        uint64_t plain_cycles = cpu.cycles;
+        uint16_t plain_AF = AF;
+
+        uint64_t skip_instructions = run_idle_program(&cpu, ppu, true, fusion);
+        assert(cpu.cycles == plain_cycles);
+        assert(AF == plain_AF);
+        assert(skip_instructions < plain_instructions / 4);
+        assert(ppu_ly(ppu, cpu.cycles) == 0x10);
+    }
+    free_ppu(ppu);
+}
+
 // ==================================================================================
 //                                  Utility Test Function
 // ==================================================================================
@@ -1333,7 +1478,7 @@ void test_STOP(cpu_t *cpu);
 void test_unsigned_16()
 {
     printf("Testing unsigned_16...\n");
-    uint16_t result = unsigned_16(0x34, 0x12);
+    uint16_t result = unsigned_16(0x12, 0x34);
     assert(result == 0x1234);
 }
 
@@ -1422,6 +1567,11 @@ void test_utility_functions()
 
 
 void main_test_cpu() {
+    // The engine tests first, so they run even if an older unit test aborts
+    printf("Running engine tests...\n");
+    test_fused_instructions();
+    test_idle_loop_skip();
+
     printf("Running Utility functions tests...\n");
     test_utility_functions();
 
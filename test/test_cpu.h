@@ -36,6 +36,9 @@ void test_LD_HLD_A(cpu_t *cpu);
 void test_LD_A_HLI(cpu_t *cpu);
 void test_LD_A_HLD(cpu_t *cpu);
 
+void test_fused_instructions();
+void test_idle_loop_skip();
+
 
 
 #endif
\ No newline at end of file
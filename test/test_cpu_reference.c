@@ -0,0 +1,156 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/cpu_reference.h"
+#include "../src/joypad.h"
+
+// ==================================================================================
+//                                  Helpers
+// ==================================================================================
+
+// A case running `opcode`, then `operand`, at 0xC000 with the given AF and BC
+static void make_case(uint8_t *input, uint8_t opcode, uint8_t operand, uint16_t af, uint16_t bc)
+{
+    memset(input, 0, CPU_DIFF_INPUT_SIZE);
+    input[0] = opcode;
+    input[1] = operand;
+    input[4] = af & 0xFF;
+    input[5] = af >> 8;
+    input[6] = bc & 0xFF;
+    input[7] = bc >> 8;
+    input[12] = 0xFE;   // SP 0xDFFE
+    input[13] = 0xDF;
+    input[15] = 0xC0;   // PC 0xC000
+}
+
+static void assert_agrees(cpu_diff_t *diff, const uint8_t *input)
+{
+    if (cpu_diff_run(diff, input, CPU_DIFF_INPUT_SIZE) != 0)
+    {
+        fprintf(stderr, "%s\n", diff->report);
+        assert(false);
+    }
+}
+
+// ==================================================================================
+//                                  Tests
+// ==================================================================================
+
+void test_cpu_reference_fixed_cases()
+{
+    printf("Testing instructions against known results...\n");
+    cpu_diff_t *diff = new_cpu_diff(1);
+    assert(diff != NULL);
+    cpu_t *cpu = diff->cpu;
+    uint8_t input[CPU_DIFF_INPUT_SIZE];
+
+    // RLA takes the carry in
+    make_case(input, 0x17, 0x00, 0x8010, 0x0000);
+    assert_agrees(diff, input);
+    assert(*cpu->registers->AF == 0x0110);
+
+    // SET 7,B and RES 0,C
+    make_case(input, 0xCB, 0xF8, 0x0000, 0x0001);
+    assert_agrees(diff, input);
+    assert(*cpu->registers->BC == 0x8001);
+    make_case(input, 0xCB, 0x81, 0x0000, 0x0001);
+    assert_agrees(diff, input);
+    assert(*cpu->registers->BC == 0x0000);
+
+    // ADC A,0xFF with the carry set wraps to A, with both carries
+    make_case(input, 0xCE, 0xFF, 0x0110, 0x0000);
+    assert_agrees(diff, input);
+    assert(*cpu->registers->AF == 0x0130);
+
+    // DAA after 0x15 + 0x27
+    make_case(input, 0x27, 0x00, 0x3C00, 0x0000);
+    assert_agrees(diff, input);
+    assert(*cpu->registers->AF == 0x4200);
+
+    // POP AF drops the low nibble of F
+    make_case(input, 0xF1, 0x00, 0x0000, 0x0000);
+    input[18] = 0xFF;
+    input[19] = 0x12;
+    assert_agrees(diff, input);
+    assert(*cpu->registers->AF == 0x12F0);
+
+    // HALT is not modelled, and is not run
+    make_case(input, 0x76, 0x00, 0x0000, 0x0000);
+    uint64_t skipped = diff->skipped;
+    assert(cpu_diff_run(diff, input, CPU_DIFF_INPUT_SIZE) == 0);
+    assert(diff->skipped == skipped + 1);
+    free_cpu_diff(diff);
+}
+
+void test_cpu_reference_agrees()
+{
+    printf("Testing every opcode against the reference...\n");
+    cpu_diff_t *diff = new_cpu_diff(2);
+    assert(diff != NULL);
+    uint64_t seed = 0x5EED;
+    uint8_t input[CPU_DIFF_INPUT_SIZE];
+    for (int opcode = 0; opcode < 512; opcode++)
+    {
+        for (int round = 0; round < 32; round++)
+        {
+            for (size_t i = 0; i < sizeof(input); i++)
+            {
+                seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+                input[i] = seed >> 56;
+            }
+            // The second half of the opcodes are the CB-prefixed ones
+            input[0] = opcode < 256 ? opcode : 0xCB;
+            if (opcode >= 256)
+            {
+                input[1] = opcode - 256;
+            }
+            assert_agrees(diff, input);
+        }
+    }
+    // STOP, HALT and the 11 unused opcodes
+    assert(diff->skipped == 13 * 32);
+    assert(diff->mismatches == 0);
+    free_cpu_diff(diff);
+}
+
+void test_cpu_reference_reports()
+{
+    printf("Testing differences are reported...\n");
+    cpu_diff_t *diff = new_cpu_diff(3);
+    assert(diff != NULL);
+    uint8_t input[CPU_DIFF_INPUT_SIZE];
+
+    // With a joypad on the bus, LDH (0x00),A no longer lands in memory
+    joypad_t *joypad = new_joypad();
+    assert(joypad != NULL);
+    diff->cpu->joypad = joypad;
+    make_case(input, 0xE0, 0x00, 0x1200, 0x0000);
+    assert(cpu_diff_run(diff, input, CPU_DIFF_INPUT_SIZE) == -1);
+    assert(diff->mismatches == 1);
+    assert(strstr(diff->report, "E0 at 0xC000:") == diff->report);
+    assert(strstr(diff->report, "(0xFF00)") != NULL);
+    assert(strstr(diff->report, "expected 0x12") != NULL);
+
+    // Short inputs are padded with zeros: a NOP at 0x0000
+    diff->cpu->joypad = NULL;
+    assert(cpu_diff_run(diff, input, 0) == 0);
+    assert(diff->cpu->PC == 0x0001);
+    free_joypad(joypad);
+    free_cpu_diff(diff);
+}
+
+// ==================================================================================
+//                                  Main Test Function
+// ==================================================================================
+
+void main_test_cpu_reference()
+{
+    printf("Running CPU reference tests...\n");
+    test_cpu_reference_fixed_cases();
+    test_cpu_reference_agrees();
+    test_cpu_reference_reports();
+    printf("CPU reference tests passed!\n");
+}
@@ -0,0 +1,17 @@
+#ifndef TEST_CPU_REFERENCE_H
+#define TEST_CPU_REFERENCE_H
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "../src/cpu_reference.h"
+
+
+void test_cpu_reference_fixed_cases();
+void test_cpu_reference_agrees();
+void test_cpu_reference_reports();
+
+void main_test_cpu_reference();
+
+
+#endif
@@ -0,0 +1,335 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/emulator.h"
+#include "./test_programs.h"
+
+// ==================================================================================
+//                                  Helpers
+// ==================================================================================
+
+static emulator_t *new_agent_emulator()
+{
+    emulator_t *emulator = new_emulator();
+    assert(emulator != NULL);
+    load_agent_program(emulator->cpu, 0);
+    // A tone, so the state carries APU timing too
+    write_memory(emulator->cpu, NR21_REGISTER, 0x80);
+    write_memory(emulator->cpu, NR22_REGISTER, 0xF0);
+    write_memory(emulator->cpu, NR24_REGISTER, 0x87);
+    return emulator;
+}
+
+// Held buttons for frame `frame` of a scripted session
+static uint8_t scripted_input(int frame)
+{
+    return (frame / 3) % 4 == 1 ? BUTTON_DOWN | BUTTON_LEFT : frame % 7 == 0 ? BUTTON_RIGHT : 0;
+}
+
+// Writes to WRAM, cartridge RAM and HRAM, including through the stack;
+// later passes rewrite some bytes with the value they already hold
+static const uint8_t ram_write_program[] = {
+    0x31, 0xFE, 0xFF,                   // 0100: LD SP,0xFFFE
+    0x21, 0x00, 0xC0,                   // 0103: LD HL,0xC000
+    0x06, 0x40,                         // 0106: LD B,0x40
+    0x78, 0x22,                         // 0108: LD A,B; LD (HL+),A
+    0xCD, 0x20, 0x01,                   // 010A: CALL 0x0120
+    0x05, 0x20, 0xF8,                   // 010D: DEC B; JR NZ,0x0108
+    0x21, 0x10, 0xA0, 0x34,             // 0110: LD HL,0xA010; INC (HL)
+    0x3E, 0x99, 0xE0, 0x90,             // 0114: LD A,0x99; LDH (0x90),A
+    0x18, 0xE9, 0x00, 0x00,             // 0118: JR 0x0103
+    0x00, 0x00, 0x00, 0x00,
+    0x34, 0xC9                          // 0120: INC (HL); RET
+};
+
+// Copies successive bytes from 0x0200 on into tiles 0 and 1, which fill
+// the screen, then into NR21-NR24, with fusable copy and countdown loops;
+// each pass starts at 0x0103
+static const uint8_t fused_copy_program[] = {
+    0x21, 0x00, 0x02,                   // 0100: LD HL,0x0200
+    0x11, 0x00, 0x80,                   // 0103: LD DE,0x8000
+    0x06, 0x20,                         // 0106: LD B,0x20
+    0x2A, 0x12, 0x13,                   // 0108: LD A,(HL+); LD (DE),A; INC DE
+    0x05, 0x20, 0xFA,                   // 010B: DEC B; JR NZ,0x0108
+    0x11, 0x16, 0xFF,                   // 010E: LD DE,NR21
+    0x06, 0x04,                         // 0111: LD B,0x04
+    0x2A, 0x12, 0x13,                   // 0113: LD A,(HL+); LD (DE),A; INC DE
+    0x05, 0x20, 0xFA,                   // 0116: DEC B; JR NZ,0x0113
+    0x18, 0xE8                          // 0119: JR 0x0103
+};
+
+static uint64_t hash_bytes(const void *bytes, size_t size)
+{
+    uint64_t hash = 0xCBF29CE484222325;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ ((const uint8_t *)bytes)[i]) * 0x100000001B3;
+    }
+    return hash;
+}
+
+// Drains the audio ring into a running hash
+static uint64_t drain_audio(emulator_t *emulator, uint64_t hash)
+{
+    int16_t block[256 * 2];
+    size_t count;
+    while ((count = audio_ring_fill(emulator->audio)) > 0)
+    {
+        count = count < 256 ? count : 256;
+        audio_ring_pop(emulator->audio, block, count);
+        hash = hash * 31 + hash_bytes(block, count * 2 * sizeof(int16_t));
+    }
+    return hash;
+}
+
+// ==================================================================================
+//                                  Tests
+// ==================================================================================
+
+void test_state_round_trip()
+{
+    printf("Testing save state round trip...\n");
+    emulator_t *emulator = new_agent_emulator();
+    emulator_state_t *state = new_emulator_state();
+    assert(state != NULL);
+    for (int frame = 0; frame < 10; frame++)
+    {
+        tick_emulator(emulator);
+    }
+    save_emulator_state(emulator, state);
+
+    // The same frames twice from the state, with input queued in between
+    uint64_t frames[2][20], cycles[2];
+    int16_t samples[2][800 * 2];
+    for (int run = 0; run < 2; run++)
+    {
+        if (run == 1)
+        {
+            load_emulator_state(emulator, state);
+        }
+        for (int frame = 0; frame < 20; frame++)
+        {
+            joypad_queue_input(emulator->joypad, emulator->cpu->cycles + 500, scripted_input(frame));
+            tick_emulator(emulator);
+            frames[run][frame] = hash_bytes(emulator->ppu->framebuffer, sizeof(emulator->ppu->framebuffer));
+        }
+        cycles[run] = emulator->cpu->cycles;
+        memset(samples[run], 0, sizeof(samples[run]));
+        apu_read_samples(emulator->apu, emulator->cpu->cycles + 17556, samples[run], 800);
+    }
+    assert(memcmp(frames[0], frames[1], sizeof(frames[0])) == 0);
+    assert(cycles[0] == cycles[1]);
+    assert(memcmp(samples[0], samples[1], sizeof(samples[0])) == 0);
+
+    // A state loads into another emulator as well
+    emulator_t *other = new_emulator();
+    assert(other != NULL);
+    load_emulator_state(other, state);
+    assert(other->cpu->PC == state->cpu.PC && *other->cpu->registers->HL == state->register_file[3]);
+    assert(other->ppu->vram == other->cpu->memorybus + 0x8000);
+    tick_emulator(other);
+    load_emulator_state(emulator, state);
+    tick_emulator(emulator);
+    assert(memcmp(other->ppu->framebuffer, emulator->ppu->framebuffer, sizeof(emulator->ppu->framebuffer)) == 0);
+
+    free_emulator(other);
+    free_emulator_state(state);
+    free_emulator(emulator);
+}
+
+void test_run_ahead_presents_future_frames()
+{
+    printf("Testing run-ahead...\n");
+    const int frames = 30;
+    for (uint32_t ahead = 1; ahead <= 3; ahead++)
+    {
+        // Reference: every frame rendered, no run-ahead, one tick per frame
+        emulator_t *reference = new_agent_emulator();
+        emulator_t *emulator = new_agent_emulator();
+        assert(set_run_ahead(emulator, ahead) == 0);
+        uint64_t shown[frames + 3], shown_ids[frames + 3];
+        uint64_t real_cycles[frames], real_audio[frames];
+        uint8_t real_counter[frames];
+        uint64_t audio = 0;
+        for (int frame = 0; frame < frames + (int)ahead; frame++)
+        {
+            joypad_set_buttons(reference->joypad, scripted_input(frame));
+            tick_emulator(reference);
+            uint64_t id;
+            const uint8_t *pixels = triple_buffer_acquire(reference->frames, &id);
+            shown[frame] = hash_bytes(pixels, SCREEN_WIDTH * SCREEN_HEIGHT);
+            shown_ids[frame] = id;
+            if (frame < frames)
+            {
+                real_cycles[frame] = reference->cpu->cycles;
+                real_counter[frame] = reference->cpu->memorybus[0xC000];
+                real_audio[frame] = audio = drain_audio(reference, audio);
+            }
+        }
+
+        // Input held for the speculative frames is the current input, so the
+        // future frame matches the reference when the input stays the same
+        audio = 0;
+        for (int frame = 0; frame < frames; frame++)
+        {
+            joypad_set_buttons(emulator->joypad, scripted_input(frame));
+            tick_emulator(emulator);
+            assert(emulator->cpu->cycles == real_cycles[frame]);
+            assert(emulator->cpu->memorybus[0xC000] == real_counter[frame]);
+            // The real frame's sound is kept, the speculative frames' dropped
+            audio = drain_audio(emulator, audio);
+            assert(audio == real_audio[frame]);
+            bool steady = true;
+            for (uint32_t i = 1; i <= ahead; i++)
+            {
+                steady = steady && scripted_input(frame + i) == scripted_input(frame);
+            }
+            uint64_t id;
+            const uint8_t *pixels = triple_buffer_acquire(emulator->frames, &id);
+            assert(pixels != NULL && id == shown_ids[frame + ahead]);
+            if (steady)
+            {
+                assert(hash_bytes(pixels, SCREEN_WIDTH * SCREEN_HEIGHT) == shown[frame + ahead]);
+            }
+        }
+        free_emulator(reference);
+        free_emulator(emulator);
+    }
+}
+
+void test_fusion_keeps_bus_timing()
+{
+    printf("Testing fused instructions against lazy PPU and APU writes...\n");
+    uint64_t hashes[2];
+    const unsigned int fusion[2] = {FUSE_NONE, FUSE_ALL};
+    for (int i = 0; i < 2; i++)
+    {
+        emulator_t *emulator = new_emulator();
+        assert(emulator != NULL);
+        cpu_t *cpu = emulator->cpu;
+        for (int address = 0x0200; address < 0x8000; address++)
+        {
+            cpu->memorybus[address] = (uint8_t)(address * 73 + (address >> 8));
+        }
+        memcpy(&cpu->memorybus[0x0100], fused_copy_program, sizeof(fused_copy_program));
+        cpu->PC = 0x0100;
+        cpu->fusion = fusion[i];
+
+        // Frames end mid-idiom when fused, so both runs stop between passes
+        // instead, at the same cycles, and hash every frame and sample
+        uint64_t hash = 0, frame = 0;
+        int16_t samples[512 * 2];
+        size_t count;
+        for (int pass = 0; pass < 500; pass++)
+        {
+            do
+            {
+                execute_next_instruction(cpu);
+            } while (cpu->PC != 0x0103);
+            ppu_catch_up(emulator->ppu, cpu->cycles);
+            if (emulator->ppu->frame_count != frame)
+            {
+                frame = emulator->ppu->frame_count;
+                hash = hash * 31 + hash_bytes(emulator->ppu->framebuffer, sizeof(emulator->ppu->framebuffer));
+            }
+            while ((count = apu_read_samples(emulator->apu, cpu->cycles, samples, 512)) > 0)
+            {
+                hash = hash * 31 + hash_bytes(samples, count * 2 * sizeof(int16_t));
+            }
+        }
+        assert(frame >= 8);
+        hashes[i] = hash;
+        free_emulator(emulator);
+    }
+    // Every store lands on the same cycle, so the same pixels and samples come out
+    assert(hashes[1] == hashes[0]);
+}
+
+void test_ram_hash_matches_recompute()
+{
+    printf("Testing the incremental RAM hash...\n");
+    emulator_t *emulator = new_emulator();
+    assert(emulator != NULL);
+    cpu_t *cpu = emulator->cpu;
+    uint64_t initial = cpu->ram_hash;
+    assert(initial == compute_ram_hash(cpu));
+    memcpy(&cpu->memorybus[0x0100], ram_write_program, sizeof(ram_write_program));
+    cpu->PC = 0x0100;
+    for (int i = 0; i < 5000; i++)
+    {
+        execute_next_instruction(cpu);
+        assert(cpu->ram_hash == compute_ram_hash(cpu));
+    }
+    assert(cpu->ram_hash != initial);
+
+    // Order does not matter: putting every byte back gives the initial hash
+    for (uint32_t address = RAM_HASH_START; address < RAM_HASH_END; address++)
+    {
+        write_memory(cpu, address, 0);
+    }
+    for (uint32_t address = HRAM_HASH_START; address < HRAM_HASH_END; address++)
+    {
+        write_memory(cpu, address, 0);
+    }
+    assert(cpu->ram_hash == initial);
+
+    // Save states carry the hash
+    cpu->PC = 0x0100;
+    for (int i = 0; i < 1000; i++)
+    {
+        execute_next_instruction(cpu);
+    }
+    emulator_state_t *state = new_emulator_state();
+    assert(state != NULL);
+    save_emulator_state(emulator, state);
+    uint64_t saved = cpu->ram_hash;
+    for (int i = 0; i < 1000; i++)
+    {
+        execute_next_instruction(cpu);
+    }
+    assert(cpu->ram_hash != saved);
+    load_emulator_state(emulator, state);
+    assert(cpu->ram_hash == saved && saved == compute_ram_hash(cpu));
+
+    // Writes that bypass write_memory, or happen with hashing off, need a rehash
+    cpu->memorybus[0xC123] ^= 0xFF;
+    assert(cpu->ram_hash != compute_ram_hash(cpu));
+    rehash_ram(cpu);
+    assert(cpu->ram_hash == compute_ram_hash(cpu));
+    uint64_t before = cpu->ram_hash;
+    cpu->ram_hashing = false;
+    write_memory(cpu, 0xFF90, 0x42);
+    write_memory(cpu, 0xDFFF, 0x42);
+    assert(cpu->ram_hash == before && before != compute_ram_hash(cpu));
+    cpu->ram_hashing = true;
+    rehash_ram(cpu);
+    assert(cpu->ram_hash == compute_ram_hash(cpu));
+
+    // Neighbouring regions are not hashed
+    uint64_t hash = cpu->ram_hash;
+    write_memory(cpu, 0x9FFF, 0x11);
+    write_memory(cpu, 0xE000, 0x11);
+    write_memory(cpu, 0xFFFF, 0x11);
+    assert(cpu->ram_hash == hash);
+
+    free_emulator_state(state);
+    free_emulator(emulator);
+}
+
+
+// ==================================================================================
+//                                  Main Test Function
+// ==================================================================================
+
+
+void main_test_emulator() {
+    printf("Running emulator tests...\n");
+    test_state_round_trip();
+    test_run_ahead_presents_future_frames();
+    test_fusion_keeps_bus_timing();
+    test_ram_hash_matches_recompute();
+    printf("Emulator tests passed!\n");
+}
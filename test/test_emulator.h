@@ -0,0 +1,16 @@
+#ifndef TEST_EMULATOR_H
+#define TEST_EMULATOR_H
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "../src/emulator.h"
+
+
+void test_state_round_trip();
+void test_run_ahead_presents_future_frames();
+
+void main_test_emulator();
+
+
+#endif
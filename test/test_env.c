@@ -0,0 +1,159 @@
+#include <assert.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/env.h"
+#include "./test_programs.h"
+
+// ==================================================================================
+//                                  Tests
+// ==================================================================================
+
+void test_env_observation()
+{
+    printf("Testing environment observations...\n");
+    const uint32_t scales[] = {1, 2, 4, 8};
+    for (size_t i = 0; i < sizeof(scales) / sizeof(scales[0]); i++)
+    {
+        env_t *env = new_agent_env(scales[i]);
+        uint32_t scale = scales[i];
+        assert(env->obs_width == SCREEN_WIDTH / scale && env->obs_height == SCREEN_HEIGHT / scale);
+        assert(env_obs_size(env) == env->obs_width * env->obs_height);
+        uint8_t *obs = malloc(env_obs_size(env) + 1);
+        assert(obs != NULL);
+        obs[env_obs_size(env)] = 0xA5;
+        env_step(env, 0, 3, obs, NULL);
+        assert(obs[env_obs_size(env)] == 0xA5);
+
+        // Box average of the frame's luma, rounded
+        const uint8_t luma[4] = {0xFF, 0xAA, 0x55, 0x00};
+        uint8_t (*frame)[SCREEN_WIDTH] = env->emulator->ppu->framebuffer;
+        bool varied = false;
+        for (uint32_t y = 0; y < env->obs_height; y++)
+        {
+            for (uint32_t x = 0; x < env->obs_width; x++)
+            {
+                uint32_t sum = 0;
+                for (uint32_t dy = 0; dy < scale; dy++)
+                {
+                    for (uint32_t dx = 0; dx < scale; dx++)
+                    {
+                        sum += luma[frame[y * scale + dy][x * scale + dx]];
+                    }
+                }
+                assert(obs[y * env->obs_width + x] == (sum + scale * scale / 2) / (scale * scale));
+                varied = varied || obs[y * env->obs_width + x] != obs[0];
+            }
+        }
+        assert(varied);
+        free(obs);
+        free_env(env);
+    }
+}
+
+void test_env_actions_and_ram()
+{
+    printf("Testing environment actions and RAM...\n");
+    env_t *env = new_agent_env(2);
+    uint8_t ram[3];
+    env_reset(env, NULL, ram);
+    assert(ram[0] == 0);
+    uint8_t scroll = ram[2];
+
+    // The first tick only reaches VBlank, then one frame per tick; with no
+    // button held the lines read 0xF, with DOWN 0x7
+    env_step(env, 0, 4, NULL, ram);
+    assert(ram[0] == 3 && ram[1] == 0xEF && ram[2] == (uint8_t)(scroll - 3 * 15));
+    env_step(env, BUTTON_DOWN | BUTTON_A, 2, NULL, ram);
+    assert(ram[0] == 5 && ram[1] == 0xE7 && ram[2] == (uint8_t)(scroll - 3 * 15 - 2 * 7));
+    assert(env->emulator->cpu->memorybus[IF_REGISTER] & JOYPAD_INTERRUPT);
+    env_step(env, 0, 1, NULL, ram);
+    assert(ram[0] == 6 && ram[1] == 0xEF && ram[2] == (uint8_t)(scroll - 3 * 15 - 2 * 7 - 15));
+    assert(env->steps == 3);
+
+    uint16_t too_many[ENV_MAX_RAM_BYTES + 1] = {0};
+    assert(env_set_ram_addresses(env, too_many, ENV_MAX_RAM_BYTES + 1) == -1);
+    free_env(env);
+}
+
+void test_env_ram_has_no_side_effects()
+{
+    printf("Testing environment RAM reads without side effects...\n");
+    env_t *env = new_agent_env(2);
+    emulator_t *emulator = env->emulator;
+    const uint16_t addresses[] = {JOYPAD_REGISTER, LY_REGISTER, STAT_REGISTER, NR52_REGISTER, 0xC000};
+    assert(env_set_ram_addresses(env, addresses, 5) == 0);
+    env_step(env, 0, 2, NULL, NULL);
+
+    // Observed lines ahead of what the PPU and APU have run: reading them must
+    // not catch either up, nor count as the program polling P1
+    emulator->cpu->cycles += 3 * CYCLES_PER_LINE;
+    uint64_t polls = emulator->joypad->polls;
+    uint64_t next_line_cycle = emulator->ppu->next_line_cycle;
+    uint64_t apu_time = emulator->apu->time;
+    uint8_t ram[5];
+    env_step(env, 0, 0, NULL, ram);
+    assert(emulator->joypad->polls == polls);
+    assert(emulator->ppu->next_line_cycle == next_line_cycle);
+    assert(emulator->apu->time == apu_time);
+    assert(ram[0] == 0xEF);
+    assert(ram[1] == ppu_ly(emulator->ppu, emulator->cpu->cycles));
+    assert(ram[4] == emulator->cpu->memorybus[0xC000]);
+    free_env(env);
+}
+
+void test_env_reset_is_deterministic()
+{
+    printf("Testing environment reset to snapshot...\n");
+    env_t *env = new_agent_env(2);
+    size_t size = env_obs_size(env);
+    uint8_t *obs = malloc(size * 2);
+    uint8_t *reset_obs = malloc(size);
+    uint8_t ram[2][3];
+    assert(obs != NULL && reset_obs != NULL);
+
+    // Two episodes of the same actions see the same observations
+    uint64_t hashes[2] = {0, 0};
+    for (int episode = 0; episode < 2; episode++)
+    {
+        env_reset(env, reset_obs, ram[episode]);
+        assert(env->steps == 0);
+        struct mallinfo2 before = mallinfo2();
+        for (int step = 0; step < 50; step++)
+        {
+            env_step(env, (uint8_t)(step * 29), 1 + step % 4, obs + episode * size, ram[episode]);
+            for (size_t i = 0; i < size; i++)
+            {
+                hashes[episode] = hashes[episode] * 131 + obs[episode * size + i];
+            }
+            hashes[episode] = hashes[episode] * 131 + ram[episode][0] + (ram[episode][2] << 8);
+        }
+        // Steps do not allocate
+        struct mallinfo2 after = mallinfo2();
+        assert(after.uordblks == before.uordblks);
+    }
+    assert(hashes[0] == hashes[1]);
+    assert(memcmp(obs, obs + size, size) == 0 && memcmp(ram[0], ram[1], 3) == 0);
+
+    free(obs);
+    free(reset_obs);
+    free_env(env);
+}
+
+
+// ==================================================================================
+//                                  Main Test Function
+// ==================================================================================
+
+
+void main_test_env() {
+    printf("Running environment tests...\n");
+    test_env_observation();
+    test_env_actions_and_ram();
+    test_env_ram_has_no_side_effects();
+    test_env_reset_is_deterministic();
+    printf("Environment tests passed!\n");
+}
@@ -0,0 +1,17 @@
+#ifndef TEST_ENV_H
+#define TEST_ENV_H
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "../src/env.h"
+
+
+void test_env_observation();
+void test_env_actions_and_ram();
+void test_env_reset_is_deterministic();
+
+void main_test_env();
+
+
+#endif
@@ -0,0 +1,220 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <dirent.h>
+#include <sys/wait.h>
+
+#include "../src/fuzzer.h"
+
+// ==================================================================================
+//                                  Helpers
+// ==================================================================================
+
+// Each frame counts in WRAM and reads the directions. RIGHT, LEFT, UP on
+// successive frames lead to a last frame where RIGHT crashes and LEFT locks up.
+static const uint8_t locking_program[] = {
+    0xCD, 0x50, 0x01,       // 0100: CALL frame
+    0xFE, 0xEE, 0x20, 0xF9, // 0103: CP RIGHT; JR NZ,0x0100
+    0xCD, 0x50, 0x01,       // 0107: CALL frame
+    0xFE, 0xED, 0x20, 0xF2, // 010A: CP LEFT; JR NZ,0x0100
+    0xCD, 0x50, 0x01,       // 010E: CALL frame
+    0xFE, 0xEB, 0x20, 0xEB, // 0111: CP UP; JR NZ,0x0100
+    0xCD, 0x50, 0x01,       // 0115: CALL frame
+    0xFE, 0xEE, 0x28, 0x07, // 0118: CP RIGHT; JR Z,0x0123
+    0xFE, 0xED, 0x28, 0x08, // 011C: CP LEFT; JR Z,0x0128
+    0xC3, 0x00, 0x01,       // 0120: JP 0x0100
+    0xD3, 0x00, 0x00, 0x00, // 0123: invalid instruction
+    0x00,
+    0xF3, 0x18, 0xFE        // 0128: DI; JR 0x0129
+};
+
+static const uint8_t frame_routine[] = {
+    0xFA, 0x00, 0xC0,                   // 0150: LD A,(0xC000)
+    0x3C,                               // 0153: INC A
+    0xEA, 0x00, 0xC0,                   // 0154: LD (0xC000),A
+    0xF0, 0x44, 0xFE, 0x90, 0x20, 0xFA, // 0157: wait for LY 0x90
+    0xF0, 0x44, 0xFE, 0x91, 0x20, 0xFA, // 015D: wait for LY 0x91
+    0xF0, 0x00,                         // 0163: LDH A,(P1)
+    0xC9                                // 0165: RET
+};
+
+// The start state of locking_program, where the crash is a jump back to
+// the start unless `crashing`
+static emulator_state_t *new_locking_state(bool crashing)
+{
+    emulator_t *emulator = new_emulator();
+    emulator_state_t *state = new_emulator_state();
+    assert(emulator != NULL && state != NULL);
+    cpu_t *cpu = emulator->cpu;
+    memcpy(&cpu->memorybus[0x0100], locking_program, sizeof(locking_program));
+    memcpy(&cpu->memorybus[0x0150], frame_routine, sizeof(frame_routine));
+    if (!crashing)
+    {
+        memcpy(&cpu->memorybus[0x0123], (const uint8_t[]){0xC3, 0x00, 0x01}, 3);
+    }
+    cpu->PC = 0x0100;
+    cpu->SP = 0xFFFE;
+    write_memory(cpu, JOYPAD_REGISTER, 0x20);
+    save_emulator_state(emulator, state);
+    free_emulator(emulator);
+    return state;
+}
+
+static fuzzer_t *new_test_fuzzer(const char *directory, const emulator_state_t *state)
+{
+    fuzzer_t *fuzzer = new_fuzzer(directory, state, 2);
+    assert(fuzzer != NULL);
+    fuzzer->frames_per_step = 1;
+    fuzzer->max_steps = 32;
+    fuzzer->hang_steps = 16;
+    return fuzzer;
+}
+
+static uint32_t count_files(const char *directory, const char *name)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", directory, name);
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+    {
+        return 0;
+    }
+    uint32_t count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        count += entry->d_name[0] != '.';
+    }
+    closedir(dir);
+    return count;
+}
+
+// The first input found in `directory`/`name`
+static uint32_t read_first_input(const char *directory, const char *name, uint8_t *buttons)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", directory, name);
+    DIR *dir = opendir(path);
+    assert(dir != NULL);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && entry->d_name[0] == '.')
+    {
+    }
+    assert(entry != NULL);
+    snprintf(path, sizeof(path), "%s/%s/%s", directory, name, entry->d_name);
+    closedir(dir);
+    FILE *file = fopen(path, "rb");
+    assert(file != NULL);
+    uint32_t length = fread(buttons, 1, FUZZ_MAX_STEPS, file);
+    fclose(file);
+    return length;
+}
+
+static int remove_entry(const char *path, const struct stat *status, int flag, struct FTW *ftw)
+{
+    (void)status;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+static void remove_directory(const char *directory)
+{
+    nftw(directory, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// ==================================================================================
+//                                  Tests
+// ==================================================================================
+
+void test_fuzzer_finds_hangs()
+{
+    printf("Testing fuzzing for soft-locks...\n");
+    char directory[] = "/tmp/gameboy_fuzz_XXXXXX";
+    assert(mkdtemp(directory) != NULL);
+    emulator_state_t *state = new_locking_state(false);
+    fuzzer_t *fuzzer = new_test_fuzzer(directory, state);
+
+    for (int i = 0; i < 500 && fuzzer->hangs == 0; i++)
+    {
+        fuzzer_fuzz_one(fuzzer);
+    }
+    assert(fuzzer->hangs > 0);
+    assert(fuzzer->execs > fuzzer->corpus_count);
+    // Every stage made it into the corpus, each of its inputs into the queue
+    assert(fuzzer->total->rom[0x0115 >> 3] & (1 << (0x0115 & 7)));
+    assert(fuzzer->corpus_count > 3);
+    assert(count_files(directory, "queue-00") == fuzzer->corpus_count);
+    assert(count_files(directory, "hangs") == fuzzer->hangs);
+
+    // The saved hang locks up again from the start
+    uint8_t buttons[FUZZ_MAX_STEPS];
+    uint32_t length = read_first_input(directory, "hangs", buttons);
+    assert(length > 3 && length <= 32);
+    assert((buttons[length - 1 - fuzzer->hang_steps] & 0x0F) == BUTTON_LEFT);
+
+    // A new fuzzer on the directory resumes with the same corpus
+    fuzzer_t *resumed = new_test_fuzzer(directory, state);
+    assert(fuzzer_sync(resumed) == fuzzer->corpus_count);
+    assert(coverage_count_edges(resumed->total) == coverage_count_edges(fuzzer->total));
+    assert(fuzzer_sync(resumed) == 0);
+    assert(fuzzer_add_seed(resumed, buttons, length) == -1);
+
+    free_fuzzer(resumed);
+    free_fuzzer(fuzzer);
+    free_emulator_state(state);
+    remove_directory(directory);
+}
+
+void test_fuzzer_instances()
+{
+    printf("Testing fuzzing instances...\n");
+    char directory[] = "/tmp/gameboy_fuzz_XXXXXX";
+    assert(mkdtemp(directory) != NULL);
+    emulator_state_t *state = new_locking_state(true);
+    fuzzer_t *fuzzer = new_test_fuzzer(directory, state);
+
+    assert(fuzzer_run(fuzzer, 2, 4000) == 0);
+    assert(fuzzer->execs >= 2 * 4000);
+    assert(fuzzer->crashes > 0 && fuzzer->hangs > 0);
+    assert(count_files(directory, "crashes") > 0);
+    assert(count_files(directory, "queue-00") > 0 && count_files(directory, "queue-01") > 0);
+
+    // The saved crash brings a process down again
+    uint8_t buttons[FUZZ_MAX_STEPS];
+    uint32_t length = read_first_input(directory, "crashes", buttons);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0)
+    {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDERR_FILENO);
+        fuzzer_add_seed(fuzzer, buttons, length);
+        _exit(0);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(!WIFEXITED(status) || WEXITSTATUS(status) != 0);
+
+    free_fuzzer(fuzzer);
+    free_emulator_state(state);
+    remove_directory(directory);
+}
+
+// ==================================================================================
+//                                  Main Test Function
+// ==================================================================================
+
+void main_test_fuzzer()
+{
+    printf("Running fuzzer tests...\n");
+    test_fuzzer_finds_hangs();
+    test_fuzzer_instances();
+    printf("Fuzzer tests passed!\n");
+}
@@ -0,0 +1,16 @@
+#ifndef TEST_FUZZER_H
+#define TEST_FUZZER_H
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "../src/fuzzer.h"
+
+
+void test_fuzzer_finds_hangs();
+void test_fuzzer_instances();
+
+void main_test_fuzzer();
+
+
+#endif
@@ -0,0 +1,238 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/joypad.h"
+#include "../src/emulator.h"
+
+// ==================================================================================
+//                                  Helpers
+// ==================================================================================
+
+// An emulator running `program` from 0x0100 with P1 selecting the directions
+static emulator_t *new_polling_emulator(const uint8_t *program, size_t size)
+{
+    emulator_t *emulator = new_emulator();
+    assert(emulator != NULL);
+    memcpy(&emulator->cpu->memorybus[0x0100], program, size);
+    emulator->cpu->PC = 0x0100;
+    write_memory(emulator->cpu, JOYPAD_REGISTER, 0x20);
+    emulator->cpu->memorybus[IF_REGISTER] = 0;
+    return emulator;
+}
+
+// ==================================================================================
+//                                  Tests
+// ==================================================================================
+
+void test_joypad_register()
+{
+    printf("Testing the P1 register...\n");
+    cpu_t *cpu = new_cpu();
+    joypad_t *joypad = new_joypad();
+    assert(cpu != NULL && joypad != NULL);
+    cpu->joypad = joypad;
+
+    // Nothing selected: all lines high
+    assert(read_memory(cpu, JOYPAD_REGISTER) == 0xFF);
+    assert(!joypad_set_buttons(joypad, BUTTON_RIGHT | BUTTON_START));
+    assert(read_memory(cpu, JOYPAD_REGISTER) == 0xFF);
+
+    // Selecting a group with a held button pulls its line low and interrupts
+    write_memory(cpu, JOYPAD_REGISTER, 0x2F);
+    assert(read_memory(cpu, JOYPAD_REGISTER) == 0xEE);
+    assert(cpu->memorybus[IF_REGISTER] & JOYPAD_INTERRUPT);
+    cpu->memorybus[IF_REGISTER] = 0;
+    write_memory(cpu, JOYPAD_REGISTER, 0x10);
+    assert(read_memory(cpu, JOYPAD_REGISTER) == 0xD7);
+    assert(cpu->memorybus[IF_REGISTER] & JOYPAD_INTERRUPT);
+    write_memory(cpu, JOYPAD_REGISTER, 0x00);
+    assert(read_memory(cpu, JOYPAD_REGISTER) == 0xC6);
+
+    // Only high to low transitions interrupt
+    assert(!joypad_set_buttons(joypad, BUTTON_RIGHT));
+    assert(joypad_set_buttons(joypad, BUTTON_RIGHT | BUTTON_DOWN));
+    assert(!joypad_set_buttons(joypad, BUTTON_DOWN | BUTTON_START));   // RIGHT and START share line 0
+
+    free_joypad(joypad);
+    free_cpu(cpu);
+}
+
+void test_joypad_queue_order()
+{
+    printf("Testing the joypad input queue...\n");
+    joypad_t *joypad = new_joypad();
+    assert(joypad != NULL);
+    joypad_write_register(joypad, 0x20);
+    assert(joypad_next_event(joypad) == UINT64_MAX);
+
+    // Out of order events are sorted, equal cycles keep their order
+    assert(joypad_queue_input(joypad, 300, BUTTON_UP));
+    assert(joypad_queue_input(joypad, 100, BUTTON_LEFT));
+    assert(joypad_queue_input(joypad, 300, BUTTON_DOWN));
+    assert(joypad_queue_input(joypad, 200, 0));
+    assert(joypad_next_event(joypad) == 100);
+
+    assert(!joypad_apply_events(joypad, 99));
+    assert(joypad->buttons == 0);
+    assert(joypad_apply_events(joypad, 150));
+    assert(joypad->buttons == BUTTON_LEFT && joypad_next_event(joypad) == 200);
+    assert(!joypad_apply_events(joypad, 200));
+    assert(joypad->buttons == 0);
+    assert(joypad_apply_events(joypad, 1000));
+    assert(joypad->buttons == BUTTON_DOWN && joypad_next_event(joypad) == UINT64_MAX);
+
+    // A full queue refuses events and counts them, wrapping around the ring
+    for (int i = 0; i < JOYPAD_QUEUE_EVENTS; i++)
+    {
+        assert(joypad_queue_input(joypad, 2000 + i, i & 0xFF));
+    }
+    assert(!joypad_queue_input(joypad, 5000, 0));
+    assert(joypad->dropped == 1);
+    joypad_apply_events(joypad, 2000 + JOYPAD_QUEUE_EVENTS - 1);
+    assert(joypad->buttons == ((JOYPAD_QUEUE_EVENTS - 1) & 0xFF) && joypad->count == 0);
+    free_joypad(joypad);
+}
+
+void test_input_applied_at_exact_cycle()
+{
+    printf("Testing input applied at an exact cycle...\n");
+    // 0x0100: LDH A,(0x00); LD (HL+),A; JR -5. 8 M-cycles per iteration, one P1 sample each
+    const uint8_t program[] = {0xF0, 0x00, 0x22, 0x18, 0xFB};
+    emulator_t *emulator = new_polling_emulator(program, sizeof(program));
+    cpu_t *cpu = emulator->cpu;
+    *cpu->registers->HL = 0xC000;
+    uint64_t start = cpu->cycles;
+
+    // Mid-frame, and on a cycle that is not an instruction boundary
+    const uint64_t press = start + 5003, release = start + 9000;
+    assert(joypad_queue_input(emulator->joypad, press, BUTTON_RIGHT | BUTTON_A));
+    assert(joypad_queue_input(emulator->joypad, release, 0));
+    tick_emulator(emulator);
+    assert(cpu->cycles - start < 8192 * 8);
+
+    // The read of iteration i starts at start + 8i and sees what is due by then
+    int iterations = (*cpu->registers->HL - 0xC000);
+    assert(iterations > 1200);
+    for (int i = 0; i < iterations; i++)
+    {
+        uint64_t read_cycle = start + 8 * (uint64_t)i;
+        uint8_t expected = read_cycle >= press && read_cycle < release ? 0xEE : 0xEF;
+        assert(cpu->memorybus[0xC000 + i] == expected);
+    }
+    assert(cpu->memorybus[IF_REGISTER] & JOYPAD_INTERRUPT);
+    free_emulator(emulator);
+
+    // A button outside the selected group changes nothing
+    emulator = new_polling_emulator(program, sizeof(program));
+    *emulator->cpu->registers->HL = 0xC000;
+    joypad_queue_input(emulator->joypad, emulator->cpu->cycles + 100, BUTTON_START);
+    tick_emulator(emulator);
+    assert(emulator->cpu->memorybus[0xC000 + 100] == 0xEF);
+    assert(!(emulator->cpu->memorybus[IF_REGISTER] & JOYPAD_INTERRUPT));
+    free_emulator(emulator);
+}
+
+void test_idle_poll_wakes_on_input()
+{
+    printf("Testing idle P1 polling wakes on queued input...\n");
+    // 0x0100: LDH A,(0x00); AND 0x01; JR NZ,-6, waiting for RIGHT (7 M-cycles)
+    // 0x0106: LD (HL+),A; JR -3, counting 5 M-cycle iterations from the exit
+    const uint8_t program[] = {0xF0, 0x00, 0xE6, 0x01, 0x20, 0xFA, 0x22, 0x18, 0xFD};
+    uint16_t counted[2];
+    for (int skip = 0; skip < 2; skip++)
+    {
+        emulator_t *emulator = new_polling_emulator(program, sizeof(program));
+        cpu_t *cpu = emulator->cpu;
+        cpu->idle_skip = skip;
+        *cpu->registers->HL = 0xC000;
+        const uint64_t press = cpu->cycles + 12345;
+        joypad_queue_input(emulator->joypad, press, BUTTON_RIGHT);
+        tick_emulator(emulator);
+
+        // The first poll at or after the press ends the wait
+        counted[skip] = *cpu->registers->HL - 0xC000;
+        uint64_t exit = cpu->cycles - 5 * (uint64_t)counted[skip];
+        assert(exit > press && exit <= press + 7 + 5);
+        free_emulator(emulator);
+    }
+    // Skipping the idle polls does not move the input by a cycle
+    assert(counted[0] == counted[1]);
+}
+
+void test_idle_loop_reentered()
+{
+    printf("Testing an idle P1 loop entered twice...\n");
+    // 0x0100: LDH A,(0x00); AND 0x01; JR NZ,-6, waiting for RIGHT
+    // 0x0106: 100 x INC (HL), then JP 0x0100 back into the same wait
+    uint8_t program[0x0106 - 0x0100 + 100 + 3] = {0xF0, 0x00, 0xE6, 0x01, 0x20, 0xFA};
+    memset(&program[6], 0x34, 100);
+    program[106] = 0xC3; program[107] = 0x00; program[108] = 0x01;
+    uint64_t cycles[2];
+    uint8_t counted[2];
+    for (int skip = 0; skip < 2; skip++)
+    {
+        emulator_t *emulator = new_polling_emulator(program, sizeof(program));
+        cpu_t *cpu = emulator->cpu;
+        cpu->idle_skip = skip;
+        *cpu->registers->HL = 0xC000;
+        uint64_t start = cpu->cycles;
+        joypad_queue_input(emulator->joypad, start + 1000, BUTTON_RIGHT);
+        joypad_queue_input(emulator->joypad, start + 1010, 0);
+        joypad_queue_input(emulator->joypad, start + 3001, BUTTON_RIGHT);
+        joypad_queue_input(emulator->joypad, start + 3011, 0);
+        tick_emulator(emulator);
+        cycles[skip] = cpu->cycles;
+        counted[skip] = cpu->memorybus[0xC000];
+        free_emulator(emulator);
+    }
+    // Both presses are seen, the second after the loop was left and re-entered
+    assert(counted[0] == 200);
+    assert(counted[1] == counted[0]);
+    assert(cycles[1] == cycles[0]);
+}
+
+void test_idle_poll_event_mid_iteration()
+{
+    printf("Testing an input event in the middle of an idle iteration...\n");
+    // 0x0100: NOP; LDH A,(0x00); AND 0x01; JR NZ,-7, waiting for RIGHT (9 M-cycles, P1 read 1 in)
+    // 0x0107: LD (HL+),A; JR -3, counting 5 M-cycle iterations from the exit
+    const uint8_t program[] = {0x00, 0xF0, 0x00, 0xE6, 0x01, 0x20, 0xF9, 0x22, 0x18, 0xFD};
+    uint64_t cycles[2];
+    uint16_t counted[2];
+    for (int skip = 0; skip < 2; skip++)
+    {
+        emulator_t *emulator = new_polling_emulator(program, sizeof(program));
+        cpu_t *cpu = emulator->cpu;
+        cpu->idle_skip = skip;
+        *cpu->registers->HL = 0xC000;
+        uint64_t start = cpu->cycles;
+        // Due after the head of an iteration but before its P1 read
+        joypad_queue_input(emulator->joypad, start + 9 * 100 + 1, BUTTON_RIGHT);
+        tick_emulator(emulator);
+        cycles[skip] = cpu->cycles;
+        counted[skip] = *cpu->registers->HL - 0xC000;
+        free_emulator(emulator);
+    }
+    assert(counted[1] == counted[0]);
+    assert(cycles[1] == cycles[0]);
+}
+
+
+// ==================================================================================
+//                                  Main Test Function
+// ==================================================================================
+
+
+void main_test_joypad() {
+    printf("Running joypad tests...\n");
+    test_joypad_register();
+    test_joypad_queue_order();
+    test_input_applied_at_exact_cycle();
+    test_idle_poll_wakes_on_input();
+    test_idle_loop_reentered();
+    test_idle_poll_event_mid_iteration();
+    printf("Joypad tests passed!\n");
+}
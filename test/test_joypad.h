@@ -0,0 +1,18 @@
+#ifndef TEST_JOYPAD_H
+#define TEST_JOYPAD_H
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "../src/joypad.h"
+
+
+void test_joypad_register();
+void test_joypad_queue_order();
+void test_input_applied_at_exact_cycle();
+void test_idle_poll_wakes_on_input();
+
+void main_test_joypad();
+
+
+#endif
@@ -0,0 +1,244 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/lockstep.h"
+
+// ==================================================================================
+//                                  Helpers
+// ==================================================================================
+
+// Per lane: loop (data & 0xF) + 1 times, branch on the data's top bit,
+// update the data through (HL), repeat
+static const uint8_t divergent_program[] = {
+    0x21, 0x00, 0xC0,       // 0100: LD HL,0xC000
+    0x7E, 0x47,             // 0103: LD A,(HL); LD B,A
+    0x0E, 0x0F, 0xA1, 0x57, // 0105: LD C,0x0F; AND C; LD D,A
+    0x14,                   // 0109: INC D
+    0x15, 0x20, 0xFD,       // 010A: DEC D; JR NZ,0x010A
+    0x78, 0xFE, 0x80,       // 010D: LD A,B; CP 0x80
+    0x38, 0x03,             // 0110: JR C,0x0115
+    0x1C, 0x18, 0x01,       // 0112: INC E; JR 0x0116
+    0x1D,                   // 0115: DEC E
+    0x78, 0xD6, 0x25, 0x77, // 0116: LD A,B; SUB 0x25; LD (HL),A
+    0x03, 0x33,             // 011A: INC BC; INC SP
+    0xC3, 0x00, 0x01        // 011C: JP 0x0100
+};
+
+static cpu_t *new_scalar_cpu()
+{
+    cpu_t *cpu = new_cpu();
+    assert(cpu != NULL);
+    cpu->fusion = FUSE_NONE;
+    cpu->idle_skip = false;
+    return cpu;
+}
+
+static void load_program(cpu_t *cpu, const uint8_t *program, size_t size, uint8_t seed)
+{
+    memcpy(&cpu->memorybus[0x0100], program, size);
+    cpu->memorybus[0xC000] = seed;
+    cpu->PC = 0x0100;
+    cpu->SP = 0xFFFE;
+}
+
+static void run_scalar(cpu_t *cpu, uint64_t target)
+{
+    while (cpu->cycles < target)
+    {
+        execute_next_instruction(cpu);
+    }
+}
+
+// Lane `lane` ended exactly where the interpreter on its own did
+static void assert_lane_matches(lockstep_t *lockstep, uint32_t lane, cpu_t *reference)
+{
+    cpu_t *cpu = lockstep->cpus[lane];
+    assert(*cpu->registers->AF == *reference->registers->AF);
+    assert(*cpu->registers->BC == *reference->registers->BC);
+    assert(*cpu->registers->DE == *reference->registers->DE);
+    assert(*cpu->registers->HL == *reference->registers->HL);
+    assert(cpu->PC == reference->PC && cpu->SP == reference->SP);
+    assert(cpu->cycles == reference->cycles);
+    assert(memcmp(cpu->memorybus, reference->memorybus, 0x10000) == 0);
+}
+
+// ==================================================================================
+//                                  Tests
+// ==================================================================================
+
+void test_lockstep_vector_instructions()
+{
+    printf("Testing lockstep vector instructions...\n");
+    // Every opcode with a vector form, then JR to itself
+    uint8_t program[512];
+    size_t size = 0;
+    for (int opcode = 0x40; opcode < 0x80; opcode++)
+    {
+        if ((opcode & 0x07) != 6 && (opcode & 0x38) != 0x30)
+        {
+            program[size++] = opcode;
+        }
+    }
+    for (int r = 0; r < 8; r++)
+    {
+        if (r != 6)
+        {
+            program[size++] = 0x04 | r << 3;
+            program[size++] = 0x05 | r << 3;
+            program[size++] = 0x06 | r << 3;
+            program[size++] = (uint8_t)(r * 0x37 + 0x0F);
+            program[size++] = 0x90 | r;
+            program[size++] = 0xB8 | r;
+            program[size++] = 0xA0 | r;
+            program[size++] = 0x04 | r << 3;
+            program[size++] = 0xD6;
+            program[size++] = (uint8_t)(r * 0x29 + 1);
+            program[size++] = 0xFE;
+            program[size++] = (uint8_t)(r * 0x51);
+        }
+    }
+    const uint8_t pairs[] = {0x03, 0x13, 0x23, 0x33, 0x0B, 0x1B, 0x2B, 0x3B, 0x00};
+    memcpy(program + size, pairs, sizeof(pairs));
+    size += sizeof(pairs);
+    const uint8_t branches[] = {0x20, 0x28, 0x30, 0x38};
+    for (int i = 0; i < 4; i++)
+    {
+        // JR cc to the next instruction either way, then a JP cc likewise
+        uint16_t next = 0x0100 + size + 5;
+        program[size++] = branches[i];
+        program[size++] = 0x00;
+        program[size++] = branches[i] + 0xA2;
+        program[size++] = next & 0xFF;
+        program[size++] = next >> 8;
+        program[size++] = 0x05;
+    }
+    const uint8_t loads[] = {0x01, 0x34, 0x12, 0x11, 0xFF, 0x00, 0x21, 0x00, 0xC0, 0x31, 0xF0, 0xDF, 0x18, 0xFE};
+    memcpy(program + size, loads, sizeof(loads));
+    size += sizeof(loads);
+
+    srand(43);
+    for (int trial = 0; trial < 16; trial++)
+    {
+        uint32_t lanes = trial % 2 ? 16 : 8;
+        lockstep_t *lockstep = new_lockstep(lanes);
+        assert(lockstep != NULL);
+        cpu_t *reference[LOCKSTEP_MAX_LANES];
+        for (uint32_t lane = 0; lane < lanes; lane++)
+        {
+            reference[lane] = new_scalar_cpu();
+            cpu_t *cpus[2] = {lockstep->cpus[lane], reference[lane]};
+            uint16_t registers[4];
+            for (int i = 0; i < 4; i++)
+            {
+                registers[i] = (uint16_t)rand() & (i == 0 ? 0xFFF0 : 0xFFFF);
+            }
+            for (int c = 0; c < 2; c++)
+            {
+                load_program(cpus[c], program, size, 0);
+                *cpus[c]->registers->AF = registers[0];
+                *cpus[c]->registers->BC = registers[1];
+                *cpus[c]->registers->DE = registers[2];
+                *cpus[c]->registers->HL = registers[3];
+            }
+        }
+        lockstep_load_registers(lockstep);
+        lockstep_run(lockstep, 700);
+        lockstep_store_registers(lockstep);
+        assert(lockstep_vector_fraction(lockstep) > 0.95);
+        for (uint32_t lane = 0; lane < lanes; lane++)
+        {
+            run_scalar(reference[lane], 700);
+            assert_lane_matches(lockstep, lane, reference[lane]);
+            free_cpu(reference[lane]);
+        }
+        free_lockstep(lockstep);
+    }
+}
+
+void test_lockstep_divergent_lanes()
+{
+    printf("Testing lockstep divergent lanes...\n");
+    const uint32_t counts[] = {8, 16};
+    for (int c = 0; c < 2; c++)
+    {
+        uint32_t lanes = counts[c];
+        lockstep_t *lockstep = new_lockstep(lanes);
+        assert(lockstep != NULL);
+        cpu_t *reference[LOCKSTEP_MAX_LANES];
+        for (uint32_t lane = 0; lane < lanes; lane++)
+        {
+            uint8_t seed = (uint8_t)(lane * 0x3B + 7);
+            reference[lane] = new_scalar_cpu();
+            load_program(lockstep->cpus[lane], divergent_program, sizeof(divergent_program), seed);
+            load_program(reference[lane], divergent_program, sizeof(divergent_program), seed);
+        }
+        // Lane 1 runs different code at one PC
+        lockstep->cpus[1]->memorybus[0x0112] = 0x1D;
+        reference[1]->memorybus[0x0112] = 0x1D;
+        lockstep_load_registers(lockstep);
+
+        // Several runs, each lane going on from where it stopped
+        uint64_t rounds = 0;
+        for (int run = 1; run <= 5; run++)
+        {
+            rounds += lockstep_run(lockstep, 1000);
+        }
+        lockstep_store_registers(lockstep);
+        for (uint32_t lane = 0; lane < lanes; lane++)
+        {
+            for (int run = 1; run <= 5; run++)
+            {
+                run_scalar(reference[lane], reference[lane]->cycles + 1000);
+            }
+            assert_lane_matches(lockstep, lane, reference[lane]);
+            free_cpu(reference[lane]);
+        }
+        assert(rounds == lockstep->groups);
+        double utilization = lockstep_utilization(lockstep);
+        assert(utilization > 0.3 && utilization < 1.0);
+        assert(lockstep_vector_fraction(lockstep) > 0.5);
+        free_lockstep(lockstep);
+    }
+}
+
+void test_lockstep_converged_lanes()
+{
+    printf("Testing lockstep converged lanes...\n");
+    lockstep_t *lockstep = new_lockstep(16);
+    assert(lockstep != NULL);
+    for (uint32_t lane = 0; lane < 16; lane++)
+    {
+        load_program(lockstep->cpus[lane], divergent_program, sizeof(divergent_program), 0x5A);
+    }
+    lockstep_load_registers(lockstep);
+    lockstep_run(lockstep, 3000);
+
+    // Identical lanes never split; only (HL) accesses run scalar
+    assert(lockstep_utilization(lockstep) == 1.0);
+    assert(lockstep->lane_instructions == lockstep->groups * 16);
+    assert(lockstep_vector_fraction(lockstep) > 0.8 && lockstep_vector_fraction(lockstep) < 1.0);
+    lockstep_store_registers(lockstep);
+    for (uint32_t lane = 1; lane < 16; lane++)
+    {
+        assert(lockstep->cpus[lane]->cycles == lockstep->cpus[0]->cycles);
+        assert(*lockstep->cpus[lane]->registers->DE == *lockstep->cpus[0]->registers->DE);
+    }
+    free_lockstep(lockstep);
+}
+
+
+// ==================================================================================
+//                                  Main Test Function
+// ==================================================================================
+
+
+void main_test_lockstep() {
+    printf("Running lockstep tests...\n");
+    test_lockstep_vector_instructions();
+    test_lockstep_divergent_lanes();
+    test_lockstep_converged_lanes();
+    printf("Lockstep tests passed!\n");
+}
@@ -0,0 +1,17 @@
+#ifndef TEST_LOCKSTEP_H
+#define TEST_LOCKSTEP_H
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "../src/lockstep.h"
+
+
+void test_lockstep_vector_instructions();
+void test_lockstep_divergent_lanes();
+void test_lockstep_converged_lanes();
+
+void main_test_lockstep();
+
+
+#endif
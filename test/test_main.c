@@ -1,8 +1,42 @@
 #include "./test_cpu.h"
+#include "./test_ppu.h"
+#include "./test_apu.h"
+#include "./test_audio_ring.h"
+#include "./test_video.h"
+#include "./test_triple_buffer.h"
+#include "./test_resampler.h"
+#include "./test_capture.h"
+#include "./test_joypad.h"
+#include "./test_emulator.h"
+#include "./test_env.h"
+#include "./test_vec_env.h"
+#include "./test_lockstep.h"
+#include "./test_shm_export.h"
+#include "./test_state_archive.h"
+#include "./test_coverage.h"
+#include "./test_fuzzer.h"
+#include "./test_cpu_reference.h"
 
 int main() {
     main_test_cpu();
     printf("All CPU tests passed!\n");
+    main_test_ppu();
+    main_test_apu();
+    main_test_audio_ring();
+    main_test_video();
+    main_test_triple_buffer();
+    main_test_resampler();
+    main_test_capture();
+    main_test_joypad();
+    main_test_emulator();
+    main_test_env();
+    main_test_vec_env();
+    main_test_lockstep();
+    main_test_shm_export();
+    main_test_state_archive();
+    main_test_coverage();
+    main_test_fuzzer();
+    main_test_cpu_reference();
 
     // If all tests pass
     printf("All tests passed!\n");
@@ -0,0 +1,396 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/emulator.h"
+#include "../src/ppu.h"
+
+// ==================================================================================
+//                                  Helpers
+// ==================================================================================
+
+// Scrolls, changes the palette and writes tile data on every iteration
+static const uint8_t raster_program[] = {
+    0x21, 0x00, 0x80,       // 0100: LD HL,0x8000
+    0x3C,                   // 0103: INC A
+    0xE0, 0x43,             // 0104: LDH (SCX),A
+    0x77,                   // 0106: LD (HL),A
+    0x23,                   // 0107: INC HL
+    0xE0, 0x47,             // 0108: LDH (BGP),A
+    0xC3, 0x03, 0x01        // 010A: JP 0x0103
+};
+
+// Logs and clears IF on every iteration while moving LYC and the STAT selects
+static const uint8_t interrupt_program[] = {
+    0x21, 0x00, 0xC0,       // 0100: LD HL,0xC000
+    0xF0, 0x0F,             // 0103: LDH A,(IF)
+    0x22,                   // 0105: LD (HL+),A
+    0xAF,                   // 0106: XOR A
+    0xE0, 0x0F,             // 0107: LDH (IF),A
+    0x7D,                   // 0109: LD A,L
+    0xE0, 0x45,             // 010A: LDH (LYC),A
+    0xE6, 0x78,             // 010C: AND 0x78
+    0xE0, 0x41,             // 010E: LDH (STAT),A
+    0x7C,                   // 0110: LD A,H
+    0xFE, 0xD0,             // 0111: CP 0xD0
+    0x20, 0xEE,             // 0113: JR NZ,0x0103
+    0x26, 0xC0,             // 0115: LD H,0xC0
+    0x18, 0xEA              // 0117: JR 0x0103
+};
+
+static emulator_t *new_raster_emulator(bool lazy)
+{
+    emulator_t *emulator = new_emulator();
+    assert(emulator != NULL);
+    uint8_t *memory = emulator->cpu->memorybus;
+    for (int i = 0; i < 0x1800; i++)
+    {
+        memory[0x8000 + i] = (uint8_t)(i * 37 + (i >> 4));
+    }
+    for (int i = 0; i < 0x800; i++)
+    {
+        memory[0x9800 + i] = (uint8_t)i;
+    }
+    // A few sprites, some overlapping
+    for (int i = 0; i < 12; i++)
+    {
+        memory[0xFE00 + i * 4] = 16 + i * 6;
+        memory[0xFE00 + i * 4 + 1] = 8 + i * 11;
+        memory[0xFE00 + i * 4 + 2] = i;
+        memory[0xFE00 + i * 4 + 3] = (i & 3) << 5;
+    }
+    for (size_t i = 0; i < sizeof(raster_program); i++)
+    {
+        memory[0x0100 + i] = raster_program[i];
+    }
+    emulator->ppu->LCDC = 0x93 | 0x20;  // LCD, BG, sprites and window on
+    emulator->ppu->WY = 100;
+    emulator->ppu->WX = 87;
+    emulator->ppu->lazy = lazy;
+    emulator->cpu->PC = 0x0100;
+    return emulator;
+}
+
+// Background shade of screen pixel (x, y), decoded straight from VRAM
+static uint8_t reference_bg_shade(ppu_t *ppu, int x, int y)
+{
+    uint8_t bx = x + ppu->SCX;
+    uint8_t by = y + ppu->SCY;
+    uint16_t map = (ppu->LCDC & 0x08) ? 0x1C00 : 0x1800;
+    uint8_t tile = ppu->vram[map + (by / 8) * 32 + bx / 8];
+    uint16_t base = (ppu->LCDC & 0x10) ? tile * 16 : 0x1000 + (int8_t)tile * 16;
+    uint8_t low = ppu->vram[base + (by % 8) * 2];
+    uint8_t high = ppu->vram[base + (by % 8) * 2 + 1];
+    uint8_t colour = (((high >> (7 - bx % 8)) & 1) << 1) | ((low >> (7 - bx % 8)) & 1);
+    return (ppu->BGP >> (colour * 2)) & 0x03;
+}
+
+static void assert_bg_matches_vram(ppu_t *ppu)
+{
+    for (int y = 0; y < SCREEN_HEIGHT; y++)
+    {
+        for (int x = 0; x < SCREEN_WIDTH; x++)
+        {
+            assert(ppu->framebuffer[y][x] == reference_bg_shade(ppu, x, y));
+        }
+    }
+}
+
+// ==================================================================================
+//                                  Tests
+// ==================================================================================
+
+void test_lazy_rendering_matches_eager()
+{
+    printf("Testing lazy rendering against eager rendering...\n");
+    emulator_t *lazy = new_raster_emulator(true);
+    emulator_t *eager = new_raster_emulator(false);
+
+    for (int frame = 0; frame < 3; frame++)
+    {
+        tick_emulator(lazy);
+        tick_emulator(eager);
+        assert(lazy->ppu->frame_count == eager->ppu->frame_count);
+        assert(memcmp(lazy->ppu->framebuffer, eager->ppu->framebuffer,
+                      sizeof(lazy->ppu->framebuffer)) == 0);
+    }
+
+    // The frame must not be uniform, or the comparison proves nothing
+    int shades[4] = {0};
+    for (int y = 0; y < SCREEN_HEIGHT; y++)
+    {
+        for (int x = 0; x < SCREEN_WIDTH; x++)
+        {
+            shades[lazy->ppu->framebuffer[y][x]]++;
+        }
+    }
+    int used = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        used += shades[i] > 0;
+    }
+    assert(used > 1);
+
+    free_emulator(lazy);
+    free_emulator(eager);
+}
+
+void test_tile_cache_follows_vram_writes()
+{
+    printf("Testing the decoded tile cache against VRAM...\n");
+    const uint8_t lcdc[] = {0x91, 0x81};    // Unsigned and signed tile addressing
+    for (size_t mode = 0; mode < sizeof(lcdc); mode++)
+    {
+        emulator_t *emulator = new_raster_emulator(true);
+        cpu_t *cpu = emulator->cpu;
+        ppu_t *ppu = emulator->ppu;
+        ppu->LCDC = lcdc[mode];
+        ppu->BGP = 0xE4;
+        ppu->SCX = 3;
+        ppu->SCY = 250;
+
+        ppu_catch_up(ppu, CYCLES_PER_FRAME);
+        assert_bg_matches_vram(ppu);
+
+        // Rewrite part of the tile data through the bus during VBlank
+        cpu->cycles = CYCLES_PER_FRAME;
+        for (int i = 0; i < 0x1800; i += 3)
+        {
+            write_memory(cpu, 0x8000 + i, (uint8_t)(i * 11 + mode));
+        }
+        ppu_catch_up(ppu, 2 * CYCLES_PER_FRAME);
+        assert_bg_matches_vram(ppu);
+
+        free_emulator(emulator);
+    }
+}
+
+void test_sprite_lines_follow_oam_writes()
+{
+    printf("Testing incremental sprite line lists...\n");
+    // `bus` sees every OAM change through write_memory, `direct` gets the
+    // same bytes behind the PPU's back and has its sprite lists rebuilt
+    emulator_t *bus = new_raster_emulator(true);
+    emulator_t *direct = new_raster_emulator(true);
+    uint32_t seed = 1;
+
+    for (int frame = 0; frame < 4; frame++)
+    {
+        for (int step = 0; step < 200; step++)
+        {
+            seed = seed * 1103515245 + 12345;
+            uint64_t cycle = frame * CYCLES_PER_FRAME + step * (CYCLES_PER_FRAME / 200);
+            uint16_t address = 0xFE00 + (seed >> 8) % 0xA0;
+            uint8_t value = seed >> 20;
+            if (step == 100 && frame % 2 == 1)
+            {
+                // Sprite height switch
+                address = LCDC_REGISTER;
+                value = bus->ppu->LCDC ^ 0x04;
+            }
+            bus->cpu->cycles = cycle;
+            direct->cpu->cycles = cycle;
+            write_memory(bus->cpu, address, value);
+            if (address == LCDC_REGISTER)
+            {
+                write_memory(direct->cpu, address, value);
+            }
+            else
+            {
+                ppu_catch_up(direct->ppu, cycle);
+                direct->cpu->memorybus[address] = value;
+                ppu_invalidate_memory(direct->ppu);
+            }
+        }
+
+        // OAM DMA from WRAM at the end of the frame
+        uint64_t cycle = (frame + 1) * CYCLES_PER_FRAME - 10;
+        for (int i = 0; i < 0xA0; i++)
+        {
+            bus->cpu->memorybus[0xC000 + i] = (uint8_t)(i * 7 + frame * 13);
+        }
+        bus->cpu->cycles = cycle;
+        write_memory(bus->cpu, DMA_REGISTER, 0xC0);
+        ppu_catch_up(direct->ppu, cycle);
+        memcpy(&direct->cpu->memorybus[0xFE00], &bus->cpu->memorybus[0xC000], 0xA0);
+        ppu_invalidate_memory(direct->ppu);
+
+        ppu_catch_up(bus->ppu, (frame + 1) * CYCLES_PER_FRAME);
+        ppu_catch_up(direct->ppu, (frame + 1) * CYCLES_PER_FRAME);
+        assert(memcmp(bus->ppu->framebuffer, direct->ppu->framebuffer,
+                      sizeof(bus->ppu->framebuffer)) == 0);
+    }
+    assert(memcmp(&bus->cpu->memorybus[0xFE00], &bus->cpu->memorybus[0xC000], 0xA0) == 0);
+
+    free_emulator(bus);
+    free_emulator(direct);
+}
+
+void test_sprite_bg_priority()
+{
+    printf("Testing sprite to background priority...\n");
+    emulator_t *emulator = new_emulator();
+    assert(emulator != NULL);
+    ppu_t *ppu = emulator->ppu;
+    uint8_t *memory = emulator->cpu->memorybus;
+    // Tile 1 all colour 3, tile 2 all colour 1, tile 3 all colour 2
+    for (int i = 0; i < 16; i++)
+    {
+        memory[0x8010 + i] = 0xFF;
+        memory[0x8020 + i] = i % 2 == 0 ? 0xFF : 0x00;
+        memory[0x8030 + i] = i % 2 == 0 ? 0x00 : 0xFF;
+    }
+    // Background colour 3 under x 0-15, colour 0 from x 16 on
+    memory[0x9800] = 1;
+    memory[0x9801] = 1;
+    // Over each background: the higher priority sprite, behind the background,
+    // overlaps the lower priority one, in front of it
+    const uint8_t sprites[4][4] = {
+        {16, 8 + 4, 2, 0x80}, {16, 8 + 8, 3, 0x00},
+        {16, 8 + 20, 2, 0x80}, {16, 8 + 24, 3, 0x00},
+    };
+    memcpy(&memory[0xFE00], sprites, sizeof(sprites));
+    ppu_invalidate_memory(ppu);
+    ppu->LCDC = 0x93;
+    ppu->BGP = 0xE4;
+    ppu->OBP0 = 0xE4;
+    ppu->lcd_on_cycle = 0;
+    ppu_catch_up(ppu, CYCLES_PER_FRAME);
+
+    const uint8_t *line = ppu->framebuffer[0];
+    for (int x = 4; x < 12; x++)
+    {
+        // The background wins where the front sprite is, even over the back one
+        assert(line[x] == 3);
+    }
+    for (int x = 12; x < 16; x++)
+    {
+        assert(line[x] == 2);
+    }
+    for (int x = 20; x < 28; x++)
+    {
+        assert(line[x] == 1);
+    }
+    for (int x = 28; x < 32; x++)
+    {
+        assert(line[x] == 2);
+    }
+    free_emulator(emulator);
+}
+
+void test_render_skip_keeps_timing()
+{
+    printf("Testing timing only and every Nth frame rendering...\n");
+    emulator_t *full = new_raster_emulator(true);
+    emulator_t *timing = new_raster_emulator(true);
+    emulator_t *half = new_raster_emulator(true);
+    ppu_set_render_interval(timing->ppu, 0);
+    ppu_set_render_interval(half->ppu, 2);
+    uint8_t blank[SCREEN_HEIGHT][SCREEN_WIDTH] = {{0}};
+
+    for (int frame = 0; frame < 6; frame++)
+    {
+        tick_emulator(full);
+        tick_emulator(timing);
+        tick_emulator(half);
+        emulator_t *skipping[] = {timing, half};
+        for (int i = 0; i < 2; i++)
+        {
+            assert(skipping[i]->cpu->cycles == full->cpu->cycles);
+            assert(skipping[i]->cpu->PC == full->cpu->PC);
+            assert(*skipping[i]->cpu->registers->AF == *full->cpu->registers->AF);
+            assert(skipping[i]->ppu->frame_count == full->ppu->frame_count);
+            assert(memcmp(skipping[i]->cpu->memorybus, full->cpu->memorybus, 0x10000) == 0);
+        }
+        assert(full->ppu->rendered_frame == full->ppu->frame_count);
+        assert(timing->ppu->rendered_frame == 0);
+        assert(memcmp(timing->ppu->framebuffer, blank, sizeof(blank)) == 0);
+        // Frames 0, 2 and 4 are drawn
+        assert(half->ppu->rendered_frame == (uint64_t)(frame - frame % 2 + 1));
+        if (frame % 2 == 0)
+        {
+            assert(memcmp(half->ppu->framebuffer, full->ppu->framebuffer,
+                          sizeof(full->ppu->framebuffer)) == 0);
+        }
+    }
+
+    // On demand
+    ppu_request_frame(timing->ppu);
+    tick_emulator(full);
+    tick_emulator(timing);
+    assert(timing->ppu->rendered_frame == timing->ppu->frame_count);
+    assert(memcmp(timing->ppu->framebuffer, full->ppu->framebuffer,
+                  sizeof(full->ppu->framebuffer)) == 0);
+    tick_emulator(timing);
+    assert(timing->ppu->rendered_frame == timing->ppu->frame_count - 1);
+
+    free_emulator(full);
+    free_emulator(timing);
+    free_emulator(half);
+}
+
+void test_interrupts_follow_timing()
+{
+    printf("Testing VBlank and STAT interrupts across render modes...\n");
+    // Eager drawing of every frame is the reference
+    emulator_t *emulators[4];
+    const bool lazy[] = {false, true, true, true};
+    const uint32_t interval[] = {1, 1, 0, 3};
+    for (int i = 0; i < 4; i++)
+    {
+        emulators[i] = new_raster_emulator(lazy[i]);
+        memcpy(&emulators[i]->cpu->memorybus[0x0100], interrupt_program, sizeof(interrupt_program));
+        ppu_set_render_interval(emulators[i]->ppu, interval[i]);
+    }
+
+    for (int frame = 0; frame < 8; frame++)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            tick_emulator(emulators[i]);
+        }
+        for (int i = 1; i < 4; i++)
+        {
+            assert(emulators[i]->cpu->cycles == emulators[0]->cpu->cycles);
+            assert(memcmp(&emulators[i]->cpu->memorybus[0xC000], &emulators[0]->cpu->memorybus[0xC000],
+                          0x1000) == 0);
+            assert(emulators[i]->cpu->memorybus[IF_REGISTER] == emulators[0]->cpu->memorybus[IF_REGISTER]);
+        }
+        // Each frame ends as VBlank starts
+        assert(emulators[0]->cpu->memorybus[IF_REGISTER] & VBLANK_INTERRUPT);
+    }
+
+    // The log must hold both kinds of request, or the comparison proves little
+    int vblank = 0;
+    int stat = 0;
+    for (int i = 0; i < 0x1000; i++)
+    {
+        vblank += (emulators[0]->cpu->memorybus[0xC000 + i] & VBLANK_INTERRUPT) != 0;
+        stat += (emulators[0]->cpu->memorybus[0xC000 + i] & STAT_INTERRUPT) != 0;
+    }
+    assert(vblank >= 3);
+    assert(stat > 100);
+
+    for (int i = 0; i < 4; i++)
+    {
+        free_emulator(emulators[i]);
+    }
+}
+
+
+// ==================================================================================
+//                                  Main Test Function
+// ==================================================================================
+
+
+void main_test_ppu() {
+    printf("Running PPU tests...\n");
+    test_lazy_rendering_matches_eager();
+    test_tile_cache_follows_vram_writes();
+    test_sprite_lines_follow_oam_writes();
+    test_sprite_bg_priority();
+    test_render_skip_keeps_timing();
+    test_interrupts_follow_timing();
+    printf("PPU tests passed!\n");
+}
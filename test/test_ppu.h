@@ -0,0 +1,19 @@
+#ifndef TEST_PPU_H
+#define TEST_PPU_H
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "../src/ppu.h"
+
+
+void test_lazy_rendering_matches_eager();
+void test_tile_cache_follows_vram_writes();
+void test_sprite_lines_follow_oam_writes();
+void test_render_skip_keeps_timing();
+void test_interrupts_follow_timing();
+
+void main_test_ppu();
+
+
+#endif
@@ -0,0 +1,57 @@
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "./test_programs.h"
+
+// ==================================================================================
+//                                  Agent program
+// ==================================================================================
+
+// Each frame: wait for VBlank, scroll up by the P1 input lines and keep a
+// frame counter and the last P1 read in WRAM
+static const uint8_t agent_program[] = {
+    0xF0, 0x44, 0xFE, 0x90, 0x20, 0xFA, // 0100: LDH A,(LY); CP 0x90; JR NZ,0x0100
+    0xF0, 0x00, 0xEA, 0x01, 0xC0,       // 0106: LDH A,(P1); LD (0xC001),A
+    0x0E, 0x0F, 0xA1, 0x47,             // 010B: LD C,0x0F; AND C; LD B,A
+    0xF0, 0x42, 0x90, 0xE0, 0x42,       // 010F: LDH A,(SCY); SUB B; LDH (SCY),A
+    0x21, 0x00, 0xC0, 0x34,             // 0114: LD HL,0xC000; INC (HL)
+    0xF0, 0x44, 0xFE, 0x90, 0x28, 0xFA, // 0118: LDH A,(LY); CP 0x90; JR Z,0x0118
+    0x18, 0xE0                          // 011E: JR 0x0100
+};
+
+// The frame counter, the last P1 read and the scroll the program drives
+const uint16_t agent_ram_addresses[AGENT_RAM_ADDRESS_COUNT] = {0xC000, 0xC001, SCY_REGISTER};
+
+/**
+ * Loads agent_program at 0x0100 over tile data and a tile map varied by
+ * `seed`, with PC at its start and the P1 direction lines selected.
+ */
+void load_agent_program(cpu_t *cpu, uint32_t seed)
+{
+    for (int i = 0; i < 0x1800; i++)
+    {
+        cpu->memorybus[0x8000 + i] = (uint8_t)(i * 37 + (i >> 7) + seed * 11);
+    }
+    for (int i = 0; i < 0x400; i++)
+    {
+        cpu->memorybus[0x9800 + i] = (uint8_t)(i * 7 + seed);
+    }
+    memcpy(&cpu->memorybus[0x0100], agent_program, sizeof(agent_program));
+    cpu->PC = 0x0100;
+    write_memory(cpu, JOYPAD_REGISTER, 0x20);
+}
+
+/**
+ * @return an environment running agent_program from its saved snapshot,
+ * observing agent_ram_addresses.
+ */
+env_t *new_agent_env(uint32_t obs_scale)
+{
+    env_t *env = new_env(obs_scale);
+    assert(env != NULL);
+    load_agent_program(env->emulator->cpu, 0);
+    assert(env_set_ram_addresses(env, agent_ram_addresses, AGENT_RAM_ADDRESS_COUNT) == 0);
+    env_save_snapshot(env);
+    return env;
+}
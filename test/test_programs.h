@@ -0,0 +1,17 @@
+#ifndef TEST_PROGRAMS_H
+#define TEST_PROGRAMS_H
+
+#include <stdint.h>
+
+#include "../src/env.h"
+
+
+#define AGENT_RAM_ADDRESS_COUNT 3
+
+extern const uint16_t agent_ram_addresses[AGENT_RAM_ADDRESS_COUNT];
+
+void load_agent_program(cpu_t *cpu, uint32_t seed);
+env_t *new_agent_env(uint32_t obs_scale);
+
+
+#endif
@@ -0,0 +1,182 @@
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/resampler.h"
+
+// ==================================================================================
+//                                  Helpers
+// ==================================================================================
+
+// Left: sine at `frequency` Hz, right: the same sine inverted
+static void make_tone(int16_t *samples, size_t frames, double frequency, uint32_t rate,
+                      double amplitude)
+{
+    for (size_t i = 0; i < frames; i++)
+    {
+        double value = amplitude * sin(2 * M_PI * frequency * i / rate);
+        samples[i * 2] = (int16_t)lrint(value);
+        samples[i * 2 + 1] = (int16_t)lrint(-value);
+    }
+}
+
+/**
+ * Resamples `frames` input frames, writing and reading `chunk` frames at a time.
+ *
+ * @return the number of output frames.
+ */
+static size_t resample(resampler_t *resampler, const int16_t *input, size_t frames,
+                       size_t chunk, int16_t *output, size_t capacity)
+{
+    size_t written = 0, read = 0;
+    while (written < frames)
+    {
+        size_t count = frames - written < chunk ? frames - written : chunk;
+        written += resampler_write(resampler, input + written * 2, count);
+        read += resampler_read(resampler, output + read * 2, capacity - read);
+    }
+    return read;
+}
+
+// RMS of one side over frames [from, to)
+static double rms(const int16_t *samples, size_t from, size_t to, int side)
+{
+    double sum = 0;
+    for (size_t i = from; i < to; i++)
+    {
+        sum += (double)samples[i * 2 + side] * samples[i * 2 + side];
+    }
+    return sqrt(sum / (to - from));
+}
+
+// ==================================================================================
+//                                  Tests
+// ==================================================================================
+
+void test_resampled_tone()
+{
+    printf("Testing resampling a tone from 48 kHz to 44.1 kHz...\n");
+    const size_t frames = 48000;
+    int16_t *input = malloc(frames * 2 * sizeof(int16_t));
+    int16_t *output = malloc(frames * 2 * sizeof(int16_t));
+    assert(input != NULL && output != NULL);
+    make_tone(input, frames, 1000.0, 48000, 10000.0);
+
+    resampler_t *resampler = new_resampler(48000, 44100);
+    assert(resampler != NULL);
+    size_t count = resample(resampler, input, frames, 700, output, frames);
+    // All but the last half filter of input is filtered
+    assert(count > 44100 - RESAMPLER_TAPS && count <= 44100);
+
+    // Still 1 kHz, at the same level, in phase with the input
+    int crossings = 0;
+    for (size_t i = 1; i < count; i++)
+    {
+        crossings += (output[(i - 1) * 2] < 0) != (output[i * 2] < 0);
+    }
+    assert(crossings >= 1998 && crossings <= 2000);
+    double level = rms(output, 100, count, 0) * sqrt(2);
+    assert(level > 9900.0 && level < 10100.0);
+    for (size_t i = 100; i < count; i += 97)
+    {
+        double expected = 10000.0 * sin(2 * M_PI * 1000.0 * i / 44100);
+        assert(fabs(output[i * 2] - expected) < 60.0);
+        assert(output[i * 2 + 1] == -output[i * 2] || output[i * 2 + 1] == -output[i * 2] - 1
+               || output[i * 2 + 1] == -output[i * 2] + 1);
+    }
+    free_resampler(resampler);
+    free(input);
+    free(output);
+}
+
+void test_resampler_rejects_aliases()
+{
+    printf("Testing resampler alias rejection...\n");
+    const size_t frames = 24000;
+    int16_t *input = malloc(frames * 2 * sizeof(int16_t));
+    int16_t *output = malloc(frames * 2 * 2 * sizeof(int16_t));
+    assert(input != NULL && output != NULL);
+
+    // 23.5 kHz is above the 22.05 kHz output Nyquist and would fold to 20.6 kHz
+    make_tone(input, frames, 23500.0, 48000, 10000.0);
+    resampler_t *resampler = new_resampler(48000, 44100);
+    assert(resampler != NULL);
+    size_t count = resample(resampler, input, frames, frames, output, frames);
+    double level = rms(output, 100, count, 0) * sqrt(2);
+    printf("  23.5 kHz at 48 kHz: %.1f dB after resampling to 44.1 kHz\n",
+           20 * log10(level / 10000.0));
+    assert(level < 10000.0 * 0.01);
+    free_resampler(resampler);
+
+    // Upsampling keeps the whole input band
+    make_tone(input, frames, 10000.0, 32000, 10000.0);
+    resampler = new_resampler(32000, 48000);
+    count = resample(resampler, input, frames, 512, output, frames * 2);
+    assert(count > frames * 3 / 2 - RESAMPLER_TAPS * 2 && count <= frames * 3 / 2);
+    level = rms(output, 100, count, 0) * sqrt(2);
+    assert(level > 9000.0 && level < 10500.0);
+    free_resampler(resampler);
+    free(input);
+    free(output);
+}
+
+void test_simd_resampling_matches_scalar()
+{
+    printf("Testing SIMD resampling against scalar...\n");
+    const size_t frames = 10007;
+    int16_t *input = malloc(frames * 2 * sizeof(int16_t));
+    int16_t *scalar = malloc(frames * 2 * sizeof(int16_t));
+    int16_t *simd = malloc(frames * 2 * sizeof(int16_t));
+    assert(input != NULL && scalar != NULL && simd != NULL);
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < frames * 2; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        input[i] = (int16_t)(seed >> 16);   // Full scale noise, so some output saturates
+    }
+
+    resampler_t *reference = new_resampler(48000, 44100);
+    assert(reference != NULL);
+    reference->kernel = RESAMPLER_KERNEL_SCALAR;
+    reference->volume = 1.5f;
+    size_t expected = resample(reference, input, frames, 333, scalar, frames);
+
+    resampler_kernel_t best = resampler_best_kernel();
+    for (int kernel = RESAMPLER_KERNEL_SSE; kernel <= (int)best; kernel++)
+    {
+        resampler_t *resampler = new_resampler(48000, 44100);
+        assert(resampler != NULL);
+        resampler->kernel = kernel;
+        resampler->volume = 1.5f;
+        // Different chunking must not change the output
+        size_t count = resample(resampler, input, frames, 1024, simd, frames);
+        assert(count == expected);
+        // Float sums in a different order: at most one step of rounding apart
+        for (size_t i = 0; i < count * 2; i++)
+        {
+            assert(abs(simd[i] - scalar[i]) <= 1);
+        }
+        free_resampler(resampler);
+    }
+    free_resampler(reference);
+    free(input);
+    free(scalar);
+    free(simd);
+}
+
+
+// ==================================================================================
+//                                  Main Test Function
+// ==================================================================================
+
+
+void main_test_resampler() {
+    printf("Running resampler tests...\n");
+    test_resampled_tone();
+    test_resampler_rejects_aliases();
+    test_simd_resampling_matches_scalar();
+    printf("Resampler tests passed!\n");
+}
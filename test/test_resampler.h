@@ -0,0 +1,17 @@
+#ifndef TEST_RESAMPLER_H
+#define TEST_RESAMPLER_H
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "../src/resampler.h"
+
+
+void test_resampled_tone();
+void test_resampler_rejects_aliases();
+void test_simd_resampling_matches_scalar();
+
+void main_test_resampler();
+
+
+#endif
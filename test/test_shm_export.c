@@ -0,0 +1,211 @@
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../src/shm_export.h"
+#include "./test_programs.h"
+
+// ==================================================================================
+//                                  Helpers
+// ==================================================================================
+
+#define STEPS 40
+
+static uint8_t action_for(int step)
+{
+    return step % 3 == 0 ? BUTTON_DOWN : step % 3 == 1 ? BUTTON_UP | BUTTON_A : 0;
+}
+
+static uint64_t hash_bytes(uint64_t hash, const uint8_t *bytes, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = hash * 131 + bytes[i];
+    }
+    return hash;
+}
+
+// Hash of the observation after each step of action_for(), from step 1;
+// entry 0 is the reset observation
+static void reference_hashes(uint64_t hashes[STEPS + 1])
+{
+    env_t *env = new_agent_env(2);
+    uint8_t obs[80 * 72];
+    uint8_t ram[3];
+    env_reset(env, obs, ram);
+    hashes[0] = hash_bytes(hash_bytes(0, obs, sizeof(obs)), ram, 3);
+    for (int step = 1; step <= STEPS; step++)
+    {
+        env_step(env, action_for(step), 2, obs, ram);
+        hashes[step] = hash_bytes(hash_bytes(0, obs, sizeof(obs)), ram, 3);
+    }
+    free_env(env);
+}
+
+// Steps through the mailbox, checking every observation in place
+static void *run_client(void *argument)
+{
+    shm_client_t *client = argument;
+    uint64_t expected[STEPS + 1];
+    reference_hashes(expected);
+    size_t size = (size_t)client->header->obs_width * client->header->obs_height;
+    bool matched = true;
+    shm_client_reset(client);
+    matched = matched && hash_bytes(hash_bytes(0, client->obs, size), client->ram, 3) == expected[0];
+    for (int step = 1; step <= STEPS; step++)
+    {
+        matched = matched && shm_client_step(client, action_for(step), 2) == (uint64_t)step;
+        matched = matched && hash_bytes(hash_bytes(0, client->obs, size), client->ram, 3) == expected[step];
+    }
+    shm_client_close(client);
+    return matched ? client : NULL;
+}
+
+// ==================================================================================
+//                                  Tests
+// ==================================================================================
+
+void test_shm_export_child_process()
+{
+    printf("Testing shared memory export to a child process...\n");
+    env_t *env = new_agent_env(2);
+    shm_export_t *export = new_shm_export(env, NULL);
+    assert(export != NULL && export->name == NULL);
+    assert(export->header->magic == SHM_EXPORT_MAGIC);
+    assert(export->header->obs_width == 80 && export->header->obs_height == 72);
+    assert(export->header->ram_count == 3);
+    assert(export->header->obs_offset % 64 == 0 && export->header->ram_offset % 64 == 0);
+
+    // The child finds the memfd by its inherited descriptor
+    pid_t child = fork();
+    assert(child >= 0);
+    if (child == 0)
+    {
+        shm_client_t *client = new_shm_client(NULL, export->fd);
+        _exit(client != NULL && run_client(client) != NULL ? 0 : 1);
+    }
+    assert(shm_export_serve(export, 10000));
+    int status;
+    assert(waitpid(child, &status, 0) == child);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(env->steps == STEPS);
+
+    // Nothing left to serve
+    assert(!shm_export_poll(export));
+    free_shm_export(export);
+    free_env(env);
+}
+
+void test_shm_export_named()
+{
+    printf("Testing named shared memory export...\n");
+    char name[64];
+    snprintf(name, sizeof(name), "/gameboy_test_%d", (int)getpid());
+    env_t *env = new_agent_env(2);
+    shm_export_t *export = new_shm_export(env, name);
+    assert(export != NULL);
+
+    shm_client_t *client = new_shm_client(name, -1);
+    assert(client != NULL);
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, run_client, client) == 0);
+    assert(shm_export_serve(export, 10000));
+    void *result;
+    pthread_join(thread, &result);
+    assert(result == client);
+    free_shm_client(client);
+
+    // Freeing the export removes the name; a wrong mapping is refused
+    free_shm_export(export);
+    assert(new_shm_client(name, -1) == NULL);
+    int fd = memfd_create("not_an_export", 0);
+    assert(fd >= 0 && ftruncate(fd, 4096) == 0);
+    assert(new_shm_client(NULL, fd) == NULL);
+    close(fd);
+    free_env(env);
+}
+
+typedef struct SnapshotReader
+{
+    shm_client_t *client;
+    const uint64_t *expected;
+    _Atomic bool stop;
+    int snapshots;
+    bool consistent;
+} snapshot_reader_t;
+
+static void *read_snapshots(void *argument)
+{
+    snapshot_reader_t *reader = argument;
+    uint8_t obs[80 * 72];
+    uint8_t ram[3];
+    // The mapping holds data once the stepper's first reset has run
+    while (atomic_load(&reader->client->header->response) == 0)
+    {
+        sched_yield();
+    }
+    while (!atomic_load(&reader->stop))
+    {
+        uint64_t steps = shm_client_snapshot(reader->client, obs, ram);
+        reader->consistent = reader->consistent && steps <= STEPS
+                             && hash_bytes(hash_bytes(0, obs, sizeof(obs)), ram, 3) == reader->expected[steps];
+        reader->snapshots++;
+    }
+    return NULL;
+}
+
+void test_shm_export_snapshot()
+{
+    printf("Testing shared memory snapshots during steps...\n");
+    uint64_t expected[STEPS + 1];
+    reference_hashes(expected);
+    env_t *env = new_agent_env(2);
+    shm_export_t *export = new_shm_export(env, NULL);
+    assert(export != NULL);
+    shm_client_t *stepper = new_shm_client(NULL, export->fd);
+    shm_client_t *observer = new_shm_client(NULL, export->fd);
+    assert(stepper != NULL && observer != NULL);
+
+    // A second reader copies the data whenever it likes and always gets one
+    // step's observation and RAM together
+    pthread_t stepping;
+    pthread_t reading;
+    snapshot_reader_t reader = {observer, expected, false, 0, true};
+    assert(pthread_create(&reading, NULL, read_snapshots, &reader) == 0);
+    assert(pthread_create(&stepping, NULL, run_client, stepper) == 0);
+    assert(shm_export_serve(export, 10000));
+    void *result;
+    pthread_join(stepping, &result);
+    atomic_store(&reader.stop, true);
+    pthread_join(reading, NULL);
+    assert(result == stepper);
+    assert(reader.consistent && reader.snapshots > 0);
+
+    free_shm_client(stepper);
+    free_shm_client(observer);
+    free_shm_export(export);
+    free_env(env);
+}
+
+
+// ==================================================================================
+//                                  Main Test Function
+// ==================================================================================
+
+
+void main_test_shm_export() {
+    printf("Running shared memory export tests...\n");
+    test_shm_export_child_process();
+    test_shm_export_named();
+    test_shm_export_snapshot();
+    printf("Shared memory export tests passed!\n");
+}
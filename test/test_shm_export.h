@@ -0,0 +1,17 @@
+#ifndef TEST_SHM_EXPORT_H
+#define TEST_SHM_EXPORT_H
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "../src/shm_export.h"
+
+
+void test_shm_export_child_process();
+void test_shm_export_named();
+void test_shm_export_snapshot();
+
+void main_test_shm_export();
+
+
+#endif
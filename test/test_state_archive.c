@@ -0,0 +1,245 @@
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/state_archive.h"
+#include "./test_programs.h"
+
+// ==================================================================================
+//                                  Helpers
+// ==================================================================================
+
+#define FRAMES 30
+
+static emulator_t *new_agent_emulator()
+{
+    emulator_t *emulator = new_emulator();
+    assert(emulator != NULL);
+    load_agent_program(emulator->cpu, 0);
+    joypad_set_buttons(emulator->joypad, BUTTON_DOWN);
+    return emulator;
+}
+
+static void archive_path(char *path, size_t size, const char *name)
+{
+    snprintf(path, size, "/tmp/gameboy_test_%s_%d", name, (int)getpid());
+}
+
+// One state per frame of the agent program, starting from power on
+static emulator_state_t **record_states(int count)
+{
+    emulator_t *emulator = new_agent_emulator();
+    emulator_state_t **states = malloc(count * sizeof(emulator_state_t *));
+    assert(states != NULL);
+    for (int i = 0; i < count; i++)
+    {
+        states[i] = new_emulator_state();
+        assert(states[i] != NULL);
+        save_emulator_state(emulator, states[i]);
+        tick_emulator(emulator);
+    }
+    free_emulator(emulator);
+    return states;
+}
+
+static void free_states(emulator_state_t **states, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        free_emulator_state(states[i]);
+    }
+    free(states);
+}
+
+// ==================================================================================
+//                                  Tests
+// ==================================================================================
+
+void test_state_archive_round_trip()
+{
+    printf("Testing state archive round trip...\n");
+    char path[64];
+    archive_path(path, sizeof(path), "archive");
+    emulator_state_t **states = record_states(FRAMES);
+    state_archive_t *archive = new_state_archive(path, 0, 4096, FRAMES);
+    assert(archive != NULL);
+    for (int i = 0; i < FRAMES; i++)
+    {
+        assert(state_archive_write(archive, states[i]) == i);
+    }
+    assert(state_archive_count(archive) == FRAMES);
+
+    // Byte for byte, through this handle and a reader's
+    emulator_state_t *state = new_emulator_state();
+    assert(state != NULL);
+    state_archive_t *reader = open_state_archive(path);
+    assert(reader != NULL && state_archive_count(reader) == FRAMES);
+    for (int i = 0; i < FRAMES; i++)
+    {
+        assert(state_archive_read(archive, i, state) == 0);
+        assert(memcmp(state, states[i], sizeof(emulator_state_t)) == 0);
+        memset(state, 0, sizeof(emulator_state_t));
+        assert(state_archive_read(reader, i, state) == 0);
+        assert(memcmp(state, states[i], sizeof(emulator_state_t)) == 0);
+    }
+    assert(state_archive_read(reader, FRAMES, state) == -1);
+    assert(state_archive_write(reader, states[0]) == -1);
+
+    // A restored state runs on like the original
+    emulator_t *emulator = new_agent_emulator();
+    assert(state_archive_read(reader, 10, state) == 0);
+    load_emulator_state(emulator, state);
+    tick_emulator(emulator);
+    assert(emulator->cpu->cycles == states[11]->cpu.cycles);
+    assert(memcmp(emulator->cpu->memorybus, states[11]->memory, sizeof(states[11]->memory)) == 0);
+    free_emulator(emulator);
+
+    free_state_archive(reader);
+    free_state_archive(archive);
+    free_emulator_state(state);
+    free_states(states, FRAMES);
+    unlink(path);
+}
+
+void test_state_archive_dedup()
+{
+    printf("Testing state archive deduplication...\n");
+    char path[64];
+    archive_path(path, sizeof(path), "dedup");
+    emulator_state_t **states = record_states(FRAMES);
+    state_archive_t *archive = new_state_archive(path, 0, 4096, FRAMES + 1);
+    assert(archive != NULL);
+    uint32_t pages_per_state = archive->header->pages_per_state;
+
+    // The first state has many equal pages (zeroed RAM), later ones only
+    // store what changed
+    assert(state_archive_write(archive, states[0]) == 0);
+    uint32_t first = atomic_load(&archive->header->page_count);
+    assert(first < pages_per_state);
+    for (int i = 1; i < FRAMES; i++)
+    {
+        assert(state_archive_write(archive, states[i]) == i);
+    }
+    uint32_t pages = atomic_load(&archive->header->page_count);
+    assert(pages - first < (FRAMES - 1) * pages_per_state / 8);
+
+    // The same state again costs no page at all
+    assert(state_archive_write(archive, states[FRAMES - 1]) == FRAMES);
+    assert(atomic_load(&archive->header->page_count) == pages);
+    assert(state_archive_dedup_ratio(archive) > 8.0);
+
+    // No room for another state
+    assert(state_archive_write(archive, states[0]) == -1);
+    free_state_archive(archive);
+
+    // Nor for new pages
+    archive = new_state_archive(path, 0, first, FRAMES);
+    assert(archive != NULL);
+    assert(state_archive_write(archive, states[0]) == 0);
+    assert(state_archive_write(archive, states[5]) == -1);
+    assert(state_archive_count(archive) == 1);
+
+    // A failed write leaves no trace: states of known pages still go in
+    emulator_state_t *state = new_emulator_state();
+    assert(state != NULL);
+    assert(state_archive_write(archive, states[0]) == 1);
+    assert(state_archive_read(archive, 1, state) == 0);
+    assert(memcmp(state, states[0], sizeof(emulator_state_t)) == 0);
+    free_emulator_state(state);
+    free_state_archive(archive);
+
+    free_states(states, FRAMES);
+    unlink(path);
+}
+
+typedef struct ArchiveReader
+{
+    const char *path;
+    emulator_state_t **states;
+    int checked;
+} archive_reader_t;
+
+// Reads every state as it is published, through its own mapping
+static void *read_archive(void *argument)
+{
+    archive_reader_t *reader = argument;
+    state_archive_t *archive = open_state_archive(reader->path);
+    assert(archive != NULL);
+    emulator_state_t *state = new_emulator_state();
+    assert(state != NULL);
+    uint32_t next = 0;
+    while (next < FRAMES)
+    {
+        uint32_t count = state_archive_count(archive);
+        for (; next < count; next++)
+        {
+            assert(state_archive_read(archive, next, state) == 0);
+            assert(memcmp(state, reader->states[next], sizeof(emulator_state_t)) == 0);
+            reader->checked++;
+        }
+        sched_yield();
+    }
+    free_emulator_state(state);
+    free_state_archive(archive);
+    return NULL;
+}
+
+void test_state_archive_concurrent_readers()
+{
+    printf("Testing state archive readers during writes...\n");
+    char path[64];
+    archive_path(path, sizeof(path), "readers");
+    emulator_state_t **states = record_states(FRAMES);
+    state_archive_t *archive = new_state_archive(path, 512, 4096, FRAMES);
+    assert(archive != NULL);
+
+    archive_reader_t readers[2];
+    pthread_t threads[2];
+    for (int i = 0; i < 2; i++)
+    {
+        readers[i] = (archive_reader_t){path, states, 0};
+        assert(pthread_create(&threads[i], NULL, read_archive, &readers[i]) == 0);
+    }
+    for (int i = 0; i < FRAMES; i++)
+    {
+        assert(state_archive_write(archive, states[i]) == i);
+        usleep(200);
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        pthread_join(threads[i], NULL);
+        assert(readers[i].checked == FRAMES);
+    }
+
+    // Something that is not an archive is refused
+    free_state_archive(archive);
+    FILE *file = fopen(path, "wb");
+    assert(file != NULL);
+    for (int i = 0; i < STATE_ARCHIVE_HEADER_SIZE; i++)
+    {
+        fputc(0x47, file);
+    }
+    fclose(file);
+    assert(open_state_archive(path) == NULL);
+
+    free_states(states, FRAMES);
+    unlink(path);
+}
+
+// ==================================================================================
+//                                  Main Test Function
+// ==================================================================================
+
+void main_test_state_archive()
+{
+    printf("Running state archive tests...\n");
+    test_state_archive_round_trip();
+    test_state_archive_dedup();
+    test_state_archive_concurrent_readers();
+    printf("State archive tests passed!\n");
+}
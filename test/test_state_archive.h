@@ -0,0 +1,17 @@
+#ifndef TEST_STATE_ARCHIVE_H
+#define TEST_STATE_ARCHIVE_H
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "../src/state_archive.h"
+
+
+void test_state_archive_round_trip();
+void test_state_archive_dedup();
+void test_state_archive_concurrent_readers();
+
+void main_test_state_archive();
+
+
+#endif
@@ -0,0 +1,150 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/emulator.h"
+#include "../src/triple_buffer.h"
+
+// ==================================================================================
+//                                  Helpers
+// ==================================================================================
+
+#define THREADED_FRAMES 20000
+
+static void fill_frame(uint8_t frame[SCREEN_HEIGHT][SCREEN_WIDTH], uint64_t id)
+{
+    memset(frame, (uint8_t)id, SCREEN_HEIGHT * SCREEN_WIDTH);
+}
+
+static void *produce_frames(void *argument)
+{
+    triple_buffer_t *buffer = argument;
+    static uint8_t frame[SCREEN_HEIGHT][SCREEN_WIDTH];
+    for (uint64_t id = 1; id <= THREADED_FRAMES; id++)
+    {
+        fill_frame(frame, id);
+        triple_buffer_publish(buffer, &frame[0][0], id);
+    }
+    return NULL;
+}
+
+// ==================================================================================
+//                                  Tests
+// ==================================================================================
+
+void test_triple_buffer_latest_frame()
+{
+    printf("Testing triple buffer handoff...\n");
+    triple_buffer_t *buffer = new_triple_buffer();
+    assert(buffer != NULL);
+    uint8_t frame[SCREEN_HEIGHT][SCREEN_WIDTH];
+    uint64_t id = 0;
+
+    assert(triple_buffer_acquire(buffer, &id) == NULL);
+
+    fill_frame(frame, 1);
+    triple_buffer_publish(buffer, &frame[0][0], 1);
+    const uint8_t *latest = triple_buffer_acquire(buffer, &id);
+    assert(latest != NULL && id == 1 && latest[0] == 1);
+
+    // Nothing new: the same frame again
+    assert(triple_buffer_acquire(buffer, &id) == latest && id == 1);
+    assert(buffer->duplicated == 1);
+
+    // The consumer only sees the latest of several frames
+    for (uint64_t i = 2; i <= 4; i++)
+    {
+        fill_frame(frame, i);
+        triple_buffer_publish(buffer, &frame[0][0], i);
+    }
+    latest = triple_buffer_acquire(buffer, &id);
+    assert(id == 4 && latest[SCREEN_HEIGHT * SCREEN_WIDTH - 1] == 4);
+    assert(atomic_load(&buffer->dropped) == 2);
+    assert(buffer->published == 4 && buffer->acquired == 3);
+
+    free_triple_buffer(buffer);
+}
+
+void test_triple_buffer_threads()
+{
+    printf("Testing triple buffer handoff across threads...\n");
+    triple_buffer_t *buffer = new_triple_buffer();
+    assert(buffer != NULL);
+    pthread_t producer;
+    assert(pthread_create(&producer, NULL, produce_frames, buffer) == 0);
+
+    uint64_t last = 0, id = 0;
+    while (last < THREADED_FRAMES)
+    {
+        const uint8_t *frame = triple_buffer_acquire(buffer, &id);
+        if (frame == NULL)
+        {
+            continue;
+        }
+        // Whole frames only, never older than the previous one
+        assert(id >= last);
+        for (int i = 0; i < SCREEN_HEIGHT * SCREEN_WIDTH; i++)
+        {
+            assert(frame[i] == (uint8_t)id);
+        }
+        last = id;
+    }
+    pthread_join(producer, NULL);
+
+    uint64_t dropped = atomic_load(&buffer->dropped);
+    uint64_t fresh = buffer->acquired - buffer->duplicated;
+    printf("  %d frames published, %lu seen, %lu dropped, %lu duplicated\n", THREADED_FRAMES,
+           (unsigned long)fresh, (unsigned long)dropped, (unsigned long)buffer->duplicated);
+    // Every published frame is either seen once or dropped
+    assert(fresh + dropped == THREADED_FRAMES);
+
+    free_triple_buffer(buffer);
+}
+
+void test_emulator_publishes_frames()
+{
+    printf("Testing emulator frame publishing...\n");
+    emulator_t *emulator = new_emulator();
+    assert(emulator != NULL);
+    uint8_t *memory = emulator->cpu->memorybus;
+    for (int i = 0; i < 0x1800; i++)
+    {
+        memory[0x8000 + i] = (uint8_t)(i * 37);
+    }
+    memory[0x0100] = 0x18;  // JR -2
+    memory[0x0101] = 0xFE;
+    emulator->cpu->PC = 0x0100;
+
+    uint64_t id = 0;
+    for (int frame = 1; frame <= 3; frame++)
+    {
+        tick_emulator(emulator);
+        const uint8_t *latest = triple_buffer_acquire(emulator->frames, &id);
+        assert(latest != NULL && id == (uint64_t)frame);
+        assert(memcmp(latest, emulator->ppu->framebuffer, sizeof(emulator->ppu->framebuffer)) == 0);
+    }
+
+    // Skipped frames are not published
+    ppu_set_render_interval(emulator->ppu, 0);
+    tick_emulator(emulator);
+    triple_buffer_acquire(emulator->frames, &id);
+    assert(id == 3 && emulator->frames->published == 3);
+
+    free_emulator(emulator);
+}
+
+
+// ==================================================================================
+//                                  Main Test Function
+// ==================================================================================
+
+
+void main_test_triple_buffer() {
+    printf("Running triple buffer tests...\n");
+    test_triple_buffer_latest_frame();
+    test_triple_buffer_threads();
+    test_emulator_publishes_frames();
+    printf("Triple buffer tests passed!\n");
+}
@@ -0,0 +1,17 @@
+#ifndef TEST_TRIPLE_BUFFER_H
+#define TEST_TRIPLE_BUFFER_H
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "../src/triple_buffer.h"
+
+
+void test_triple_buffer_latest_frame();
+void test_triple_buffer_threads();
+void test_emulator_publishes_frames();
+
+void main_test_triple_buffer();
+
+
+#endif
@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/vec_env.h"
+#include "./test_programs.h"
+
+// ==================================================================================
+//                                  Helpers
+// ==================================================================================
+
+// Loads the program with environment-specific tiles and saves the snapshot
+static void load_agent(env_t *env, uint32_t seed)
+{
+    load_agent_program(env->emulator->cpu, seed);
+    env_save_snapshot(env);
+}
+
+static vec_env_t *new_agent_vec_env(uint32_t count, uint32_t threads)
+{
+    vec_env_t *vec = new_vec_env(count, 2, threads);
+    assert(vec != NULL);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        load_agent(vec->envs[i], i);
+    }
+    assert(vec_env_set_ram_addresses(vec, agent_ram_addresses, AGENT_RAM_ADDRESS_COUNT) == 0);
+    return vec;
+}
+
+static uint8_t action_for(uint32_t env, int step)
+{
+    return (uint8_t)((env * 5 + step) * 29);
+}
+
+// Ends an episode once the frame counter reaches the context's value
+static bool frames_reached(env_t *env, void *context)
+{
+    return env->emulator->cpu->memorybus[0xC000] >= *(uint8_t *)context;
+}
+
+// ==================================================================================
+//                                  Tests
+// ==================================================================================
+
+void test_vec_env_matches_env()
+{
+    printf("Testing vector environment against single environments...\n");
+    const uint32_t count = 5;
+    vec_env_t *vec = new_agent_vec_env(count, 3);
+    size_t size = vec->obs_size;
+    assert(size == (SCREEN_WIDTH / 2) * (SCREEN_HEIGHT / 2));
+    uint8_t *obs = malloc(count * size);
+    uint8_t *expected_obs = malloc(size);
+    uint8_t ram[5][3];
+    uint8_t expected_ram[3];
+    uint8_t dones[5];
+    assert(obs != NULL && expected_obs != NULL);
+
+    env_t *single[5];
+    for (uint32_t i = 0; i < count; i++)
+    {
+        single[i] = new_env(2);
+        assert(single[i] != NULL);
+        load_agent(single[i], i);
+        assert(env_set_ram_addresses(single[i], agent_ram_addresses, AGENT_RAM_ADDRESS_COUNT) == 0);
+    }
+
+    // Environment i's slice of each array matches stepping it on its own
+    vec_env_reset(vec, obs, ram[0]);
+    for (int step = 0; step < 12; step++)
+    {
+        uint8_t actions[5];
+        for (uint32_t i = 0; i < count; i++)
+        {
+            actions[i] = action_for(i, step);
+        }
+        uint32_t frameskip = 1 + step % 3;
+        vec_env_step(vec, actions, frameskip, obs, ram[0], dones);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            env_step(single[i], actions[i], frameskip, expected_obs, expected_ram);
+            assert(memcmp(obs + i * size, expected_obs, size) == 0);
+            assert(memcmp(ram[i], expected_ram, 3) == 0);
+            assert(dones[i] == 0);
+        }
+    }
+    // Different tiles give different observations
+    assert(memcmp(obs, obs + size, size) != 0);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        free_env(single[i]);
+    }
+    free(obs);
+    free(expected_obs);
+    free_vec_env(vec);
+}
+
+void test_vec_env_auto_reset()
+{
+    printf("Testing vector environment episode resets...\n");
+    const uint32_t count = 4;
+    vec_env_t *vec = new_agent_vec_env(count, 2);
+    size_t size = vec->obs_size;
+    uint8_t *obs = malloc(count * size);
+    uint8_t *reset_obs = malloc(count * size);
+    uint8_t ram[4][3];
+    uint8_t dones[4];
+    uint8_t actions[4] = {0, BUTTON_DOWN, BUTTON_UP, BUTTON_A};
+    assert(obs != NULL && reset_obs != NULL);
+    vec_env_reset(vec, reset_obs, NULL);
+
+    // Time limit: every third step ends the episode and returns the reset state
+    vec->episode_steps = 3;
+    for (int step = 1; step <= 7; step++)
+    {
+        vec_env_step(vec, actions, 2, obs, ram[0], dones);
+        bool done = step % 3 == 0;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            assert(dones[i] == done);
+            assert(vec->envs[i]->steps == (uint64_t)step % 3);
+            if (done)
+            {
+                assert(ram[i][0] == 0);
+                assert(memcmp(obs + i * size, reset_obs + i * size, size) == 0);
+            }
+            else
+            {
+                assert(ram[i][0] == 2 * (step % 3) - 1);
+            }
+        }
+    }
+
+    // Condition on RAM: the frame counter reaching 4 ends the episode
+    uint8_t limit = 4;
+    vec->episode_steps = 0;
+    vec->done = frames_reached;
+    vec->done_context = &limit;
+    vec_env_reset(vec, NULL, NULL);
+    int episodes = 0;
+    for (int step = 0; step < 9; step++)
+    {
+        vec_env_step(vec, actions, 1, NULL, ram[0], dones);
+        episodes += dones[0];
+        for (uint32_t i = 1; i < count; i++)
+        {
+            assert(dones[i] == dones[0]);
+        }
+        assert(dones[0] ? ram[0][0] == 0 : ram[0][0] < limit);
+    }
+    // Counter 0 then 1, 2, 3, 4 per episode: done on the fifth step of each
+    assert(episodes == 1);
+
+    free(obs);
+    free(reset_obs);
+    free_vec_env(vec);
+}
+
+void test_vec_env_pool()
+{
+    printf("Testing vector environment thread pool...\n");
+    // Slices cover every environment once, more threads than environments
+    // are clamped, and each pool thread is pinned but not the caller
+    cpu_set_t caller, after;
+    assert(sched_getaffinity(0, sizeof(caller), &caller) == 0);
+    const uint32_t threads[] = {1, 3, 7, 16};
+    for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++)
+    {
+        vec_env_t *vec = new_vec_env(7, 4, threads[t]);
+        assert(vec != NULL);
+        assert(vec->thread_count == (threads[t] < 7 ? threads[t] : 7));
+        uint32_t next = 0;
+        for (uint32_t w = 0; w < vec->thread_count; w++)
+        {
+            assert(vec->workers[w].first == next && vec->workers[w].last > next);
+            assert(w == 0 ? vec->workers[w].cpu == -1 : vec->workers[w].cpu >= 0);
+            next = vec->workers[w].last;
+        }
+        assert(next == 7);
+        for (uint32_t i = 0; i < 7; i++)
+        {
+            assert(vec->envs[i] != NULL && vec->envs[i]->obs_scale == 4);
+        }
+
+        // Many back-to-back requests through the pool
+        for (int i = 0; i < 200; i++)
+        {
+            vec_env_reset(vec, NULL, NULL);
+        }
+        free_vec_env(vec);
+        assert(sched_getaffinity(0, sizeof(after), &after) == 0);
+        assert(CPU_EQUAL(&caller, &after));
+    }
+}
+
+
+// ==================================================================================
+//                                  Main Test Function
+// ==================================================================================
+
+
+void main_test_vec_env() {
+    printf("Running vector environment tests...\n");
+    test_vec_env_matches_env();
+    test_vec_env_auto_reset();
+    test_vec_env_pool();
+    printf("Vector environment tests passed!\n");
+}
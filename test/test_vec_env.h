@@ -0,0 +1,17 @@
+#ifndef TEST_VEC_ENV_H
+#define TEST_VEC_ENV_H
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "../src/vec_env.h"
+
+
+void test_vec_env_matches_env();
+void test_vec_env_auto_reset();
+void test_vec_env_pool();
+
+void main_test_vec_env();
+
+
+#endif
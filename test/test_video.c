@@ -0,0 +1,94 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/video.h"
+
+// ==================================================================================
+//                                  Tests
+// ==================================================================================
+
+void test_pixel_formats()
+{
+    printf("Testing pixel formats...\n");
+    const uint8_t shades[4] = {0, 1, 2, 3};
+    uint8_t pixels[16];
+
+    video_output_t *output = new_video_output(PIXEL_FORMAT_RGBA8888);
+    assert(output != NULL);
+    video_convert(output, shades, 4, 4, 1, pixels, sizeof(pixels));
+    const uint8_t rgba[16] = {0xFF, 0xFF, 0xFF, 0xFF, 0xAA, 0xAA, 0xAA, 0xFF,
+                              0x55, 0x55, 0x55, 0xFF, 0x00, 0x00, 0x00, 0xFF};
+    assert(memcmp(pixels, rgba, 16) == 0);
+    free_video_output(output);
+
+    output = new_video_output(PIXEL_FORMAT_RGB565);
+    const uint32_t colours[4] = {0xFF0000, 0x00FF00, 0x0000FF, 0x000000};
+    video_set_palette(output, colours);
+    video_convert(output, shades, 4, 4, 1, pixels, sizeof(pixels));
+    const uint8_t rgb565[8] = {0x00, 0xF8, 0xE0, 0x07, 0x1F, 0x00, 0x00, 0x00};
+    assert(memcmp(pixels, rgb565, 8) == 0);
+    free_video_output(output);
+
+    output = new_video_output(PIXEL_FORMAT_GRAY8);
+    video_convert(output, shades, 4, 4, 1, pixels, sizeof(pixels));
+    assert(pixels[0] == 0xFF && pixels[1] == 0xAA && pixels[2] == 0x55 && pixels[3] == 0x00);
+    free_video_output(output);
+}
+
+void test_simd_conversion_matches_scalar()
+{
+    printf("Testing SIMD pixel conversion against scalar...\n");
+    // Odd width so every row ends with a scalar tail, padded rows on both sides
+    const int width = 157, height = 9;
+    const size_t shades_stride = 160, stride = width * 4 + 12;
+    uint8_t shades[160 * 9];
+    for (size_t i = 0; i < sizeof(shades); i++)
+    {
+        shades[i] = (uint8_t)(i * 7 + (i >> 3));  // Upper bits must be ignored
+    }
+    uint8_t *simd = malloc(stride * height);
+    uint8_t *scalar = malloc(stride * height);
+    assert(simd != NULL && scalar != NULL);
+
+    const pixel_format_t formats[] = {PIXEL_FORMAT_RGBA8888, PIXEL_FORMAT_RGB565, PIXEL_FORMAT_GRAY8};
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+    {
+        video_output_t *output = new_video_output(formats[i]);
+        assert(output != NULL);
+        memset(simd, 0xCC, stride * height);
+        memset(scalar, 0xCC, stride * height);
+        video_convert(output, shades, shades_stride, width, height, simd, stride);
+        output->simd = false;
+        video_convert(output, shades, shades_stride, width, height, scalar, stride);
+        assert(memcmp(simd, scalar, stride * height) == 0);
+
+        // Padding past each row is left alone
+        size_t row_size = width * pixel_format_size(formats[i]);
+        for (int y = 0; y < height; y++)
+        {
+            for (size_t x = row_size; x < stride; x++)
+            {
+                assert(simd[y * stride + x] == 0xCC);
+            }
+        }
+        free_video_output(output);
+    }
+    free(simd);
+    free(scalar);
+}
+
+
+// ==================================================================================
+//                                  Main Test Function
+// ==================================================================================
+
+
+void main_test_video() {
+    printf("Running video output tests...\n");
+    test_pixel_formats();
+    test_simd_conversion_matches_scalar();
+    printf("Video output tests passed!\n");
+}
@@ -0,0 +1,16 @@
+#ifndef TEST_VIDEO_H
+#define TEST_VIDEO_H
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "../src/video.h"
+
+
+void test_pixel_formats();
+void test_simd_conversion_matches_scalar();
+
+void main_test_video();
+
+
+#endif